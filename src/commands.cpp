@@ -5,12 +5,11 @@
 #include "net.h"
 #include "tasks/tasks.h"
 #include "tools/tools.h"
+#include "status.h"
 
 namespace mob
 {
 
-constexpr bool do_timings = false;
-
 // in main.cpp
 void set_sigint_handler();
 
@@ -87,6 +86,9 @@ clipp::group command::common_options_group()
 			& clipp::value("OPTION", o.options)))
 			%  "sets an option, such as 'versions/openssl=1.2'",
 
+		(clipp::option("--profile") >> o.profile)
+			% "shows how long startup took, by phase",
+
 		(clipp::option("--no-default-inis") >> o.no_default_inis)
 			% "disables auto loading of ini files, only uses --ini; the first"
 			  "--ini must be the master ini file";
@@ -168,7 +170,12 @@ int command::gather_inis(bool verbose)
 
 	try
 	{
-		inis_ = find_inis(!o.no_default_inis, o.inis, verbose);
+		inis_ = startup_profile::instance()
+			.instrument<startup_profile::times::find_inis>([&]
+			{
+				return find_inis(!o.no_default_inis, o.inis, verbose);
+			});
+
 		return 0;
 	}
 	catch(bailed&)
@@ -230,6 +237,17 @@ int command::run()
 	if (flags_ & handle_sigint)
 		set_sigint_handler();
 
+	// also printed when bailing out
+	guard g([&]
+	{
+		if (common.profile)
+		{
+			u8cout
+				<< "startup:\n"
+				<< startup_profile::instance().breakdown() << "\n";
+		}
+	});
+
 	const auto r = do_run();
 
 	if (code_)
@@ -372,6 +390,39 @@ std::string options_command::do_doc()
 }
 
 
+// adds the super tasks that depend on the given ones, recursively; used by
+// `build --affected` and `watch`
+//
+static void add_super_dependents(std::set<task*>& tasks)
+{
+	const auto supers = find_tasks("super");
+
+	for (;;)
+	{
+		bool added = false;
+
+		for (auto* t : supers)
+		{
+			if (tasks.contains(t))
+				continue;
+
+			for (auto* d : t->dependencies())
+			{
+				if (tasks.contains(d))
+				{
+					tasks.insert(t);
+					added = true;
+					break;
+				}
+			}
+		}
+
+		if (!added)
+			break;
+	}
+}
+
+
 build_command::build_command()
 	: command(flags(requires_options | handle_sigint))
 {
@@ -445,6 +496,19 @@ clipp::group build_command::do_group()
 		(clipp::option("--keep-msbuild") >> keep_msbuild_)
 			% "don't terminate msbuild.exe instances after building",
 
+		(clipp::option("--status") >> status_)
+			% "shows the status of running tasks at the bottom of the console, "
+			  "only warnings and errors are logged to it",
+
+		(clipp::option("--affected") >> affected_)
+			% "only builds the super tasks that changed since their last "
+			  "successful build, and the tasks that depend on them",
+
+		(clipp::option("--affected-since").set(affected_)
+			& clipp::value("ref") >> since_)
+			% "same as --affected, but compares the repos against the given "
+			  "commit, branch or tag instead",
+
 		(clipp::opt_values(
 			clipp::match::prefix_not("-"), "task", tasks_))
 			% "tasks to run; specify 'super' to only build modorganizer "
@@ -516,12 +580,49 @@ void build_command::convert_cl_to_conf()
 
 int build_command::do_run()
 {
+	if (conf::background_delete())
+		op::trash::instance().resume(gcx());
+
+	// whatever isn't deleted yet is done on the next run
+	guard g([&]
+	{
+		if (conf::background_delete())
+			op::trash::instance().stop();
+	});
+
+	if (status_)
+		live_status::instance().start();
+
 	try
 	{
-		run_all_tasks();
+		if (affected_)
+			enable_affected();
+
+		// with --dry, nothing takes any time, this is what it would take;
+		// the manifests of all the tasks have to be created, so it's only
+		// done for real builds when it's shown
+		if (conf::dry() || status_)
+		{
+			const auto predicted = predict(conf::dry());
+
+			if (predicted > 0)
+			{
+				live_status::instance().set_estimate(
+					std::chrono::seconds(static_cast<long long>(predicted)));
+			}
+		}
+
+		// the counters of the cache are for everything it's ever compiled
+		const auto cc_before = compiler_cache::stats(gcx());
+
+		{
+			guard sg([&]{ live_status::instance().stop(); });
+			run_all_tasks();
+		}
 
-		if (do_timings)
-			dump_timings();
+		add_compiler_cache_stats(cc_before);
+		dump_timings();
+		dump_metrics(true);
 
 		if (!keep_msbuild_)
 			terminate_msbuild();
@@ -532,15 +633,93 @@ int build_command::do_run()
 	catch(bailed&)
 	{
 		error("bailing out");
+		dump_metrics(false);
 		return 1;
 	}
 }
 
+void build_command::enable_affected()
+{
+	const auto supers = find_tasks("super");
+
+	std::set<task*> tasks;
+
+	for (auto* t : supers)
+	{
+		if (t->enabled() && is_affected(*t))
+			tasks.insert(t);
+	}
+
+	add_super_dependents(tasks);
+
+	std::vector<std::string> names;
+
+	// everything else has been built before and hasn't changed, the super
+	// tasks using it are built against the prefix; super_build isn't a super
+	// task, it has its own enabled()
+	for (auto* t : get_all_tasks())
+	{
+		if (tasks.contains(t))
+			names.push_back(t->name());
+		else
+			conf::set_for_task(t->name(), "task", "enabled", "false");
+	}
+
+	if (names.empty())
+		gcx().info(context::generic, "no tasks affected");
+	else
+		gcx().info(context::generic, "affected: {}", join(names, ", "));
+}
+
+bool build_command::is_affected(const task& t) const
+{
+	const auto src = t.get_fingerprint_path();
+
+	if (!fs::exists(src) || !git::is_git_repo(src))
+	{
+		gcx().debug(context::generic, "{}: no repo at {}", t.name(), src);
+		return true;
+	}
+
+	std::string rev = since_;
+
+	if (rev.empty())
+	{
+		// the stamp is written after every successful build and has the HEAD
+		// of the repo at that time
+		const auto heads = t.stamp_values("head");
+		if (!heads.empty())
+			rev = heads.back();
+
+		if (rev.empty())
+		{
+			gcx().debug(context::generic,
+				"{}: no successful build recorded", t.name());
+
+			return true;
+		}
+	}
+
+	if (git::changed_since(src, rev))
+	{
+		gcx().debug(context::generic, "{}: changed since {}", t.name(), rev);
+		return true;
+	}
+
+	gcx().trace(context::generic, "{}: unchanged since {}", t.name(), rev);
+	return false;
+}
+
+fs::path build_command::timings_file()
+{
+	return paths::prefix() / "timings.txt";
+}
+
 void build_command::dump_timings()
 {
 	using namespace std::chrono;
 
-	std::ofstream out("timings.txt");
+	std::ostringstream out;
 
 	auto write = [&](auto&& inst)
 	{
@@ -558,7 +737,22 @@ void build_command::dump_timings()
 					<< inst.instrumentable_name() << "\t"
 					<< (start_ms / 1000.0) << "\t"
 					<< (end_ms / 1000.0) << "\t"
-					<< t.name << "\n";
+					<< t.name << "\t"
+					<< tp.thread << "\t"
+					<< duration_cast<milliseconds>(tp.usage.user).count() << "\t"
+					<< duration_cast<milliseconds>(tp.usage.kernel).count() << "\t"
+					<< tp.usage.peak_memory << "\t"
+					<< tp.usage.read_bytes << "\t"
+					<< tp.usage.write_bytes << "\t"
+					<< tp.usage.processes << "\t"
+					<< tp.usage.downloads << "\t"
+					<< tp.usage.download_bytes << "\t"
+					<< duration_cast<milliseconds>(tp.usage.download_time).count() << "\t"
+					<< tp.usage.download_retries << "\t"
+					<< tp.usage.fs_ops << "\t"
+					<< tp.usage.fs_files << "\t"
+					<< tp.usage.fs_bytes << "\t"
+					<< duration_cast<milliseconds>(tp.usage.fs_time).count() << "\n";
 			}
 		}
 	};
@@ -567,1125 +761,4699 @@ void build_command::dump_timings()
 		write(*tk);
 
 	write(git_submodule_adder::instance());
-}
+	write(startup_profile::instance());
 
-void build_command::terminate_msbuild()
-{
-	if (conf::dry())
-		return;
+	op::write_text_file(gcx(), encodings::utf8, timings_file(), out.str());
 
-	system("taskkill /im msbuild.exe /f > NUL 2>&1");
+	dump_downloads();
+	dump_fs();
+	dump_spans();
+	dump_msbuild();
+	dump_compiler_cache();
+	dump_replay();
+	append_history();
 }
 
-
-command::meta_t list_command::meta() const
+fs::path build_command::downloads_file()
 {
-	return
-	{
-		"list",
-		"lists available tasks"
-	};
+	return paths::prefix() / "downloads.txt";
 }
 
-clipp::group list_command::do_group()
+void build_command::dump_downloads()
 {
-	return clipp::group(
-		clipp::command("list").set(picked_),
+	using namespace std::chrono;
 
-		(clipp::option("-h", "--help") >> help_)
-			% "shows this message",
+	const auto v = download_stats::all();
+	if (v.empty())
+		return;
 
-		(clipp::option("-a", "--all") >> all_)
-			% "shows all the tasks, including pseudo parallel tasks",
+	std::ostringstream out;
 
-		(clipp::opt_values(
-			clipp::match::prefix_not("-"), "task", tasks_))
-			% "with -a; when given, acts like the tasks given to `build` and "
-			  "shows only the tasks that would run"
-	);
+	for (auto&& d : v)
+	{
+		out
+			<< d.task << "\t"
+			<< d.url << "\t"
+			<< (d.ok ? "ok" : "failed") << "\t"
+			<< d.bytes << "\t"
+			<< duration_cast<milliseconds>(d.total).count() << "\t"
+			<< duration_cast<milliseconds>(d.dns).count() << "\t"
+			<< duration_cast<milliseconds>(d.connect).count() << "\t"
+			<< duration_cast<milliseconds>(d.tls).count() << "\t"
+			<< duration_cast<milliseconds>(d.ttfb).count() << "\t"
+			<< static_cast<std::uint64_t>(d.average_rate()) << "\t"
+			<< static_cast<std::uint64_t>(d.peak_rate) << "\t"
+			<< d.retries << "\n";
+	}
+
+	op::write_text_file(gcx(), encodings::utf8, downloads_file(), out.str());
 }
 
-int list_command::do_run()
+fs::path build_command::fs_file()
 {
-	if (all_)
-	{
-		if (!tasks_.empty())
-			set_task_enabled_flags(tasks_);
+	return paths::prefix() / "fs.txt";
+}
 
-		load_options();
-		dump(get_top_level_tasks(), 0);
-	}
-	else
+void build_command::dump_fs()
+{
+	using namespace std::chrono;
+
+	const auto v = op::fs_stats::all();
+	if (v.empty())
+		return;
+
+	std::ostringstream out;
+
+	for (auto&& st : v)
 	{
-		for (auto&& t : get_all_tasks())
-			u8cout << " - " << join(t->names(), ", ") << "\n";
+		out
+			<< (st.task.empty() ? "-" : st.task) << "\t"
+			<< st.op << "\t"
+			<< st.calls << "\t"
+			<< st.files << "\t"
+			<< st.bytes << "\t"
+			<< duration_cast<milliseconds>(st.time).count() << "\n";
 	}
 
-	return 0;
+	op::write_text_file(gcx(), encodings::utf8, fs_file(), out.str());
 }
 
-void list_command::dump(const std::vector<task*>& v, std::size_t indent) const
+fs::path build_command::spans_file()
 {
-	for (auto&& t : v)
+	return paths::prefix() / "spans.txt";
+}
+
+void build_command::dump_spans()
+{
+	using namespace std::chrono;
+
+	auto v = span::all();
+	if (v.empty())
+		return;
+
+	std::sort(v.begin(), v.end(), [](auto&& a, auto&& b) {
+		return (a.id < b.id);
+	});
+
+	// names are free text, the file is tab separated
+	auto clean = [](std::string s)
 	{
-		if (!t->enabled())
-			continue;
+		for (auto& c : s)
+		{
+			if (c == '\t' || c == '\r' || c == '\n')
+				c = ' ';
+		}
 
-		u8cout
-			<< std::string(indent*4, ' ')
-			<< " - " << join(t->names(), ",")
-			<< "\n";
+		return s;
+	};
 
-		if (auto* ct=dynamic_cast<container_task*>(t))
-			dump(ct->children(), indent + 1);
+	std::ostringstream out;
+
+	for (auto&& r : v)
+	{
+		const auto start_ms = static_cast<double>(
+			duration_cast<milliseconds>(r.start).count());
+
+		const auto end_ms = static_cast<double>(
+			duration_cast<milliseconds>(r.end).count());
+
+		out
+			<< r.id << "\t"
+			<< r.parent << "\t"
+			<< (r.task.empty() ? "-" : clean(r.task)) << "\t"
+			<< r.kind << "\t"
+			<< clean(r.name) << "\t"
+			<< (start_ms / 1000.0) << "\t"
+			<< (end_ms / 1000.0) << "\t"
+			<< r.thread << "\n";
 	}
+
+	op::write_text_file(gcx(), encodings::utf8, spans_file(), out.str());
 }
 
-std::string list_command::do_doc()
+fs::path build_command::msbuild_file()
 {
-	return
-		"Lists all available tasks. The special task name `super` is a\n"
-		"shorthand for all modorganizer tasks.";
+	return paths::prefix() / "msbuild.txt";
 }
 
-
-release_command::release_command()
-	: command(requires_options)
+void build_command::dump_msbuild()
 {
+	const auto v = msbuild::perf();
+	if (v.empty())
+		return;
+
+	std::ostringstream out;
+
+	for (auto&& e : v)
+	{
+		out
+			<< e.task << "\t"
+			<< e.kind << "\t"
+			<< e.name << "\t"
+			<< e.time.count() << "\t"
+			<< e.calls << "\n";
+	}
+
+	op::write_text_file(gcx(), encodings::utf8, msbuild_file(), out.str());
 }
 
-command::meta_t release_command::meta() const
+fs::path build_command::compiler_cache_file()
 {
-	return
-	{
-		"release",
-		"creates a release"
-	};
+	return paths::prefix() / "compiler_cache.txt";
 }
 
-void release_command::make_bin()
+void build_command::add_compiler_cache_stats(
+	const std::optional<cache_stats::counts>& before)
 {
-	const auto out = out_ / make_filename("");
-	u8cout << "making binary archive " << path_to_utf8(out) << "\n";
+	if (!before)
+		return;
+
+	const auto after = compiler_cache::stats(gcx());
+	if (!after)
+		return;
 
-	op::archive_from_glob(gcx(),
-		paths::install_bin() / "*", out, {"__pycache__"});
+	// the counters go back to 0 if the server is restarted
+	if (after->hits < before->hits || after->misses < before->misses)
+		return;
+
+	cache_stats::counts c;
+	c.hits = after->hits - before->hits;
+	c.misses = after->misses - before->misses;
+
+	cache_stats::add("compiler", c);
 }
 
-void release_command::make_pdbs()
+void build_command::dump_compiler_cache()
 {
-	const auto out = out_ / make_filename("pdbs");
-	u8cout << "making pdbs archive " << path_to_utf8(out) << "\n";
+	const auto v = compiler_cache::tasks();
+	if (v.empty())
+		return;
+
+	std::ostringstream out;
+
+	for (auto&& e : v)
+	{
+		out
+			<< e.task << "\t"
+			<< e.counts.hits << "\t"
+			<< e.counts.misses << "\t"
+			<< (e.shared ? 1 : 0) << "\n";
+	}
 
-	op::archive_from_glob(gcx(),
-		paths::install_pdbs() / "*", out, {"__pycache__"});
+	op::write_text_file(
+		gcx(), encodings::utf8, compiler_cache_file(), out.str());
 }
 
-void release_command::make_src()
+fs::path build_command::replay_file()
 {
-	const auto out = out_ / make_filename("src");
-	u8cout << "making src archive " << path_to_utf8(out) << "\n";
+	return paths::prefix() / "replay.txt";
+}
 
-	const std::vector<std::string> ignore =
+// wall time covered by the given periods, which overlap when they're nested
+// or run in parallel, and the cpu time of the processes that ran during them;
+// the usage of a nested period is already in its parent
+//
+template <class TimePair>
+static std::pair<double, double> wall_and_cpu(std::vector<TimePair> v)
+{
+	using namespace std::chrono;
+
+	std::sort(v.begin(), v.end(), [](auto&& a, auto&& b) {
+		return (a.start < b.start);
+	});
+
+	auto secs = [](nanoseconds ns)
 	{
-		"\\..+",     // dot files
-		".*\\.log",
-		".*\\.tlog",
-		".*\\.dll",
-		".*\\.exe",
-		".*\\.lib",
-		".*\\.obj",
-		".*\\.ts",
-		".*\\.aps",
-		"vsbuild"
+		return duration_cast<duration<double>>(ns).count();
 	};
 
-	const std::vector<std::regex> ignore_re(ignore.begin(), ignore.end());
+	double wall = 0, cpu = 0;
+	std::optional<nanoseconds> end;
 
-	std::vector<fs::path> files;
-	std::size_t total_size = 0;
-
-	if (!fs::exists(modorganizer::super_path()))
+	for (auto&& tp : v)
 	{
-		gcx().bail_out(context::generic,
-			"modorganizer super path not found: {}",
-			modorganizer::super_path());
+		// bailed out before finishing
+		if (tp.end < tp.start)
+			continue;
+
+		if (end && tp.end <= *end)
+			continue;
+
+		wall += secs(tp.end - (end ? std::max(*end, tp.start) : tp.start));
+		cpu += secs(tp.usage.user + tp.usage.kernel);
+		end = tp.end;
 	}
 
-	walk_dir(modorganizer::super_path(), files, ignore_re, total_size);
+	return {wall, cpu};
+}
 
-	// should be below 20MB
-	const std::size_t max_expected_size = 20 * 1024 * 1024;
-	if (total_size >= max_expected_size)
-	{
-		gcx().warning(context::generic,
-			"total size of source files would be {}, expected something "
-			"below {}, something might be wrong",
-			total_size, max_expected_size);
+// wall times of the fetch and build phases of a task in the last build, and
+// the cpu time of the processes of the build phases
+//
+struct task_times
+{
+	double fetch = 0, build = 0, cpu = 0;
 
-		if (!force_)
+	// false if the task didn't run, it was disabled or skipped
+	bool ran = false;
+};
+
+static task_times times_of(const task& t)
+{
+	using tp = task::time_pair;
+
+	std::vector<tp> fetch, build;
+
+	for (auto&& it : t.instrumented_tasks())
+	{
+		for (auto&& p : it.tps)
 		{
-			gcx().bail_out(context::generic,
-				"bailing out, use --force to ignore");
+			if (it.name == "configure" || it.name == "build" ||
+				it.name == "install")
+			{
+				build.push_back(p);
+			}
+			else
+			{
+				fetch.push_back(p);
+			}
 		}
 	}
 
-	op::archive_from_files(gcx(),
-		files, modorganizer::super_path(), out);
-}
+	task_times tt;
 
-void release_command::make_installer()
-{
-	const auto file = "Mod.Organizer-" + version_ + ".exe";
-	const auto src = paths::install_installer() / file;
-	const auto dest = out_;
+	if (fetch.empty() && build.empty())
+		return tt;
 
-	u8cout << "copying installer " << file << "\n";
+	tt.ran = true;
+	tt.fetch = wall_and_cpu(fetch).first;
+	std::tie(tt.build, tt.cpu) = wall_and_cpu(build);
 
-	op::copy_file_to_dir_if_better(gcx(), src, dest);
+	return tt;
 }
 
-void release_command::walk_dir(
-	const fs::path& dir, std::vector<fs::path>& files,
-	const std::vector<std::regex>& ignore_re, std::size_t& total_size)
+void build_command::dump_replay()
 {
-	for (auto e : fs::directory_iterator(dir))
-	{
-		const auto p = e.path();
-		const auto filename = path_to_utf8(p.filename());
+	using namespace std::chrono;
 
-		bool ignored = false;
+	std::ostringstream out;
+	nanoseconds end(0);
 
-		for (auto&& re : ignore_re)
+	for (auto* t : get_all_tasks())
+	{
+		for (auto&& it : t->instrumented_tasks())
 		{
-			if (std::regex_match(filename, re))
-			{
-				ignored = true;
-				break;
-			}
+			for (auto&& p : it.tps)
+				end = std::max(end, p.end);
 		}
 
-		if (ignored)
+		const auto tt = times_of(*t);
+		if (!tt.ran)
 			continue;
 
-		if (e.is_directory())
-		{
-			walk_dir(e.path(), files, ignore_re, total_size);
-		}
-		else if (e.is_regular_file())
-		{
-			total_size += fs::file_size(p);
-			files.push_back(p);
-		}
+		std::vector<std::string> deps;
+		for (auto* d : t->dependencies())
+			deps.push_back(d->name());
+
+		out
+			<< "task\t"
+			<< t->name() << "\t"
+			<< (deps.empty() ? "-" : join(deps, ",")) << "\t"
+			<< tt.fetch << "\t"
+			<< tt.build << "\t"
+			<< tt.cpu << "\n";
 	}
+
+	// unlimited fetches are 0, like the option
+	const auto fetch_jobs = job_slots::network().total();
+	const bool unlimited =
+		(fetch_jobs == std::numeric_limits<std::size_t>::max());
+
+	const std::string header = fmt::format(
+		"build\t{}\t{}\t{}\n",
+		duration_cast<duration<double>>(end).count(),
+		job_slots::instance().total(),
+		unlimited ? 0 : fetch_jobs);
+
+	op::write_text_file(
+		gcx(), encodings::utf8, replay_file(), header + out.str());
 }
 
-fs::path release_command::make_filename(const std::string& what) const
+fs::path build_command::history_file()
 {
-	std::string filename = "Mod.Organizer";
+	return paths::prefix() / "history.txt";
+}
 
-	if (!version_.empty())
-		filename += "-" + version_;
+// whether the clean flags make a task build from scratch, which takes a lot
+// longer than an incremental build; kept separately in the history
+//
+static bool is_full_build()
+{
+	return (conf::clean() && (conf::rebuild() || conf::reconfigure() ||
+		conf::reextract()));
+}
 
-	if (!suffix_.empty())
-		filename += "-" + suffix_;
+// hash of the options that change how long a build takes, builds with
+// different fingerprints aren't compared by `timings compare`
+//
+static std::string timings_fingerprint()
+{
+	std::string s;
 
-	if (!what.empty())
-		filename += "-" + what;
+	for (auto&& k : conf::global_keys("versions"))
+		s += "versions/" + k + "=" + conf::version_by_name(k) + "\n";
 
-	filename += ".7z";
+	for (auto&& k : conf::global_keys("prebuilt"))
+		s += "prebuilt/" + k + "=" + conf::get_global("prebuilt", k) + "\n";
 
-	return filename;
+	s += "vs=" + vs::version() + "\n";
+	s += "toolset=" + vs::toolset() + "\n";
+	s += "jobs=" + std::to_string(job_slots::instance().total()) + "\n";
+
+	return hash_string(s).substr(0, 12);
 }
 
-clipp::group release_command::do_group()
+void build_command::append_history()
 {
-	return clipp::group(
-		clipp::command("release").set(picked_),
+	using namespace std::chrono;
 
-		(clipp::option("-h", "--help") >> help_)
-			% ("shows this message"),
+	// runs kept in the file
+	constexpr std::size_t max_runs = 200;
 
-		"devbuild" %
-		(clipp::command("devbuild").set(mode_, modes::devbuild),
-			(
-				clipp::option("--bin").set(bin_, true) |
-				clipp::option("--no-bin").set(bin_, false)
-			) % "sets whether the binary archive is created [default: yes]",
+	if (conf::dry())
+		return;
 
-			(
-				clipp::option("--pdbs").set(pdbs_, true) |
-				clipp::option("--no-pdbs").set(pdbs_, false)
-			) % "sets whether the PDBs archive is created [default: yes]",
+	const auto now = system_clock::now();
+	const auto t = system_clock::to_time_t(now);
 
-			(
-				clipp::option("--src").set(src_, true) |
-				clipp::option("--no-src").set(src_, false)
-			) % "sets whether the source archive is created [default: yes]",
+	std::tm tm = {};
+	localtime_s(&tm, &t);
 
-			(
-				clipp::option("--inst").set(installer_, true) |
-				clipp::option("--no-inst").set(installer_, false)
-			) % "sets whether the installer is copied [default: no]",
+	char id[32] = {};
+	std::strftime(id, sizeof(id), "%Y%m%d-%H%M%S", &tm);
 
-			clipp::option("--version-from-exe").set(version_exe_)
-				% "retrieves version information from ModOrganizer.exe "
-				  "[default]",
+	const bool full = is_full_build();
 
-			clipp::option("--version-from-rc").set(version_rc_)
-				% "retrieves version information from modorganizer/src/version.rc",
+	std::ostringstream out;
 
-			(clipp::option("--rc")
-				& clipp::value("PATH") >> utf8_rc_path_)
-				% "overrides the path to version.rc",
+	out
+		<< "run\t"
+		<< duration_cast<seconds>(now.time_since_epoch()).count() << "\t"
+		<< id << "\t"
+		<< (full ? "full" : "incremental") << "\t"
+		<< timings_fingerprint() << "\n";
 
-			(clipp::option("--version")
-				& clipp::value("VERSION") >> version_)
-				% "overrides the version string",
+	for (auto* tk : get_all_tasks())
+	{
+		const auto tt = times_of(*tk);
+		if (!tt.ran)
+			continue;
 
-			(clipp::option("--output-dir")
-				& clipp::value("PATH") >> utf8out_)
-				% "sets the output directory to use instead of `$prefix/releases`",
+		out
+			<< "task\t"
+			<< tk->name() << "\t"
+			<< (full ? "full" : "incremental") << "\t"
+			<< (conf::fetch() ? tt.fetch : -1.0) << "\t"
+			<< (conf::build() ? tt.build : -1.0) << "\n";
 
-			(clipp::option("--suffix")
-				& clipp::value("SUFFIX") >> suffix_)
-				% "optional suffix to add to the archive filenames",
+		for (auto&& it : tk->instrumented_tasks())
+		{
+			if (it.tps.empty())
+				continue;
 
-			clipp::option("--force").set(force_)
-				% "ignores file size warnings and existing release directories"
-		)
+			std::vector<task::time_pair> tps(it.tps.begin(), it.tps.end());
 
-		|
+			out
+				<< "phase\t"
+				<< tk->name() << "\t"
+				<< it.name << "\t"
+				<< wall_and_cpu(tps).first << "\n";
+		}
 
-		"official" %
-		(clipp::command("official").set(mode_, modes::official),
-			(clipp::value("branch") >> branch_)
-				% "use this branch in the super repos"
-		)
-	);
-}
+		// to see what changed between two runs
+		const auto src = tk->get_fingerprint_path();
 
-void release_command::convert_cl_to_conf()
-{
-	command::convert_cl_to_conf();
+		if (tk->is_super() && fs::exists(src) && git::is_git_repo(src))
+		{
+			out
+				<< "head\t"
+				<< tk->name() << "\t"
+				<< git::head_commit(src) << "\n";
+		}
+	}
 
-	if (mode_ == modes::official)
+	std::string text = op::read_text_file(
+		gcx(), encodings::utf8, history_file(), op::optional);
+
+	// drops the oldest runs
+	std::vector<std::size_t> runs;
+
+	std::size_t pos = 0;
+
+	while (pos < text.size())
 	{
-		common.options.push_back("task/mo_branch=" + branch_);
-		common.options.push_back("translations:task/enabled=true");
-		common.options.push_back("installer:task/enabled=true");
+		if (text.compare(pos, 4, "run\t") == 0)
+			runs.push_back(pos);
 
-		common.options.push_back("transifex/force=true");
-		common.options.push_back("transifex/configure=true");
-		common.options.push_back("transifex/pull=true");
+		const auto nl = text.find('\n', pos);
+		if (nl == std::string::npos)
+			break;
+
+		pos = nl + 1;
 	}
+
+	if (runs.size() >= max_runs)
+		text.erase(0, runs[runs.size() - max_runs + 1]);
+
+	text += out.str();
+
+	op::write_text_file(gcx(), encodings::utf8, history_file(), text);
 }
 
-int release_command::do_run()
+double build_command::predict(bool print)
 {
-	switch (mode_)
+	using namespace std::chrono;
+
+	// last durations of each task, newest last; -1 when the phase didn't run
+	struct samples
 	{
-		case modes::devbuild:
-			return do_devbuild();
+		std::vector<double> fetch, build, full_build;
+	};
 
-		case modes::official:
-			return do_official();
+	std::map<std::string, samples> history;
 
-		case modes::none:
-		default:
-			u8cerr << "bad release mode " << static_cast<int>(mode_) << "\n";
-			throw bailed();
-	}
-}
+	const auto text = op::read_text_file(
+		gcx(), encodings::utf8, history_file(), op::optional);
 
-int release_command::do_devbuild()
-{
-	prepare();
+	for_each_line(text, [&](auto&& line)
+	{
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() != 5 || cs[0] != "task")
+			return;
 
-	u8cout
-		<< ">> don't forget to update the version number before making a release\n"
-		<< "\n"
-		<< "creating release for " << version_ << "\n";
+		try
+		{
+			auto& s = history[cs[1]];
 
-	if (bin_)
-		make_bin();
+			const double fetch = std::stod(cs[3]);
+			const double build = std::stod(cs[4]);
 
-	if (pdbs_)
-		make_pdbs();
+			if (fetch >= 0)
+				s.fetch.push_back(fetch);
 
-	if (src_)
-		make_src();
+			if (build >= 0)
+				(cs[2] == "full" ? s.full_build : s.build).push_back(build);
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad history line '{}'", line);
+		}
+	});
 
-	if (installer_)
-		make_installer();
+	if (history.empty())
+	{
+		if (print)
+		{
+			u8cout
+				<< "no build history in "
+				<< path_to_utf8(history_file()) << "\n";
+		}
 
-	return 0;
-}
+		return 0;
+	}
 
-int release_command::do_official()
-{
-	set_sigint_handler();
+	// median of the last few runs, old ones are from different versions
+	auto median = [](const std::vector<double>& v) -> std::optional<double>
+	{
+		if (v.empty())
+			return {};
 
-	u8cout << "checking repos for branch " << branch_ << "...\n";
+		const auto n = std::min<std::size_t>(v.size(), 5);
+		std::vector<double> last(
+			v.end() - static_cast<std::ptrdiff_t>(n), v.end());
 
-	thread_pool tp;
-	std::atomic<bool> failed = false;
+		std::sort(last.begin(), last.end());
+		return last[last.size() / 2];
+	};
 
-	for (const auto* t : find_tasks("super"))
+	struct estimate
+	{
+		double fetch = 0, build = 0, end = 0;
+		const task* critical = nullptr;
+		std::string note;
+	};
+
+	std::map<const task*, estimate> estimates;
+	const bool full = is_full_build();
+
+	for (auto* t : get_all_tasks())
 	{
 		if (!t->enabled())
 			continue;
 
-		tp.add([this, t, &failed]
+		estimate e;
+
+		auto itor = history.find(t->name());
+		if (itor == history.end())
 		{
-			const auto* o = dynamic_cast<const modorganizer*>(t);
+			e.note = "no history";
+		}
+		else
+		{
+			const auto& s = itor->second;
+
+			if (conf::fetch())
+				e.fetch = median(s.fetch).value_or(0);
 
-			if (!git::branch_exists(o->git_url(), branch_))
+			if (conf::build())
 			{
-				gcx().error(context::generic,
-					"branch {} doesn't exist in the {} repo",
-					branch_, o->name());
+				auto b = median(full ? s.full_build : s.build);
 
-				failed = true;
+				// better than nothing
+				if (!b)
+					b = median(full ? s.build : s.full_build);
+
+				e.build = b.value_or(0);
 			}
-		});
-	}
+		}
 
-	tp.join();
+		if (conf::build() && t->would_skip_unchanged())
+		{
+			e.build = 0;
+			e.note = "unchanged";
+		}
 
-	if (failed)
-	{
-		gcx().bail_out(context::generic,
-			"either fix the branch name, create a remote branch for the "
-			"repos that don't have it, or disable tasks with "
-			"`-s TASKNAME:task/enabled=false`");
+		estimates[t] = e;
 	}
 
-
-	if (fs::exists(paths::prefix()))
+	// all tasks fetch at once and are built when their dependencies are; the
+	// job budget is ignored, the history already has the time the tasks
+	// took while sharing it
+	std::function<double (const task*)> end_of = [&](const task* t)
 	{
-		u8cout
-			<< "prefix " << path_to_utf8(paths::prefix()) << " already exists\n"
-			<< "delete? [Y/n] ";
+		auto itor = estimates.find(t);
+		if (itor == estimates.end())
+			return 0.0;
 
-		std::wstring s;
-		std::getline(std::wcin, s);
+		auto& e = itor->second;
+		if (e.end > 0)
+			return e.end;
 
-		if (s == L"" || s == L"y" || s == L"Y")
+		double start = e.fetch;
+
+		for (auto* d : t->dependencies())
 		{
-			build_command::terminate_msbuild();
-			op::delete_directory(gcx(), paths::prefix());
+			const double de = end_of(d);
+			if (de > start)
+			{
+				start = de;
+				e.critical = d;
+			}
 		}
-		else
+
+		e.end = start + e.build;
+		return e.end;
+	};
+
+	const task* last = nullptr;
+	double total = 0;
+
+	for (auto&& [t, e] : estimates)
+	{
+		if (end_of(t) > total)
 		{
-			return 1;
+			total = end_of(t);
+			last = t;
 		}
 	}
 
-	run_all_tasks();
-	build_command::terminate_msbuild();
-
-	prepare();
-	make_bin();
-	make_pdbs();
-	make_src();
-	make_installer();
+	std::vector<std::string> critical;
+	for (const task* t=last; t; t=estimates[t].critical)
+		critical.push_back(t->name());
 
-	return 0;
-}
+	std::reverse(critical.begin(), critical.end());
 
-void release_command::prepare()
-{
-	rc_path_ = fs::path(utf8_to_utf16(utf8_rc_path_));
-	if (rc_path_.empty())
+	if (print)
 	{
-		rc_path_ =
-			modorganizer::super_path() / "modorganizer" / "src" / "version.rc";
-	}
+		u8cout << fmt::format(
+			"{:<30} {:>9} {:>9} {:>9}\n", "task", "fetch", "build", "done");
 
-	if (version_.empty())
+		std::vector<std::pair<const task*, estimate>> sorted(
+			estimates.begin(), estimates.end());
+
+		std::sort(sorted.begin(), sorted.end(), [](auto&& a, auto&& b) {
+			return (a.second.end < b.second.end);
+		});
+
+		for (auto&& [t, e] : sorted)
+		{
+			u8cout << fmt::format(
+				"{:<30} {:>8.0f}s {:>8.0f}s {:>8.0f}s  {}\n",
+				t->name(), e.fetch, e.build, e.end, e.note);
+		}
+
+		u8cout
+			<< "\n"
+			<< fmt::format("predicted {:.0f}m{:02.0f}s, critical path: {}\n",
+				std::floor(total / 60), std::fmod(total, 60),
+				join(critical, " > "));
+	}
+	else
 	{
-		if (version_rc_)
-			version_ = version_from_rc();
-		else
-			version_ = version_from_exe();
+		gcx().info(context::generic,
+			"predicted {}s from the history, critical path: {}",
+			static_cast<long long>(total), join(critical, " > "));
 	}
 
-	out_ = fs::path(utf8_to_utf16(utf8out_));
-	if (out_.empty())
-		out_ = paths::prefix() / "releases" / version_;
-	else if (out_.is_relative())
-		out_ = paths::prefix() / out_;
+	return total;
 }
 
-std::string release_command::do_doc()
+// quotes and escapes a label value for the OpenMetrics text format
+//
+static std::string metrics_label(std::string_view s)
 {
-	return
-		"Creates archives for an MO installation, PDBs and sources.\n"
-		"\n"
-		"Commands:\n"
-		"devbuild\n"
-		"  Can creates three archives in `$prefix/releases/version`: one from\n"
-		"  `install/bin/*`, one from `install/pdbs/*` and another with the\n"
-		"  sources of projects from modorganizer_super.\n"
-		"  \n"
-		"  The archive filename is `Mod.Organizer-version-suffix-what.7z`,\n"
-		"  where:\n"
-		"    - `version` is taken from `ModOrganizer.exe`, `version.rc`\n"
-		"      or from --version;\n"
-		"    - `suffix` is the optional `--suffix` argument;\n"
-		"    - `what` is either nothing, `src` or `pdbs`.\n"
-		"\n"
-		"official\n"
-		"  Creates a new full build in the prefix. Requires that directory\n"
-		"  to be empty. Puts the binary archive, source, PDBs and installer\n"
-		"  in `$prefix/releases/version`. Forces all tasks to be enabled,\n"
-		"  including translations and installer. Make sure the transifex API\n"
-		"  key is in the INI or TX_TOKEN is set.";
+	std::string r = "\"";
+
+	for (char c : s)
+	{
+		switch (c)
+		{
+			case '\\': r += "\\\\"; break;
+			case '"':  r += "\\\""; break;
+			case '\n': r += "\\n"; break;
+			default:   r += c; break;
+		}
+	}
+
+	r += "\"";
+	return r;
 }
 
-std::string release_command::version_from_exe() const
+std::string build_command::make_metrics(bool ok) const
 {
-	const auto exe = paths::install_bin() / "ModOrganizer.exe";
+	using namespace std::chrono;
 
-	// getting version info size
-	DWORD dummy = 0;
-	const DWORD size = GetFileVersionInfoSizeW(exe.native().c_str(), &dummy);
+	auto seconds_of = [](auto d)
+	{
+		return duration_cast<duration<double>>(d).count();
+	};
 
-	if (size == 0)
+	std::ostringstream out;
+
+	// all the metrics are gauges, they're for this build only and are reset
+	// on every run
+	auto family = [&](std::string_view name, std::string_view help)
 	{
-		const auto e = GetLastError();
-		gcx().bail_out(context::generic,
-			"can't get file version info size from {}, {}",
-			exe, error_message(e));
-	}
+		out
+			<< "# TYPE " << name << " gauge\n"
+			<< "# HELP " << name << " " << help << "\n";
+	};
 
-	// getting version info
-	auto buffer = std::make_unique<std::byte[]>(size);
 
-	if (!GetFileVersionInfoW(exe.native().c_str(), 0, size, buffer.get()))
+	family("mob_build_duration_seconds", "Wall time of the build, with startup.");
+	out << "mob_build_duration_seconds " << seconds_of(timestamp()) << "\n";
+
+	family("mob_build_success", "1 if the build succeeded, 0 if it bailed out.");
+	out << "mob_build_success " << (ok ? 1 : 0) << "\n";
+
+
+	// total time spent in each phase and resources used by processes, per
+	// task
+	std::map<std::pair<std::string, std::string>, double> phases;
+	std::map<std::string, resource_usage> usage;
+
+	auto add = [&](auto&& inst)
 	{
-		const auto e = GetLastError();
-		gcx().bail_out(context::generic,
-			"can't get file version info from {}, {}",
-			exe, error_message(e));
+		for (auto&& t : inst.instrumented_tasks())
+		{
+			for (auto&& tp : t.tps)
+			{
+				phases[{inst.instrumentable_name(), t.name}] +=
+					seconds_of(tp.end - tp.start);
+
+				usage[inst.instrumentable_name()] += tp.usage;
+			}
+		}
+	};
+
+	for (auto&& tk : get_all_tasks())
+		add(*tk);
+
+	add(git_submodule_adder::instance());
+	add(startup_profile::instance());
+
+	family("mob_task_phase_seconds", "Time spent by a task in a phase.");
+	for (auto&& [k, secs] : phases)
+	{
+		out
+			<< "mob_task_phase_seconds{task=" << metrics_label(k.first)
+			<< ",phase=" << metrics_label(k.second) << "} " << secs << "\n";
 	}
 
-	struct LANGANDCODEPAGE
+	family("mob_task_cpu_seconds", "User and kernel time of the processes of a task.");
+	for (auto&& [task, u] : usage)
 	{
-		WORD wLanguage;
-		WORD wCodePage;
-	};
+		out
+			<< "mob_task_cpu_seconds{task=" << metrics_label(task) << "} "
+			<< seconds_of(u.user + u.kernel) << "\n";
+	}
 
-	void* value_pointer = nullptr;
-	unsigned int value_size = 0;
 
-	// getting list of available languages
-	auto ret = VerQueryValueW(
-		buffer.get(), L"\\VarFileInfo\\Translation",
-		&value_pointer, &value_size);
+	// downloads
+	std::uint64_t downloads = 0, failed = 0, bytes = 0, retries = 0;
 
-	if (!ret || !value_pointer || value_size == 0)
+	for (auto&& d : download_stats::all())
 	{
-		const auto e = GetLastError();
-		gcx().bail_out(context::generic,
-			"VerQueryValueW() for translations failed on {}, {}",
-			exe, error_message(e));
+		++downloads;
+		bytes += d.bytes;
+		retries += d.retries;
+
+		if (!d.ok)
+			++failed;
 	}
 
-	// number of languages
-	const auto count = value_size / sizeof(LANGANDCODEPAGE);
-	if (count == 0)
-		gcx().bail_out(context::generic, "no languages found in {}", exe);
+	family("mob_downloads", "Number of downloads.");
+	out << "mob_downloads " << downloads << "\n";
 
-	// using the first language in the list to get FileVersion
-	const auto* lcp = static_cast<LANGANDCODEPAGE*>(value_pointer);
+	family("mob_downloads_failed", "Number of downloads that failed.");
+	out << "mob_downloads_failed " << failed << "\n";
 
-	const auto sub_block = ::fmt::format(
-		L"\\StringFileInfo\\{:04x}{:04x}\\FileVersion",
-		lcp->wLanguage, lcp->wCodePage);
+	family("mob_download_bytes", "Bytes received by downloads.");
+	out << "mob_download_bytes " << bytes << "\n";
 
-	ret = VerQueryValueW(
-		buffer.get(), sub_block.c_str(), &value_pointer, &value_size);
+	family("mob_download_retries", "Downloads that had to be retried.");
+	out << "mob_download_retries " << retries << "\n";
 
-	if (!ret || !value_pointer || value_size == 0)
+
+	// caches
+	const auto caches = cache_stats::all();
+
+	family("mob_cache_hits", "Hits for a cache.");
+	for (auto&& [name, c] : caches)
+		out << "mob_cache_hits{cache=" << metrics_label(name) << "} " << c.hits << "\n";
+
+	family("mob_cache_misses", "Misses for a cache.");
+	for (auto&& [name, c] : caches)
+		out << "mob_cache_misses{cache=" << metrics_label(name) << "} " << c.misses << "\n";
+
+
+	// steps that failed and were run again
+	const auto retries_by_step = retry_stats::all();
+
+	family("mob_step_retries", "Times a step of a task had to be run again.");
+	for (auto&& [k, c] : retries_by_step)
 	{
-		gcx().bail_out(context::generic,
-			"language {} not found in {}", sub_block, exe);
+		out
+			<< "mob_step_retries{task=" << metrics_label(k.first)
+			<< ",step=" << metrics_label(k.second) << "} " << c.retries << "\n";
 	}
 
-	// value_size includes the null terminator
-	return utf16_to_utf8(std::wstring(
-		static_cast<wchar_t*>(value_pointer),
-		value_size - 1));
+	family("mob_step_retry_wasted_seconds", "Time lost on the failed attempts of a step.");
+	for (auto&& [k, c] : retries_by_step)
+	{
+		out
+			<< "mob_step_retry_wasted_seconds{task=" << metrics_label(k.first)
+			<< ",step=" << metrics_label(k.second) << "} "
+			<< seconds_of(c.wasted) << "\n";
+	}
+
+	out << "# EOF\n";
+
+	return out.str();
 }
 
-std::string release_command::version_from_rc() const
+void build_command::dump_metrics(bool ok)
 {
-	// matching: #define VER_FILEVERSION_STR "2.2.1\0"
-	std::regex re(R"(#define VER_FILEVERSION_STR "(.+)\\0")");
+	const std::string file = conf::metrics_file();
+	const std::string u = conf::metrics_url();
 
-	const std::string rc = op::read_text_file(
-		gcx(), encodings::utf8, rc_path_);
+	if (file.empty() && u.empty())
+		return;
 
-	std::smatch m;
-	std::string v;
+	const std::string text = make_metrics(ok);
 
-	for_each_line(rc, [&](std::string_view line)
+	if (!file.empty())
 	{
-		std::string line_s(line);
-		if (std::regex_match(line_s, m, re))
-			v = m[1];
-	});
+		fs::path p = utf8_to_utf16(file);
+		if (p.is_relative())
+			p = paths::prefix() / p;
 
-	if (v.empty())
+		try
+		{
+			// written under a temporary name first and renamed over the old
+			// one, collectors might read it at any time; the file can be
+			// outside the prefix
+			fs::path temp = p;
+			temp += ".tmp";
+
+			std::error_code ec;
+			fs::create_directories(p.parent_path(), ec);
+
+			op::write_text_file(gcx(), encodings::utf8, temp, text, op::unsafe);
+
+			fs::rename(temp, p, ec);
+
+			if (ec)
+			{
+				gcx().warning(context::fs,
+					"can't rename {} to {}, {}", temp, p, ec.message());
+			}
+		}
+		catch(bailed&)
+		{
+			// already logged, the build itself is done
+		}
+	}
+
+	if (!u.empty())
 	{
-		gcx().bail_out(context::generic,
-			"can't find version string in {}", rc_path_);
+		http_post(
+			gcx(), u, text,
+			"application/openmetrics-text; version=1.0.0; charset=utf-8");
 	}
+}
 
-	return v;
+void build_command::terminate_msbuild()
+{
+	if (conf::dry())
+		return;
+
+	// only the msbuild nodes started by mob, other builds on the machine
+	// keep theirs
+	process::terminate_leftovers();
 }
 
 
-git_command::git_command()
+command::meta_t list_command::meta() const
+{
+	return
+	{
+		"list",
+		"lists available tasks"
+	};
+}
+
+clipp::group list_command::do_group()
+{
+	return clipp::group(
+		clipp::command("list").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% "shows this message",
+
+		(clipp::option("-a", "--all") >> all_)
+			% "shows the enabled tasks and their dependencies",
+
+		(clipp::opt_values(
+			clipp::match::prefix_not("-"), "task", tasks_))
+			% "with -a; when given, acts like the tasks given to `build` and "
+			  "shows only the tasks that would run"
+	);
+}
+
+int list_command::do_run()
+{
+	if (all_)
+	{
+		if (!tasks_.empty())
+			set_task_enabled_flags(tasks_);
+
+		load_options();
+		dump(get_top_level_tasks());
+	}
+	else
+	{
+		for (auto&& t : get_all_tasks())
+			u8cout << " - " << join(t->names(), ", ") << "\n";
+	}
+
+	return 0;
+}
+
+void list_command::dump(const std::vector<task*>& v) const
+{
+	for (auto&& t : v)
+	{
+		if (!t->enabled())
+			continue;
+
+		u8cout << " - " << join(t->names(), ",") << "\n";
+
+		const auto deps = t->dependencies();
+
+		if (!deps.empty())
+		{
+			u8cout << "     after: "
+				<< join(map(deps, [](auto* d) { return d->name(); }), ", ")
+				<< "\n";
+		}
+	}
+}
+
+std::string list_command::do_doc()
+{
+	return
+		"Lists all available tasks. The special task name `super` is a\n"
+		"shorthand for all modorganizer tasks.";
+}
+
+
+release_command::release_command()
 	: command(requires_options)
 {
 }
 
-command::meta_t git_command::meta() const
+command::meta_t release_command::meta() const
 {
 	return
 	{
-		"git",
-		"manages the git repos"
+		"release",
+		"creates a release"
 	};
 }
 
-clipp::group git_command::do_group()
+void release_command::make_archives(bool bin, bool pdbs, bool src)
 {
-	return clipp::group(
-		clipp::command("git").set(picked_),
+	std::vector<std::function<void (std::size_t)>> v;
 
-		(clipp::option("-h", "--help") >> help_)
-			% ("shows this message"),
+	if (bin)
+		v.push_back([&](std::size_t n){ make_bin(n); });
 
-		"set-remotes" %
-		(clipp::command("set-remotes").set(mode_, modes::set_remotes),
-			(clipp::required("-u", "--username")
-				& clipp::value("USERNAME") >> username_)
-				% "git username",
+	if (pdbs)
+		v.push_back([&](std::size_t n){ make_pdbs(n); });
 
-			(clipp::required("-e", "--email")
-				& clipp::value("EMAIL") >> email_)
-				% "git email",
+	if (src)
+		v.push_back([&](std::size_t n){ make_src(n); });
 
-			(clipp::option("-k", "--key")
-				& clipp::value("PATH") >> key_)
-				% "path to putty key",
+	if (v.empty())
+		return;
 
-			(clipp::option("-s", "--no-push").set(nopush_)
-				% "disables pushing to 'upstream' by changing the push url "
-				  "to 'nopushurl' to avoid accidental pushes"),
+	auto& js = job_slots::instance();
+	const std::size_t share = std::max<std::size_t>(1, js.total() / v.size());
 
-			(clipp::option("-p", "--push-origin").set(push_default_)
-				% "sets the new 'origin' remote as the default push target"),
+	parallel_for(v.size(), v.size(), [&](std::size_t i)
+	{
+		auto lease = js.lease(share);
+		v[i](lease.count());
+	});
+}
 
-			(clipp::opt_value("path") >> path_)
-				% "only use this repo"
-		)
+void release_command::make_archive(
+	const std::string& what, const fs::path& src_glob, std::size_t threads)
+{
+	const auto out = out_ / make_filename(what);
+	const std::vector<std::string> ignore = {"__pycache__"};
 
-		|
+	if (incremental_)
+	{
+		u8cout
+			<< "updating " << (what.empty() ? "binary" : what) << " archive "
+			<< path_to_utf8(out) << "\n";
 
-		"add-remote" %
-		(clipp::command("add-remote").set(mode_, modes::add_remote),
-			(clipp::required("-n", "--name")
-				& clipp::value("NAME") >> remote_)
-				% "name of new remote",
+		op::update_archive_from_glob(gcx(), src_glob, out, ignore, threads);
+	}
+	else
+	{
+		u8cout
+			<< "making " << (what.empty() ? "binary" : what) << " archive "
+			<< path_to_utf8(out) << "\n";
 
-			(clipp::required("-u", "--username")
-				& clipp::value("USERNAME") >> username_)
-				% "git username",
+		op::archive_from_glob(gcx(), src_glob, out, ignore, threads);
+	}
+}
 
-			(clipp::option("-k", "--key")
-				& clipp::value("PATH") >> key_)
-				% "path to putty key",
+void release_command::make_bin(std::size_t threads)
+{
+	make_archive("", paths::install_bin() / "*", threads);
+}
+
+void release_command::make_pdbs(std::size_t threads)
+{
+	make_archive("pdbs", paths::install_pdbs() / "*", threads);
+}
+
+// one matcher for all the patterns instead of a regex_match() per pattern
+// per file
+//
+static const std::regex& src_ignore_re()
+{
+	static const std::vector<std::string> ignore =
+	{
+		"\\..+",     // dot files
+		".*\\.log",
+		".*\\.tlog",
+		".*\\.dll",
+		".*\\.exe",
+		".*\\.lib",
+		".*\\.obj",
+		".*\\.ts",
+		".*\\.aps",
+		"vsbuild"
+	};
+
+	static const std::regex re(
+		"(?:" + join(ignore, ")|(?:") + ")", std::regex::optimize);
+
+	return re;
+}
+
+void release_command::make_src(std::size_t threads)
+{
+	const auto out = out_ / make_filename("src");
+	u8cout << "making src archive " << path_to_utf8(out) << "\n";
+
+	const std::regex& ignore_re = src_ignore_re();
+
+	std::vector<fs::path> files;
+	std::size_t total_size = 0;
+
+	if (!fs::exists(modorganizer::super_path()))
+	{
+		gcx().bail_out(context::generic,
+			"modorganizer super path not found: {}",
+			modorganizer::super_path());
+	}
+
+	// the super repos are enumerated from their index, which skips build
+	// trees and untracked files entirely; anything else is walked
+	std::vector<fs::path> dirs;
+
+	for (auto e : fs::directory_iterator(modorganizer::super_path()))
+	{
+		const auto p = e.path();
+
+		if (std::regex_match(path_to_utf8(p.filename()), ignore_re))
+			continue;
+
+		if (e.is_directory())
+		{
+			dirs.push_back(p);
+		}
+		else if (e.is_regular_file())
+		{
+			total_size += fs::file_size(p);
+			files.push_back(p);
+		}
+	}
+
+	std::vector<src_files> found(dirs.size());
+
+	parallel_for(dirs.size(), 8, [&](std::size_t i)
+	{
+		{
+			std::scoped_lock lock(src_mutex_);
+
+			auto itor = src_listed_.find(dirs[i]);
+			if (itor != src_listed_.end())
+			{
+				found[i] = itor->second;
+				return;
+			}
+		}
+
+		found[i] = list_src_dir(dirs[i]);
+	});
+
+	for (auto&& df : found)
+	{
+		files.insert(files.end(), df.files.begin(), df.files.end());
+		total_size += df.size;
+	}
+
+	// should be below 20MB
+	const std::size_t max_expected_size = 20 * 1024 * 1024;
+	if (total_size >= max_expected_size)
+	{
+		gcx().warning(context::generic,
+			"total size of source files would be {}, expected something "
+			"below {}, something might be wrong",
+			total_size, max_expected_size);
+
+		if (!force_)
+		{
+			gcx().bail_out(context::generic,
+				"bailing out, use --force to ignore");
+		}
+	}
+
+	op::archive_from_files(gcx(),
+		files, modorganizer::super_path(), out, threads);
+}
+
+release_command::src_files release_command::list_src_dir(const fs::path& dir)
+{
+	const std::regex& ignore_re = src_ignore_re();
+	src_files df;
+
+	if (!git::is_git_repo(dir))
+	{
+		walk_dir(dir, df.files, ignore_re, df.size);
+		return df;
+	}
+
+	for (auto&& rp : git::tracked_files(dir))
+	{
+		bool ignored = false;
+
+		for (auto&& part : rp)
+		{
+			if (std::regex_match(path_to_utf8(part), ignore_re))
+			{
+				ignored = true;
+				break;
+			}
+		}
+
+		if (ignored)
+			continue;
+
+		const auto p = dir / rp;
+
+		std::error_code ec;
+		const auto size = fs::file_size(p, ec);
+		if (ec)
+			continue;
+
+		df.size += size;
+		df.files.push_back(p);
+	}
+
+	return df;
+}
+
+void release_command::make_installer()
+{
+	const auto file = "Mod.Organizer-" + version_ + ".exe";
+	const auto src = paths::install_installer() / file;
+	const auto dest = out_;
+
+	u8cout << "copying installer " << file << "\n";
+
+	op::copy_file_to_dir_if_better(gcx(), src, dest);
+}
+
+void release_command::make_prebuilts()
+{
+	std::vector<const task*> tasks;
+
+	for (const auto* t : get_all_tasks())
+	{
+		if (t->prebuilt_filename().empty() || !t->enabled())
+			continue;
+
+		if (t->get_prebuilt())
+		{
+			u8cout << "skipping " << t->name() << ", it uses a prebuilt\n";
+			continue;
+		}
+
+		tasks.push_back(t);
+	}
+
+	if (tasks.empty())
+	{
+		u8cout << "no tasks are built from source\n";
+		return;
+	}
+
+	auto& js = job_slots::instance();
+	const std::size_t share = std::max<std::size_t>(
+		1, js.total() / tasks.size());
+
+	std::vector<std::optional<prebuilt>> made(tasks.size());
+
+	parallel_for(tasks.size(), tasks.size(), [&](std::size_t i)
+	{
+		auto lease = js.lease(share);
+		made[i] = make_prebuilt(*tasks[i], lease.count());
+	});
+
+	// the hashes can be given to the agents that use the prebuilts with
+	// --ini, the downloader checks them
+	std::string manifest, hashes = "[sha256]\n";
+
+	for (auto&& p : made)
+	{
+		if (!p)
+			continue;
+
+		manifest += fmt::format(
+			"{} {} {} {} {}\n",
+			p->task, p->version, p->filename, p->size, p->sha256);
+
+		hashes += p->filename + " = " + p->sha256 + "\n";
+	}
+
+	u8cout << "writing prebuilts.txt and prebuilts.ini\n";
+
+	op::write_text_file(
+		gcx(), encodings::utf8, out_ / "prebuilts.txt", manifest);
+
+	op::write_text_file(
+		gcx(), encodings::utf8, out_ / "prebuilts.ini", hashes);
+}
+
+std::optional<release_command::prebuilt> release_command::make_prebuilt(
+	const task& t, std::size_t threads)
+{
+	const auto root = t.prebuilt_root();
+
+	if (!fs::exists(root))
+	{
+		gcx().warning(context::generic,
+			"{} was not built, {} doesn't exist", t.name(), root);
+
+		return {};
+	}
+
+	// intermediate build files and mob's own files, nothing that the tasks
+	// using the prebuilt need
+	const std::vector<std::string> ignore =
+	{
+		"\\.git",
+		"_mob_.*",
+		"bin\\.v2",
+		"__pycache__",
+		".*\\.obj",
+		".*\\.tlog",
+		".*\\.pch",
+		".*\\.ilk",
+		".*\\.iobj",
+		".*\\.ipdb",
+		".*\\.idb",
+		".*\\.log"
+	};
+
+	const std::regex ignore_re(
+		"(?:" + join(ignore, ")|(?:") + ")", std::regex::optimize);
+
+	std::vector<fs::path> files;
+	std::size_t total_size = 0;
+
+	for (auto&& p : t.prebuilt_files())
+	{
+		if (fs::is_directory(p))
+		{
+			walk_dir(p, files, ignore_re, total_size);
+		}
+		else if (fs::is_regular_file(p))
+		{
+			total_size += fs::file_size(p);
+			files.push_back(p);
+		}
+	}
+
+	if (files.empty())
+	{
+		gcx().warning(context::generic,
+			"{} has no files to archive in {}", t.name(), root);
+
+		return {};
+	}
+
+	prebuilt pb;
+	pb.task = t.name();
+	pb.version = t.get_version();
+	pb.filename = t.prebuilt_filename();
+
+	const auto out = out_ / pb.filename;
+
+	u8cout
+		<< "making prebuilt " << path_to_utf8(out) << " from "
+		<< files.size() << " files\n";
+
+	// 7z would add to an existing archive
+	op::delete_file(gcx(), out, op::optional);
+	op::archive_from_files(gcx(), files, root, out, threads);
+
+	if (conf::dry())
+		return pb;
+
+	sha256 h;
+	if (!h.update_from_file(out))
+		gcx().bail_out(context::generic, "can't read {}", out);
+
+	pb.sha256 = h.finish();
+	pb.size = fs::file_size(out);
+
+	return pb;
+}
+
+void release_command::walk_dir(
+	const fs::path& dir, std::vector<fs::path>& files,
+	const std::regex& ignore_re, std::size_t& total_size)
+{
+	for (auto e : fs::directory_iterator(dir))
+	{
+		const auto p = e.path();
+
+		if (std::regex_match(path_to_utf8(p.filename()), ignore_re))
+			continue;
+
+		if (e.is_directory())
+		{
+			walk_dir(e.path(), files, ignore_re, total_size);
+		}
+		else if (e.is_regular_file())
+		{
+			total_size += fs::file_size(p);
+			files.push_back(p);
+		}
+	}
+}
+
+fs::path release_command::make_filename(const std::string& what) const
+{
+	std::string filename = "Mod.Organizer";
+
+	if (!version_.empty())
+		filename += "-" + version_;
+
+	if (!suffix_.empty())
+		filename += "-" + suffix_;
+
+	if (!what.empty())
+		filename += "-" + what;
+
+	filename += ".7z";
+
+	return filename;
+}
+
+clipp::group release_command::do_group()
+{
+	return clipp::group(
+		clipp::command("release").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message"),
+
+		"devbuild" %
+		(clipp::command("devbuild").set(mode_, modes::devbuild),
+			(
+				clipp::option("--bin").set(bin_, true) |
+				clipp::option("--no-bin").set(bin_, false)
+			) % "sets whether the binary archive is created [default: yes]",
+
+			(
+				clipp::option("--pdbs").set(pdbs_, true) |
+				clipp::option("--no-pdbs").set(pdbs_, false)
+			) % "sets whether the PDBs archive is created [default: yes]",
+
+			(
+				clipp::option("--src").set(src_, true) |
+				clipp::option("--no-src").set(src_, false)
+			) % "sets whether the source archive is created [default: yes]",
+
+			(
+				clipp::option("--inst").set(installer_, true) |
+				clipp::option("--no-inst").set(installer_, false)
+			) % "sets whether the installer is copied [default: no]",
+
+			clipp::option("--incremental").set(incremental_)
+				% "updates existing binary and PDBs archives with the files "
+				  "that changed since they were created instead of creating "
+				  "them from scratch",
+
+			clipp::option("--version-from-exe").set(version_exe_)
+				% "retrieves version information from ModOrganizer.exe "
+				  "[default]",
+
+			clipp::option("--version-from-rc").set(version_rc_)
+				% "retrieves version information from modorganizer/src/version.rc",
+
+			(clipp::option("--rc")
+				& clipp::value("PATH") >> utf8_rc_path_)
+				% "overrides the path to version.rc",
+
+			(clipp::option("--version")
+				& clipp::value("VERSION") >> version_)
+				% "overrides the version string",
+
+			(clipp::option("--output-dir")
+				& clipp::value("PATH") >> utf8out_)
+				% "sets the output directory to use instead of `$prefix/releases`",
+
+			(clipp::option("--suffix")
+				& clipp::value("SUFFIX") >> suffix_)
+				% "optional suffix to add to the archive filenames",
+
+			clipp::option("--force").set(force_)
+				% "ignores file size warnings and existing release directories"
+		)
+
+		|
+
+		"official" %
+		(clipp::command("official").set(mode_, modes::official),
+			(clipp::value("branch") >> branch_)
+				% "use this branch in the super repos"
+		)
+
+		|
+
+		"prebuilts" %
+		(clipp::command("prebuilts").set(mode_, modes::prebuilts),
+			(clipp::option("--output-dir")
+				& clipp::value("PATH") >> utf8out_)
+				% "sets the output directory to use instead of "
+				  "`$prefix/releases/prebuilts`"
+		)
+	);
+}
+
+void release_command::convert_cl_to_conf()
+{
+	command::convert_cl_to_conf();
+
+	if (mode_ == modes::official)
+	{
+		common.options.push_back("task/mo_branch=" + branch_);
+		common.options.push_back("translations:task/enabled=true");
+		common.options.push_back("installer:task/enabled=true");
+
+		common.options.push_back("transifex/force=true");
+		common.options.push_back("transifex/configure=true");
+		common.options.push_back("transifex/pull=true");
+	}
+}
+
+int release_command::do_run()
+{
+	switch (mode_)
+	{
+		case modes::devbuild:
+			return do_devbuild();
+
+		case modes::official:
+			return do_official();
+
+		case modes::prebuilts:
+			return do_prebuilts();
+
+		case modes::none:
+		default:
+			u8cerr << "bad release mode " << static_cast<int>(mode_) << "\n";
+			throw bailed();
+	}
+}
+
+int release_command::do_devbuild()
+{
+	prepare();
+
+	u8cout
+		<< ">> don't forget to update the version number before making a release\n"
+		<< "\n"
+		<< "creating release for " << version_ << "\n";
+
+	make_archives(bin_, pdbs_, src_);
+
+	if (installer_)
+		make_installer();
+
+	return 0;
+}
+
+int release_command::do_official()
+{
+	set_sigint_handler();
+	check_official_branch();
+
+	if (fs::exists(paths::prefix()))
+	{
+		u8cout
+			<< "prefix " << path_to_utf8(paths::prefix()) << " already exists\n"
+			<< "delete? [Y/n] ";
+
+		std::wstring s;
+		std::getline(std::wcin, s);
+
+		if (s == L"" || s == L"y" || s == L"Y")
+		{
+			build_command::terminate_msbuild();
+			op::delete_directory(gcx(), paths::prefix());
+		}
+		else
+		{
+			return 1;
+		}
+	}
+
+	// the files of each super repo are listed for the source archive as soon
+	// as it's been cloned, while the rest is still building; only git repos
+	// are listed early, their index doesn't change during the build but
+	// anything else would have to be walked again
+	thread_pool tp(4);
+	std::mutex futures_mutex;
+	std::vector<std::future<void>> futures;
+
+	run_all_tasks([&](task& t)
+	{
+		if (!t.is_super())
+			return;
+
+		const auto dir = t.get_source_path();
+
+		std::scoped_lock lock(futures_mutex);
+
+		futures.push_back(tp.add([this, dir]
+		{
+			if (!git::is_git_repo(dir))
+				return;
+
+			auto df = list_src_dir(dir);
+
+			std::scoped_lock lock(src_mutex_);
+			src_listed_[dir] = std::move(df);
+		}));
+	});
+
+	build_command::terminate_msbuild();
+
+	// rethrows if a listing bailed out
+	for (auto&& f : futures)
+		f.get();
+
+	if (task::all_interrupted())
+		throw bailed();
+
+	prepare();
+	make_archives(true, true, true);
+	make_installer();
+
+	return 0;
+}
+
+void release_command::check_official_branch()
+{
+	u8cout << "checking repos for branch " << branch_ << "...\n";
+
+	std::vector<const modorganizer*> tasks;
+	std::vector<mob::url> urls;
+
+	for (const auto* t : find_tasks("super"))
+	{
+		if (!t->enabled())
+			continue;
+
+		const auto* o = dynamic_cast<const modorganizer*>(t);
+		tasks.push_back(o);
+		urls.push_back(o->git_url());
+	}
+
+	const auto missing = git::remotes_without_branch(urls, branch_);
+	if (missing.empty())
+		return;
+
+	for (auto&& u : missing)
+	{
+		for (std::size_t i=0; i<urls.size(); ++i)
+		{
+			if (urls[i].string() == u.string())
+			{
+				gcx().error(context::generic,
+					"branch {} doesn't exist in the {} repo",
+					branch_, tasks[i]->name());
+			}
+		}
+	}
+
+	gcx().bail_out(context::generic,
+		"either fix the branch name, create a remote branch for the "
+		"repos that don't have it, or disable tasks with "
+		"`-s TASKNAME:task/enabled=false`");
+}
+
+int release_command::do_prebuilts()
+{
+	out_ = fs::path(utf8_to_utf16(utf8out_));
+	if (out_.empty())
+		out_ = paths::prefix() / "releases" / "prebuilts";
+	else if (out_.is_relative())
+		out_ = paths::prefix() / out_;
+
+	make_prebuilts();
+
+	return 0;
+}
+
+void release_command::prepare()
+{
+	rc_path_ = fs::path(utf8_to_utf16(utf8_rc_path_));
+	if (rc_path_.empty())
+	{
+		rc_path_ =
+			modorganizer::super_path() / "modorganizer" / "src" / "version.rc";
+	}
+
+	if (version_.empty())
+	{
+		if (version_rc_)
+			version_ = version_from_rc();
+		else
+			version_ = version_from_exe();
+	}
+
+	out_ = fs::path(utf8_to_utf16(utf8out_));
+	if (out_.empty())
+		out_ = paths::prefix() / "releases" / version_;
+	else if (out_.is_relative())
+		out_ = paths::prefix() / out_;
+}
+
+std::string release_command::do_doc()
+{
+	return
+		"Creates archives for an MO installation, PDBs and sources.\n"
+		"\n"
+		"Commands:\n"
+		"devbuild\n"
+		"  Can creates three archives in `$prefix/releases/version`: one from\n"
+		"  `install/bin/*`, one from `install/pdbs/*` and another with the\n"
+		"  sources of projects from modorganizer_super.\n"
+		"  \n"
+		"  The archive filename is `Mod.Organizer-version-suffix-what.7z`,\n"
+		"  where:\n"
+		"    - `version` is taken from `ModOrganizer.exe`, `version.rc`\n"
+		"      or from --version;\n"
+		"    - `suffix` is the optional `--suffix` argument;\n"
+		"    - `what` is either nothing, `src` or `pdbs`.\n"
+		"\n"
+		"official\n"
+		"  Creates a new full build in the prefix. Requires that directory\n"
+		"  to be empty. Puts the binary archive, source, PDBs and installer\n"
+		"  in `$prefix/releases/version`. Forces all tasks to be enabled,\n"
+		"  including translations and installer. Make sure the transifex API\n"
+		"  key is in the INI or TX_TOKEN is set.\n"
+		"\n"
+		"prebuilts\n"
+		"  Archives the tasks that can use a prebuilt and were built from\n"
+		"  source in `$prefix/releases/prebuilts`, with the layout expected\n"
+		"  when `prebuilt` is true for them. Also writes `prebuilts.txt`\n"
+		"  with the task, version, filename, size and SHA-256 of each\n"
+		"  archive and `prebuilts.ini` with a `[sha256]` section for them.";
+}
+
+std::string release_command::version_from_exe() const
+{
+	const auto exe = paths::install_bin() / "ModOrganizer.exe";
+
+	// getting version info size
+	DWORD dummy = 0;
+	const DWORD size = GetFileVersionInfoSizeW(exe.native().c_str(), &dummy);
+
+	if (size == 0)
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::generic,
+			"can't get file version info size from {}, {}",
+			exe, error_message(e));
+	}
+
+	// getting version info
+	auto buffer = std::make_unique<std::byte[]>(size);
+
+	if (!GetFileVersionInfoW(exe.native().c_str(), 0, size, buffer.get()))
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::generic,
+			"can't get file version info from {}, {}",
+			exe, error_message(e));
+	}
+
+	struct LANGANDCODEPAGE
+	{
+		WORD wLanguage;
+		WORD wCodePage;
+	};
+
+	void* value_pointer = nullptr;
+	unsigned int value_size = 0;
+
+	// getting list of available languages
+	auto ret = VerQueryValueW(
+		buffer.get(), L"\\VarFileInfo\\Translation",
+		&value_pointer, &value_size);
+
+	if (!ret || !value_pointer || value_size == 0)
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::generic,
+			"VerQueryValueW() for translations failed on {}, {}",
+			exe, error_message(e));
+	}
+
+	// number of languages
+	const auto count = value_size / sizeof(LANGANDCODEPAGE);
+	if (count == 0)
+		gcx().bail_out(context::generic, "no languages found in {}", exe);
+
+	// using the first language in the list to get FileVersion
+	const auto* lcp = static_cast<LANGANDCODEPAGE*>(value_pointer);
+
+	const auto sub_block = ::fmt::format(
+		L"\\StringFileInfo\\{:04x}{:04x}\\FileVersion",
+		lcp->wLanguage, lcp->wCodePage);
+
+	ret = VerQueryValueW(
+		buffer.get(), sub_block.c_str(), &value_pointer, &value_size);
+
+	if (!ret || !value_pointer || value_size == 0)
+	{
+		gcx().bail_out(context::generic,
+			"language {} not found in {}", sub_block, exe);
+	}
+
+	// value_size includes the null terminator
+	return utf16_to_utf8(std::wstring(
+		static_cast<wchar_t*>(value_pointer),
+		value_size - 1));
+}
+
+std::string release_command::version_from_rc() const
+{
+	// matching: #define VER_FILEVERSION_STR "2.2.1\0"
+	std::regex re(R"(#define VER_FILEVERSION_STR "(.+)\\0")");
+
+	const std::string rc = op::read_text_file(
+		gcx(), encodings::utf8, rc_path_);
+
+	std::smatch m;
+	std::string v;
+
+	for_each_line(rc, [&](std::string_view line)
+	{
+		std::string line_s(line);
+		if (std::regex_match(line_s, m, re))
+			v = m[1];
+	});
+
+	if (v.empty())
+	{
+		gcx().bail_out(context::generic,
+			"can't find version string in {}", rc_path_);
+	}
+
+	return v;
+}
+
+
+git_command::git_command()
+	: command(requires_options)
+{
+}
+
+command::meta_t git_command::meta() const
+{
+	return
+	{
+		"git",
+		"manages the git repos"
+	};
+}
+
+clipp::group git_command::do_group()
+{
+	return clipp::group(
+		clipp::command("git").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message"),
+
+		"set-remotes" %
+		(clipp::command("set-remotes").set(mode_, modes::set_remotes),
+			(clipp::required("-u", "--username")
+				& clipp::value("USERNAME") >> username_)
+				% "git username",
+
+			(clipp::required("-e", "--email")
+				& clipp::value("EMAIL") >> email_)
+				% "git email",
+
+			(clipp::option("-k", "--key")
+				& clipp::value("PATH") >> key_)
+				% "path to putty key",
+
+			(clipp::option("-s", "--no-push").set(nopush_)
+				% "disables pushing to 'upstream' by changing the push url "
+				  "to 'nopushurl' to avoid accidental pushes"),
+
+			(clipp::option("-p", "--push-origin").set(push_default_)
+				% "sets the new 'origin' remote as the default push target"),
+
+			(clipp::opt_value("path") >> path_)
+				% "only use this repo"
+		)
+
+		|
+
+		"add-remote" %
+		(clipp::command("add-remote").set(mode_, modes::add_remote),
+			(clipp::required("-n", "--name")
+				& clipp::value("NAME") >> remote_)
+				% "name of new remote",
+
+			(clipp::required("-u", "--username")
+				& clipp::value("USERNAME") >> username_)
+				% "git username",
+
+			(clipp::option("-k", "--key")
+				& clipp::value("PATH") >> key_)
+				% "path to putty key",
+
+			(clipp::option("-p", "--push-origin").set(push_default_)
+				% "sets this new remote as the default push target"),
+
+			(clipp::opt_value("path") >> path_)
+				% "only use this repo"
+		)
+
+		|
+
+		"ignore-ts" %
+		(clipp::command("ignore-ts").set(mode_, modes::ignore_ts),
+			(
+				clipp::command("on").set(tson_, true) |
+				clipp::command("off").set(tson_, false)
+			)
+		)
+	);
+}
+
+int git_command::do_run()
+{
+	switch (mode_)
+	{
+		case modes::set_remotes:
+		{
+			do_set_remotes();
+			break;
+		}
+
+		case modes::add_remote:
+		{
+			do_add_remote();
+			break;
+		}
+
+		case modes::ignore_ts:
+		{
+			do_ignore_ts();
+			break;
+		}
+
+		case modes::none:
+		default:
+			u8cerr << "bad git mode " << static_cast<int>(mode_) << "\n";
+			throw bailed();
+	}
+
+	return 0;
+}
+
+std::string git_command::do_doc()
+{
+	return
+		"All the commands will go through all modorganizer repos, plus usvfs\n"
+		"and NCC.\n"
+		"\n"
+		"Commands:\n"
+		"set-remotes\n"
+		"  For each repo, this first sets the username and email. Then, it\n"
+		"  will rename the remote 'origin' to 'upstream' and create a new\n"
+		"  remote 'origin' with the given information. If the remote\n"
+		"  'upstream' already exists in a repo, nothing happens.\n"
+		"\n"
+		"add-remote\n"
+		"  For each repo, adds a new remote with the given information. If a\n"
+		"  remote with the same name already exists, nothing happens.\n"
+		"\n"
+		"ignore-ts\n"
+		"  Toggles the --assume-changed status of all .ts files in all repos.";
+}
+
+void git_command::do_set_remotes()
+{
+	for_each_repo([&](auto&& r){ return do_set_remotes(r); });
+}
+
+std::string git_command::do_set_remotes(const fs::path& r)
+{
+	git::set_credentials(r, username_, email_);
+	git::set_remote(r, username_, key_, nopush_, push_default_);
+
+	return "setting up " + path_to_utf8(r.filename()) + "\n";
+}
+
+void git_command::do_add_remote()
+{
+	u8cout
+		<< "adding remote '" << remote_ << "' "
+		<< "from '" << username_ << "' to repos\n";
+
+	for_each_repo([&](auto&& r){ return do_add_remote(r); });
+}
+
+std::string git_command::do_add_remote(const fs::path& r)
+{
+	git::add_remote(r, remote_, username_, key_, push_default_);
+	return path_to_utf8(r.filename()) + "\n";
+}
+
+void git_command::do_ignore_ts()
+{
+	if (tson_)
+		u8cout << "ignoring .ts files\n";
+	else
+		u8cout << "un-ignoring .ts files\n";
+
+	for_each_repo([&](auto&& r){ return do_ignore_ts(r); });
+}
+
+std::string git_command::do_ignore_ts(const fs::path& r)
+{
+	git::ignore_ts(r, tson_);
+	return path_to_utf8(r.filename()) + "\n";
+}
+
+void git_command::for_each_repo(
+	std::function<std::string (const fs::path&)> f)
+{
+	if (!path_.empty())
+	{
+		u8cout << f(path_);
+		return;
+	}
+
+	const auto repos = get_repos();
+
+	// this is config work, the git processes mostly wait on the disk; more
+	// than a few at once just fight over it
+	const std::size_t max_jobs = 8;
+
+	parallel_for(repos.size(), max_jobs, [&](std::size_t i)
+	{
+		// output of a repo is printed in one go so lines from different
+		// repos don't get mixed up
+		u8cout << f(repos[i]);
+	});
+}
+
+std::vector<fs::path> git_command::get_repos() const
+{
+	std::vector<fs::path> v;
+
+	if (fs::exists(usvfs::source_path()))
+		v.push_back(usvfs::source_path());
+
+	if (fs::exists(ncc::source_path()))
+		v.push_back(ncc::source_path());
+
+
+	const auto super = modorganizer::super_path();
+
+	if (fs::exists(super))
+	{
+		for (auto e : fs::directory_iterator(super))
+		{
+			if (!e.is_directory())
+				continue;
+
+			const auto p = e.path();
+			if (path_to_utf8(p.filename()).starts_with("."))
+				continue;
+
+			v.push_back(p);
+		}
+	}
+
+	return v;
+}
+
+
+cmake_command::cmake_command()
+	: command(requires_options)
+{
+}
+
+command::meta_t cmake_command::meta() const
+{
+	return
+	{
+		"cmake",
+		"runs cmake in a directory"
+	};
+}
+
+clipp::group cmake_command::do_group()
+{
+	return clipp::group(
+		clipp::command("cmake").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% "shows this message",
+
+		(clipp::option("-G", "--generator")
+			& clipp::value("GEN") >> gen_)
+			% ("sets the -G option for cmake [default: VS]"),
+
+		(clipp::option("-c", "--cmd")
+			& clipp::value("CMD") >> cmd_)
+			% "overrides the cmake command line [default: \"..\"]",
+
+		(
+			clipp::option("--x64").set(x64_, true) |
+			clipp::option("--x86").set(x64_, false)
+		)
+			% "whether to use the x64 or x86 vcvars; if -G is not set, "
+			  "whether to pass \"-A Win32\" or \"-A x64\" for the default "
+			  "VS generator [default: x64]",
+
+		(clipp::option("--install-prefix")
+			& clipp::value("PATH") >> prefix_)
+			% "sets CMAKE_INSTALL_PREFIX [default: empty]",
+
+		(clipp::value("PATH") >> path_)
+			% "path from which to run `cmake`"
+	);
+}
+
+int cmake_command::do_run()
+{
+	auto t = modorganizer::create_cmake_tool(fs::path(utf8_to_utf16(path_)));
+
+	t.generator(gen_);
+	t.cmd(cmd_);
+	t.prefix(prefix_);
+	t.output(path_);
+
+	if (!x64_)
+		t.architecture(arch::x86);
+
+	context cxcopy(gcx());
+	t.run(cxcopy);
+
+	return 0;
+}
+
+std::string cmake_command::do_doc()
+{
+	return
+		"Runs `cmake ..` in the given directory with the same command line\n"
+		"as the one used for modorganizer projects.";
+}
+
+
+command::meta_t inis_command::meta() const
+{
+	return
+	{
+		"inis",
+		"lists the INIs used by mob"
+	};
+}
+
+clipp::group inis_command::do_group()
+{
+	return clipp::group(
+		clipp::command("inis").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message")
+	);
+}
+
+int inis_command::do_run()
+{
+	return prepare_options(true);
+}
+
+std::string inis_command::do_doc()
+{
+	return "Shows which INIs are found.";
+}
+
+
+timings_command::timings_command()
+	: command(requires_options)
+{
+}
+
+command::meta_t timings_command::meta() const
+{
+	return
+	{
+		"timings",
+		"shows where the time went in the last build"
+	};
+}
+
+clipp::group timings_command::do_group()
+{
+	return clipp::group(
+		clipp::command("timings").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message"),
+
+		(clipp::option("-i", "--input")
+			& clipp::value("FILE") >> input_)
+			% "timings file written by `build` [default: prefix/timings.txt], "
+			  "or history file with compare [default: prefix/history.txt]",
+
+		(clipp::option("-o", "--output")
+			& clipp::value("FILE") >> output_)
+			% "trace file to write [default: prefix/timings.json]",
+
+		(clipp::command("compare").set(compare_).required(false))
+			% "compares the last build in the history with the ones before "
+			  "it instead",
+
+		(clipp::option("--threshold")
+			& clipp::value("PERCENT").set(threshold_))
+			% "with compare, how much slower a phase must be to be reported "
+			  "[default: 20]",
+
+		(clipp::option("--baseline")
+			& clipp::value("RUNS").set(baseline_))
+			% "with compare, number of previous builds to compare against "
+			  "[default: 10]",
+
+		(clipp::option("--min-seconds")
+			& clipp::value("S").set(min_seconds_))
+			% "with compare, phases that got slower by less than this are "
+			  "ignored [default: 5]"
+	);
+}
+
+int timings_command::do_run()
+{
+	if (compare_)
+		return do_compare();
+
+	const fs::path in = input_.empty() ?
+		build_command::timings_file() : fs::path(utf8_to_utf16(input_));
+
+	const fs::path out = output_.empty() ?
+		paths::prefix() / "timings.json" : fs::path(utf8_to_utf16(output_));
+
+	if (!fs::exists(in))
+	{
+		u8cerr << path_to_utf8(in) << " not found, run `mob build` first\n";
+		return 1;
+	}
+
+	const auto v = read_timings(in);
+
+	if (v.empty())
+	{
+		u8cerr << "no timings in " << path_to_utf8(in) << "\n";
+		return 1;
+	}
+
+	// written by `build` next to the timings
+	std::vector<span_entry> spans;
+	const auto spans_file = in.parent_path() / "spans.txt";
+	if (fs::exists(spans_file))
+		spans = read_spans(spans_file);
+
+	write_trace(v, spans, out);
+	print_critical_path(v);
+	print_usage(v);
+
+	// written by `build` next to the timings
+	const auto downloads = in.parent_path() / "downloads.txt";
+	if (fs::exists(downloads))
+		print_downloads(downloads);
+
+	const auto fs_ops = in.parent_path() / "fs.txt";
+	if (fs::exists(fs_ops))
+		print_fs(fs_ops);
+
+	const auto msbuild_perf = in.parent_path() / "msbuild.txt";
+	if (fs::exists(msbuild_perf))
+		print_msbuild(msbuild_perf);
+
+	const auto cc = in.parent_path() / "compiler_cache.txt";
+	if (fs::exists(cc))
+		print_compiler_cache(cc);
+
+	return 0;
+}
+
+std::string timings_command::do_doc()
+{
+	return
+		"Reads the timings written by the last `mob build` and converts them\n"
+		"to the Chrome trace event format, which can be opened in\n"
+		"chrome://tracing or https://ui.perfetto.dev, with one track per task\n"
+		"and thread. The tools, processes and downloads of every task are\n"
+		"nested under their phase, from spans.txt.\n"
+		"\n"
+		"Also prints the critical path: the chain of tasks that bounded the\n"
+		"total build time, going from the task that finished last back\n"
+		"through the dependency that finished last, with the time spent in\n"
+		"each phase, the resources used by each task and the stats of every\n"
+		"download.\n"
+		"\n"
+		"`mob timings compare` reads history.txt instead and compares the\n"
+		"phases of every task in the last build with the median of the\n"
+		"previous ones that had the same kind of build and options, and\n"
+		"reports the ones that got slower by more than --threshold percent\n"
+		"and --min-seconds, with the commits of the repo that changed in\n"
+		"between. Returns 1 if something regressed.";
+}
+
+int timings_command::do_compare()
+{
+	const fs::path in = input_.empty() ?
+		build_command::history_file() : fs::path(utf8_to_utf16(input_));
+
+	if (!fs::exists(in))
+	{
+		u8cerr << path_to_utf8(in) << " not found, run `mob build` first\n";
+		return 1;
+	}
+
+	const auto runs = read_history(in);
+
+	if (runs.size() < 2)
+	{
+		u8cerr << "need at least two builds in " << path_to_utf8(in) << "\n";
+		return 1;
+	}
+
+	const auto& last = runs.back();
+
+	// previous runs with the same kind of build and options, newest first
+	std::vector<const history_run*> baseline;
+
+	for (auto itor=runs.rbegin() + 1; itor!=runs.rend(); ++itor)
+	{
+		if (baseline.size() >= static_cast<std::size_t>(baseline_))
+			break;
+
+		if (itor->kind == last.kind && itor->fingerprint == last.fingerprint)
+			baseline.push_back(&*itor);
+	}
+
+	if (baseline.empty())
+	{
+		u8cerr
+			<< "no previous " << last.kind << " build with the same options "
+			<< "as " << last.id << "\n";
+
+		return 1;
+	}
+
+	u8cout
+		<< "comparing " << last.id << " (" << last.kind << ") with "
+		<< baseline.size() << " builds since " << baseline.back()->id << "\n";
+
+	bool regressed = false;
+
+	for (auto&& [k, secs] : last.phases)
+	{
+		std::vector<double> v;
+
+		for (auto* r : baseline)
+		{
+			auto itor = r->phases.find(k);
+			if (itor != r->phases.end())
+				v.push_back(itor->second);
+		}
+
+		if (v.empty())
+			continue;
+
+		// the median isn't thrown off by one slow build in the baseline
+		std::sort(v.begin(), v.end());
+		const double median = v[v.size() / 2];
+
+		const double limit = median * (1.0 + threshold_ / 100.0);
+
+		if (secs <= limit || (secs - median) < min_seconds_)
+			continue;
+
+		regressed = true;
+
+		u8cout << fmt::format(
+			"  {:<30} {:<10} {:>8.1f}s -> {:>8.1f}s  +{:.0f}%",
+			k.first, k.second, median, secs,
+			median > 0 ? ((secs - median) * 100.0) / median : 100.0);
+
+		// the repo of a super task changed since the most recent build of
+		// the baseline
+		auto h = last.heads.find(k.first);
+		auto old = baseline.front()->heads.find(k.first);
+
+		if (h != last.heads.end() && old != baseline.front()->heads.end() &&
+			h->second != old->second)
+		{
+			u8cout << fmt::format(
+				"  ({}..{})",
+				old->second.substr(0, 8), h->second.substr(0, 8));
+		}
+
+		u8cout << "\n";
+	}
+
+	if (!regressed)
+		u8cout << "no regressions\n";
+
+	return (regressed ? 1 : 0);
+}
+
+std::vector<timings_command::history_run> timings_command::read_history(
+	const fs::path& file) const
+{
+	std::vector<history_run> v;
+
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	for_each_line(text, [&](auto&& line)
+	{
+		const auto cs = split(std::string(line), "\t");
+		if (cs.empty())
+			return;
+
+		try
+		{
+			if (cs[0] == "run")
+			{
+				history_run r;
+
+				// older files only have the time
+				if (cs.size() >= 5)
+				{
+					r.id = cs[2];
+					r.kind = cs[3];
+					r.fingerprint = cs[4];
+				}
+				else if (cs.size() >= 2)
+				{
+					r.id = cs[1];
+				}
+
+				v.push_back(std::move(r));
+			}
+			else if (v.empty())
+			{
+				// lines before the first run
+			}
+			else if (cs[0] == "phase" && cs.size() == 4)
+			{
+				v.back().phases[{cs[1], cs[2]}] = std::stod(cs[3]);
+			}
+			else if (cs[0] == "head" && cs.size() == 3)
+			{
+				v.back().heads[cs[1]] = cs[2];
+			}
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad history line '{}'", line);
+		}
+	});
+
+	return v;
+}
+
+std::vector<timings_command::entry> timings_command::read_timings(
+	const fs::path& file) const
+{
+	std::vector<entry> v;
+
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	for_each_line(text, [&](auto&& line)
+	{
+		// task, start, end and phase, followed by the thread and resource
+		// usage, which older files don't have
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() < 4)
+			return;
+
+		try
+		{
+			using namespace std::chrono;
+
+			entry e;
+
+			e.task = cs[0];
+			e.start = std::stod(cs[1]);
+			e.end = std::stod(cs[2]);
+			e.phase = cs[3];
+
+			if (cs.size() > 4)
+				e.thread = std::stoul(cs[4]);
+
+			if (cs.size() > 10)
+			{
+				e.usage.user = milliseconds(std::stoull(cs[5]));
+				e.usage.kernel = milliseconds(std::stoull(cs[6]));
+				e.usage.peak_memory = std::stoull(cs[7]);
+				e.usage.read_bytes = std::stoull(cs[8]);
+				e.usage.write_bytes = std::stoull(cs[9]);
+				e.usage.processes = std::stoull(cs[10]);
+			}
+
+			if (cs.size() > 14)
+			{
+				e.usage.downloads = std::stoull(cs[11]);
+				e.usage.download_bytes = std::stoull(cs[12]);
+				e.usage.download_time = milliseconds(std::stoull(cs[13]));
+				e.usage.download_retries = std::stoull(cs[14]);
+			}
+
+			if (cs.size() > 18)
+			{
+				e.usage.fs_ops = std::stoull(cs[15]);
+				e.usage.fs_files = std::stoull(cs[16]);
+				e.usage.fs_bytes = std::stoull(cs[17]);
+				e.usage.fs_time = milliseconds(std::stoull(cs[18]));
+			}
+
+			v.push_back(std::move(e));
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad timings line '{}'", line);
+		}
+	});
+
+	return v;
+}
+
+std::vector<timings_command::span_entry> timings_command::read_spans(
+	const fs::path& file) const
+{
+	std::vector<span_entry> v;
+
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	for_each_line(text, [&](auto&& line)
+	{
+		// id, parent, task, kind, name, start, end and thread
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() < 8)
+			return;
+
+		try
+		{
+			span_entry e;
+
+			e.id = std::stoull(cs[0]);
+			e.parent = std::stoull(cs[1]);
+			e.task = (cs[2] == "-" ? "" : cs[2]);
+			e.kind = cs[3];
+			e.name = cs[4];
+			e.start = std::stod(cs[5]);
+			e.end = std::stod(cs[6]);
+			e.thread = std::stoul(cs[7]);
+
+			v.push_back(std::move(e));
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad spans line '{}'", line);
+		}
+	});
+
+	return v;
+}
+
+void timings_command::write_trace(
+	const std::vector<entry>& v, const std::vector<span_entry>& spans,
+	const fs::path& file) const
+{
+	using namespace std::chrono;
+
+	// each task is a process, each thread within it is a track; pids are
+	// given in the order tasks first show up in the file
+	std::map<std::string, std::size_t> pids;
+	std::set<std::pair<std::size_t, std::size_t>> threads;
+
+	std::ostringstream oss;
+	oss << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	bool first = true;
+
+	auto event = [&](const std::string& e)
+	{
+		if (!first)
+			oss << ",\n";
+
+		oss << e;
+		first = false;
+	};
+
+	auto pid_for = [&](const std::string& task, std::size_t thread)
+	{
+		auto itor = pids.find(task);
+
+		if (itor == pids.end())
+		{
+			itor = pids.emplace(task, pids.size() + 1).first;
+
+			event(fmt::format(
+				"{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},"
+				"\"args\":{{\"name\":{}}}}}",
+				itor->second, json_string(task)));
+		}
+
+		const auto pid = itor->second;
+
+		if (threads.insert({pid, thread}).second)
+		{
+			event(fmt::format(
+				"{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},"
+				"\"tid\":{},\"args\":{{\"name\":\"thread {}\"}}}}",
+				pid, thread, thread));
+		}
+
+		return pid;
+	};
+
+	for (auto&& e : v)
+	{
+		const auto pid = pid_for(e.task, e.thread);
+
+		// microseconds
+		const auto ts = static_cast<long long>(e.start * 1'000'000);
+		const auto dur = static_cast<long long>((e.end - e.start) * 1'000'000);
+
+		const auto& u = e.usage;
+
+		event(fmt::format(
+			"{{\"name\":{},\"cat\":\"mob\",\"ph\":\"X\",\"ts\":{},"
+			"\"dur\":{},\"pid\":{},\"tid\":{},\"args\":{{"
+			"\"user_ms\":{},\"kernel_ms\":{},\"peak_memory\":{},"
+			"\"read_bytes\":{},\"write_bytes\":{},\"processes\":{},"
+			"\"downloads\":{},\"download_bytes\":{},\"download_ms\":{},"
+			"\"download_retries\":{},\"fs_ops\":{},\"fs_files\":{},"
+			"\"fs_bytes\":{},\"fs_ms\":{}}}}}",
+			json_string(e.phase), ts, dur, pid, e.thread,
+			duration_cast<milliseconds>(u.user).count(),
+			duration_cast<milliseconds>(u.kernel).count(),
+			u.peak_memory, u.read_bytes, u.write_bytes, u.processes,
+			u.downloads, u.download_bytes,
+			duration_cast<milliseconds>(u.download_time).count(),
+			u.download_retries, u.fs_ops, u.fs_files, u.fs_bytes,
+			duration_cast<milliseconds>(u.fs_time).count()));
+	}
+
+	for (auto&& sp : spans)
+	{
+		// phases are already in the timings, with their resource usage
+		if (sp.kind == "phase")
+			continue;
+
+		const auto pid = pid_for(sp.task.empty() ? "mob" : sp.task, sp.thread);
+		const auto ts = static_cast<long long>(sp.start * 1'000'000);
+		const auto dur = static_cast<long long>((sp.end - sp.start) * 1'000'000);
+
+		if (sp.kind == "download")
+		{
+			// downloads end on the network thread and overlap with whatever
+			// the task does in the meantime, so they get their own async
+			// track instead of being nested
+			event(fmt::format(
+				"{{\"name\":{},\"cat\":\"download\",\"ph\":\"b\",\"ts\":{},"
+				"\"pid\":{},\"tid\":{},\"id\":{}}}",
+				json_string(sp.name), ts, pid, sp.thread, sp.id));
+
+			event(fmt::format(
+				"{{\"name\":{},\"cat\":\"download\",\"ph\":\"e\",\"ts\":{},"
+				"\"pid\":{},\"tid\":{},\"id\":{}}}",
+				json_string(sp.name), ts + dur, pid, sp.thread, sp.id));
+
+			continue;
+		}
+
+		event(fmt::format(
+			"{{\"name\":{},\"cat\":{},\"ph\":\"X\",\"ts\":{},"
+			"\"dur\":{},\"pid\":{},\"tid\":{},\"args\":{{"
+			"\"id\":{},\"parent\":{}}}}}",
+			json_string(sp.name), json_string(sp.kind), ts, dur, pid,
+			sp.thread, sp.id, sp.parent));
+	}
+
+	oss << "\n]}\n";
+
+	op::write_text_file(gcx(), encodings::utf8, file, oss.str());
+	u8cout << "trace written to " << path_to_utf8(file) << "\n";
+}
+
+void timings_command::print_critical_path(const std::vector<entry>& v) const
+{
+	struct span
+	{
+		double start = std::numeric_limits<double>::max();
+		double end = 0;
+
+		// total time per phase, in the order they first show up
+		std::vector<std::pair<std::string, double>> phases;
+	};
+
+	std::map<std::string, span> spans;
+
+	for (auto&& e : v)
+	{
+		auto& s = spans[e.task];
+
+		s.start = std::min(s.start, e.start);
+		s.end = std::max(s.end, e.end);
+
+		auto itor = std::find_if(s.phases.begin(), s.phases.end(),
+			[&](auto&& p) { return p.first == e.phase; });
+
+		if (itor == s.phases.end())
+			s.phases.push_back({e.phase, e.end - e.start});
+		else
+			itor->second += e.end - e.start;
+	}
+
+	auto find_task = [&](const std::string& name) -> task*
+	{
+		for (auto* t : get_all_tasks())
+		{
+			if (t->name() == name)
+				return t;
+		}
+
+		return nullptr;
+	};
+
+	// the task that finished last, ignoring things like the submodule adder
+	task* t = nullptr;
+
+	for (auto&& [name, s] : spans)
+	{
+		auto* ct = find_task(name);
+		if (ct && (!t || s.end > spans[t->name()].end))
+			t = ct;
+	}
+
+	if (!t)
+		return;
+
+	// walks back through the dependency that finished last, which is the one
+	// the task had to wait for before building
+	std::vector<task*> path;
+
+	while (t)
+	{
+		path.push_back(t);
+
+		task* next = nullptr;
+
+		for (auto* d : t->dependencies())
+		{
+			auto itor = spans.find(d->name());
+			if (itor == spans.end())
+				continue;
+
+			if (!next || itor->second.end > spans[next->name()].end)
+				next = d;
+		}
+
+		t = next;
+	}
+
+	std::reverse(path.begin(), path.end());
+
+	auto secs = [](double d)
+	{
+		return fmt::format("{:.2f}s", d);
+	};
+
+	std::vector<std::pair<std::string, std::string>> rows;
+
+	for (auto* pt : path)
+	{
+		const auto& s = spans[pt->name()];
+
+		std::string phases;
+		for (auto&& [name, d] : s.phases)
+		{
+			if (!phases.empty())
+				phases += ", ";
+
+			phases += name + " " + secs(d);
+		}
+
+		rows.push_back({
+			pt->name(),
+			secs(s.start) + " - " + secs(s.end) + "  " + phases});
+	}
+
+	u8cout
+		<< "critical path (" << secs(spans[path.back()->name()].end) << "):\n"
+		<< table(rows, 4, 2) << "\n";
+}
+
+void timings_command::print_usage(const std::vector<entry>& v) const
+{
+	using namespace std::chrono;
+
+	// in the order tasks show up
+	std::vector<std::pair<std::string, resource_usage>> tasks;
+	std::map<std::string, double> wall;
+
+	for (auto&& e : v)
+	{
+		auto itor = std::find_if(tasks.begin(), tasks.end(),
+			[&](auto&& p) { return p.first == e.task; });
+
+		if (itor == tasks.end())
+		{
+			tasks.push_back({e.task, {}});
+			itor = tasks.end() - 1;
+		}
+
+		itor->second += e.usage;
+		wall[e.task] += e.end - e.start;
+	}
+
+	auto mb = [](std::uint64_t b)
+	{
+		return fmt::format("{:.0f}MB", static_cast<double>(b) / 1024 / 1024);
+	};
+
+	std::vector<std::pair<std::string, std::string>> rows;
+
+	for (auto&& [name, u] : tasks)
+	{
+		if (u.processes == 0 && u.downloads == 0 && u.fs_ops == 0)
+			continue;
+
+		const double cpu = duration<double>(u.user + u.kernel).count();
+		const double w = wall[name];
+
+		// a task using more cpu than wall time is using multiple cores; one
+		// with a low ratio is waiting on something, like io or the network
+		auto s = fmt::format(
+			"cpu {:.1f}s ({:.1f}x wall), kernel {:.1f}s, peak {}, "
+			"read {}, written {}, {} processes",
+			cpu, (w > 0 ? cpu / w : 0.0),
+			duration<double>(u.kernel).count(),
+			mb(u.peak_memory), mb(u.read_bytes), mb(u.write_bytes),
+			u.processes);
+
+		if (u.downloads > 0)
+		{
+			s += fmt::format(
+				", downloaded {} in {:.1f}s ({} downloads, {} retries)",
+				mb(u.download_bytes), duration<double>(u.download_time).count(),
+				u.downloads, u.download_retries);
+		}
+
+		if (u.fs_ops > 0)
+		{
+			s += fmt::format(
+				", fs {} in {:.1f}s ({} files)",
+				mb(u.fs_bytes), duration<double>(u.fs_time).count(),
+				u.fs_files);
+		}
+
+		rows.push_back({name, std::move(s)});
+	}
+
+	if (rows.empty())
+		return;
+
+	u8cout << "\nresources:\n" << table(rows, 4, 2) << "\n";
+}
+
+void timings_command::print_downloads(const fs::path& file) const
+{
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	auto mbs = [](const std::string& bps)
+	{
+		return fmt::format(
+			"{:.2f}MB/s", static_cast<double>(std::stoull(bps)) / 1024 / 1024);
+	};
+
+	auto mb = [](const std::string& b)
+	{
+		return fmt::format(
+			"{:.1f}MB", static_cast<double>(std::stoull(b)) / 1024 / 1024);
+	};
+
+	std::vector<std::pair<std::string, std::string>> rows;
+
+	for_each_line(text, [&](auto&& line)
+	{
+		// task, url, ok, bytes, total, dns, connect, tls, first byte, average
+		// and peak rates, retries
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() < 12)
+			return;
+
+		try
+		{
+			rows.push_back({cs[0], fmt::format(
+				"{} {}, {} in {}ms ({} avg, {} peak), dns {}ms, "
+				"connect {}ms, tls {}ms, first byte {}ms, {} retries",
+				cs[1], cs[2], mb(cs[3]), cs[4], mbs(cs[9]), mbs(cs[10]),
+				cs[5], cs[6], cs[7], cs[8], cs[11])});
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad downloads line '{}'", line);
+		}
+	});
+
+	if (rows.empty())
+		return;
+
+	u8cout << "\ndownloads:\n" << table(rows, 4, 2) << "\n";
+}
+
+void timings_command::print_fs(const fs::path& file) const
+{
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	std::vector<std::pair<std::string, std::string>> rows;
+
+	for_each_line(text, [&](auto&& line)
+	{
+		// task, op, calls, files, bytes, ms
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() < 6)
+			return;
+
+		try
+		{
+			rows.push_back({cs[0], fmt::format(
+				"{} {} calls, {} files, {:.1f}MB in {:.1f}s",
+				cs[1], cs[2], cs[3],
+				static_cast<double>(std::stoull(cs[4])) / 1024 / 1024,
+				static_cast<double>(std::stoull(cs[5])) / 1000)});
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad fs line '{}'", line);
+		}
+	});
+
+	if (rows.empty())
+		return;
+
+	u8cout << "\nfilesystem:\n" << table(rows, 4, 2) << "\n";
+}
+
+void timings_command::print_msbuild(const fs::path& file) const
+{
+	// slowest projects and targets shown per task
+	const std::size_t top = 5;
+
+	struct item
+	{
+		std::string name;
+		std::uint64_t ms = 0;
+		std::size_t calls = 0;
+	};
+
+	// task -> kind -> items, the same project or target can show up in
+	// several builds of a task, they're added up
+	std::map<std::string,
+		std::map<std::string, std::map<std::string, item>>> tasks;
+
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	for_each_line(text, [&](auto&& line)
+	{
+		// task, kind, name, ms, calls
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() < 5)
+			return;
+
+		try
+		{
+			auto& i = tasks[cs[0]][cs[1]][cs[2]];
+			i.name = cs[2];
+			i.ms += std::stoull(cs[3]);
+			i.calls += std::stoul(cs[4]);
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad msbuild line '{}'", line);
+		}
+	});
+
+	if (tasks.empty())
+		return;
+
+	std::vector<std::pair<std::string, std::string>> rows;
+
+	for (auto&& [task, kinds] : tasks)
+	{
+		for (auto&& [kind, items] : kinds)
+		{
+			std::vector<item> v;
+			for (auto&& [name, i] : items)
+				v.push_back(i);
+
+			std::sort(v.begin(), v.end(), [](auto&& a, auto&& b) {
+				return (a.ms > b.ms);
+			});
+
+			for (std::size_t i=0; i<std::min(v.size(), top); ++i)
+			{
+				rows.push_back({task, fmt::format(
+					"{} {:.1f}s {} ({} calls)",
+					kind, static_cast<double>(v[i].ms) / 1000,
+					v[i].name, v[i].calls)});
+			}
+		}
+	}
+
+	u8cout
+		<< "\nslowest msbuild projects and targets:\n"
+		<< table(rows, 4, 2) << "\n";
+}
+
+void timings_command::print_compiler_cache(const fs::path& file) const
+{
+	std::vector<std::pair<std::string, std::string>> rows;
+	bool any_shared = false;
+
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	for_each_line(text, [&](auto&& line)
+	{
+		// task, hits, misses, shared
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() < 4)
+			return;
+
+		try
+		{
+			const auto hits = std::stoull(cs[1]);
+			const auto misses = std::stoull(cs[2]);
+			const bool shared = (cs[3] == "1");
+
+			if (hits + misses == 0)
+				return;
+
+			const auto percent = (hits * 100) / (hits + misses);
+
+			rows.push_back({cs[0], fmt::format(
+				"{} hits, {} misses, {}%{}",
+				hits, misses, percent, (shared ? " *" : ""))});
+
+			any_shared = any_shared || shared;
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic,
+				"bad compiler cache line '{}'", line);
+		}
+	});
+
+	if (rows.empty())
+		return;
+
+	u8cout << "\ncompiler cache:\n" << table(rows, 4, 2) << "\n";
+
+	if (any_shared)
+	{
+		u8cout
+			<< "  * other tasks were building at the same time, their "
+			<< "compilations are included\n";
+	}
+}
+
+
+tx_command::tx_command()
+	: command(requires_options)
+{
+}
+
+command::meta_t tx_command::meta() const
+{
+	return
+	{
+		"tx",
+		"manages transifex translations"
+	};
+}
+
+clipp::group tx_command::do_group()
+{
+	return clipp::group(
+		clipp::command("tx").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message"),
+
+		"get" %
+		(clipp::command("get").set(mode_, modes::get),
+			(clipp::option("-k", "--key")
+				& clipp::value("APIKEY") >> key_)
+				% "API key",
+
+			(clipp::option("-t", "--team")
+				& clipp::value("TEAM") >> team_)
+				% "team name",
+
+			(clipp::option("-p", "--project")
+				& clipp::value("PROJECT") >> project_)
+				% "project name",
+
+			(clipp::option("-u", "--url")
+				& clipp::value("URL") >> url_)
+				% "project URL",
+
+			(clipp::option("-m", "--minimum")
+				& clipp::value("PERCENT").set(min_))
+				% "minimum translation threshold to download [0-100]",
+
+			(clipp::option("-f", "--force").call([&]{ force_ = true; }))
+				% "don't check timestamps, re-download all translation files",
+
+			(clipp::value("path") >> path_)
+				% "path that will contain the .tx directory"
+		)
+
+		|
+
+		"build" %
+		(clipp::command("build").set(mode_, modes::build),
+
+			(clipp::value("source") >> path_)
+				% "path that contains the translation directories",
+
+			(clipp::value("destination") >> dest_)
+				% "path that will contain the .qm files"
+		)
+	);
+}
+
+void tx_command::convert_cl_to_conf()
+{
+	command::convert_cl_to_conf();
+
+	if (!key_.empty())
+		common.options.push_back("transifex/key=" + key_);
+
+	if (!team_.empty())
+		common.options.push_back("transifex/team=" + team_);
+
+	if (!project_.empty())
+		common.options.push_back("transifex/project=" + project_);
+
+	if (!url_.empty())
+		common.options.push_back("transifex/url=" + url_);
+
+	if (min_ >= 0)
+		common.options.push_back("transifex/minimum=" + std::to_string(min_));
+
+	if (force_)
+		common.options.push_back("transifex/force=" + std::to_string(*force_));
+}
+
+int tx_command::do_run()
+{
+	switch (mode_)
+	{
+		case modes::get:
+			do_get();
+			break;
+
+		case modes::build:
+			do_build();
+			break;
+
+		case modes::none:
+		default:
+			u8cerr << "bad tx mode " << static_cast<int>(mode_) << "\n";
+			throw bailed();
+	}
+
+	return 0;
+}
+
+std::string tx_command::do_doc()
+{
+	return
+		"Some values will be taken from the INI file if not specified.\n"
+		"\n"
+		"Commands:\n"
+		"get\n"
+		"  Initializes a Transifex project in the given directory if\n"
+		"  necessary and pulls all the translation files.\n"
+		"\n"
+		"build\n"
+		"  Builds all .qm files. The path can either be the transifex\n"
+		"  project (where .tx is) or the `translations` directory (where the\n"
+		"  individual translation directories are).";
+}
+
+void tx_command::do_get()
+{
+	const url u =
+		conf::get_global("transifex", "url") + "/" +
+		conf::get_global("transifex", "team") + "/" +
+		conf::get_global("transifex", "project");
+
+	const std::string key = conf::get_global("transifex", "key");
+
+	if (key.empty() && !this_env::get_opt("TX_TOKEN"))
+	{
+		u8cout <<
+			"(no key was in the INI, --key wasn't given and TX_TOKEN env\n"
+			"variable doesn't exist, this will probably fail)\n\n";
+	}
+
+	context cxcopy = gcx();
+
+	u8cout << "initializing\n";
+	transifex(transifex::init)
+		.root(path_)
+		.run(cxcopy);
+
+	u8cout << "configuring\n";
+	transifex(transifex::config)
+		.stdout_level(context::level::info)
+		.root(path_)
+		.api_key(key)
+		.url(u)
+		.run(cxcopy);
+
+	u8cout << "pulling\n";
+	transifex(transifex::pull)
+		.stdout_level(context::level::info)
+		.root(path_)
+		.api_key(key)
+		.minimum(conf::get_global_int("transifex", "minimum"))
+		.force(conf::get_global_bool("transifex", "force"))
+		.workers(static_cast<std::size_t>(
+			conf::get_global_int("transifex", "workers")))
+		.run(cxcopy);
+}
+
+void tx_command::do_build()
+{
+	fs::path root = path_;
+	if (fs::exists(root / ".tx") && fs::exists(root / "translations"))
+		root = root / "translations";
+
+	translations::projects ps(root);
+
+	fs::path dest = dest_;
+	op::create_directories(gcx(), dest, op::unsafe);
+
+	for (auto&& w : ps.warnings())
+		u8cerr << w << "\n";
+
+	thread_pool tp;
+	std::vector<std::future<void>> futures;
+
+	for (auto& p : ps.get())
+	{
+		for (auto& lg : p.langs)
+		{
+			futures.push_back(tp.add([&, cxcopy=gcx()]() mutable
+			{
+				lrelease()
+					.project(p.name)
+					.sources(lg.ts_files)
+					.out(dest)
+					.run(cxcopy);
+			}));
+		}
+	}
+
+	// rethrows if lrelease bailed out
+	for (auto&& f : futures)
+		f.get();
+}
+
+
+// set by ctrl+c while watching, a build that fails also interrupts all the
+// tasks but shouldn't stop `watch`
+//
+static std::atomic<bool> g_stop_watching = false;
+
+static BOOL WINAPI watch_signal_handler(DWORD) noexcept
+{
+	g_stop_watching = true;
+	task::interrupt_all();
+	return TRUE;
+}
+
+// build trees, git and visual studio change files all the time
+//
+static bool is_ignored_change(const fs::path& rel)
+{
+	for (auto&& part : rel)
+	{
+		const auto s = path_to_utf8(part);
+
+		if (s == ".git" || s == ".vs" || s.starts_with("vsbuild"))
+			return true;
+	}
+
+	return false;
+}
+
+
+watch_command::watch_command()
+	: command(requires_options)
+{
+}
+
+command::meta_t watch_command::meta() const
+{
+	return
+	{
+		"watch",
+		"builds the super repos as they change"
+	};
+}
+
+void watch_command::convert_cl_to_conf()
+{
+	command::convert_cl_to_conf();
+
+	// the repos are being edited, they must not be touched
+	common.options.push_back("global/clean_task=false");
+	common.options.push_back("global/fetch_task=false");
+}
+
+clipp::group watch_command::do_group()
+{
+	return clipp::group(
+		clipp::command("watch").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message"),
+
+		(clipp::option("--debounce")
+			& clipp::value("MS").set(debounce_))
+			% "how long to wait after the last change before building "
+			  "[default: 1000]",
+
+		(
+			clipp::option("--dependents").set(dependents_, true) |
+			clipp::option("--no-dependents").set(dependents_, false)
+		) % "whether the tasks that depend on a changed repo are built too "
+		    "[default: yes]"
+	);
+}
+
+std::string watch_command::do_doc()
+{
+	return
+		"Watches the repos in modorganizer_super. After a change, waits\n"
+		"until nothing has changed for --debounce milliseconds and builds\n"
+		"the tasks of the repos that changed, along with the tasks that\n"
+		"depend on them. The INIs, tools and environments are only loaded\n"
+		"once. The tasks are never cleaned or fetched, and the prefix must\n"
+		"have been built once. Stops on ctrl+c.";
+}
+
+int watch_command::do_run()
+{
+	using namespace std::chrono;
+
+	::SetConsoleCtrlHandler(watch_signal_handler, TRUE);
+
+	const auto root = modorganizer::super_path();
+
+	if (!fs::exists(root))
+	{
+		u8cerr
+			<< path_to_utf8(root) << " doesn't exist, "
+			<< "run `mob build` first\n";
+
+		return 1;
+	}
+
+	directory_watcher w(root);
+
+	u8cout << "watching " << path_to_utf8(root) << ", ctrl+c to stop\n";
+
+	while (!g_stop_watching)
+	{
+		// short enough for ctrl+c to be noticed
+		auto files = w.wait(500ms);
+		if (files.empty())
+			continue;
+
+		// editors and git change several files in a row
+		while (!g_stop_watching)
+		{
+			const auto more = w.wait(milliseconds(debounce_));
+			if (more.empty())
+				break;
+
+			files.insert(files.end(), more.begin(), more.end());
+		}
+
+		if (g_stop_watching)
+			break;
+
+		auto tasks = affected_tasks(files);
+		if (tasks.empty())
+			continue;
+
+		if (dependents_)
+			add_super_dependents(tasks);
+
+		build(tasks);
+	}
+
+	u8cout << "stopped watching\n";
+	return 0;
+}
+
+std::set<task*> watch_command::affected_tasks(
+	const std::vector<fs::path>& files) const
+{
+	const auto root = modorganizer::super_path();
+
+	std::map<fs::path, task*> repos;
+	for (auto* t : find_tasks("super"))
+		repos[t->get_fingerprint_path().filename()] = t;
+
+	std::set<task*> tasks;
+
+	for (auto&& f : files)
+	{
+		// changes were lost, build everything
+		if (f == root)
+		{
+			for (auto&& [_, t] : repos)
+				tasks.insert(t);
+
+			break;
+		}
+
+		const auto rel = f.lexically_relative(root);
+		if (rel.empty() || is_ignored_change(rel))
+			continue;
+
+		auto itor = repos.find(*rel.begin());
+		if (itor == repos.end())
+			continue;
+
+		gcx().debug(context::generic,
+			"{} changed, building {}", f, itor->second->name());
+
+		tasks.insert(itor->second);
+	}
+
+	return tasks;
+}
+
+bool watch_command::build(const std::set<task*>& tasks)
+{
+	using namespace std::chrono;
+
+	std::vector<std::string> names;
+	for (auto* t : tasks)
+		names.push_back(t->name());
+
+	std::sort(names.begin(), names.end());
+	u8cout << "building " << join(names, ", ") << "\n";
+
+	// super_build isn't a super task, it has its own enabled()
+	for (auto* t : get_all_tasks())
+	{
+		conf::set_for_task(
+			t->name(), "task", "enabled", tasks.contains(t) ? "true" : "false");
+	}
+
+	task::reset_interrupt();
+
+	const auto start = steady_clock::now();
+	bool ok = true;
+
+	try
+	{
+		run_all_tasks();
+		ok = !task::all_interrupted();
+	}
+	catch(bailed&)
+	{
+		ok = false;
+	}
+
+	const auto s = duration_cast<seconds>(steady_clock::now() - start);
+
+	if (g_stop_watching)
+		u8cout << "interrupted\n";
+	else if (ok)
+		u8cout << "done in " << s.count() << "s, watching\n";
+	else
+		u8cout << "failed after " << s.count() << "s, watching\n";
+
+	return ok;
+}
+
+
+// the store is usually outside the prefix, where op:: refuses to write
+//
+static void write_to_store(const fs::path& p, const std::string& text)
+{
+	std::error_code ec;
+	fs::create_directories(p.parent_path(), ec);
+
+	std::ofstream out(p, std::ios::binary);
+	out.write(text.data(), static_cast<std::streamsize>(text.size()));
+	out.close();
+
+	if (out.bad())
+		gcx().bail_out(context::fs, "can't write to {}", p);
+}
+
+static std::string sha256_of(const fs::path& p)
+{
+	sha256 h;
+	if (!h.update_from_file(p))
+		gcx().bail_out(context::fs, "can't read {}", p);
+
+	return h.finish();
+}
+
+
+snapshot_command::snapshot_command()
+	: command(requires_options)
+{
+}
+
+command::meta_t snapshot_command::meta() const
+{
+	return
+	{
+		"snapshot",
+		"saves or restores the built state of the prefix"
+	};
+}
+
+clipp::group snapshot_command::do_group()
+{
+	return clipp::group(
+		clipp::command("snapshot").set(picked_),
+
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message"),
+
+		(clipp::option("--store")
+			& clipp::value("PATH") >> store_)
+			% "directory where snapshots are kept instead of `snapshot_store`",
+
+		"create" %
+		(clipp::command("create").set(mode_, modes::create),
+			(clipp::value("name") >> name_)
+				% "name of the snapshot"
+		)
+
+		|
+
+		"restore" %
+		(clipp::command("restore").set(mode_, modes::restore),
+			(clipp::value("name") >> name_)
+				% "name of the snapshot"
+		)
+	);
+}
+
+int snapshot_command::do_run()
+{
+	if (store().empty())
+	{
+		u8cerr << "no store, set `snapshot_store` or use --store\n";
+		return 1;
+	}
+
+	switch (mode_)
+	{
+		case modes::create:
+			return do_create();
+
+		case modes::restore:
+			return do_restore();
+
+		case modes::none:
+		default:
+			u8cerr << "bad snapshot mode " << static_cast<int>(mode_) << "\n";
+			throw bailed();
+	}
+}
+
+std::string snapshot_command::do_doc()
+{
+	return
+		"Tasks are only saved if they have a manifest from skip_unchanged.\n"
+		"\n"
+		"Commands:\n"
+		"create\n"
+		"  Archives the source directory of every task into\n"
+		"  `store/objects/`, named after the manifest of the task, so\n"
+		"  identical tasks are only stored once across snapshots. The\n"
+		"  install directory is archived too. Writes `store/name.txt`.\n"
+		"\n"
+		"restore\n"
+		"  Checks the hash of every archive of the snapshot and extracts\n"
+		"  it. The manifest of a task is only kept if its inputs in this\n"
+		"  prefix are the same as when the snapshot was created, so `build`\n"
+		"  skips it; the others are built again over the restored files.";
+}
+
+fs::path snapshot_command::store() const
+{
+	std::string s = store_;
+	if (s.empty())
+		s = conf::get_global("global", "snapshot_store");
+
+	return fs::path(utf8_to_utf16(s));
+}
+
+fs::path snapshot_command::snapshot_file() const
+{
+	return store() / (name_ + ".txt");
+}
+
+int snapshot_command::do_create()
+{
+	std::vector<entry> v;
+
+	// the install directory is made by all the tasks
+	std::string install_key;
+
+	std::map<std::string, fs::path> dirs;
+
+	for (auto* t : get_all_tasks())
+	{
+		if (!t->enabled())
+			continue;
+
+		// super tasks have no source path, this is their repo
+		const auto src = t->get_fingerprint_path();
+		if (src.empty() || !fs::exists(src))
+			continue;
+
+		if (!fs::exists(t->manifest_file()))
+		{
+			u8cout
+				<< "skipping " << t->name() << ", it has no manifest; "
+				<< "skip_unchanged must be enabled for the build\n";
+
+			continue;
+		}
+
+		const auto manifest = op::read_text_file(
+			gcx(), encodings::utf8, t->manifest_file());
+
+		const auto h = hash_string(manifest);
+
+		v.push_back({t->name(), t->name() + "-" + h + ".7z", "", h});
+		dirs[t->name()] = src;
+		install_key += t->name() + " " + h + "\n";
+	}
+
+	if (v.empty())
+	{
+		u8cerr << "no task has a manifest, nothing to snapshot\n";
+		return 1;
+	}
+
+	if (fs::exists(paths::install()))
+		v.push_back({"", "install-" + hash_string(install_key) + ".7z"});
+
+	auto& js = job_slots::instance();
+	const std::size_t share = std::max<std::size_t>(1, js.total() / v.size());
+
+	// archives are created in the temp directory, which is on the same
+	// disk, and then copied to the store
+	parallel_for(v.size(), v.size(), [&](std::size_t i)
+	{
+		auto lease = js.lease(share);
+
+		const fs::path dir = (v[i].task.empty() ?
+			paths::install() : dirs.at(v[i].task));
+
+		store_object(dir, v[i], lease.count());
+	});
+
+	if (conf::dry())
+		return 0;
+
+	write_snapshot(v);
+
+	u8cout
+		<< "snapshot " << name_ << " with " << v.size() << " archives "
+		<< "written to " << path_to_utf8(snapshot_file()) << "\n";
+
+	return 0;
+}
+
+int snapshot_command::do_restore()
+{
+	const auto v = read_snapshot();
+
+	std::map<std::string, task*> tasks;
+	for (auto* t : get_all_tasks())
+		tasks[t->name()] = t;
+
+	std::map<std::string, entry> entries;
+
+	for (auto&& e : v)
+	{
+		if (e.task.empty())
+			continue;
+
+		if (!tasks.contains(e.task))
+		{
+			gcx().warning(context::generic,
+				"task {} in snapshot doesn't exist, ignoring", e.task);
+
+			continue;
+		}
+
+		entries[e.task] = e;
+	}
+
+	auto& js = job_slots::instance();
+	const std::size_t share = std::max<std::size_t>(1, js.total() / v.size());
+
+	parallel_for(v.size(), v.size(), [&](std::size_t i)
+	{
+		const auto& e = v[i];
+
+		if (!e.task.empty() && !entries.contains(e.task))
+			return;
+
+		auto lease = js.lease(share);
+
+		const fs::path dir = (e.task.empty() ?
+			paths::install() : tasks.at(e.task)->get_fingerprint_path());
+
+		restore_object(e, dir, lease.count());
+	});
+
+	if (conf::dry())
+		return 0;
+
+	// manifests include the ones of the dependencies, so they're checked
+	// in order
+	std::map<std::string, bool> done;
+	std::size_t adopted = 0;
+
+	for (auto&& [name, e] : entries)
+	{
+		if (adopt_manifest(*tasks[name], entries, done))
+			++adopted;
+	}
+
+	u8cout
+		<< "restored " << v.size() << " archives, " << adopted << " of "
+		<< entries.size() << " tasks are up to date\n";
+
+	return 0;
+}
+
+void snapshot_command::store_object(
+	const fs::path& dir, entry& e, std::size_t threads)
+{
+	const fs::path dest = store() / "objects" / e.object;
+	fs::path hash_file = dest;
+	hash_file += ".sha256";
+
+	if (fs::exists(dest) && fs::exists(hash_file))
+	{
+		e.sha256 = trim_copy(op::read_text_file(
+			gcx(), encodings::utf8, hash_file));
+
+		u8cout << "reusing " << e.object << "\n";
+		return;
+	}
+
+	u8cout << "archiving " << path_to_utf8(dir) << "\n";
+
+	const fs::path temp = paths::temp_dir() / e.object;
+	op::delete_file(gcx(), temp, op::optional);
+	guard g([&]{ op::delete_file(gcx(), temp, op::optional); });
+
+	op::archive_from_glob(gcx(), dir / "*", temp, {}, threads);
+
+	if (conf::dry())
+		return;
+
+	e.sha256 = sha256_of(temp);
+
+	// copied under a temporary name first so that other machines never pick
+	// up a partial file; the hash is written last, an object without one is
+	// archived again
+	fs::path part = dest;
+	part += ".part";
+
+	std::error_code ec;
+	fs::create_directories(dest.parent_path(), ec);
+
+	if (!ec)
+		fs::copy_file(temp, part, fs::copy_options::overwrite_existing, ec);
+
+	if (!ec)
+		fs::rename(part, dest, ec);
+
+	if (ec)
+		gcx().bail_out(context::fs, "failed to store {}, {}", dest, ec.message());
+
+	write_to_store(hash_file, e.sha256 + "\n");
+}
+
+void snapshot_command::restore_object(
+	const entry& e, const fs::path& dir, std::size_t threads)
+{
+	const fs::path src = store() / "objects" / e.object;
+	const fs::path file = paths::cache() / "snapshots" / e.object;
+
+	if (!fs::exists(src))
+		gcx().bail_out(context::generic, "{} is missing from the store", src);
+
+	u8cout << "restoring " << e.object << "\n";
+
+	op::create_directories(gcx(), file.parent_path());
+
+	// source file is outside prefix
+	op::copy_file_to_file_if_better(gcx(), src, file, op::unsafe);
+
+	if (conf::dry())
+		return;
+
+	const auto hash = sha256_of(file);
+
+	if (hash != e.sha256)
+	{
+		op::delete_file(gcx(), file, op::optional);
+
+		gcx().bail_out(context::generic,
+			"sha256 mismatch for {}, expected {}, got {}",
+			e.object, e.sha256, hash);
+	}
+
+	// tasks are extracted next to their directory and swapped, the install
+	// directory is shared and extracted in place
+	fs::path out = dir;
+
+	if (!e.task.empty())
+	{
+		out += ".snapshot";
+		op::delete_directory(gcx(), out, op::optional);
+	}
+
+	auto p = process()
+		.binary(extractor::binary())
+		.arg("x")
+		.arg("-aoa")
+		.arg("-bd")
+		.arg("-bb0")
+		.arg("-mmt=", std::to_string(threads), process::nospace)
+		.arg("-o", out, process::nospace)
+		.arg(file);
+
+	p.run();
+	p.join();
+
+	if (!e.task.empty())
+	{
+		op::delete_directory(gcx(), dir, op::optional);
+		op::rename(gcx(), out, dir);
+	}
+
+	op::delete_file(gcx(), file, op::optional);
+}
+
+bool snapshot_command::adopt_manifest(
+	task& t, const std::map<std::string, entry>& entries,
+	std::map<std::string, bool>& done)
+{
+	auto itor = done.find(t.name());
+	if (itor != done.end())
+		return itor->second;
+
+	done[t.name()] = false;
+
+	for (auto* d : t.dependencies())
+	{
+		if (entries.contains(d->name()))
+			adopt_manifest(*d, entries, done);
+	}
+
+	const auto& e = entries.at(t.name());
+	const auto manifest = t.make_manifest();
+
+	if (!manifest || hash_string(*manifest) != e.manifest_hash)
+	{
+		u8cout
+			<< "inputs of " << t.name() << " are not the same as in the "
+			<< "snapshot, it will be built\n";
+
+		op::delete_file(gcx(), t.manifest_file(), op::optional);
+		return false;
+	}
+
+	op::create_directories(gcx(), t.manifest_file().parent_path());
+
+	op::write_text_file(
+		gcx(), encodings::utf8, t.manifest_file(), *manifest);
+
+	done[t.name()] = true;
+	return true;
+}
+
+std::vector<snapshot_command::entry> snapshot_command::read_snapshot() const
+{
+	const auto file = snapshot_file();
+
+	if (!fs::exists(file))
+		gcx().bail_out(context::generic, "snapshot {} not found", file);
+
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
 
-			(clipp::option("-p", "--push-origin").set(push_default_)
-				% "sets this new remote as the default push target"),
+	std::vector<entry> v;
 
-			(clipp::opt_value("path") >> path_)
-				% "only use this repo"
-		)
+	for_each_line(text, [&](auto&& line)
+	{
+		const auto cs = split(std::string(line), " ");
 
-		|
+		// task name object sha256 manifest_hash
+		if (cs.size() == 5 && cs[0] == "task")
+			v.push_back({cs[1], cs[2], cs[3], cs[4]});
 
-		"ignore-ts" %
-		(clipp::command("ignore-ts").set(mode_, modes::ignore_ts),
-			(
-				clipp::command("on").set(tson_, true) |
-				clipp::command("off").set(tson_, false)
-			)
-		)
-	);
+		// install object sha256
+		else if (cs.size() == 3 && cs[0] == "install")
+			v.push_back({"", cs[1], cs[2]});
+
+		else
+			gcx().bail_out(context::generic, "bad line in {}: {}", file, line);
+	});
+
+	return v;
 }
 
-int git_command::do_run()
+void snapshot_command::write_snapshot(const std::vector<entry>& v) const
 {
-	switch (mode_)
+	std::string text;
+
+	for (auto&& e : v)
 	{
-		case modes::set_remotes:
+		if (e.task.empty())
 		{
-			do_set_remotes();
-			break;
+			text += fmt::format("install {} {}\n", e.object, e.sha256);
 		}
-
-		case modes::add_remote:
+		else
 		{
-			do_add_remote();
-			break;
+			text += fmt::format(
+				"task {} {} {} {}\n",
+				e.task, e.object, e.sha256, e.manifest_hash);
 		}
+	}
 
-		case modes::ignore_ts:
-		{
-			do_ignore_ts();
-			break;
-		}
+	write_to_store(snapshot_file(), text);
+}
 
-		case modes::none:
-		default:
-			u8cerr << "bad git mode " << static_cast<int>(mode_) << "\n";
-			throw bailed();
-	}
 
-	return 0;
+replay_command::replay_command()
+	: command(requires_options)
+{
 }
 
-std::string git_command::do_doc()
+command::meta_t replay_command::meta() const
 {
 	return
-		"All the commands will go through all modorganizer repos, plus usvfs\n"
-		"and NCC.\n"
-		"\n"
-		"Commands:\n"
-		"set-remotes\n"
-		"  For each repo, this first sets the username and email. Then, it\n"
-		"  will rename the remote 'origin' to 'upstream' and create a new\n"
-		"  remote 'origin' with the given information. If the remote\n"
-		"  'upstream' already exists in a repo, nothing happens.\n"
-		"\n"
-		"add-remote\n"
-		"  For each repo, adds a new remote with the given information. If a\n"
-		"  remote with the same name already exists, nothing happens.\n"
-		"\n"
-		"ignore-ts\n"
-		"  Toggles the --assume-changed status of all .ts files in all repos.";
+	{
+		"replay",
+		"simulates the last build with different settings"
+	};
 }
 
-void git_command::do_set_remotes()
+clipp::group replay_command::do_group()
 {
-	if (path_.empty())
-	{
-		const auto repos = get_repos();
+	return clipp::group(
+		clipp::command("replay").set(picked_),
 
-		for (auto&& r : repos)
-			do_set_remotes(r);
-	}
-	else
-	{
-		do_set_remotes(path_);
-	}
+		(clipp::option("-h", "--help") >> help_)
+			% ("shows this message"),
+
+		(clipp::option("-i", "--input")
+			& clipp::value("FILE") >> input_)
+			% "replay file written by `build` [default: prefix/replay.txt]",
+
+		(clipp::option("--jobs")
+			& clipp::value("N").set(jobs_))
+			% "size of the job budget [default: same as the build]",
+
+		(clipp::option("--fetch-jobs")
+			& clipp::value("N").set(fetch_jobs_))
+			% "number of tasks fetching at once, 0 for unlimited "
+			  "[default: same as the build]",
+
+		(clipp::option("--policy")
+			& clipp::value("POLICY") >> policy_)
+			% "which ready task is built first: fifo, critical-path or "
+			  "longest [default: fifo]",
+
+		(clipp::repeatable(clipp::option("--cached")
+			& clipp::value("GLOB", cached_)))
+			% "tasks that are skipped or restored from the cache, their "
+			  "build takes no time; can be given multiple times"
+	);
 }
 
-void git_command::do_set_remotes(const fs::path& r)
+std::string replay_command::do_doc()
 {
-	u8cout << "setting up " << path_to_utf8(r.filename()) << "\n";
-	git::set_credentials(r, username_, email_);
-	git::set_remote(r, username_, key_, nopush_, push_default_);
+	return
+		"Reads replay.txt, written by the last `mob build`, and simulates\n"
+		"the build in a few milliseconds instead of running it. All tasks\n"
+		"start fetching at once, up to --fetch-jobs, and are built once\n"
+		"fetched and their dependencies are built. A build uses as many job\n"
+		"slots as processes it had running on average, or fewer if not\n"
+		"enough are free, in which case it's slower by the same ratio.\n"
+		"\n"
+		"This is a model: the phases of a task are merged into a fetch and a\n"
+		"build, and what the tools do inside them isn't simulated. It's for\n"
+		"comparing settings with each other rather than predicting the\n"
+		"exact time of a build.";
 }
 
-void git_command::do_add_remote()
+int replay_command::do_run()
 {
-	u8cout
-		<< "adding remote '" << remote_ << "' "
-		<< "from '" << username_ << "' to repos\n";
+	const fs::path in = input_.empty() ?
+		build_command::replay_file() : fs::path(utf8_to_utf16(input_));
 
-	if (path_.empty())
+	if (!fs::exists(in))
 	{
-		const auto repos = get_repos();
-
-		for (auto&& r : repos)
-			do_add_remote(r);
+		u8cerr << path_to_utf8(in) << " not found, run `mob build` first\n";
+		return 1;
 	}
+
+	policies p = policies::fifo;
+
+	if (policy_ == "fifo")
+		p = policies::fifo;
+	else if (policy_ == "critical-path")
+		p = policies::critical_path;
+	else if (policy_ == "longest")
+		p = policies::longest;
 	else
 	{
-		do_add_remote(path_);
+		u8cerr << "bad policy '" << policy_ << "'\n";
+		return 1;
 	}
-}
 
-void git_command::do_add_remote(const fs::path& r)
-{
-	u8cout << path_to_utf8(r.filename()) << "\n";
-	git::add_remote(r, remote_, username_, key_, push_default_);
+	auto v = read(in);
+
+	if (v.empty())
+	{
+		u8cerr << "no tasks in " << path_to_utf8(in) << "\n";
+		return 1;
+	}
+
+	const std::size_t jobs = (jobs_ > 0 ?
+		static_cast<std::size_t>(jobs_) : recorded_jobs_);
+
+	const std::size_t fetch_jobs = (fetch_jobs_ >= 0 ?
+		static_cast<std::size_t>(fetch_jobs_) : recorded_fetch_jobs_);
+
+	rank(v);
+
+	const double total = simulate(v, jobs, fetch_jobs, p);
+
+	print(v, total, jobs);
+
+	u8cout
+		<< "\n"
+		<< fmt::format(
+			"simulated {:.1f}s with {} jobs, {} fetch jobs, {} policy; "
+			"the recorded build took {:.1f}s with {} jobs\n",
+			total, jobs,
+			(fetch_jobs == 0 ? "unlimited" : std::to_string(fetch_jobs)),
+			policy_, recorded_total_, recorded_jobs_);
+
+	return 0;
 }
 
-void git_command::do_ignore_ts()
+std::vector<replay_command::sim_task> replay_command::read(
+	const fs::path& file)
 {
-	if (tson_)
-		u8cout << "ignoring .ts files\n";
-	else
-		u8cout << "un-ignoring .ts files\n";
+	std::vector<sim_task> v;
+	std::vector<std::vector<std::string>> dep_names;
 
-	if (path_.empty())
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	for_each_line(text, [&](auto&& line)
 	{
-		const auto repos = get_repos();
+		const auto cs = split(std::string(line), "\t");
 
-		for (auto&& r : repos)
-			do_ignore_ts(r);
-	}
-	else
+		try
+		{
+			if (cs.size() == 4 && cs[0] == "build")
+			{
+				recorded_total_ = std::stod(cs[1]);
+				recorded_jobs_ = std::stoul(cs[2]);
+				recorded_fetch_jobs_ = std::stoul(cs[3]);
+			}
+			else if (cs.size() == 6 && cs[0] == "task")
+			{
+				sim_task t;
+
+				t.name = cs[1];
+				t.fetch = std::stod(cs[3]);
+				t.build = std::stod(cs[4]);
+				t.cpu = std::stod(cs[5]);
+
+				// the average number of processes running during the build
+				if (t.build > 0)
+				{
+					t.width = static_cast<std::size_t>(
+						std::max(1.0, std::round(t.cpu / t.build)));
+				}
+
+				for (auto&& g : cached_)
+				{
+					if (glob_match(g, t.name))
+						t.build = 0;
+				}
+
+				dep_names.push_back(
+					cs[2] == "-" ? std::vector<std::string>() : split(cs[2], ","));
+
+				v.push_back(std::move(t));
+			}
+			else
+			{
+				gcx().warning(context::generic, "bad replay line '{}'", line);
+			}
+		}
+		catch(std::exception&)
+		{
+			gcx().warning(context::generic, "bad replay line '{}'", line);
+		}
+	});
+
+	// dependencies that weren't built aren't in the file, they're done
+	// before the simulation starts
+	for (std::size_t i=0; i<v.size(); ++i)
 	{
-		do_ignore_ts(path_);
+		for (auto&& name : dep_names[i])
+		{
+			for (std::size_t j=0; j<v.size(); ++j)
+			{
+				if (v[j].name == name)
+					v[i].deps.push_back(j);
+			}
+		}
 	}
+
+	if (recorded_jobs_ == 0)
+		recorded_jobs_ = std::max(1u, std::thread::hardware_concurrency());
+
+	return v;
 }
 
-void git_command::do_ignore_ts(const fs::path& r)
+void replay_command::rank(std::vector<sim_task>& v) const
 {
-	u8cout << path_to_utf8(r.filename()) << "\n";
-	git::ignore_ts(r, tson_);
+	std::vector<std::vector<std::size_t>> dependents(v.size());
+
+	for (std::size_t i=0; i<v.size(); ++i)
+	{
+		for (auto d : v[i].deps)
+			dependents[d].push_back(i);
+	}
+
+	std::vector<bool> done(v.size(), false);
+
+	std::function<double (std::size_t)> rank_of = [&](std::size_t i)
+	{
+		if (done[i])
+			return v[i].rank;
+
+		double r = 0;
+		for (auto d : dependents[i])
+			r = std::max(r, rank_of(d));
+
+		v[i].rank = v[i].build + r;
+		done[i] = true;
+
+		return v[i].rank;
+	};
+
+	for (std::size_t i=0; i<v.size(); ++i)
+		rank_of(i);
 }
 
-std::vector<fs::path> git_command::get_repos() const
+double replay_command::simulate(
+	std::vector<sim_task>& v, std::size_t jobs, std::size_t fetch_jobs,
+	policies p) const
 {
-	std::vector<fs::path> v;
+	if (fetch_jobs == 0)
+		fetch_jobs = v.size();
 
-	if (fs::exists(usvfs::source_path()))
-		v.push_back(usvfs::source_path());
+	double now = 0;
+	std::size_t free_jobs = jobs;
+	std::size_t fetching = 0;
+	std::size_t next_fetch = 0;
+	std::size_t built = 0;
 
-	if (fs::exists(ncc::source_path()))
-		v.push_back(ncc::source_path());
+	// fetch_end and build_end are also set for what hasn't finished yet, a
+	// task is done once now reaches them
+	std::vector<std::size_t> running_fetches, running_builds;
 
+	auto is_built = [&](std::size_t i)
+	{
+		return (v[i].build_end >= 0 && v[i].build_end <= now);
+	};
 
-	const auto super = modorganizer::super_path();
+	auto count_built = [&]
+	{
+		std::size_t n = 0;
 
-	if (fs::exists(super))
+		for (std::size_t i=0; i<v.size(); ++i)
+		{
+			if (is_built(i))
+				++n;
+		}
+
+		return n;
+	};
+
+	while (built < v.size())
 	{
-		for (auto e : fs::directory_iterator(super))
+		// fetches start in the order of the file as slots are free
+		while (next_fetch < v.size() && fetching < fetch_jobs)
 		{
-			if (!e.is_directory())
+			v[next_fetch].fetch_end = now + v[next_fetch].fetch;
+			running_fetches.push_back(next_fetch);
+			++fetching;
+			++next_fetch;
+		}
+
+		// tasks that can be built now
+		std::vector<std::size_t> ready;
+
+		for (std::size_t i=0; i<v.size(); ++i)
+		{
+			auto& t = v[i];
+
+			if (t.build_start >= 0 || t.fetch_end < 0 || t.fetch_end > now)
 				continue;
 
-			const auto p = e.path();
-			if (path_to_utf8(p.filename()).starts_with("."))
+			bool deps_built = true;
+			for (auto d : t.deps)
+			{
+				if (!is_built(d))
+				{
+					deps_built = false;
+					break;
+				}
+			}
+
+			if (!deps_built)
 				continue;
 
-			v.push_back(p);
+			if (t.ready < 0)
+				t.ready = now;
+
+			ready.push_back(i);
 		}
-	}
 
-	return v;
-}
+		std::stable_sort(ready.begin(), ready.end(), [&](auto a, auto b)
+		{
+			switch (p)
+			{
+				case policies::critical_path:
+					return (v[a].rank > v[b].rank);
 
+				case policies::longest:
+					return (v[a].build > v[b].build);
 
-cmake_command::cmake_command()
-	: command(requires_options)
-{
-}
+				case policies::fifo:
+				default:
+					return (v[a].ready < v[b].ready);
+			}
+		});
 
-command::meta_t cmake_command::meta() const
-{
-	return
-	{
-		"cmake",
-		"runs cmake in a directory"
-	};
-}
+		for (auto i : ready)
+		{
+			auto& t = v[i];
 
-clipp::group cmake_command::do_group()
-{
-	return clipp::group(
-		clipp::command("cmake").set(picked_),
+			// cached builds don't need slots
+			if (t.build == 0)
+			{
+				t.build_start = t.build_end = now;
+				continue;
+			}
 
-		(clipp::option("-h", "--help") >> help_)
-			% "shows this message",
+			if (free_jobs == 0)
+				break;
 
-		(clipp::option("-G", "--generator")
-			& clipp::value("GEN") >> gen_)
-			% ("sets the -G option for cmake [default: VS]"),
+			t.slots = std::min(t.width, free_jobs);
+			free_jobs -= t.slots;
 
-		(clipp::option("-c", "--cmd")
-			& clipp::value("CMD") >> cmd_)
-			% "overrides the cmake command line [default: \"..\"]",
+			const double slower =
+				static_cast<double>(t.width) / static_cast<double>(t.slots);
 
-		(
-			clipp::option("--x64").set(x64_, true) |
-			clipp::option("--x86").set(x64_, false)
-		)
-			% "whether to use the x64 or x86 vcvars; if -G is not set, "
-			  "whether to pass \"-A Win32\" or \"-A x64\" for the default "
-			  "VS generator [default: x64]",
+			t.build_start = now;
+			t.build_end = now + t.build * slower;
+			running_builds.push_back(i);
+		}
 
-		(clipp::option("--install-prefix")
-			& clipp::value("PATH") >> prefix_)
-			% "sets CMAKE_INSTALL_PREFIX [default: empty]",
+		// next thing to finish
+		std::optional<double> next;
 
-		(clipp::value("PATH") >> path_)
-			% "path from which to run `cmake`"
-	);
+		for (auto i : running_fetches)
+			next = std::min(next.value_or(v[i].fetch_end), v[i].fetch_end);
+
+		for (auto i : running_builds)
+			next = std::min(next.value_or(v[i].build_end), v[i].build_end);
+
+		// cached builds finish immediately, which can make more tasks ready
+		const std::size_t before = built;
+		built = count_built();
+
+		if (!next)
+		{
+			if (built == before && built < v.size())
+			{
+				gcx().bail_out(context::generic,
+					"replay is stuck, there's a dependency cycle");
+			}
+
+			continue;
+		}
+
+		now = *next;
+
+		std::erase_if(running_fetches, [&](auto i)
+		{
+			if (v[i].fetch_end > now)
+				return false;
+
+			--fetching;
+			return true;
+		});
+
+		std::erase_if(running_builds, [&](auto i)
+		{
+			if (v[i].build_end > now)
+				return false;
+
+			free_jobs += v[i].slots;
+			return true;
+		});
+
+		built = count_built();
+	}
+
+	return now;
 }
 
-int cmake_command::do_run()
-{
-	auto t = modorganizer::create_cmake_tool(fs::path(utf8_to_utf16(path_)));
+void replay_command::print(
+	const std::vector<sim_task>& v, double total, std::size_t jobs) const
+{
+	std::vector<const sim_task*> sorted;
+	for (auto&& t : v)
+		sorted.push_back(&t);
+
+	std::sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) {
+		return (a->build_start < b->build_start);
+	});
+
+	u8cout << fmt::format(
+		"{:<30} {:>9} {:>9} {:>9} {:>9} {:>6}\n",
+		"task", "fetched", "ready", "start", "end", "jobs");
 
-	t.generator(gen_);
-	t.cmd(cmd_);
-	t.prefix(prefix_);
-	t.output(path_);
+	double used = 0;
 
-	if (!x64_)
-		t.architecture(arch::x86);
+	for (auto* t : sorted)
+	{
+		u8cout << fmt::format(
+			"{:<30} {:>8.1f}s {:>8.1f}s {:>8.1f}s {:>8.1f}s {:>3}/{:<2}\n",
+			t->name, t->fetch_end, t->ready, t->build_start, t->build_end,
+			t->slots, t->width);
 
-	context cxcopy(gcx());
-	t.run(cxcopy);
+		used += static_cast<double>(t->slots) * (t->build_end - t->build_start);
+	}
 
-	return 0;
+	if (total > 0 && jobs > 0)
+	{
+		u8cout << fmt::format(
+			"\njob slots were {:.0f}% used\n",
+			(used * 100.0) / (total * static_cast<double>(jobs)));
+	}
 }
 
-std::string cmake_command::do_doc()
+
+// written by the benchmarks so the compiler can't drop what they compute
+//
+static volatile std::size_t g_bench_sink = 0;
+
+
+bench_command::bench_command()
+	: command(requires_options)
 {
-	return
-		"Runs `cmake ..` in the given directory with the same command line\n"
-		"as the one used for modorganizer projects.";
 }
 
-
-command::meta_t inis_command::meta() const
+command::meta_t bench_command::meta() const
 {
 	return
 	{
-		"inis",
-		"lists the INIs used by mob"
+		"bench",
+		"times some of mob's internals"
 	};
 }
 
-clipp::group inis_command::do_group()
+clipp::group bench_command::do_group()
 {
 	return clipp::group(
-		clipp::command("inis").set(picked_),
+		clipp::command("bench").set(picked_),
 
 		(clipp::option("-h", "--help") >> help_)
-			% ("shows this message")
+			% ("shows this message"),
+
+		(clipp::option("-o", "--output")
+			& clipp::value("FILE") >> output_)
+			% "json file to write [default: prefix/bench.json]",
+
+		(clipp::option("--filter")
+			& clipp::value("GLOB") >> filter_)
+			% "only runs the benchmarks matching the glob, such as 'env/*'",
+
+		(clipp::option("--min-time")
+			& clipp::value("MS").set(min_time_))
+			% "how long each benchmark runs, in milliseconds [default: 500]"
 	);
 }
 
-int inis_command::do_run()
+std::string bench_command::do_doc()
 {
-	return prepare_options(true);
+	return
+		"Times the splitting of process output into lines, task lookups,\n"
+		"config lookups, logging, environment blocks and the checks done\n"
+		"before copying files. Each benchmark runs for at least --min-time\n"
+		"and the time per iteration is written to a json file in the format\n"
+		"of Google Benchmark, which its compare.py can diff between two\n"
+		"runs.\n"
+		"\n"
+		"Whether the logging benchmarks write anything depends on the log\n"
+		"levels, run with the same levels as the builds to measure.";
 }
 
-std::string inis_command::do_doc()
+int bench_command::do_run()
 {
-	return "Shows which INIs are found.";
-}
+	const fs::path out = output_.empty() ?
+		paths::prefix() / "bench.json" : fs::path(utf8_to_utf16(output_));
 
+	bench_buffers();
+	bench_tasks();
+	bench_logging();
+	bench_env();
+	bench_fs();
 
-tx_command::tx_command()
-	: command(requires_options)
-{
-}
+	flush_logs();
 
-command::meta_t tx_command::meta() const
-{
-	return
+	if (results_.empty())
 	{
-		"tx",
-		"manages transifex translations"
-	};
-}
+		u8cerr << "no benchmark matches '" << filter_ << "'\n";
+		return 1;
+	}
 
-clipp::group tx_command::do_group()
-{
-	return clipp::group(
-		clipp::command("tx").set(picked_),
+	for (auto&& r : results_)
+	{
+		u8cout << fmt::format(
+			"{:<40} {:>14.1f} ns {:>12}", r.name, r.ns, r.iterations);
 
-		(clipp::option("-h", "--help") >> help_)
-			% ("shows this message"),
+		if (r.bytes > 0)
+		{
+			const double mbs =
+				(static_cast<double>(r.bytes) / (1024.0 * 1024.0)) /
+				(r.ns / 1'000'000'000.0);
 
-		"get" %
-		(clipp::command("get").set(mode_, modes::get),
-			(clipp::option("-k", "--key")
-				& clipp::value("APIKEY") >> key_)
-				% "API key",
+			u8cout << fmt::format(" {:>10.1f} MB/s", mbs);
+		}
 
-			(clipp::option("-t", "--team")
-				& clipp::value("TEAM") >> team_)
-				% "team name",
+		u8cout << "\n";
+	}
 
-			(clipp::option("-p", "--project")
-				& clipp::value("PROJECT") >> project_)
-				% "project name",
+	write_json(out);
+	u8cout << "wrote " << path_to_utf8(out) << "\n";
 
-			(clipp::option("-u", "--url")
-				& clipp::value("URL") >> url_)
-				% "project URL",
+	return 0;
+}
 
-			(clipp::option("-m", "--minimum")
-				& clipp::value("PERCENT").set(min_))
-				% "minimum translation threshold to download [0-100]",
+void bench_command::run(
+	const std::string& name, std::size_t bytes,
+	const std::function<void ()>& f)
+{
+	using namespace std::chrono;
 
-			(clipp::option("-f", "--force").call([&]{ force_ = true; }))
-				% "don't check timestamps, re-download all translation files",
+	if (!filter_.empty() && !glob_match(filter_, name))
+		return;
 
-			(clipp::value("path") >> path_)
-				% "path that will contain the .tx directory"
-		)
+	gcx().debug(context::generic, "bench: {}", name);
 
-		|
+	// warm up, this also fills the caches the benchmarks are supposed to hit
+	f();
 
-		"build" %
-		(clipp::command("build").set(mode_, modes::build),
+	const auto min = milliseconds(min_time_);
+	std::size_t batch = 1;
+	std::size_t total = 0;
+	nanoseconds elapsed(0);
 
-			(clipp::value("source") >> path_)
-				% "path that contains the translation directories",
+	// batches get bigger so the clock isn't read for every iteration of the
+	// fast ones
+	while (elapsed < min)
+	{
+		const auto start = steady_clock::now();
 
-			(clipp::value("destination") >> dest_)
-				% "path that will contain the .qm files"
-		)
-	);
+		for (std::size_t i=0; i<batch; ++i)
+			f();
+
+		elapsed += duration_cast<nanoseconds>(steady_clock::now() - start);
+		total += batch;
+
+		if (batch < 1'000'000)
+			batch *= 2;
+	}
+
+	results_.push_back({
+		name, total,
+		static_cast<double>(elapsed.count()) / static_cast<double>(total),
+		bytes});
 }
 
-void tx_command::convert_cl_to_conf()
+void bench_command::bench_buffers()
 {
-	command::convert_cl_to_conf();
+	// looks like the output of cmake builds
+	std::string utf8;
 
-	if (!key_.empty())
-		common.options.push_back("transifex/key=" + key_);
+	for (int i=0; i<10'000; ++i)
+	{
+		utf8 += fmt::format(
+			"[{:3}%] Building CXX object "
+			"src/CMakeFiles/uibase.dir/file{}.cpp.obj\r\n", i % 100, i);
+	}
 
-	if (!team_.empty())
-		common.options.push_back("transifex/team=" + team_);
+	const std::wstring w = utf8_to_utf16(utf8);
 
-	if (!project_.empty())
-		common.options.push_back("transifex/project=" + project_);
+	const std::string utf16(
+		reinterpret_cast<const char*>(w.data()), w.size() * sizeof(wchar_t));
 
-	if (!url_.empty())
-		common.options.push_back("transifex/url=" + url_);
+	auto lines = [](encodings e, const std::string& bytes)
+	{
+		std::size_t n = 0;
+		encoded_buffer b(e);
 
-	if (min_ >= 0)
-		common.options.push_back("transifex/minimum=" + std::to_string(min_));
+		// in chunks, like reading from a pipe
+		for (std::size_t i=0; i<bytes.size(); i+=4096)
+		{
+			b.add(std::string_view(bytes).substr(i, 4096));
+			b.next_utf8_lines(false, [&](std::string_view s){ n += s.size(); });
+		}
 
-	if (force_)
-		common.options.push_back("transifex/force=" + std::to_string(*force_));
+		b.next_utf8_lines(true, [&](std::string_view s){ n += s.size(); });
+		g_bench_sink = n;
+	};
+
+	run("encoded_buffer/utf8", utf8.size(), [&]
+	{
+		lines(encodings::utf8, utf8);
+	});
+
+	run("encoded_buffer/utf16", utf16.size(), [&]
+	{
+		lines(encodings::utf16, utf16);
+	});
+
+	run("encoded_buffer/acp", utf8.size(), [&]
+	{
+		lines(encodings::acp, utf8);
+	});
+
+	run("encoded_buffer/oem", utf8.size(), [&]
+	{
+		lines(encodings::oem, utf8);
+	});
 }
 
-int tx_command::do_run()
+void bench_command::bench_tasks()
 {
-	switch (mode_)
+	std::vector<std::string> names;
+	for (auto* t : get_all_tasks())
+		names.push_back(t->name());
+
+	run("glob_match/all_tasks", 0, [&]
 	{
-		case modes::get:
-			do_get();
-			break;
+		std::size_t n = 0;
 
-		case modes::build:
-			do_build();
-			break;
+		for (auto&& name : names)
+		{
+			if (glob_match("installer_*", name))
+				++n;
+		}
 
-		case modes::none:
-		default:
-			u8cerr << "bad tx mode " << static_cast<int>(mode_) << "\n";
-			throw bailed();
-	}
+		g_bench_sink = n;
+	});
 
-	return 0;
+	run("find_tasks/super", 0, [&]
+	{
+		g_bench_sink = find_tasks("super").size();
+	});
+
+	run("find_tasks/glob", 0, [&]
+	{
+		g_bench_sink = find_tasks("installer_*").size();
+	});
+
+	run("find_tasks/name", 0, [&]
+	{
+		g_bench_sink = find_tasks("modorganizer-uibase").size();
+	});
+
+	const std::vector<std::string> task_names =
+		{"modorganizer-uibase", "uibase", "super"};
+
+	run("conf/get_for_task", 0, [&]
+	{
+		g_bench_sink = conf::get_for_task(
+			task_names, "task", "git_url_prefix").size();
+	});
 }
 
-std::string tx_command::do_doc()
+void bench_command::bench_logging()
 {
-	return
-		"Some values will be taken from the INI file if not specified.\n"
-		"\n"
-		"Commands:\n"
-		"get\n"
-		"  Initializes a Transifex project in the given directory if\n"
-		"  necessary and pulls all the translation files.\n"
-		"\n"
-		"build\n"
-		"  Builds all .qm files. The path can either be the transifex\n"
-		"  project (where .tx is) or the `translations` directory (where the\n"
-		"  individual translation directories are).";
+	const fs::path p = paths::build() / "modorganizer_super" / "uibase";
+	int i = 0;
+
+	run("context/trace", 0, [&]
+	{
+		gcx().trace(context::generic, "bench {} {}", ++i, p);
+	});
+
+	run("context/debug", 0, [&]
+	{
+		gcx().debug(context::generic, "bench {} {}", ++i, p);
+	});
 }
 
-void tx_command::do_get()
+void bench_command::bench_env()
 {
-	const url u =
-		conf::get_global("transifex", "url") + "/" +
-		conf::get_global("transifex", "team") + "/" +
-		conf::get_global("transifex", "project");
+	// a derived environment, like every tool that sets a variable
+	env e = this_env::get();
+	e.set("MOB_BENCH", "1");
 
-	const std::string key = conf::get_global("transifex", "key");
-
-	if (key.empty() && !this_env::get_opt("TX_TOKEN"))
+	run("env/get_unicode_pointers", 0, [&]
 	{
-		u8cout <<
-			"(no key was in the INI, --key wasn't given and TX_TOKEN env\n"
-			"variable doesn't exist, this will probably fail)\n\n";
-	}
+		g_bench_sink = (e.get_unicode_pointers() != nullptr);
+	});
+}
 
-	context cxcopy = gcx();
+void bench_command::bench_fs()
+{
+	const fs::path dir = paths::temp_dir() / "mob_bench";
 
-	u8cout << "initializing\n";
-	transifex(transifex::init)
-		.root(path_)
-		.run(cxcopy);
+	guard g([&]
+	{
+		std::error_code ec;
+		fs::remove_all(dir, ec);
+	});
 
-	u8cout << "configuring\n";
-	transifex(transifex::config)
-		.stdout_level(context::level::info)
-		.root(path_)
-		.api_key(key)
-		.url(u)
-		.run(cxcopy);
+	op::create_directories(gcx(), dir);
 
-	u8cout << "pulling\n";
-	transifex(transifex::pull)
-		.stdout_level(context::level::info)
-		.root(path_)
-		.api_key(key)
-		.minimum(conf::get_global_int("transifex", "minimum"))
-		.force(conf::get_global_bool("transifex", "force"))
-		.run(cxcopy);
-}
+	const auto src = dir / "src.bin";
+	const auto same = dir / "same.bin";
+	const auto older = dir / "older.bin";
 
-void tx_command::do_build()
-{
-	fs::path root = path_;
-	if (fs::exists(root / ".tx") && fs::exists(root / "translations"))
-		root = root / "translations";
+	op::write_text_file(
+		gcx(), encodings::dont_know, src, std::string(64 * 1024, 'x'));
 
-	translations::projects ps(root);
+	fs::copy_file(src, same);
+	fs::copy_file(src, older);
 
-	fs::path dest = dest_;
-	op::create_directories(gcx(), dest, op::unsafe);
+	// same contents, but the source is newer and has to be hashed; the
+	// hashes are cached
+	fs::last_write_time(older,
+		fs::last_write_time(src) - std::chrono::hours(1));
 
-	for (auto&& w : ps.warnings())
-		u8cerr << w << "\n";
+	run("is_source_better/same", 0, [&]
+	{
+		g_bench_sink = op::is_source_better(gcx(), src, same);
+	});
 
-	thread_pool tp;
+	run("is_source_better/newer_same_contents", 0, [&]
+	{
+		g_bench_sink = op::is_source_better(gcx(), src, older);
+	});
+}
 
-	for (auto& p : ps.get())
+void bench_command::write_json(const fs::path& file) const
+{
+	std::ostringstream oss;
+
+	oss
+		<< "{\n"
+		<< "  \"context\": {\n"
+		<< "    \"executable\": \"" << version() << "\",\n"
+		<< "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+		<< "    \"library_build_type\": \"release\"\n"
+		<< "  },\n"
+		<< "  \"benchmarks\": [\n";
+
+	for (std::size_t i=0; i<results_.size(); ++i)
 	{
-		for (auto& lg : p.langs)
+		const auto& r = results_[i];
+
+		// everything runs on one thread, the cpu time is the same
+		oss << fmt::format(
+			"    {{\"name\": \"{0}\", \"run_name\": \"{0}\", "
+			"\"run_type\": \"iteration\", \"iterations\": {1}, "
+			"\"real_time\": {2}, \"cpu_time\": {2}, \"time_unit\": \"ns\"",
+			r.name, r.iterations, r.ns);
+
+		if (r.bytes > 0)
 		{
-			tp.add([&, cxcopy=gcx()]() mutable
-			{
-				lrelease()
-					.project(p.name)
-					.sources(lg.ts_files)
-					.out(dest)
-					.run(cxcopy);
-			});
+			oss << fmt::format(
+				", \"bytes_per_second\": {}",
+				static_cast<double>(r.bytes) / (r.ns / 1'000'000'000.0));
 		}
+
+		oss << "}" << (i + 1 < results_.size() ? "," : "") << "\n";
 	}
+
+	oss
+		<< "  ]\n"
+		<< "}\n";
+
+	op::write_text_file(gcx(), encodings::utf8, file, oss.str());
 }
 
 }	// namespace
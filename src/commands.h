@@ -1,5 +1,7 @@
 #pragma once
 
+#include "utility.h"
+
 namespace mob
 {
 
@@ -18,6 +20,7 @@ public:
 		std::vector<std::string> inis;
 		bool no_default_inis = false;
 		bool dump_inis = false;
+		bool profile = false;
 		std::string prefix;
 	};
 
@@ -124,6 +127,37 @@ public:
 	meta_t meta() const override;
 	static void terminate_msbuild();
 
+	// where timings are written after a build, read by `mob timings`
+	//
+	static fs::path timings_file();
+
+	// per-url download stats of the last build, see download_stats
+	//
+	static fs::path downloads_file();
+	static fs::path fs_file();
+
+	// every span of the last build, see span
+	//
+	static fs::path spans_file();
+
+	// slowest msbuild projects and targets, see the `msbuild_logs` option
+	//
+	static fs::path msbuild_file();
+
+	// compiler cache hits and misses per task, see compiler_cache
+	//
+	static fs::path compiler_cache_file();
+
+	// dependencies, fetch and build times of every task, read by
+	// `mob replay`
+	//
+	static fs::path replay_file();
+
+	// fetch and build times of every task, appended after every build; used
+	// to predict how long a build will take
+	//
+	static fs::path history_file();
+
 protected:
 	void convert_cl_to_conf() override;
 	clipp::group do_group() override;
@@ -142,9 +176,44 @@ private:
 	std::optional<bool> nopull_;
 	bool ignore_uncommitted_ = false;
 	bool keep_msbuild_ = false;
+	bool status_ = false;
 	std::optional<bool> revert_ts_;
+	bool affected_ = false;
+	std::string since_;
+
+	// disables every task except the super tasks that changed since their
+	// last successful build or since --affected-since, and the tasks that
+	// depend on them
+	//
+	void enable_affected();
+	bool is_affected(const task& t) const;
 
 	void dump_timings();
+	void dump_downloads();
+	void dump_fs();
+	void dump_spans();
+	void dump_msbuild();
+	void dump_compiler_cache();
+	void dump_replay();
+	void append_history();
+
+	// how long the enabled tasks should take from the history, following
+	// the critical path through their dependencies; prints every task if
+	// `print` is true, or logs the total; returns 0 without history
+	//
+	double predict(bool print);
+
+	// adds the hits and misses of the compiler cache since `before` to
+	// cache_stats, so they end up in the metrics
+	//
+	void add_compiler_cache_stats(
+		const std::optional<cache_stats::counts>& before);
+
+	// writes and pushes the metrics if metrics_file or metrics_url are set,
+	// never throws
+	//
+	void dump_metrics(bool ok);
+	std::string make_metrics(bool ok) const;
 };
 
 
@@ -162,7 +231,7 @@ private:
 	bool all_ = false;
 	std::vector<std::string> tasks_;
 
-	void dump(const std::vector<task*>& v, std::size_t indent) const;
+	void dump(const std::vector<task*>& v) const;
 };
 
 
@@ -172,11 +241,28 @@ public:
 	release_command();
 	meta_t meta() const override;
 
-	void make_bin();
-	void make_pdbs();
-	void make_src();
+	// creates the enabled archives concurrently, each with its share of the
+	// job budget as compression threads
+	//
+	void make_archives(bool bin, bool pdbs, bool src);
+
+	// creates or updates the archive from the glob, depending on
+	// --incremental
+	//
+	void make_archive(
+		const std::string& what, const fs::path& src_glob,
+		std::size_t threads);
+
+	void make_bin(std::size_t threads);
+	void make_pdbs(std::size_t threads);
+	void make_src(std::size_t threads);
 	void make_installer();
 
+	// archives the from-source build of every task that supports prebuilts,
+	// concurrently, and writes the manifest and hashes
+	//
+	void make_prebuilts();
+
 protected:
 	clipp::group do_group() override;
 	int do_run() override;
@@ -188,7 +274,27 @@ private:
 	{
 		none = 0,
 		devbuild,
-		official
+		official,
+		prebuilts
+	};
+
+	// files from a directory of the super path that go in the source archive,
+	// with their total size
+	//
+	struct src_files
+	{
+		std::vector<fs::path> files;
+		std::size_t size = 0;
+	};
+
+	// one archive created by make_prebuilts()
+	struct prebuilt
+	{
+		std::string task;
+		std::string version;
+		std::string filename;
+		std::uintmax_t size = 0;
+		std::string sha256;
 	};
 
 
@@ -197,6 +303,7 @@ private:
 	bool src_ = true;
 	bool pdbs_ = true;
 	bool installer_ = false;
+	bool incremental_ = false;
 	std::string utf8out_;
 	fs::path out_;
 	std::string version_;
@@ -208,17 +315,35 @@ private:
 	std::string suffix_;
 	std::string branch_;
 
+	// super repos listed by `official` while other tasks were still
+	// building, used by make_src() instead of listing them again
+	std::mutex src_mutex_;
+	std::map<fs::path, src_files> src_listed_;
+
 
 	int do_devbuild();
 	int do_official();
+	int do_prebuilts();
 
 	void prepare();
 
 	fs::path make_filename(const std::string& what) const;
 
+	std::optional<prebuilt> make_prebuilt(const task& t, std::size_t threads);
+
+	// checks that the branch exists in all the enabled super repos, bails out
+	// if it doesn't
+	//
+	void check_official_branch();
+
+	// lists the files of a directory in the super path for the source
+	// archive, from the index for git repos
+	//
+	src_files list_src_dir(const fs::path& dir);
+
 	void walk_dir(
 		const fs::path& dir, std::vector<fs::path>& files,
-		const std::vector<std::regex>& ignore_re, std::size_t& total_size);
+		const std::regex& ignore_re, std::size_t& total_size);
 
 	std::string version_from_exe() const;
 	std::string version_from_rc() const;
@@ -256,13 +381,18 @@ private:
 	bool push_default_ = false;
 
 	void do_set_remotes();
-	void do_set_remotes(const fs::path& r);
+	std::string do_set_remotes(const fs::path& r);
 
 	void do_add_remote();
-	void do_add_remote(const fs::path& r);
+	std::string do_add_remote(const fs::path& r);
 
 	void do_ignore_ts();
-	void do_ignore_ts(const fs::path& r);
+	std::string do_ignore_ts(const fs::path& r);
+
+	// calls `f` for path_ if given, or for all the repos in parallel; `f`
+	// returns the output for the repo, which is printed in one go
+	//
+	void for_each_repo(std::function<std::string (const fs::path&)> f);
 
 	std::vector<fs::path> get_repos() const;
 };
@@ -300,6 +430,83 @@ protected:
 };
 
 
+class timings_command : public command
+{
+public:
+	timings_command();
+	meta_t meta() const override;
+
+protected:
+	clipp::group do_group() override;
+	int do_run() override;
+	std::string do_doc() override;
+
+private:
+	// one line from the timings file
+	struct entry
+	{
+		std::string task;
+		std::string phase;
+		double start = 0, end = 0;
+		std::size_t thread = 0;
+		resource_usage usage;
+	};
+
+	// one line from the spans file
+	struct span_entry
+	{
+		std::uint64_t id = 0, parent = 0;
+		std::string task;
+		std::string kind;
+		std::string name;
+		double start = 0, end = 0;
+		std::size_t thread = 0;
+	};
+
+	// one build from the history file, see build_command::history_file()
+	struct history_run
+	{
+		std::string id;
+		std::string kind;
+		std::string fingerprint;
+
+		// task and phase
+		std::map<std::pair<std::string, std::string>, double> phases;
+
+		// HEAD of the super repos
+		std::map<std::string, std::string> heads;
+	};
+
+	std::string input_;
+	std::string output_;
+
+	bool compare_ = false;
+	int threshold_ = 20;
+	int baseline_ = 10;
+	int min_seconds_ = 5;
+
+	// compares the last run in the history with the ones before it, returns
+	// 1 if something regressed
+	//
+	int do_compare();
+	std::vector<history_run> read_history(const fs::path& file) const;
+
+	std::vector<entry> read_timings(const fs::path& file) const;
+	std::vector<span_entry> read_spans(const fs::path& file) const;
+
+	void write_trace(
+		const std::vector<entry>& v, const std::vector<span_entry>& spans,
+		const fs::path& file) const;
+
+	void print_critical_path(const std::vector<entry>& v) const;
+	void print_usage(const std::vector<entry>& v) const;
+	void print_downloads(const fs::path& file) const;
+	void print_fs(const fs::path& file) const;
+	void print_msbuild(const fs::path& file) const;
+	void print_compiler_cache(const fs::path& file) const;
+};
+
+
 class tx_command : public command
 {
 public:
@@ -331,4 +538,233 @@ private:
 	void do_build();
 };
 
+
+// keeps running and builds the super tasks whose repo changed, see do_doc()
+//
+class watch_command : public command
+{
+public:
+	watch_command();
+	meta_t meta() const override;
+
+protected:
+	void convert_cl_to_conf() override;
+	clipp::group do_group() override;
+	int do_run() override;
+	std::string do_doc() override;
+
+private:
+	int debounce_ = 1000;
+	bool dependents_ = true;
+
+	// super tasks that have one of the files in their repo
+	//
+	std::set<task*> affected_tasks(const std::vector<fs::path>& files) const;
+
+	// enables only the given tasks and runs them, returns false if it failed
+	// or was interrupted
+	//
+	bool build(const std::set<task*>& tasks);
+};
+
+
+// archives the source directory of every task that has a manifest and the
+// install directory into a store, and extracts them in another prefix; see
+// do_doc()
+//
+class snapshot_command : public command
+{
+public:
+	snapshot_command();
+	meta_t meta() const override;
+
+protected:
+	clipp::group do_group() override;
+	int do_run() override;
+	std::string do_doc() override;
+
+private:
+	enum class modes
+	{
+		none = 0,
+		create,
+		restore
+	};
+
+	// one line in the snapshot file
+	struct entry
+	{
+		// task name, empty for the install directory
+		std::string task;
+
+		// archive in the objects/ directory of the store
+		std::string object;
+		std::string sha256;
+
+		// hash of the manifest of the task when the snapshot was created
+		std::string manifest_hash;
+	};
+
+	modes mode_ = modes::none;
+	std::string name_;
+	std::string store_;
+
+	fs::path store() const;
+	fs::path snapshot_file() const;
+
+	int do_create();
+	int do_restore();
+
+	// archives the directory into the store unless the object is already
+	// there, fills in the hash
+	//
+	void store_object(const fs::path& dir, entry& e, std::size_t threads);
+
+	// copies the object from the store, checks its hash and extracts it in
+	// the directory
+	//
+	void restore_object(
+		const entry& e, const fs::path& dir, std::size_t threads);
+
+	// writes the manifest of the task if its inputs in this prefix are the
+	// same as when the snapshot was created, dependencies first
+	//
+	bool adopt_manifest(
+		task& t, const std::map<std::string, entry>& entries,
+		std::map<std::string, bool>& done);
+
+	std::vector<entry> read_snapshot() const;
+	void write_snapshot(const std::vector<entry>& v) const;
+};
+
+
+// simulates the last build from replay.txt with a different number of jobs,
+// fetch slots, scheduling policy or cached tasks, see replay_file()
+//
+class replay_command : public command
+{
+public:
+	replay_command();
+	meta_t meta() const override;
+
+protected:
+	clipp::group do_group() override;
+	int do_run() override;
+	std::string do_doc() override;
+
+private:
+	// which ready task gets the free job slots first
+	enum class policies
+	{
+		// in the order they became ready, like the real build
+		fifo,
+
+		// longest chain of builds left first
+		critical_path,
+
+		// longest build first
+		longest
+	};
+
+	// a task from the replay file and its state during the simulation, in
+	// seconds since the start
+	struct sim_task
+	{
+		std::string name;
+		std::vector<std::size_t> deps;
+		double fetch = 0, build = 0, cpu = 0;
+
+		// job slots the build can use, from its cpu and wall times
+		std::size_t width = 1;
+
+		// build time of this task and of the longest chain of tasks that
+		// depend on it
+		double rank = 0;
+
+		double fetch_end = -1;
+		double ready = -1;
+		double build_start = -1;
+		double build_end = -1;
+		std::size_t slots = 0;
+	};
+
+	std::string input_;
+	int jobs_ = -1;
+	int fetch_jobs_ = -1;
+	std::string policy_ = "fifo";
+	std::vector<std::string> cached_;
+
+	// from the replay file
+	double recorded_total_ = 0;
+	std::size_t recorded_jobs_ = 0;
+	std::size_t recorded_fetch_jobs_ = 0;
+
+	std::vector<sim_task> read(const fs::path& file);
+
+	// sets the rank of every task
+	//
+	void rank(std::vector<sim_task>& v) const;
+
+	// runs the tasks and returns the total time; the builds get the number
+	// of slots they want among what's free, like job_slots
+	//
+	double simulate(
+		std::vector<sim_task>& v, std::size_t jobs, std::size_t fetch_jobs,
+		policies p) const;
+
+	void print(
+		const std::vector<sim_task>& v, double total, std::size_t jobs) const;
+};
+
+
+// times some of mob's internals that run for every line of output, every
+// task or every file, and writes the results in the same json format as
+// Google Benchmark so they can be compared with its tools
+//
+class bench_command : public command
+{
+public:
+	bench_command();
+	meta_t meta() const override;
+
+protected:
+	clipp::group do_group() override;
+	int do_run() override;
+	std::string do_doc() override;
+
+private:
+	struct result
+	{
+		std::string name;
+		std::size_t iterations = 0;
+
+		// per iteration
+		double ns = 0;
+
+		// processed by one iteration, 0 if it doesn't apply
+		std::size_t bytes = 0;
+	};
+
+	std::string filter_;
+	std::string output_;
+	int min_time_ = 500;
+
+	std::vector<result> results_;
+
+	// calls f() until it has run for at least --min-time, unless the name
+	// doesn't match --filter
+	//
+	void run(
+		const std::string& name, std::size_t bytes,
+		const std::function<void ()>& f);
+
+	void bench_buffers();
+	void bench_tasks();
+	void bench_logging();
+	void bench_env();
+	void bench_fs();
+
+	void write_json(const fs::path& file) const;
+};
+
 }	// namespace
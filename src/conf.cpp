@@ -10,9 +10,59 @@ namespace mob
 {
 
 conf::task_map conf::map_;
+std::mutex conf::task_option_ids_mutex_;
+std::map<std::string, std::size_t> conf::task_option_ids_;
+std::vector<std::string> conf::task_option_names_;
+std::shared_mutex conf::resolved_mutex_;
+std::map<std::string, conf::resolved_task> conf::resolved_;
 int conf::output_log_level_ = 3;
 int conf::file_log_level_ = 5;
 bool conf::dry_ = false;
+bool conf::async_log_ = false;
+
+startup_profile::startup_profile()
+	: instrumentable("startup", {
+		"add_tasks", "command_line", "find_inis", "parse_inis", "discovery",
+		"vcvars_x86", "vcvars_x64"})
+{
+}
+
+startup_profile& startup_profile::instance()
+{
+	static startup_profile p;
+	return p;
+}
+
+std::string startup_profile::breakdown() const
+{
+	using namespace std::chrono;
+
+	std::vector<std::pair<std::string, std::string>> rows;
+	nanoseconds total{};
+
+	for (auto&& t : instrumented_tasks())
+	{
+		if (t.tps.empty())
+			continue;
+
+		nanoseconds d{};
+		for (auto&& tp : t.tps)
+			d += (tp.end - tp.start);
+
+		total += d;
+
+		rows.push_back({
+			t.name,
+			std::to_string(duration_cast<milliseconds>(d).count()) + "ms"});
+	}
+
+	rows.push_back({
+		"total",
+		std::to_string(duration_cast<milliseconds>(total).count()) + "ms"});
+
+	return table(rows, 2, 1);
+}
+
 
 std::string master_ini_filename()
 {
@@ -69,6 +119,9 @@ void conf::set_global(
 	}
 
 	kitor->second = value;
+
+	if (section == "task")
+		invalidate_resolved();
 }
 
 int conf::get_global_int(const std::string& section, const std::string& key)
@@ -96,6 +149,51 @@ void conf::add_global(
 	const std::string& key, const std::string& value)
 {
 	map_[""][section][key] = value;
+
+	if (section == "task")
+		invalidate_resolved();
+}
+
+std::string conf::expected_sha256(const std::string& filename)
+{
+	auto global = map_.find("");
+	MOB_ASSERT(global != map_.end());
+
+	auto sitor = global->second.find("sha256");
+	if (sitor == global->second.end())
+		return {};
+
+	auto kitor = sitor->second.find(filename);
+	if (kitor == sitor->second.end())
+		return {};
+
+	std::string s = kitor->second;
+	std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c)
+	{
+		return static_cast<char>(std::tolower(c));
+	});
+
+	return s;
+}
+
+std::vector<std::string> conf::global_keys(const std::string& section)
+{
+	auto global = map_.find("");
+	MOB_ASSERT(global != map_.end());
+
+	auto sitor = global->second.find(section);
+	if (sitor == global->second.end())
+	{
+		gcx().bail_out(context::conf,
+			"conf section '{}' doesn't exist", section);
+	}
+
+	std::vector<std::string> v;
+
+	for (auto&& [k, _] : sitor->second)
+		v.push_back(k);
+
+	return v;
 }
 
 std::optional<std::string> conf::find_for_task(
@@ -161,6 +259,9 @@ void conf::set_for_task(
 	get_global(section, key);
 
 	map_[task_name][section][key] = value;
+
+	if (section == "task")
+		invalidate_resolved();
 }
 
 bool conf::prebuilt_by_name(const std::string& task)
@@ -198,14 +299,141 @@ bool conf::bool_global_by_name(const std::string& name)
 std::string conf::task_option_by_name(
 	const std::vector<std::string>& task_names, const std::string& name)
 {
-	return get_for_task(task_names, "task", name);
+	return task_option(task_names, task_option_id(name));
 }
 
 bool conf::bool_task_option_by_name(
 	const std::vector<std::string>& task_names, const std::string& name)
 {
-	const std::string s = task_option_by_name(task_names, name);
-	return bool_from_string(s);
+	return bool_task_option(task_names, task_option_id(name));
+}
+
+void conf::resolve_task_options()
+{
+	std::map<std::string, resolved_task> resolved;
+
+	auto global = map_.find("");
+	MOB_ASSERT(global != map_.end());
+
+	auto sitor = global->second.find("task");
+	if (sitor != global->second.end())
+	{
+		for (auto&& [k, v] : sitor->second)
+			task_option_id(k);
+	}
+
+	std::vector<std::string> names;
+
+	{
+		std::scoped_lock lock(task_option_ids_mutex_);
+		names = task_option_names_;
+	}
+
+	auto add = [&](const std::vector<std::string>& task_names)
+	{
+		resolved_task r;
+		r.names = task_names;
+
+		for (auto&& n : names)
+		{
+			auto v = get_for_task(task_names, "task", n);
+			r.bools.push_back(bool_from_string(v));
+			r.values.push_back(std::move(v));
+		}
+
+		resolved[task_names.empty() ? "" : task_names.front()] = std::move(r);
+	};
+
+	add({});
+
+	for (auto* t : get_all_tasks())
+		add(t->names());
+
+	std::unique_lock lock(resolved_mutex_);
+	resolved_ = std::move(resolved);
+}
+
+void conf::invalidate_resolved()
+{
+	{
+		std::shared_lock lock(resolved_mutex_);
+
+		// not resolved yet, init_options() will do it
+		if (resolved_.empty())
+			return;
+	}
+
+	resolve_task_options();
+}
+
+std::size_t conf::task_option_id(const std::string& name)
+{
+	std::scoped_lock lock(task_option_ids_mutex_);
+
+	auto itor = task_option_ids_.find(name);
+	if (itor != task_option_ids_.end())
+		return itor->second;
+
+	const std::size_t id = task_option_names_.size();
+	task_option_names_.push_back(name);
+	task_option_ids_.emplace(name, id);
+
+	return id;
+}
+
+std::string conf::task_option_name(std::size_t id)
+{
+	std::scoped_lock lock(task_option_ids_mutex_);
+	MOB_ASSERT(id < task_option_names_.size());
+	return task_option_names_[id];
+}
+
+const conf::resolved_task* conf::find_resolved(
+	const std::vector<std::string>& task_names)
+{
+	auto itor = resolved_.find(task_names.empty() ? "" : task_names.front());
+	if (itor == resolved_.end())
+		return nullptr;
+
+	// a task can be given with only some of its names
+	if (itor->second.names != task_names)
+		return nullptr;
+
+	return &itor->second;
+}
+
+std::string conf::task_option(
+	const std::vector<std::string>& task_names, std::size_t id)
+{
+	// options that were interned after resolving are looked up
+	{
+		std::shared_lock lock(resolved_mutex_);
+
+		if (const auto* r=find_resolved(task_names))
+		{
+			if (id < r->values.size())
+				return r->values[id];
+		}
+	}
+
+	return get_for_task(task_names, "task", task_option_name(id));
+}
+
+bool conf::bool_task_option(
+	const std::vector<std::string>& task_names, std::size_t id)
+{
+	{
+		std::shared_lock lock(resolved_mutex_);
+
+		if (const auto* r=find_resolved(task_names))
+		{
+			if (id < r->bools.size())
+				return r->bools[id];
+		}
+	}
+
+	return bool_from_string(
+		get_for_task(task_names, "task", task_option_name(id)));
 }
 
 void conf::set_output_log_level(const std::string& s)
@@ -252,6 +480,11 @@ void conf::set_dry(const std::string& s)
 	dry_ = bool_from_string(s);
 }
 
+void conf::set_async_log(const std::string& s)
+{
+	async_log_ = bool_from_string(s);
+}
+
 
 std::vector<std::string> conf::format_options()
 {
@@ -607,7 +840,7 @@ fs::path find_temp_dir()
 	if (GetTempPathW(static_cast<DWORD>(buffer_size), buffer) == 0)
 	{
 		const auto e = GetLastError();
-		gcx().bail_out(context::conf, "can't get temp path", error_message(e));
+		gcx().bail_out(context::conf, "can't get temp path, {}", error_message(e));
 	}
 
 	fs::path p(buffer);
@@ -769,7 +1002,9 @@ void parse_section(
 
 		if (task.empty())
 		{
-			if (add)
+			// hashes are for arbitrary filenames and profiles can be added
+			// by any ini, they can't all be in the main ini
+			if (add || section == "sha256" || section.starts_with("profile_"))
 				conf::add_global(section, k, v);
 			else
 				conf::set_global(section, k, v);
@@ -896,6 +1131,7 @@ void set_special_options()
 	conf::set_output_log_level(conf::get_global("global", "output_log_level"));
 	conf::set_file_log_level(conf::get_global("global", "file_log_level"));
 	conf::set_dry(conf::get_global("global", "dry"));
+	conf::set_async_log(conf::get_global("global", "async_log"));
 }
 
 std::vector<fs::path> find_inis(
@@ -1067,25 +1303,170 @@ fs::path find_iscc()
 	gcx().bail_out(context::conf, "can't find {} anywhere", iscc);
 }
 
+// results of the tool discovery done in init_options(), kept in the temp
+// directory for later runs; the filename is a hash of everything the results
+// depend on:
+//
+//   - mob.exe and its modification time,
+//   - the PATH mob was started with,
+//   - the inis, their modification times and the options from the command
+//     line,
+//   - the directory where Visual Studio keeps its instances, which changes
+//     when one is installed, removed or updated
+//
+// cached paths are only used if they still exist
+//
+class discovery_cache
+{
+public:
+	discovery_cache(
+		const std::vector<fs::path>& inis, const std::vector<std::string>& opts)
+			: dirty_(false)
+	{
+		if (conf::dry() || !conf::bool_global_by_name("discovery_cache"))
+			return;
+
+		const auto exe = mob_exe_path();
+
+		const auto vs_instances = get_known_folder(FOLDERID_ProgramData) /
+			"Microsoft" / "VisualStudio" / "Packages" / "_Instances";
+
+		std::string key =
+			path_to_utf8(exe) + "\n" +
+			file_time_string(exe) + "\n" +
+			this_env::get("PATH") + "\n" +
+			file_time_string(vs_instances) + "\n";
+
+		for (auto&& i : inis)
+			key += path_to_utf8(i) + "=" + file_time_string(i) + "\n";
+
+		for (auto&& o : opts)
+			key += o + "\n";
+
+		file_ = find_temp_dir() / "mob" /
+			("discovery-" + hash_string(key) + ".txt");
+
+		std::ifstream in(file_, std::ios::binary);
+		std::string line;
+
+		while (std::getline(in, line))
+		{
+			const auto sep = line.find('=');
+			if (sep == std::string::npos)
+				continue;
+
+			values_[line.substr(0, sep)] = utf8_to_utf16(line.substr(sep + 1));
+		}
+
+		if (!values_.empty())
+			gcx().trace(context::conf, "using discovery cache {}", file_);
+	}
+
+	~discovery_cache()
+	{
+		if (!dirty_ || file_.empty())
+			return;
+
+		std::error_code ec;
+		fs::create_directories(file_.parent_path(), ec);
+
+		std::ofstream out(file_, std::ios::binary);
+
+		for (auto&& [k, v] : values_)
+			out << k << "=" << path_to_utf8(v) << "\n";
+	}
+
+	// the cached result for k if it still exists, or f()
+	//
+	template <class F>
+	fs::path get(const std::string& k, F&& f)
+	{
+		if (file_.empty())
+			return f();
+
+		auto itor = values_.find(k);
+		if (itor != values_.end())
+		{
+			if (itor->second.empty() || fs::exists(itor->second))
+			{
+				gcx().trace(context::conf,
+					"{} is {} (cached)", k, itor->second);
+
+				cache_stats::hit("discovery");
+				return itor->second;
+			}
+		}
+
+		cache_stats::miss("discovery");
+		const fs::path p = f();
+
+		values_[k] = p;
+		dirty_ = true;
+
+		return p;
+	}
+
+private:
+	fs::path file_;
+	std::map<std::string, fs::path> values_;
+	bool dirty_;
+};
+
+// finds the tools and directories that weren't set in the inis
+//
+void find_tools(discovery_cache& dc, const std::vector<fs::path>& inis)
+{
+	gcx().debug(context::conf,
+		"command line: {}", std::wstring(GetCommandLineW()));
+
+	gcx().debug(context::conf, "using inis in order:");
+
+	for (auto&& ini : inis)
+		gcx().debug(context::conf, "  . {}", ini);
+
+	set_path_if_empty("third_party", find_third_party_directory);
+	this_env::prepend_to_path(paths::third_party() / "bin");
+
+	set_path_if_empty("pf_x86", [&]{ return dc.get("pf_x86", find_program_files_x86); });
+	set_path_if_empty("pf_x64", [&]{ return dc.get("pf_x64", find_program_files_x64); });
+	set_path_if_empty("vs",     [&]{ return dc.get("vs", find_vs); });
+	set_path_if_empty("qt_install", [&]{ return dc.get("qt_install", find_qt); });
+	set_path_if_empty("temp_dir",   find_temp_dir);
+	set_path_if_empty("patches",    find_in_root("patches"));
+	set_path_if_empty("licenses",   find_in_root("licenses"));
+	set_path_if_empty("qt_bin",     qt::installation_path() / "bin");
+
+	find_vcvars();
+	validate_qt();
+
+	this_env::append_to_path(conf::path_by_name("qt_bin"));
+}
+
 void init_options(
 	const std::vector<fs::path>& inis, const std::vector<std::string>& opts)
 {
 	MOB_ASSERT(!inis.empty());
 
+	auto& sp = startup_profile::instance();
+
 	// Keep track of the INI that contained a prefix:
 	fs::path ini_prefix;
-	bool add = true;
-	for (auto&& ini : inis)
+
+	sp.instrument<startup_profile::times::parse_inis>([&]
 	{
-		// Check if the prefix is set by this ini file:
-		fs::path cprefix = add ? fs::path{} : paths::prefix();
-		parse_ini(ini, add);
+		bool add = true;
+		for (auto&& ini : inis)
+		{
+			// Check if the prefix is set by this ini file:
+			fs::path cprefix = add ? fs::path{} : paths::prefix();
+			parse_ini(ini, add);
 
-		if (paths::prefix() != cprefix)
-			ini_prefix = ini;
+			if (paths::prefix() != cprefix)
+				ini_prefix = ini;
 
-		add = false;
-	}
+			add = false;
+		}
+	});
 
 	if (!opts.empty())
 	{
@@ -1130,31 +1511,15 @@ void init_options(
 
 	set_special_options();
 	context::set_log_file(conf::log_file());
+	context::set_json_log_file(conf::json_log_file());
 
-	gcx().debug(context::conf,
-		"command line: {}", std::wstring(GetCommandLineW()));
-
-	gcx().debug(context::conf, "using inis in order:");
-
-	for (auto&& ini : inis)
-		gcx().debug(context::conf, "  . {}", ini);
-
-	set_path_if_empty("third_party", find_third_party_directory);
-	this_env::prepend_to_path(paths::third_party() / "bin");
-
-	set_path_if_empty("pf_x86",     find_program_files_x86);
-	set_path_if_empty("pf_x64",     find_program_files_x64);
-	set_path_if_empty("vs",         find_vs);
-	set_path_if_empty("qt_install", find_qt);
-	set_path_if_empty("temp_dir",   find_temp_dir);
-	set_path_if_empty("patches",    find_in_root("patches"));
-	set_path_if_empty("licenses",   find_in_root("licenses"));
-	set_path_if_empty("qt_bin",     qt::installation_path() / "bin");
+	// before PATH is changed in find_tools()
+	discovery_cache dc(inis, opts);
 
-	find_vcvars();
-	validate_qt();
-
-	this_env::append_to_path(conf::path_by_name("qt_bin"));
+	sp.instrument<startup_profile::times::discovery>([&]
+	{
+		find_tools(dc, inis);
+	});
 
 	if (!paths::prefix().empty())
 		make_canonical_path("prefix", ini_prefix.empty() ? fs::current_path() : ini_prefix.parent_path(), "");
@@ -1183,7 +1548,12 @@ void init_options(
 		"install_translations",
 		paths::install_bin(), "translations");
 
-	conf::set_global("tools", "iscc", path_to_utf8(find_iscc()));
+	sp.instrument<startup_profile::times::discovery>([&]
+	{
+		conf::set_global("tools", "iscc", path_to_utf8(dc.get("iscc", find_iscc)));
+	});
+
+	conf::resolve_task_options();
 }
 
 bool verify_options()
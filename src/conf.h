@@ -1,5 +1,7 @@
 #pragma once
 
+#include "utility.h"
+
 namespace mob
 {
 
@@ -24,6 +26,10 @@ public:
 		const std::string& section,
 		const std::string& key, const std::string& value);
 
+	// all the keys in the given global section, sorted
+	//
+	static std::vector<std::string> global_keys(const std::string& section);
+
 
 	static std::string get_for_task(
 		const std::vector<std::string>& task_names,
@@ -48,6 +54,23 @@ public:
 	static bool bool_task_option_by_name(
 		const std::vector<std::string>& task_names, const std::string& name);
 
+	// the [task] options are resolved once for every task after the inis and
+	// the command line are loaded, which replaces the lookups through
+	// _override, the task names, super and the global section by an array
+	// read; the table is dropped if an option is changed afterwards
+	//
+	static void resolve_task_options();
+
+	// interned index of a [task] option for task_option(), never changes
+	//
+	static std::size_t task_option_id(const std::string& name);
+
+	static std::string task_option(
+		const std::vector<std::string>& task_names, std::size_t id);
+
+	static bool bool_task_option(
+		const std::vector<std::string>& task_names, std::size_t id);
+
 
 	static int output_log_level() { return output_log_level_; }
 	static void set_output_log_level(const std::string& s);
@@ -58,7 +81,11 @@ public:
 	static bool dry() { return dry_; }
 	static void set_dry(const std::string& s);
 
+	static bool async_log() { return async_log_; }
+	static void set_async_log(const std::string& s);
+
 	static fs::path log_file() { return global_by_name("log_file"); }
+	static fs::path json_log_file() { return global_by_name("json_log_file"); }
 	static bool redownload()   { return bool_global_by_name("redownload"); }
 	static bool reextract()    { return bool_global_by_name("reextract"); }
 	static bool reconfigure()  { return bool_global_by_name("reconfigure"); }
@@ -72,6 +99,100 @@ public:
 		return bool_global_by_name("ignore_uncommitted");
 	}
 
+	static std::string artifact_cache()
+	{
+		return global_by_name("artifact_cache");
+	}
+
+	static bool publish_artifacts()
+	{
+		return bool_global_by_name("publish_artifacts");
+	}
+
+	static bool vcvars_cache()
+	{
+		return bool_global_by_name("vcvars_cache");
+	}
+
+	static std::string shared_download_cache()
+	{
+		return global_by_name("shared_download_cache");
+	}
+
+	static bool stream_extract()
+	{
+		return bool_global_by_name("stream_extract");
+	}
+
+	static bool revalidate_downloads()
+	{
+		return bool_global_by_name("revalidate_downloads");
+	}
+
+	static std::string git_reference_store()
+	{
+		return global_by_name("git_reference_store");
+	}
+
+	static std::string metrics_file()
+	{
+		return global_by_name("metrics_file");
+	}
+
+	static std::string metrics_url()
+	{
+		return global_by_name("metrics_url");
+	}
+
+	static bool msbuild_logs()
+	{
+		return bool_global_by_name("msbuild_logs");
+	}
+
+	static std::string compiler_cache()
+	{
+		return global_by_name("compiler_cache");
+	}
+
+	static std::string compiler_cache_dir()
+	{
+		return global_by_name("compiler_cache_dir");
+	}
+
+	static bool wheel_cache()
+	{
+		return bool_global_by_name("wheel_cache");
+	}
+
+	static bool upgrade_cache()
+	{
+		return bool_global_by_name("upgrade_cache");
+	}
+
+	static bool probe_remotes()
+	{
+		return bool_global_by_name("probe_remotes");
+	}
+
+	static std::string install_mode()
+	{
+		return global_by_name("install_mode");
+	}
+
+	static bool background_delete()
+	{
+		return bool_global_by_name("background_delete");
+	}
+
+	static bool compare_contents()
+	{
+		return bool_global_by_name("compare_contents");
+	}
+
+	// expected hash of a downloaded file from the [sha256] section, or empty
+	//
+	static std::string expected_sha256(const std::string& filename);
+
 	static std::vector<std::string> format_options();
 
 private:
@@ -81,14 +202,45 @@ private:
 
 	static task_map map_;
 
+	// [task] options for a task, indexed by option id
+	struct resolved_task
+	{
+		std::vector<std::string> names;
+		std::vector<std::string> values;
+		std::vector<char> bools;
+	};
+
+	static std::mutex task_option_ids_mutex_;
+	static std::map<std::string, std::size_t> task_option_ids_;
+	static std::vector<std::string> task_option_names_;
+
+	// keyed on the first task name, empty for options without a task; tasks
+	// read it from their threads while a [task] option can be changed from
+	// another one
+	static std::shared_mutex resolved_mutex_;
+	static std::map<std::string, resolved_task> resolved_;
+
 	// special cases to avoid string manipulations
 	static int output_log_level_;
 	static int file_log_level_;
 	static bool dry_;
+	static bool async_log_;
 
 	static std::optional<std::string> find_for_task(
 		const std::string& task_name,
 		const std::string& section, const std::string& key);
+
+	// resolved_mutex_ must be held by the caller
+	//
+	static const resolved_task* find_resolved(
+		const std::vector<std::string>& task_names);
+
+	// re-resolves the options after a [task] option changed, if they had
+	// been resolved already
+	//
+	static void invalidate_resolved();
+
+	static std::string task_option_name(std::size_t id);
 };
 
 
@@ -126,6 +278,34 @@ struct paths
 };
 
 
+// phases of mob before and around the tasks, written to the timings and
+// printed with --profile
+//
+class startup_profile : public instrumentable<7>
+{
+public:
+	enum class times
+	{
+		add_tasks,
+		command_line,
+		find_inis,
+		parse_inis,
+		discovery,
+		vcvars_x86,
+		vcvars_x64
+	};
+
+	static startup_profile& instance();
+
+	// a line per phase with its total time
+	//
+	std::string breakdown() const;
+
+private:
+	startup_profile();
+};
+
+
 std::string master_ini_filename();
 
 std::vector<fs::path> find_inis(
@@ -4,18 +4,32 @@
 #include "conf.h"
 #include "tasks/task.h"
 #include "tools/tools.h"
+#include "status.h"
 
 namespace mob::details
 {
 
-std::string converter<std::wstring>::convert(const std::wstring& s)
+std::string_view utf8_scratch(std::wstring_view s)
 {
-	return utf16_to_utf8(s);
-}
+	static thread_local std::string buffer;
 
-std::string converter<fs::path>::convert(const fs::path& s)
-{
-	return utf16_to_utf8(s.native());
+	if (s.empty())
+		return {};
+
+	const int size = WideCharToMultiByte(
+		CP_UTF8, 0, s.data(), static_cast<int>(s.size()),
+		nullptr, 0, nullptr, nullptr);
+
+	if (size <= 0)
+		return {};
+
+	buffer.resize(static_cast<std::size_t>(size));
+
+	WideCharToMultiByte(
+		CP_UTF8, 0, s.data(), static_cast<int>(s.size()),
+		buffer.data(), size, nullptr, nullptr);
+
+	return buffer;
 }
 
 std::string converter<url>::convert(const url& u)
@@ -30,11 +44,14 @@ namespace mob
 {
 
 static hr_clock::time_point g_start_time = hr_clock::now();
-static std::vector<std::string> g_errors, g_warnings;
 static handle_ptr g_log_file;
+static handle_ptr g_json_log_file;
 static std::mutex g_mutex;
 
-console_color level_color(context::level lv)
+// width of the timestamp at the start of log lines, '0000.00 '
+static constexpr std::size_t g_timestamp_width = 8;
+
+console_color::colors level_color_value(context::level lv)
 {
 	switch (lv)
 	{
@@ -55,6 +72,163 @@ console_color level_color(context::level lv)
 	}
 }
 
+console_color level_color(context::level lv)
+{
+	return level_color_value(lv);
+}
+
+// collects warnings and errors for the summary shown by dump_logs(); identical
+// messages from the same task are counted instead of being stored again, and
+// only the first `max_entries` distinct messages per level are kept, the rest
+// are only counted
+//
+// the full list is always in the log file, this is only meant to keep the
+// summary readable at the end of a long build
+//
+class problem_summary
+{
+public:
+	// distinct messages kept per level
+	static constexpr std::size_t max_entries = 200;
+
+	// messages shown per level and per task by dump()
+	static constexpr std::size_t max_shown = 10;
+
+	static problem_summary& instance()
+	{
+		static problem_summary s;
+		return s;
+	}
+
+	// `line` is the full log line, `key` is the part used for deduplication,
+	// which is the line without the timestamp
+	//
+	void add(
+		context::level lv, const std::string& task,
+		std::string_view line, std::string_view key)
+	{
+		std::scoped_lock lock(m_);
+
+		auto& lvl = (lv == context::level::error ? errors_ : warnings_);
+
+		auto k = std::make_pair(task, std::string(key));
+		auto itor = lvl.index.find(k);
+
+		if (itor != lvl.index.end())
+		{
+			++lvl.entries[itor->second].count;
+			return;
+		}
+
+		if (lvl.entries.size() >= max_entries)
+		{
+			++lvl.dropped;
+			return;
+		}
+
+		lvl.index.emplace(std::move(k), lvl.entries.size());
+		lvl.entries.push_back({task, std::string(line), 1});
+	}
+
+	bool empty() const
+	{
+		std::scoped_lock lock(m_);
+		return warnings_.entries.empty() && errors_.entries.empty();
+	}
+
+	void dump() const
+	{
+		std::scoped_lock lock(m_);
+
+		{
+			auto c = level_color(context::level::warning);
+			dump(warnings_, "warning");
+		}
+
+		{
+			auto c = level_color(context::level::error);
+			dump(errors_, "error");
+		}
+	}
+
+private:
+	struct entry
+	{
+		std::string task;
+		std::string line;
+		std::size_t count;
+	};
+
+	struct level_entries
+	{
+		// in the order they were first seen
+		std::vector<entry> entries;
+
+		// (task, key) to index in `entries`
+		std::map<std::pair<std::string, std::string>, std::size_t> index;
+
+		// messages not kept because `entries` was full
+		std::size_t dropped = 0;
+	};
+
+	mutable std::mutex m_;
+	level_entries warnings_, errors_;
+
+	void dump(const level_entries& lvl, std::string_view what) const
+	{
+		// tasks in the order of their first message
+		std::vector<std::string> tasks;
+		for (auto&& e : lvl.entries)
+		{
+			if (std::find(tasks.begin(), tasks.end(), e.task) == tasks.end())
+				tasks.push_back(e.task);
+		}
+
+		for (auto&& t : tasks)
+		{
+			std::vector<const entry*> v;
+			for (auto&& e : lvl.entries)
+			{
+				if (e.task == t)
+					v.push_back(&e);
+			}
+
+			// most frequent first, ties stay in the order they were seen
+			std::stable_sort(v.begin(), v.end(), [](auto* a, auto* b) {
+				return (a->count > b->count);
+			});
+
+			const std::size_t shown = std::min(v.size(), max_shown);
+
+			for (std::size_t i=0; i<shown; ++i)
+			{
+				if (v[i]->count > 1)
+					u8cout << v[i]->line << " (x" << v[i]->count << ")\n";
+				else
+					u8cout << v[i]->line << "\n";
+			}
+
+			if (v.size() > shown)
+			{
+				std::size_t hidden = 0;
+				for (std::size_t i=shown; i<v.size(); ++i)
+					hidden += v[i]->count;
+
+				u8cout
+					<< "... and " << hidden << " more " << what << "(s) for "
+					<< (t.empty() ? "mob" : t) << ", see the log file\n";
+			}
+		}
+
+		if (lvl.dropped > 0)
+		{
+			u8cout
+				<< "... and " << lvl.dropped << " more " << what << "(s) "
+				<< "not summarized, see the log file\n";
+		}
+	}
+};
+
 const char* reason_string(context::reason r)
 {
 	switch (r)
@@ -110,6 +284,232 @@ std::chrono::nanoseconds timestamp()
 	return (hr_clock::now() - g_start_time);
 }
 
+std::size_t thread_index()
+{
+	static std::atomic<std::size_t> next = 0;
+	thread_local const std::size_t i = next++;
+
+	return i;
+}
+
+
+// guards all the resource_usage objects bound to sinks; processes complete
+// rarely enough that there's no point in anything finer
+static std::mutex g_usage_mutex;
+thread_local const usage_sink* usage_sink::current_ = nullptr;
+
+resource_usage& resource_usage::operator+=(const resource_usage& u)
+{
+	user += u.user;
+	kernel += u.kernel;
+	peak_memory = std::max(peak_memory, u.peak_memory);
+	read_bytes += u.read_bytes;
+	write_bytes += u.write_bytes;
+	processes += u.processes;
+	downloads += u.downloads;
+	download_bytes += u.download_bytes;
+	download_time += u.download_time;
+	download_retries += u.download_retries;
+	fs_ops += u.fs_ops;
+	fs_files += u.fs_files;
+	fs_bytes += u.fs_bytes;
+	fs_time += u.fs_time;
+
+	return *this;
+}
+
+usage_sink::usage_sink(resource_usage& u)
+	: u_(&u), previous_(current_)
+{
+	current_ = this;
+}
+
+usage_sink::~usage_sink()
+{
+	current_ = previous_;
+}
+
+const usage_sink* usage_sink::current()
+{
+	return current_;
+}
+
+const usage_sink* usage_sink::exchange(const usage_sink* s)
+{
+	return std::exchange(current_, s);
+}
+
+void usage_sink::add(const resource_usage& u)
+{
+	std::scoped_lock lock(g_usage_mutex);
+
+	for (auto* s=current_; s; s=s->previous_)
+		*s->u_ += u;
+}
+
+
+static std::mutex g_cache_stats_mutex;
+static std::map<std::string, cache_stats::counts> g_cache_stats;
+
+void cache_stats::hit(const std::string& cache)
+{
+	std::scoped_lock lock(g_cache_stats_mutex);
+	++g_cache_stats[cache].hits;
+}
+
+void cache_stats::miss(const std::string& cache)
+{
+	std::scoped_lock lock(g_cache_stats_mutex);
+	++g_cache_stats[cache].misses;
+}
+
+void cache_stats::add(const std::string& cache, const counts& c)
+{
+	std::scoped_lock lock(g_cache_stats_mutex);
+
+	auto& e = g_cache_stats[cache];
+	e.hits += c.hits;
+	e.misses += c.misses;
+}
+
+std::map<std::string, cache_stats::counts> cache_stats::all()
+{
+	std::scoped_lock lock(g_cache_stats_mutex);
+	return g_cache_stats;
+}
+
+
+static std::mutex g_retry_stats_mutex;
+static std::map<std::pair<std::string, std::string>, retry_stats::counts>
+	g_retry_stats;
+
+void retry_stats::add(
+	const std::string& task, const std::string& step,
+	std::chrono::nanoseconds wasted)
+{
+	std::scoped_lock lock(g_retry_stats_mutex);
+
+	auto& e = g_retry_stats[{task, step}];
+	++e.retries;
+	e.wasted += wasted;
+}
+
+std::map<std::pair<std::string, std::string>, retry_stats::counts>
+retry_stats::all()
+{
+	std::scoped_lock lock(g_retry_stats_mutex);
+	return g_retry_stats;
+}
+
+
+// every thread that ends a span has a buffer, owned by this list so that the
+// spans survive the thread; each buffer has its own mutex, which is only
+// contended by all()
+//
+struct span_buffer
+{
+	std::mutex m;
+	std::vector<span::record> records;
+};
+
+static std::mutex g_span_buffers_mutex;
+static std::vector<std::shared_ptr<span_buffer>> g_span_buffers;
+static std::atomic<std::uint64_t> g_next_span_id = 1;
+static thread_local span::thread_state g_span_state;
+
+static span_buffer& this_thread_span_buffer()
+{
+	thread_local std::shared_ptr<span_buffer> b = []
+	{
+		auto b = std::make_shared<span_buffer>();
+
+		std::scoped_lock lock(g_span_buffers_mutex);
+		g_span_buffers.push_back(b);
+
+		return b;
+	}();
+
+	return *b;
+}
+
+span::span(std::string kind, std::string name, std::string task)
+	: ended_(false)
+{
+	r_.id = g_next_span_id++;
+	r_.parent = g_span_state.current;
+	r_.task = task.empty() ? g_span_state.task : std::move(task);
+	r_.kind = std::move(kind);
+	r_.name = std::move(name);
+	r_.start = timestamp();
+	r_.thread = thread_index();
+}
+
+span::~span()
+{
+	end();
+}
+
+std::uint64_t span::id() const
+{
+	return r_.id;
+}
+
+const std::string& span::task() const
+{
+	return r_.task;
+}
+
+void span::end()
+{
+	if (ended_)
+		return;
+
+	ended_ = true;
+	r_.end = timestamp();
+
+	auto& b = this_thread_span_buffer();
+	std::scoped_lock lock(b.m);
+	b.records.push_back(std::move(r_));
+}
+
+const span::thread_state& span::current()
+{
+	return g_span_state;
+}
+
+span::thread_state span::exchange(thread_state s)
+{
+	return std::exchange(g_span_state, std::move(s));
+}
+
+std::vector<span::record> span::all()
+{
+	std::vector<record> v;
+
+	std::scoped_lock lock(g_span_buffers_mutex);
+
+	for (auto&& b : g_span_buffers)
+	{
+		std::scoped_lock block(b->m);
+		v.insert(v.end(), b->records.begin(), b->records.end());
+	}
+
+	return v;
+}
+
+
+span_scope::span_scope(std::string kind, std::string name, std::string task)
+	: span_(std::move(kind), std::move(name), std::move(task))
+{
+	previous_ = span::exchange({span_.id(), span_.task()});
+}
+
+span_scope::~span_scope()
+{
+	span_.end();
+	span::exchange(std::move(previous_));
+}
+
 std::string_view timestamp_string()
 {
 	static thread_local char buffer[50];
@@ -175,6 +575,19 @@ static bool log_enabled(context::level lv, int conf_lv)
 	}
 }
 
+// while the live status is shown, only warnings and errors go to the console,
+// anything else would scroll it away
+//
+static int console_log_level()
+{
+	const int lv = conf::output_log_level();
+
+	if (live_status::active())
+		return std::min(lv, 2);
+
+	return lv;
+}
+
 bool context::enabled(level lv)
 {
 	const int minimum_log_level =
@@ -183,52 +596,397 @@ bool context::enabled(level lv)
 	return log_enabled(lv, minimum_log_level);
 }
 
+static HANDLE open_log_file(const fs::path& p)
+{
+	HANDLE h = CreateFileW(
+		p.native().c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+		nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+
+	if (h == INVALID_HANDLE_VALUE)
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::generic,
+			"failed to open log file {}, {}", p, error_message(e));
+	}
+
+	return h;
+}
+
 void context::set_log_file(const fs::path& p)
 {
 	if (!p.empty())
+		g_log_file.reset(open_log_file(p));
+}
+
+void context::set_json_log_file(const fs::path& p)
+{
+	if (!p.empty())
+		g_json_log_file.reset(open_log_file(p));
+}
+
+const char* level_string(context::level lv)
+{
+	switch (lv)
+	{
+		case context::level::dump:     return "dump";
+		case context::level::trace:    return "trace";
+		case context::level::debug:    return "debug";
+		case context::level::info:     return "info";
+		case context::level::warning:  return "warning";
+		case context::level::error:    return "error";
+		default:                       return "?";
+	}
+}
+
+// a log line that's waiting to be written by the log writer
+//
+struct log_record
+{
+	context::level lv = context::level::info;
+	bool console = false;
+	bool file = false;
+	std::string text;
+
+	// empty if there's no json log
+	std::string json;
+};
+
+// when conf::async_log() is set, log lines are pushed into a bounded
+// multi-producer ring buffer and written by a single thread, so the threads
+// that log, such as the ones reading process pipes, don't wait on the
+// console or the log file
+//
+// the writer takes everything that's available, writes consecutive console
+// lines of the same color in one go and all the file lines with a single
+// WriteFile()
+//
+class log_writer
+{
+public:
+	static log_writer& instance()
+	{
+		static log_writer w;
+		return w;
+	}
+
+	~log_writer()
+	{
+		stop_ = true;
+		cv_.notify_one();
+
+		if (thread_.joinable())
+			thread_.join();
+	}
+
+	void push(log_record r)
 	{
-		HANDLE h = CreateFileW(
-			p.native().c_str(), GENERIC_WRITE, FILE_SHARE_READ,
-			nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+		start();
 
-		if (h == INVALID_HANDLE_VALUE)
+		std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		cell* c = nullptr;
+
+		for (;;)
 		{
-			const auto e = GetLastError();
-			gcx().bail_out(context::generic,
-				"failed to open log file {}, {}", p, error_message(e));
+			c = &cells_[pos & mask];
+
+			const std::size_t seq = c->seq.load(std::memory_order_acquire);
+			const auto diff =
+				static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+			if (diff == 0)
+			{
+				if (enqueue_pos_.compare_exchange_weak(
+					pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				// full, the writer is behind
+				cv_.notify_one();
+				std::this_thread::yield();
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+			else
+			{
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
 		}
 
-		g_log_file.reset(h);
+		c->record = std::move(r);
+		c->seq.store(pos + 1, std::memory_order_release);
+
+		cv_.notify_one();
 	}
+
+	void flush()
+	{
+		const std::size_t target = enqueue_pos_.load(std::memory_order_acquire);
+
+		if (written_.load(std::memory_order_acquire) >= target)
+			return;
+
+		// the writer is the one logging, it can't wait on itself
+		if (std::this_thread::get_id() == thread_.get_id())
+			return;
+
+		cv_.notify_one();
+
+		std::unique_lock lock(flushed_mutex_);
+		flushed_.wait(lock, [&]
+		{
+			return (written_.load(std::memory_order_acquire) >= target);
+		});
+	}
+
+private:
+	static constexpr std::size_t capacity = 4096;
+	static constexpr std::size_t mask = capacity - 1;
+
+	struct cell
+	{
+		std::atomic<std::size_t> seq;
+		log_record record;
+	};
+
+	std::unique_ptr<cell[]> cells_;
+	std::atomic<std::size_t> enqueue_pos_;
+	std::size_t dequeue_pos_;
+	std::atomic<std::size_t> written_;
+
+	std::once_flag started_;
+	std::thread thread_;
+	std::atomic<bool> stop_;
+
+	std::mutex m_;
+	std::condition_variable cv_;
+
+	std::mutex flushed_mutex_;
+	std::condition_variable flushed_;
+
+	log_writer()
+		:	cells_(new cell[capacity]), enqueue_pos_(0), dequeue_pos_(0),
+			written_(0), stop_(false)
+	{
+		for (std::size_t i=0; i<capacity; ++i)
+			cells_[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	void start()
+	{
+		std::call_once(started_, [&]
+		{
+			thread_ = std::thread([&]{ run(); });
+		});
+	}
+
+	// single consumer
+	//
+	bool pop(log_record& r)
+	{
+		cell& c = cells_[dequeue_pos_ & mask];
+
+		if (c.seq.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+			return false;
+
+		r = std::move(c.record);
+		c.seq.store(dequeue_pos_ + capacity, std::memory_order_release);
+		++dequeue_pos_;
+
+		return true;
+	}
+
+	void run()
+	{
+		std::vector<log_record> batch;
+
+		for (;;)
+		{
+			log_record r;
+			while (batch.size() < capacity && pop(r))
+				batch.push_back(std::move(r));
+
+			if (!batch.empty())
+			{
+				write(batch);
+				batch.clear();
+
+				written_.store(dequeue_pos_, std::memory_order_release);
+
+				{
+					std::scoped_lock lock(flushed_mutex_);
+				}
+
+				flushed_.notify_all();
+				continue;
+			}
+
+			if (stop_)
+				break;
+
+			// producers notify without the lock, the timeout catches a
+			// missed notification
+			std::unique_lock lock(m_);
+			cv_.wait_for(lock, std::chrono::milliseconds(20));
+		}
+	}
+
+	void write(const std::vector<log_record>& batch)
+	{
+		std::string console, file, json;
+		context::level console_lv = context::level::info;
+
+		auto flush_console = [&]
+		{
+			if (console.empty())
+				return;
+
+			// write_ln() adds the last newline
+			console.pop_back();
+
+			auto c = level_color(console_lv);
+			u8cout.write_ln(console);
+
+			console.clear();
+		};
+
+		for (auto&& r : batch)
+		{
+			if (r.console)
+			{
+				// a color change ends the run
+				if (!console.empty() &&
+					level_color_value(r.lv) != level_color_value(console_lv))
+				{
+					flush_console();
+				}
+
+				console_lv = r.lv;
+				console += r.text;
+				console += "\n";
+			}
+
+			if (r.file)
+			{
+				file += r.text;
+				file += "\r\n";
+			}
+
+			if (!r.json.empty())
+			{
+				json += r.json;
+				json += "\n";
+			}
+		}
+
+		flush_console();
+		write_file(g_log_file, file);
+		write_file(g_json_log_file, json);
+	}
+
+	static void write_file(const handle_ptr& h, const std::string& s)
+	{
+		if (s.empty() || !h)
+			return;
+
+		DWORD written = 0;
+
+		::WriteFile(
+			h.get(), s.data(), static_cast<DWORD>(s.size()), &written, nullptr);
+	}
+};
+
+
+void flush_logs()
+{
+	if (conf::async_log())
+		log_writer::instance().flush();
 }
 
 void context::do_log_impl(
-	bool bail, reason r, level lv, std::string_view utf8) const
+	bool bail, reason r, level lv, std::string_view utf8, DWORD pid) const
 {
+	std::string json;
+	if (g_json_log_file && log_enabled(lv, conf::file_log_level()))
+		json = make_json_log_string(r, lv, utf8, pid);
+
 	std::string_view ls = make_log_string(r, lv, utf8);
 
 	if (bail)
 	{
-		emit_log(lv, std::string(ls) + " (bailing out)");
+		emit_log(lv, std::string(ls) + " (bailing out)", std::move(json));
+
+		// the error must be out before anything handles the exception
+		flush_logs();
+
 		throw bailed(std::string(ls));
 	}
 	else
 	{
-		emit_log(lv, ls);
+		emit_log(lv, ls, std::move(json));
 	}
 }
 
-void context::emit_log(level lv, std::string_view utf8) const
+std::string context::make_json_log_string(
+	reason r, level lv, std::string_view utf8, DWORD pid) const
+{
+	std::string s = "{\"ts\":";
+	s += timestamp_string();
+	s += ",\"level\":\"";
+	s += level_string(lv);
+	s += "\",\"reason\":";
+	s += json_string(reason_string(r));
+	s += ",\"task\":";
+	s += json_string(task_);
+	s += ",\"tool\":";
+	s += json_string(tool_ ? tool_->name() : "");
+
+	if (pid != 0)
+	{
+		s += ",\"pid\":";
+		s += std::to_string(pid);
+	}
+
+	s += ",\"msg\":";
+	s += json_string(utf8);
+	s += "}";
+
+	return s;
+}
+
+void context::emit_log(level lv, std::string_view utf8, std::string json) const
 {
+	const bool console = log_enabled(lv, console_log_level());
+	const bool file = g_log_file && log_enabled(lv, conf::file_log_level());
+
+	if (lv == level::error || lv == level::warning)
+	{
+		// without the timestamp so identical messages are merged
+		const auto key = utf8.substr(std::min(utf8.size(), g_timestamp_width + 1));
+		problem_summary::instance().add(lv, task_, utf8, key);
+	}
+
+	if (!console && !file && json.empty())
+		return;
+
+	if (conf::async_log())
+	{
+		log_writer::instance().push(
+			{lv, console, file, std::string(utf8), std::move(json)});
+
+		return;
+	}
+
 	std::scoped_lock lock(g_mutex);
 
-	if (log_enabled(lv, conf::output_log_level()))
+	if (console)
 	{
 		auto c = level_color(lv);
 		u8cout.write_ln(utf8);
 	}
 
-	if (g_log_file && log_enabled(lv, conf::file_log_level()))
+	if (file)
 	{
 		DWORD written = 0;
 
@@ -239,10 +997,16 @@ void context::emit_log(level lv, std::string_view utf8) const
 		::WriteFile(g_log_file.get(), "\r\n", 2, &written, nullptr);
 	}
 
-	if (lv == level::error)
-		g_errors.emplace_back(utf8);
-	else if (lv == level::warning)
-		g_warnings.emplace_back(utf8);
+	if (!json.empty())
+	{
+		json += "\n";
+
+		DWORD written = 0;
+
+		::WriteFile(
+			g_json_log_file.get(), json.data(), static_cast<DWORD>(json.size()),
+			&written, nullptr);
+	}
 }
 
 void append_brackets(std::string& s, std::string_view what, std::size_t total)
@@ -283,7 +1047,7 @@ void append(std::string& s, std::string_view what, std::size_t total)
 
 std::string_view context::make_log_string(reason r, level, std::string_view s) const
 {
-	const std::size_t total_timestamp = 8; // '0000.00 '
+	const std::size_t total_timestamp = g_timestamp_width;
 
 	const std::size_t longest_task_name = 15;
 	const std::size_t total_task_name = 1 + longest_task_name + 2; // '[x] '
@@ -356,21 +1120,14 @@ std::string_view context::make_log_string(reason r, level, std::string_view s) c
 
 void dump_logs()
 {
-	if (!g_warnings.empty() || !g_errors.empty())
-	{
-		u8cout << "\n\nthere were problems:\n";
+	flush_logs();
 
-		{
-			auto c = level_color(context::level::warning);
-			for (auto&& s : g_warnings)
-				u8cout << s << "\n";
-		}
+	auto& ps = problem_summary::instance();
 
-		{
-			auto c = level_color(context::level::error);
-			for (auto&& s : g_errors)
-				u8cout << s << "\n";
-		}
+	if (!ps.empty())
+	{
+		u8cout << "\n\nthere were problems:\n";
+		ps.dump();
 	}
 }
 
@@ -11,10 +11,10 @@ namespace mob
 namespace mob::details
 {
 
-// T to std::string converters
+// T to something fmt can format
 //
 // those are kept in this namespace so they don't leak all over the place;
-// they're used directly by doLog() below
+// they're used directly by do_log() below
 
 template <class T, class=void>
 struct converter
@@ -25,16 +25,21 @@ struct converter
 	}
 };
 
-template <>
-struct converter<std::wstring>
+// a wide string given to a log function, converted to utf8 by its formatter
+// when the line is formatted
+//
+struct wide_arg
 {
-	static std::string convert(const std::wstring& s);
+	std::wstring_view s;
 };
 
 template <>
-struct converter<fs::path>
+struct converter<std::wstring>
 {
-	static std::string convert(const fs::path& s);
+	static wide_arg convert(const std::wstring& s)
+	{
+		return {s};
+	}
 };
 
 template <>
@@ -52,12 +57,127 @@ struct converter<T, std::enable_if_t<std::is_enum_v<T>>>
 	}
 };
 
+// converts to utf8 in a thread local buffer that's reused by the next call
+//
+std::string_view utf8_scratch(std::wstring_view s);
+
+// number of automatic replacement fields in a format string, -1 if the braces
+// are unbalanced and -2 if the fields are numbered or named, which isn't
+// checked
+//
+consteval int count_format_fields(std::string_view s)
+{
+	int n = 0;
+
+	for (std::size_t i=0; i<s.size(); ++i)
+	{
+		if (s[i] == '{')
+		{
+			if (i + 1 < s.size() && s[i + 1] == '{')
+			{
+				++i;
+				continue;
+			}
+
+			const auto close = s.find('}', i);
+			if (close == std::string_view::npos)
+				return -1;
+
+			if (close > i + 1 && s[i + 1] != ':')
+				return -2;
+
+			++n;
+			i = close;
+		}
+		else if (s[i] == '}')
+		{
+			if (i + 1 < s.size() && s[i + 1] == '}')
+			{
+				++i;
+				continue;
+			}
+
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+// not constexpr, calling it from the consteval constructor below fails the
+// build
+//
+inline void bad_log_format_string()
+{
+}
+
+// a format string for the log functions, checked when compiling against the
+// number of arguments; strings without arguments are logged as-is
+//
+template <class... Args>
+class basic_log_format
+{
+public:
+	template <std::size_t N>
+	consteval basic_log_format(const char (&s)[N])
+		: s_(s, N - 1)
+	{
+		if constexpr (sizeof...(Args) > 0)
+		{
+			const int n = count_format_fields(s_);
+
+			if (n == -1 || (n >= 0 && n != static_cast<int>(sizeof...(Args))))
+				bad_log_format_string();
+		}
+	}
+
+	std::string_view str() const
+	{
+		return s_;
+	}
+
+private:
+	std::string_view s_;
+};
+
 }	// namespace
 
 
+template <>
+struct fmt::formatter<mob::details::wide_arg> : fmt::formatter<fmt::string_view>
+{
+	template <class FormatContext>
+	auto format(const mob::details::wide_arg& a, FormatContext& ctx)
+	{
+		const auto utf8 = mob::details::utf8_scratch(a.s);
+
+		return fmt::formatter<fmt::string_view>::format(
+			fmt::string_view(utf8.data(), utf8.size()), ctx);
+	}
+};
+
+template <>
+struct fmt::formatter<std::filesystem::path> : fmt::formatter<fmt::string_view>
+{
+	template <class FormatContext>
+	auto format(const std::filesystem::path& p, FormatContext& ctx)
+	{
+		const auto utf8 = mob::details::utf8_scratch(p.native());
+
+		return fmt::formatter<fmt::string_view>::format(
+			fmt::string_view(utf8.data(), utf8.size()), ctx);
+	}
+};
+
+
 namespace mob
 {
 
+template <class... Args>
+using log_format = details::basic_log_format<
+	std::type_identity_t<std::decay_t<Args>>...>;
+
+
 class task;
 class tool;
 
@@ -118,12 +238,24 @@ public:
 	static bool enabled(level lv);
 	static void set_log_file(const fs::path& p);
 
+	// one json object per line with the timestamp, level, reason, task,
+	// tool, pid and message of each log line that goes to the log file
+	//
+	static void set_json_log_file(const fs::path& p);
+
 	context(std::string task_name);
 
 	void set_tool(tool* t);
 
+	// name of the task that owns this context, empty for the global one
+	//
+	const std::string& task_name() const
+	{
+		return task_;
+	}
+
 	template <class... Args>
-	void log(reason r, level lv, const char* f, Args&&... args) const
+	void log(reason r, level lv, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(false, r, lv, f, std::forward<Args>(args)...);
 	}
@@ -133,44 +265,54 @@ public:
 		do_log_string(false, r, lv, s);
 	}
 
+	// output of the process with the given id
+	//
+	void log_process_string(
+		reason r, level lv, std::string_view s, DWORD pid) const
+	{
+		if (enabled(lv))
+			do_log_impl(false, r, lv, s, pid);
+	}
+
 	template <class... Args>
-	void dump(reason r, const char* f, Args&&... args) const
+	void dump(reason r, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(false, r, level::dump, f, std::forward<Args>(args)...);
 	}
 
 	template <class... Args>
-	void trace(reason r, const char* f, Args&&... args) const
+	void trace(reason r, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(false, r, level::trace, f, std::forward<Args>(args)...);
 	}
 
 	template <class... Args>
-	void debug(reason r, const char* f, Args&&... args) const
+	void debug(reason r, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(false, r, level::debug, f, std::forward<Args>(args)...);
 	}
 
 	template <class... Args>
-	void info(reason r, const char* f, Args&&... args) const
+	void info(reason r, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(false, r, level::info, f, std::forward<Args>(args)...);
 	}
 
 	template <class... Args>
-	void warning(reason r, const char* f, Args&&... args) const
+	void warning(reason r, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(false, r, level::warning, f, std::forward<Args>(args)...);
 	}
 
 	template <class... Args>
-	void error(reason r, const char* f, Args&&... args) const
+	void error(reason r, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(false, r, level::error, f, std::forward<Args>(args)...);
 	}
 
 	template <class... Args>
-	[[noreturn]] void bail_out(reason r, const char* f, Args&&... args) const
+	[[noreturn]] void bail_out(
+		reason r, log_format<Args...> f, Args&&... args) const
 	{
 		do_log(true, r, level::error, f, std::forward<Args>(args)...);
 	}
@@ -187,45 +329,57 @@ private:
 		do_log_impl(bail, r, lv, s);
 	}
 
-	void do_log(bool bail, reason r, level lv, const char* f) const
+	void do_log(bool bail, reason r, level lv, log_format<> f) const
 	{
-		do_log_string(bail, r, lv, f);
+		do_log_string(bail, r, lv, f.str());
 	}
 
 	template <class... Args>
-	void do_log(bool bail, reason r, level lv, const char* f, Args&&... args) const
+	void do_log(
+		bool bail, reason r, level lv, log_format<Args...> f,
+		Args&&... args) const
 	{
 		if (!bail && !enabled(lv))
 			return;
 
+		// reused by every line logged on this thread
+		static thread_local ::fmt::memory_buffer buffer;
+		buffer.clear();
+
 		try
 		{
-			const std::string utf8 = ::fmt::format(
-				f,
+			const auto fs = f.str();
+
+			::fmt::format_to(
+				buffer, ::fmt::string_view(fs.data(), fs.size()),
 				details::converter<std::decay_t<Args>>::convert(
 					std::forward<Args>(args))...);
-
-			do_log_impl(bail, r, lv, utf8);
 		}
 		catch(std::exception&)
 		{
-			std::wstring s;
+			// the number of arguments is checked when compiling, but the
+			// format specs aren't
+			const auto fs = f.str();
+			std::wcerr
+				<< "bad format string '"
+				<< std::wstring(fs.begin(), fs.end()) << "'\n";
 
-			const char* p = f;
-			while (*p)
-			{
-				s += (wchar_t)*p;
-				++p;
-			}
-
-			std::wcerr << "bad format string '" << s << "'\n";
 			MOB_ASSERT(false, "bad format string");
+			return;
 		}
+
+		do_log_impl(bail, r, lv, std::string_view(buffer.data(), buffer.size()));
 	}
 
 	std::string_view make_log_string(reason r, level lv, std::string_view s) const;
-	void do_log_impl(bool bail, reason r, level lv, std::string_view utf8) const;
-	void emit_log(level lv, std::string_view utf8) const;
+	void do_log_impl(
+		bool bail, reason r, level lv, std::string_view utf8,
+		DWORD pid=0) const;
+
+	void emit_log(level lv, std::string_view utf8, std::string json) const;
+
+	std::string make_json_log_string(
+		reason r, level lv, std::string_view utf8, DWORD pid) const;
 };
 
 
@@ -236,6 +390,11 @@ inline const context& gcx()
 
 void dump_logs();
 
+// waits until everything logged so far has been written by the log writer,
+// see conf::async_log()
+//
+void flush_logs();
+
 
 // temp
 
@@ -255,34 +414,34 @@ inline void out(context::level lv, const std::string& s, const std::error_code&
 }
 
 template <class... Args>
-[[noreturn]] void bail_out(Args&&... args)
+[[noreturn]] void bail_out(log_format<Args...> f, Args&&... args)
 {
-	gcx().bail_out(context::generic, std::forward<Args>(args)...);
+	gcx().bail_out(context::generic, f, std::forward<Args>(args)...);
 }
 
 
 template <class... Args>
-void error(Args&&... args)
+void error(log_format<Args...> f, Args&&... args)
 {
-	gcx().error(context::generic, std::forward<Args>(args)...);
+	gcx().error(context::generic, f, std::forward<Args>(args)...);
 }
 
 template <class... Args>
-void warn(Args&&... args)
+void warn(log_format<Args...> f, Args&&... args)
 {
-	gcx().warn(context::generic, std::forward<Args>(args)...);
+	gcx().warning(context::generic, f, std::forward<Args>(args)...);
 }
 
 template <class... Args>
-void info(Args&&... args)
+void info(log_format<Args...> f, Args&&... args)
 {
-	gcx().info(context::generic, std::forward<Args>(args)...);
+	gcx().info(context::generic, f, std::forward<Args>(args)...);
 }
 
 template <class... Args>
-void debug(Args&&... args)
+void debug(log_format<Args...> f, Args&&... args)
 {
-	gcx().debug(context::generic, std::forward<Args>(args)...);
+	gcx().debug(context::generic, f, std::forward<Args>(args)...);
 }
 
 }	// namespace
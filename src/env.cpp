@@ -10,27 +10,71 @@
 namespace mob
 {
 
-env get_vcvars_env(arch a)
+// parses the output of `set`, one `name=value` per line
+//
+env parse_vcvars_env(const std::string& text)
 {
-	std::string arch_s;
+	std::stringstream ss(text);
+	env e;
 
-	switch (a)
+	gcx().trace(context::generic, "parsing variables");
+
+	for (;;)
 	{
-		case arch::x86:
-			arch_s = "x86";
+		std::string line;
+		std::getline(ss, line);
+		if (!ss)
 			break;
 
-		case arch::x64:
-			arch_s = "amd64";
-			break;
+		const auto sep = line.find('=');
 
-		case arch::dont_care:
-		default:
-			gcx().bail_out(context::generic, "get_vcvars_env: bad arch");
+		if (sep == std::string::npos)
+			continue;
+
+		std::string name = line.substr(0, sep);
+		std::string value = line.substr(sep + 1);
+
+		gcx().trace(context::generic, "{} = {}", name, value);
+		e.set(std::move(name), std::move(value));
 	}
 
-	gcx().trace(context::generic, "looking for vcvars for {}", arch_s);
+	return e;
+}
+
+// the file in the cache for the environment of the given arch; the name
+// is a hash of everything that can change what vcvars outputs:
+//
+//   - the path of vcvarsall.bat and its modification time, along with the
+//     default toolset version file next to it, which both change when VS is
+//     updated,
+//   - the arch and the versions from the ini, and
+//   - the environment mob was started with, because vcvars builds on top of
+//     it
+//
+fs::path vcvars_cache_file(const std::string& arch_s)
+{
+	const auto bat = vs::vcvars();
+	const auto tools_version = bat.parent_path() /
+		"Microsoft.VCToolsVersion.default.txt";
 
+	std::string key =
+		path_to_utf8(bat) + "\n" +
+		file_time_string(bat) + "\n" +
+		file_time_string(tools_version) + "\n" +
+		arch_s + "\n" +
+		vs::version() + "\n" +
+		vs::toolset() + "\n" +
+		vs::sdk() + "\n";
+
+	for (auto&& [k, v] : this_env::get().get_map())
+		key += utf16_to_utf8(k) + "=" + utf16_to_utf8(v) + "\n";
+
+	const auto name = "vcvars-" + arch_s + "-" + hash_string(key) + ".txt";
+	return paths::cache() / "vcvars" / name;
+}
+
+std::string run_vcvars(const std::string& arch_s)
+{
 	const fs::path tmp = make_temp_file();
 
 	// "vcvarsall.bat" amd64 && set > temp_file
@@ -44,30 +88,66 @@ env get_vcvars_env(arch a)
 
 	gcx().trace(context::generic, "reading from {}", tmp);
 
-	std::stringstream ss(op::read_text_file(gcx(), encodings::utf16, tmp));
+	std::string text = op::read_text_file(gcx(), encodings::utf16, tmp);
 	op::delete_file(gcx(), tmp);
 
-	env e;
+	return text;
+}
 
-	gcx().trace(context::generic, "parsing variables");
+env get_vcvars_env(arch a)
+{
+	std::string arch_s;
 
-	for (;;)
+	switch (a)
 	{
-		std::string line;
-		std::getline(ss, line);
-		if (!ss)
+		case arch::x86:
+			arch_s = "x86";
 			break;
 
-		const auto sep = line.find('=');
+		case arch::x64:
+			arch_s = "amd64";
+			break;
 
-		if (sep == std::string::npos)
-			continue;
+		case arch::dont_care:
+		default:
+			gcx().bail_out(context::generic, "get_vcvars_env: bad arch");
+	}
 
-		std::string name = line.substr(0, sep);
-		std::string value = line.substr(sep + 1);
+	gcx().trace(context::generic, "looking for vcvars for {}", arch_s);
 
-		gcx().trace(context::generic, "{} = {}", name, value);
-		e.set(std::move(name), std::move(value));
+	fs::path cache_file;
+
+	if (conf::vcvars_cache())
+	{
+		cache_file = vcvars_cache_file(arch_s);
+
+		if (fs::exists(cache_file))
+		{
+			gcx().trace(context::generic,
+				"using cached vcvars environment {}", cache_file);
+
+			env e = parse_vcvars_env(
+				op::read_text_file(gcx(), encodings::utf8, cache_file));
+
+			// an empty or truncated file would give a broken path
+			if (!e.get("PATH").empty())
+				return e;
+
+			gcx().debug(context::generic,
+				"cached vcvars environment {} is bad, ignoring", cache_file);
+		}
+	}
+
+	const std::string text = run_vcvars(arch_s);
+	env e = parse_vcvars_env(text);
+
+	if (!cache_file.empty() && !e.get("PATH").empty())
+	{
+		gcx().trace(context::generic,
+			"saving vcvars environment to {}", cache_file);
+
+		op::create_directories(gcx(), cache_file.parent_path());
+		op::write_text_file(gcx(), encodings::utf8, cache_file, text);
 	}
 
 	return e;
@@ -76,13 +156,27 @@ env get_vcvars_env(arch a)
 
 env env::vs_x86()
 {
-	static env e = get_vcvars_env(arch::x86);
+	static env e = startup_profile::instance()
+		.instrument<startup_profile::times::vcvars_x86>([]
+		{
+			env v = get_vcvars_env(arch::x86);
+			compiler_cache::set_env(v);
+			return v;
+		});
+
 	return e;
 }
 
 env env::vs_x64()
 {
-	static env e = get_vcvars_env(arch::x64);
+	static env e = startup_profile::instance()
+		.instrument<startup_profile::times::vcvars_x64>([]
+		{
+			env v = get_vcvars_env(arch::x64);
+			compiler_cache::set_env(v);
+			return v;
+		});
+
 	return e;
 }
 
@@ -105,18 +199,58 @@ env env::vs(arch a)
 }
 
 
+static std::atomic<std::uint64_t> g_next_env_id = 1;
+
+// derived environments, keyed on the id of the base and the list of changes,
+// see env::resolved(); env::data is private, so it's stored as void
+//
+// every task derives its own environments, so the entries that nothing else
+// uses anymore are dropped once there are more than g_max_derived
+static std::mutex g_derived_mutex;
+static std::map<std::pair<std::uint64_t, std::wstring>, std::shared_ptr<void>>
+	g_derived;
+static const std::size_t g_max_derived = 256;
+
+// g_derived_mutex must be locked
+//
+static void trim_derived()
+{
+	if (g_derived.size() < g_max_derived)
+		return;
+
+	for (auto itor=g_derived.begin(); itor!=g_derived.end();)
+	{
+		if (itor->second.use_count() == 1)
+			itor = g_derived.erase(itor);
+		else
+			++itor;
+	}
+
+	// everything is still in use, they'll be derived again if needed
+	if (g_derived.size() >= g_max_derived)
+		g_derived.clear();
+}
+
+
+env::data::data()
+	: id(g_next_env_id++)
+{
+}
+
 env::env()
 	: own_(false)
 {
 }
 
 env::env(const env& e)
-	: data_(e.data_), own_(false)
+	: data_(e.data_), own_(false), changes_(e.changes_)
 {
 }
 
 env::env(env&& e)
-	: data_(std::move(e.data_)), own_(e.own_)
+	:
+		data_(std::move(e.data_)), own_(e.own_),
+		changes_(std::move(e.changes_))
 {
 }
 
@@ -124,6 +258,7 @@ env& env::operator=(const env& e)
 {
 	data_ = e.data_;
 	own_ = false;
+	changes_ = e.changes_;
 	return *this;
 }
 
@@ -131,6 +266,7 @@ env& env::operator=(env&& e)
 {
 	data_ = std::move(e.data_);
 	own_ = e.own_;
+	changes_ = std::move(e.changes_);
 	return *this;
 }
 
@@ -160,213 +296,203 @@ env& env::append_path(const std::vector<fs::path>& v)
 
 env& env::change_path(const std::vector<fs::path>& v, flags f)
 {
-	copy_for_write();
-
-	std::wstring path;
-
-	switch (f)
+	if (f == replace)
 	{
-		case replace:
-		{
-			const auto strings =
-				mob::map(v, [&](auto&& p){ return p.native(); });
-
-			path = join(strings, L";");
-
-			break;
-		}
-
-		case append:
-		{
-			auto current = find(L"PATH");
-			if (current)
-				path = *current;
-
-			for (auto&& p : v)
-			{
-				if (!path.empty())
-					path += L";";
-
-				path += p.native();
-			}
-
-			break;
-		}
+		const auto strings =
+			mob::map(v, [&](auto&& p){ return p.native(); });
 
-		case prepend:
-		{
-			auto current = find(L"PATH");
-			if (current)
-				path = *current;
-
-			for (auto&& p : v)
-			{
-				if (!path.empty())
-					path = L";" + path;
-
-				path = p.native() + path;
-			}
-
-			break;
-		}
+		add_change({L"PATH", join(strings, L";"), replace, false});
+	}
+	else
+	{
+		for (auto&& p : v)
+			add_change({L"PATH", p.native(), f, true});
 	}
-
-	set(L"PATH", path, replace);
 
 	return *this;
 }
 
 env& env::set(std::string_view k, std::string_view v, flags f)
 {
-	copy_for_write();
-	set_impl(utf8_to_utf16(k), utf8_to_utf16(v), f);
+	add_change({utf8_to_utf16(k), utf8_to_utf16(v), f, false});
 	return *this;
 }
 
 env& env::set(std::wstring k, std::wstring v, flags f)
 {
-	copy_for_write();
-	set_impl(std::move(k), std::move(v), f);
+	add_change({std::move(k), std::move(v), f, false});
 	return *this;
 }
 
-void env::set_impl(std::wstring k, std::wstring v, flags f)
+void env::add_change(change c)
+{
+	if (data_ && !own_)
+	{
+		// shared, don't copy it now, see resolved()
+		changes_.push_back(std::move(c));
+		return;
+	}
+
+	if (!data_)
+	{
+		data_.reset(new data);
+		own_ = true;
+	}
+
+	std::scoped_lock lock(data_->m);
+
+	apply(data_->vars, c);
+	data_->sys.clear();
+
+	// anything derived from the old variables is now stale
+	data_->id = g_next_env_id++;
+}
+
+void env::apply(map& vars, const change& c)
 {
-	auto current = find(k);
+	auto itor = vars.find(c.k);
 
-	if (!current)
+	if (itor == vars.end())
 	{
-		data_->vars.emplace(std::move(k), std::move(v));
+		vars.emplace(c.k, c.v);
 		return;
 	}
 
-	switch (f)
+	std::wstring& current = itor->second;
+
+	if (c.path && !current.empty())
+	{
+		if (c.f == append)
+			current += L";" + c.v;
+		else
+			current = c.v + L";" + current;
+
+		return;
+	}
+
+	switch (c.f)
 	{
 		case replace:
-			*current = std::move(v);
+			current = c.v;
 			break;
 
 		case append:
-			*current += v;
+			current += c.v;
 			break;
 
 		case prepend:
-			*current = v + *current;
+			current = c.v + current;
 			break;
 	}
 }
 
-std::string env::get(std::string_view k) const
+std::shared_ptr<env::data> env::resolved() const
 {
-	if (!data_)
-		return {};
+	if (changes_.empty() || !data_)
+		return data_;
 
-	auto current = find(utf8_to_utf16(k));
-	if (!current)
-		return {};
-
-	return utf16_to_utf8(*current);
-}
+	std::wstring key;
 
-env::map env::get_map() const
-{
-	if (!data_)
-		return {};
+	for (auto&& c : changes_)
+	{
+		key += c.k + L'\1' + c.v + L'\1';
+		key += static_cast<wchar_t>(L'0' + c.f);
+		key += (c.path ? L'p' : L'v');
+		key += L'\2';
+	}
 
-	std::scoped_lock lock(data_->m);
-	return data_->vars;
-}
+	std::scoped_lock lock(g_derived_mutex);
 
-void env::set_from(const env& e)
-{
-	copy_for_write();
+	std::uint64_t base_id;
+	map vars;
 
-	if (e.data_)
 	{
-		for (auto&& v : e.data_->vars)
-			set_impl(v.first, v.second, replace);
-	}
-}
+		std::scoped_lock data_lock(data_->m);
+		base_id = data_->id;
 
-void env::create() const
-{
-	data_->sys.clear();
+		auto itor = g_derived.find({base_id, key});
+		if (itor != g_derived.end())
+			return std::static_pointer_cast<data>(itor->second);
 
-	for (auto&& v : data_->vars)
-	{
-		data_->sys += v.first + L"=" + v.second;
-		data_->sys.append(1, L'\0');
+		vars = data_->vars;
 	}
 
-	data_->sys.append(1, L'\0');
+	for (auto&& c : changes_)
+		apply(vars, c);
+
+	auto d = std::make_shared<data>();
+	d->vars = std::move(vars);
+
+	trim_derived();
+	g_derived.emplace(std::make_pair(base_id, std::move(key)), d);
+
+	return d;
 }
 
-std::wstring* env::find(std::wstring_view name)
+std::string env::get(std::string_view k) const
 {
-	if (!data_)
+	auto d = resolved();
+	if (!d)
 		return {};
 
-	for (auto itor=data_->vars.begin(); itor!=data_->vars.end(); ++itor)
-	{
-		if (_wcsicmp(itor->first.c_str(), name.data()) == 0)
-			return &itor->second;
-	}
+	std::scoped_lock lock(d->m);
 
-	return {};
+	auto itor = d->vars.find(utf8_to_utf16(k));
+	if (itor == d->vars.end())
+		return {};
+
+	return utf16_to_utf8(itor->second);
 }
 
-const std::wstring* env::find(std::wstring_view name) const
+env::map env::get_map() const
 {
-	if (!data_)
+	auto d = resolved();
+	if (!d)
 		return {};
 
-	for (auto itor=data_->vars.begin(); itor!=data_->vars.end(); ++itor)
-	{
-		if (_wcsicmp(itor->first.c_str(), name.data()) == 0)
-			return &itor->second;
-	}
+	std::scoped_lock lock(d->m);
+	return d->vars;
+}
 
-	return {};
+void env::set_from(const env& e)
+{
+	for (auto&& [k, v] : e.get_map())
+		add_change({k, v, replace, false});
 }
 
-void* env::get_unicode_pointers() const
+void env::create(data& d) const
 {
-	if (!data_ || data_->vars.empty())
-		return nullptr;
+	d.sys.clear();
 
+	for (auto&& v : d.vars)
 	{
-		std::scoped_lock lock(data_->m);
-		if (data_->sys.empty())
-			create();
+		d.sys += v.first + L"=" + v.second;
+		d.sys.append(1, L'\0');
 	}
 
-	return (void*)data_->sys.c_str();
+	d.sys.append(1, L'\0');
 }
 
-void env::copy_for_write()
+void* env::get_unicode_pointers() const
 {
-	if (own_)
-	{
-		if (data_)
-			data_->sys.clear();
+	auto d = resolved();
+	if (!d)
+		return nullptr;
 
-		return;
-	}
+	std::scoped_lock lock(d->m);
 
-	if (data_)
-	{
-		auto shared = data_;
-		data_.reset(new data);
+	if (d->vars.empty())
+		return nullptr;
 
-		std::scoped_lock lock(shared->m);
-		data_->vars = shared->vars;
-	}
-	else
-	{
-		data_.reset(new data);
-	}
+	// the block is built once per set of variables; derived environments are
+	// kept in g_derived so it's shared by all the processes that use them
+	if (d->sys.empty())
+		create(*d);
+
+	if (d != data_)
+		derived_ = d;
 
-	own_ = true;
+	return (void*)d->sys.c_str();
 }
 
 
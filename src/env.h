@@ -8,7 +8,16 @@ namespace mob
 class env
 {
 public:
-	using map = std::map<std::wstring, std::wstring>;
+	// variable names are case insensitive on windows
+	struct icase_less
+	{
+		bool operator()(const std::wstring& a, const std::wstring& b) const
+		{
+			return (_wcsicmp(a.c_str(), b.c_str()) < 0);
+		}
+	};
+
+	using map = std::map<std::wstring, std::wstring, icase_less>;
 
 	enum flags
 	{
@@ -45,20 +54,47 @@ public:
 private:
 	struct data
 	{
+		// unique for every set of variables, changed when they're modified;
+		// used as the key for derived environments, see resolved()
+		std::uint64_t id;
+
 		std::mutex m;
 		map vars;
 		mutable std::wstring sys;
+
+		data();
+	};
+
+	// a change made on top of a shared environment, such as a prepend_path()
+	// on a copy of env::vs_x64()
+	struct change
+	{
+		std::wstring k;
+		std::wstring v;
+		flags f;
+
+		// for prepend_path() and append_path(), adds a separator if needed
+		bool path;
 	};
 
 	std::shared_ptr<data> data_;
 	bool own_;
 
-	void create() const;
-	std::wstring* find(std::wstring_view name);
-	const std::wstring* find(std::wstring_view name) const;
-	void set_impl(std::wstring k, std::wstring v, flags f);
-	void copy_for_write();
+	// changes that haven't been applied to a copy of data_ yet; those are
+	// applied once for each distinct base and list of changes and the result
+	// is shared by all environments that do the same thing
+	std::vector<change> changes_;
+
+	// the derived environment returned by the last get_unicode_pointers(),
+	// keeps the block alive after it's been dropped from the cache
+	mutable std::shared_ptr<data> derived_;
+
+	void create(data& d) const;
+	std::shared_ptr<data> resolved() const;
+	void add_change(change c);
 	env& change_path(const std::vector<fs::path>& v, flags f);
+
+	static void apply(map& vars, const change& c);
 };
 
 
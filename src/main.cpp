@@ -26,7 +26,12 @@ std::shared_ptr<command> handle_command_line(const std::vector<std::string>& arg
 		std::make_unique<git_command>(),
 		std::make_unique<cmake_command>(),
 		std::make_unique<inis_command>(),
-		std::make_unique<tx_command>()
+		std::make_unique<tx_command>(),
+		std::make_unique<timings_command>(),
+		std::make_unique<snapshot_command>(),
+		std::make_unique<watch_command>(),
+		std::make_unique<replay_command>(),
+		std::make_unique<bench_command>()
 	};
 
 	help->set_commands(commands);
@@ -83,105 +88,178 @@ BOOL WINAPI signal_handler(DWORD) noexcept
 
 void add_tasks()
 {
-	add_task<parallel_tasks>(false)
-		.add_task<sevenz>()
-		.add_task<zlib>()
-		.add_task<fmt>()
-		.add_task<gtest>()
-		.add_task<libbsarch>()
-		.add_task<libloot>()
-		.add_task<openssl>()
-		.add_task<libffi>()
-		.add_task<bzip2>()
-		.add_task<nmm>();
-
-	add_task<parallel_tasks>(false)
-		.add_task<python>()
-		.add_task<boost>()
-		.add_task<boost_di>()
-		.add_task<lz4>()
-		.add_task<spdlog>();
-
-	add_task<parallel_tasks>(false)
-		.add_task<sip>()
-		.add_task<ncc>();
-
-	add_task<parallel_tasks>(false)
-		.add_task<pyqt>()
-		.add_task<usvfs>()
-		.add_task<stylesheets>()
-		.add_task<licenses>()
-		.add_task<explorerpp>();
+	// tasks are fetched in parallel as soon as mob starts, but each task is
+	// only built once all of its dependencies have been built and installed;
+	// see run_all_tasks()
+
+	add_task<sevenz>();
+	add_task<zlib>();
+	add_task<fmt>();
+	add_task<gtest>();
+	add_task<libbsarch>();
+	add_task<libloot>();
+	add_task<openssl>();
+	add_task<libffi>();
+	add_task<bzip2>();
+	add_task<nmm>();
+
+	add_task<python>()
+		.depends_on({"openssl", "bzip2", "zlib", "libffi"});
+
+	add_task<boost>()
+		.depends_on({"python"});
+
+	add_task<boost_di>();
+	add_task<lz4>();
+	add_task<spdlog>();
+
+	add_task<sip>()
+		.depends_on({"python"});
+
+	add_task<ncc>()
+		.depends_on({"nmm"});
+
+	add_task<pyqt>()
+		.depends_on({"python", "sip"});
+
+	// udis requires python in its custom build step
+	add_task<usvfs>()
+		.depends_on({"python"});
+
+	add_task<stylesheets>();
+	add_task<licenses>();
+	add_task<explorerpp>();
 
 
 	using mo = modorganizer;
 
+	// everything given to cmake in modorganizer::create_cmake_tool()
+	const std::vector<std::string> mo_deps =
+	{
+		"boost", "fmt", "spdlog", "libloot", "lz4", "zlib", "python",
+		"7z", "libbsarch", "boost_di", "gtest", "cmake_common"
+	};
+
 	// most of the alternate names below are from the transifex slugs, which
 	// are sometimes different from the project names, for whatever reason
 
-	add_task<parallel_tasks>(true)
-		.add_task<mo>("cmake_common")
-		.add_task<mo>("modorganizer-uibase");
-
-	add_task<parallel_tasks>(true)
-		.add_task<mo>("modorganizer-game_features")
-		.add_task<mo>("modorganizer-archive")
-		.add_task<mo>("modorganizer-lootcli")
-		.add_task<mo>("modorganizer-esptk")
-		.add_task<mo>("modorganizer-bsatk")
-		.add_task<mo>("modorganizer-nxmhandler")
-		.add_task<mo>("modorganizer-helper")
-		.add_task<mo>("githubpp")
-		.add_task<mo>("modorganizer-game_gamebryo")
-		.add_task<mo>({"modorganizer-bsapacker", "bsa_packer"})
-		.add_task<mo>("modorganizer-preview_bsa");
+	add_task<mo>("cmake_common");
+
+	add_task<mo>("modorganizer-uibase")
+		.depends_on(mo_deps);
+
+	add_task<mo>("modorganizer-game_features")
+		.depends_on(mo_deps).depends_on({"uibase"});
+
+	for (auto&& name : {
+		"modorganizer-archive",
+		"modorganizer-lootcli",
+		"modorganizer-esptk",
+		"modorganizer-bsatk",
+		"modorganizer-nxmhandler",
+		"modorganizer-helper",
+		"githubpp"})
+	{
+		add_task<mo>(name)
+			.depends_on(mo_deps).depends_on({"uibase"});
+	}
+
+	add_task<mo>("modorganizer-game_gamebryo")
+		.depends_on(mo_deps).depends_on({"uibase", "game_features"});
+
+	add_task<mo>({"modorganizer-bsapacker", "bsa_packer"})
+		.depends_on(mo_deps).depends_on({"uibase"});
+
+	add_task<mo>("modorganizer-preview_bsa")
+		.depends_on(mo_deps).depends_on({"uibase", "bsatk"});
 
 	// the gamebryo flag must be set for all game plugins that inherit from
 	// the gamebryo classes; this will merge the .ts file from gamebryo with
 	// the one from the specific plugin
-	add_task<parallel_tasks>(true)
-		.add_task<mo>("modorganizer-game_oblivion", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_fallout3", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_fallout4", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_fallout4vr", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_falloutnv", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_morrowind", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_skyrim", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_skyrimse", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_skyrimvr", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_ttw", mo::gamebryo)
-		.add_task<mo>("modorganizer-game_enderal", mo::gamebryo);
-
-	add_task<parallel_tasks>(true)
-		.add_task<mo>({"modorganizer-tool_inieditor", "inieditor"})
-		.add_task<mo>("modorganizer-tool_inibakery")
-		.add_task<mo>("modorganizer-preview_base")
-		.add_task<mo>("modorganizer-diagnose_basic")
-		.add_task<mo>("modorganizer-check_fnis")
-		.add_task<mo>("modorganizer-installer_bain")
-		.add_task<mo>("modorganizer-installer_manual")
-		.add_task<mo>("modorganizer-installer_bundle")
-		.add_task<mo>("modorganizer-installer_quick")
-		.add_task<mo>("modorganizer-installer_fomod")
-		.add_task<mo>("modorganizer-installer_fomod_csharp")
-		.add_task<mo>("modorganizer-installer_ncc")
-		.add_task<mo>("modorganizer-bsa_extractor")
-		.add_task<mo>("modorganizer-plugin_python")
-		.add_task<translations>();
-
-	add_task<parallel_tasks>(true)
-		.add_task<mo>({"modorganizer-tool_configurator", "pycfg"})
-		.add_task<mo>("modorganizer-fnistool")
-		.add_task<mo>("modorganizer-basic_games")
-		.add_task<mo>({
-			"modorganizer-script_extender_plugin_checker",
-			"diagnose-script_extender_plugin_checker",
-			})
-		.add_task<mo>({"modorganizer-form43_checker", "form43checker"})
-		.add_task<mo>({"modorganizer-preview_dds", "ddspreview"})
-		.add_task<mo>({"modorganizer", "organizer"});
-
-	add_task<installer>();
+	for (auto&& name : {
+		"modorganizer-game_oblivion",
+		"modorganizer-game_fallout3",
+		"modorganizer-game_fallout4",
+		"modorganizer-game_fallout4vr",
+		"modorganizer-game_falloutnv",
+		"modorganizer-game_morrowind",
+		"modorganizer-game_skyrim",
+		"modorganizer-game_skyrimse",
+		"modorganizer-game_skyrimvr",
+		"modorganizer-game_ttw",
+		"modorganizer-game_enderal"})
+	{
+		add_task<mo>(name, mo::gamebryo)
+			.depends_on(mo_deps)
+			.depends_on({"uibase", "game_features", "game_gamebryo"});
+	}
+
+	add_task<mo>({"modorganizer-tool_inieditor", "inieditor"})
+		.depends_on(mo_deps).depends_on({"uibase"});
+
+	for (auto&& name : {
+		"modorganizer-tool_inibakery",
+		"modorganizer-preview_base",
+		"modorganizer-diagnose_basic",
+		"modorganizer-check_fnis",
+		"modorganizer-installer_bain",
+		"modorganizer-installer_manual",
+		"modorganizer-installer_bundle",
+		"modorganizer-installer_quick",
+		"modorganizer-installer_fomod",
+		"modorganizer-installer_fomod_csharp",
+		"modorganizer-installer_ncc"})
+	{
+		add_task<mo>(name)
+			.depends_on(mo_deps).depends_on({"uibase", "game_features"});
+	}
+
+	add_task<mo>("modorganizer-bsa_extractor")
+		.depends_on(mo_deps).depends_on({"uibase", "bsatk"});
+
+	add_task<mo>("modorganizer-plugin_python")
+		.depends_on(mo_deps)
+		.depends_on({"uibase", "game_features", "sip", "pyqt"});
+
+	// only needs lrelease, which comes with qt
+	add_task<translations>();
+
+	// python plugins
+	add_task<mo>({"modorganizer-tool_configurator", "pycfg"})
+		.depends_on({"plugin_python"});
+
+	for (auto&& name : {
+		"modorganizer-fnistool",
+		"modorganizer-basic_games"})
+	{
+		add_task<mo>(name)
+			.depends_on({"plugin_python"});
+	}
+
+	add_task<mo>({
+		"modorganizer-script_extender_plugin_checker",
+		"diagnose-script_extender_plugin_checker"})
+		.depends_on({"plugin_python"});
+
+	add_task<mo>({"modorganizer-form43_checker", "form43checker"})
+		.depends_on({"plugin_python"});
+
+	add_task<mo>({"modorganizer-preview_dds", "ddspreview"})
+		.depends_on({"plugin_python"});
+
+	add_task<mo>({"modorganizer", "organizer"})
+		.depends_on(mo_deps)
+		.depends_on({
+			"uibase", "game_features", "archive", "bsatk", "esptk",
+			"githubpp", "usvfs"});
+
+	// builds the solutions of the MO tasks above with aggregate_build
+	add_task<super_build>()
+		.depends_on({"super"});
+
+	// packages everything in the install directory
+	add_task<installer>()
+		.depends_on({"*"});
 }
 
 
@@ -238,11 +316,20 @@ int run(const std::vector<std::string>& args)
 	font_restorer fr;
 	curl_init curl;
 
-	add_tasks();
+	auto& sp = startup_profile::instance();
+
+	sp.instrument<startup_profile::times::add_tasks>([&]
+	{
+		add_tasks();
+	});
 
 	try
 	{
-		auto c = handle_command_line(args);
+		auto c = sp.instrument<startup_profile::times::command_line>([&]
+		{
+			return handle_command_line(args);
+		});
+
 		if (!c)
 			return 1;
 
@@ -253,6 +340,11 @@ int run(const std::vector<std::string>& args)
 		// silent
 		return 1;
 	}
+	catch(interrupted&)
+	{
+		// a tool run outside of a task was interrupted
+		return 1;
+	}
 }
 
 } // namespace
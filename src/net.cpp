@@ -4,6 +4,7 @@
 #include "op.h"
 #include "utility.h"
 #include "context.h"
+#include "status.h"
 
 namespace mob
 {
@@ -15,137 +16,1712 @@ curl_init::curl_init()
 
 curl_init::~curl_init()
 {
+	download_engine::instance().stop();
 	curl_global_cleanup();
 }
 
 
+bool http_post(
+	const context& cx, const url& u,
+	std::string_view body, const std::string& content_type)
+{
+	cx.debug(context::net, "posting {} bytes to {}", body.size(), u);
+
+	if (conf::dry())
+		return true;
+
+	CURL* c = curl_easy_init();
+	if (!c)
+	{
+		cx.warning(context::net, "can't post to {}, curl_easy_init failed", u);
+		return false;
+	}
+
+	guard g([&]{ curl_easy_cleanup(c); });
+
+	const std::string header = "Content-Type: " + content_type;
+	curl_slist* headers = curl_slist_append(nullptr, header.c_str());
+	guard gh([&]{ curl_slist_free_all(headers); });
+
+	// the response body is ignored
+	auto discard = [](char*, size_t size, size_t nmemb, void*) -> size_t
+	{
+		return size * nmemb;
+	};
+
+	curl_easy_setopt(c, CURLOPT_URL, u.c_str());
+	curl_easy_setopt(c, CURLOPT_POST, 1l);
+	curl_easy_setopt(c, CURLOPT_POSTFIELDS, body.data());
+	curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE_LARGE,
+		static_cast<curl_off_t>(body.size()));
+	curl_easy_setopt(c, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1l);
+	curl_easy_setopt(c, CURLOPT_TIMEOUT, 30l);
+	curl_easy_setopt(c, CURLOPT_WRITEFUNCTION,
+		static_cast<size_t (*)(char*, size_t, size_t, void*)>(discard));
+
+	char error[CURL_ERROR_SIZE] = {};
+	curl_easy_setopt(c, CURLOPT_ERRORBUFFER, error);
+
+	const auto r = curl_easy_perform(c);
+
+	if (r != CURLE_OK)
+	{
+		cx.warning(context::net,
+			"failed to post to {}, {}",
+			u, (error[0] ? error : curl_easy_strerror(r)));
+
+		return false;
+	}
+
+	long code = 0;
+	curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &code);
+
+	if (code >= 400)
+	{
+		cx.warning(context::net, "failed to post to {}, http {}", u, code);
+		return false;
+	}
+
+	return true;
+}
+
+
 url::url(const char* p)
 	: s_(p)
 {
 }
 
-url::url(std::string s)
-	: s_(std::move(s))
-{
+url::url(std::string s)
+	: s_(std::move(s))
+{
+}
+
+const char* url::c_str() const
+{
+	return s_.c_str();
+}
+
+const std::string& url::string() const
+{
+	return s_;
+}
+
+bool url::empty() const
+{
+	return s_.empty();
+}
+
+std::string url::filename() const
+{
+	std::string path;
+
+	{
+		auto* h = curl_url();
+		guard g([&]{ curl_url_cleanup(h); });
+
+		auto r = curl_url_set(h, CURLUPART_URL, s_.c_str(), 0);
+
+		if (r != CURLUE_OK)
+			gcx().bail_out(context::net, "bad url '{}'", s_);
+
+		char* buffer = nullptr;
+		r = curl_url_get(h, CURLUPART_PATH, &buffer, 0);
+
+		if (r != CURLUE_OK)
+			gcx().bail_out(context::net, "bad url '{}'", s_);
+
+		guard g2([&]{ curl_free(buffer); });
+
+		path = buffer;
+	}
+
+	const auto pos = path.find_last_of("/");
+
+	if (pos == std::string::npos)
+		return path;
+	else
+		return path.substr(pos + 1);
+}
+
+std::string url::host() const
+{
+	auto* h = curl_url();
+	guard g([&]{ curl_url_cleanup(h); });
+
+	auto r = curl_url_set(h, CURLUPART_URL, s_.c_str(), 0);
+
+	if (r != CURLUE_OK)
+		gcx().bail_out(context::net, "bad url '{}'", s_);
+
+	char* buffer = nullptr;
+	r = curl_url_get(h, CURLUPART_HOST, &buffer, 0);
+
+	if (r != CURLUE_OK)
+		return {};
+
+	guard g2([&]{ curl_free(buffer); });
+
+	std::string s = buffer;
+	std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c)
+	{
+		return static_cast<char>(std::tolower(c));
+	});
+
+	return s;
+}
+
+
+download_engine& download_engine::instance()
+{
+	static download_engine e;
+	return e;
+}
+
+download_engine::download_engine()
+	: multi_(nullptr), share_(nullptr), quit_(false), started_(false)
+{
+}
+
+download_engine::~download_engine()
+{
+	stop();
+}
+
+void download_engine::post(std::function<void ()> f)
+{
+	CURLM* multi = nullptr;
+
+	{
+		std::scoped_lock lock(posted_mutex_);
+
+		if (!started_)
+		{
+			multi_ = curl_multi_init();
+			curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+			// the multi handle already shares connections and dns between its
+			// transfers, but not tls sessions
+			share_ = curl_share_init();
+			curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+			curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+			started_ = true;
+			thread_ = start_thread([&]{ run(); });
+		}
+
+		posted_.push_back(std::move(f));
+		multi = multi_;
+	}
+
+	posted_cv_.notify_one();
+
+	// the thread is in curl_multi_poll() when there are transfers running
+	curl_multi_wakeup(multi);
+}
+
+void download_engine::add(
+	CURL* c, const void* owner, bool multiplex, done_fun done)
+{
+	auto t = std::make_unique<transfer>();
+	t->owner = owner;
+	t->done = std::move(done);
+
+	curl_easy_setopt(c, CURLOPT_ERRORBUFFER, t->error);
+	curl_easy_setopt(c, CURLOPT_SHARE, share_);
+
+	if (multiplex)
+	{
+		// waits for an existing connection to the host instead of opening a
+		// new one, if it can be multiplexed
+		curl_easy_setopt(c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(c, CURLOPT_PIPEWAIT, 1l);
+	}
+	else
+	{
+		curl_easy_setopt(c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+	}
+
+	transfers_.emplace(c, std::move(t));
+	curl_multi_add_handle(multi_, c);
+}
+
+void download_engine::abort(const void* owner)
+{
+	{
+		std::scoped_lock lock(posted_mutex_);
+		if (!started_)
+			return;
+	}
+
+	post([this, owner]
+	{
+		std::vector<CURL*> v;
+
+		for (auto&& [c, t] : transfers_)
+		{
+			if (t->owner == owner)
+				v.push_back(c);
+		}
+
+		for (auto* c : v)
+			finish(c, CURLE_ABORTED_BY_CALLBACK, "aborted");
+	});
+}
+
+void download_engine::stop()
+{
+	{
+		std::scoped_lock lock(posted_mutex_);
+
+		if (!started_)
+			return;
+
+		quit_ = true;
+	}
+
+	posted_cv_.notify_one();
+	curl_multi_wakeup(multi_);
+
+	if (thread_.joinable())
+		thread_.join();
+
+	curl_multi_cleanup(multi_);
+	curl_share_cleanup(share_);
+
+	multi_ = nullptr;
+	share_ = nullptr;
+	started_ = false;
+}
+
+void download_engine::run()
+{
+	while (!quit_)
+	{
+		run_posted();
+
+		int running = 0;
+		const auto r = curl_multi_perform(multi_, &running);
+
+		if (r != CURLM_OK)
+			gcx().error(context::net, "curl: {}", curl_multi_strerror(r));
+
+		check_done();
+
+		if (running > 0)
+		{
+			// woken up by post() for new transfers and aborts, the timeout
+			// is only for curl's own timers
+			curl_multi_poll(multi_, nullptr, 0, 1000, nullptr);
+		}
+		else if (transfers_.empty())
+		{
+			std::unique_lock lock(posted_mutex_);
+			posted_cv_.wait(lock, [&]{ return quit_ || !posted_.empty(); });
+		}
+	}
+
+	cancel_all();
+}
+
+void download_engine::run_posted()
+{
+	std::vector<std::function<void ()>> v;
+
+	{
+		std::scoped_lock lock(posted_mutex_);
+		v.swap(posted_);
+	}
+
+	for (auto&& f : v)
+		f();
+}
+
+void download_engine::check_done()
+{
+	int left = 0;
+
+	while (auto* msg = curl_multi_info_read(multi_, &left))
+	{
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		auto itor = transfers_.find(msg->easy_handle);
+		MOB_ASSERT(itor != transfers_.end());
+
+		finish(msg->easy_handle, msg->data.result, itor->second->error);
+	}
+}
+
+void download_engine::finish(CURL* c, CURLcode r, std::string_view error)
+{
+	auto itor = transfers_.find(c);
+	if (itor == transfers_.end())
+		return;
+
+	auto t = std::move(itor->second);
+	transfers_.erase(itor);
+
+	curl_multi_remove_handle(multi_, c);
+
+	// the error buffer is in the transfer
+	const std::string e(error);
+
+	// this may add new transfers
+	t->done(c, r, e);
+
+	curl_easy_cleanup(c);
+}
+
+void download_engine::cancel_all()
+{
+	for (auto&& [c, t] : transfers_)
+	{
+		curl_multi_remove_handle(multi_, c);
+		t->done(c, CURLE_ABORTED_BY_CALLBACK, "download engine stopped");
+		curl_easy_cleanup(c);
+	}
+
+	transfers_.clear();
+}
+
+
+// downloads get a few buffers per stream, writes are only waited on when the
+// disk is this far behind the network
+static const std::size_t writer_buffer_size = 512 * 1024;
+static const std::size_t writer_buffer_count = 4;
+
+overlapped_writer::overlapped_writer(HANDLE h, std::uint64_t offset)
+	: h_(h), offset_(offset), buffers_(writer_buffer_count), current_(0), error_(0)
+{
+	for (auto&& b : buffers_)
+	{
+		// page-aligned
+		b.data = static_cast<char*>(::VirtualAlloc(
+			nullptr, writer_buffer_size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE));
+
+		b.ov.hEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+		if (!b.data || !b.ov.hEvent)
+			error_ = GetLastError();
+	}
+}
+
+overlapped_writer::~overlapped_writer()
+{
+	for (auto&& b : buffers_)
+	{
+		// the buffer can't be freed while the kernel is still writing it
+		wait(b);
+
+		if (b.ov.hEvent)
+			::CloseHandle(b.ov.hEvent);
+
+		if (b.data)
+			::VirtualFree(b.data, 0, MEM_RELEASE);
+	}
+}
+
+bool overlapped_writer::write(const char* p, std::size_t n)
+{
+	while (n > 0)
+	{
+		if (error_ != 0)
+			return false;
+
+		auto& b = buffers_[current_];
+
+		if (!wait(b))
+			return false;
+
+		const auto c = std::min(n, writer_buffer_size - b.used);
+
+		std::memcpy(b.data + b.used, p, c);
+		b.used += c;
+		p += c;
+		n -= c;
+
+		if (b.used == writer_buffer_size)
+		{
+			if (!submit(b))
+				return false;
+
+			current_ = (current_ + 1) % buffers_.size();
+		}
+	}
+
+	return (error_ == 0);
+}
+
+bool overlapped_writer::flush()
+{
+	auto& b = buffers_[current_];
+
+	if (!b.pending && b.used > 0)
+	{
+		if (!submit(b))
+			return false;
+
+		current_ = (current_ + 1) % buffers_.size();
+	}
+
+	for (auto&& pb : buffers_)
+	{
+		if (!wait(pb))
+			return false;
+	}
+
+	return (error_ == 0);
+}
+
+std::uint64_t overlapped_writer::completed() const
+{
+	// buffers are submitted in order, starting with the one after the
+	// current one
+	for (std::size_t i=1; i<=buffers_.size(); ++i)
+	{
+		const auto& b = buffers_[(current_ + i) % buffers_.size()];
+
+		if (b.pending && !HasOverlappedIoCompleted(&b.ov))
+			return b.offset;
+	}
+
+	return offset_;
+}
+
+DWORD overlapped_writer::error() const
+{
+	return error_;
+}
+
+bool overlapped_writer::submit(buffer& b)
+{
+	if (error_ != 0)
+		return false;
+
+	b.offset = offset_;
+	b.ov.Offset = static_cast<DWORD>(offset_ & 0xffffffff);
+	b.ov.OffsetHigh = static_cast<DWORD>(offset_ >> 32);
+	::ResetEvent(b.ov.hEvent);
+
+	offset_ += b.used;
+
+	// this may also complete right away, in which case the result is still
+	// picked up by wait()
+	const auto r = ::WriteFile(
+		h_, b.data, static_cast<DWORD>(b.used), nullptr, &b.ov);
+
+	if (!r && GetLastError() != ERROR_IO_PENDING)
+	{
+		error_ = GetLastError();
+		return false;
+	}
+
+	b.pending = true;
+	return true;
+}
+
+bool overlapped_writer::wait(buffer& b)
+{
+	if (!b.pending)
+		return true;
+
+	b.pending = false;
+
+	DWORD written = 0;
+	if (!::GetOverlappedResult(h_, &b.ov, &written, TRUE))
+	{
+		if (error_ == 0)
+			error_ = GetLastError();
+	}
+	else if (written != b.used && error_ == 0)
+	{
+		error_ = ERROR_WRITE_FAULT;
+	}
+
+	b.used = 0;
+	return (error_ == 0);
+}
+
+
+// reserves disk space for the file without changing its size, so it's less
+// fragmented
+//
+static void preallocate(HANDLE h, std::uint64_t size)
+{
+	FILE_ALLOCATION_INFO info = {};
+	info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+
+	::SetFileInformationByHandle(h, FileAllocationInfo, &info, sizeof(info));
+}
+
+static bool set_file_size(HANDLE h, std::uint64_t size)
+{
+	FILE_END_OF_FILE_INFO info = {};
+	info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+
+	return ::SetFileInformationByHandle(
+		h, FileEndOfFileInfo, &info, sizeof(info));
+}
+
+
+download_stream::download_stream(accept_fun accept)
+	:
+		accept_(std::move(accept)), read_(INVALID_HANDLE_VALUE),
+		write_(INVALID_HANDLE_VALUE), done_(false), ok_(false)
+{
+	// large enough that the process rarely waits for a write
+	const DWORD pipe_size = 1024 * 1024;
+
+	if (!::CreatePipe(&read_, &write_, nullptr, pipe_size))
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::net, "can't create pipe, {}", error_message(e));
+	}
+}
+
+download_stream::~download_stream()
+{
+	finish(false);
+	close_read();
+}
+
+bool download_stream::accepts(const fs::path& file) const
+{
+	return accept_(file);
+}
+
+HANDLE download_stream::read_handle() const
+{
+	return read_;
+}
+
+void download_stream::close_read()
+{
+	std::scoped_lock lock(mutex_);
+
+	if (read_ != INVALID_HANDLE_VALUE)
+	{
+		::CloseHandle(read_);
+		read_ = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool download_stream::write(const char* p, std::size_t n)
+{
+	while (n > 0)
+	{
+		DWORD written = 0;
+		const auto r = ::WriteFile(
+			write_, p, static_cast<DWORD>(n), &written, nullptr);
+
+		if (!r)
+			return false;
+
+		p += written;
+		n -= written;
+	}
+
+	return true;
+}
+
+void download_stream::finish(bool ok)
+{
+	{
+		std::scoped_lock lock(mutex_);
+
+		if (done_)
+			return;
+
+		done_ = true;
+		ok_ = ok;
+
+		::CloseHandle(write_);
+		write_ = INVALID_HANDLE_VALUE;
+	}
+
+	cv_.notify_all();
+}
+
+bool download_stream::finished() const
+{
+	std::scoped_lock lock(mutex_);
+	return done_;
+}
+
+bool download_stream::wait() const
+{
+	std::unique_lock lock(mutex_);
+	cv_.wait(lock, [&]{ return done_; });
+	return ok_;
+}
+
+
+static std::mutex g_stats_mutex;
+static std::vector<download_stats> g_stats;
+
+double download_stats::average_rate() const
+{
+	using namespace std::chrono;
+
+	const auto s = duration<double>(total).count();
+	return (s > 0 ? static_cast<double>(bytes) / s : 0.0);
+}
+
+void download_stats::record(download_stats s)
+{
+	std::scoped_lock lock(g_stats_mutex);
+	g_stats.push_back(std::move(s));
+}
+
+std::vector<download_stats> download_stats::all()
+{
+	std::scoped_lock lock(g_stats_mutex);
+	return g_stats;
+}
+
+
+curl_downloader::curl_downloader(const context* cx)
+	:
+		cx_(cx ? *cx : gcx()), bytes_(0), interrupt_(false), discard_(false),
+		received_(0), ok_(false),
+		quiet_http_errors_(false), compute_hash_(false), record_stats_(false),
+		window_bytes_(0), ranges_(false), length_(0),
+		saved_length_(0), resume_from_(0), single_(nullptr), headers_(nullptr),
+		not_modified_(false),
+		segments_left_(0), segments_ok_(false), interrupt_segments_(false),
+		on_disk_(0), generation_(0), done_(true)
+{
+}
+
+curl_downloader::~curl_downloader()
+{
+	// the engine's callbacks still point to this downloader until the
+	// transfer is finished, a download that was never joined is aborted and
+	// waited for
+	if (!finished())
+	{
+		interrupt_ = true;
+		download_engine::instance().abort(this);
+
+		std::unique_lock lock(done_mutex_);
+		done_cv_.wait(lock, [&]{ return done_; });
+	}
+
+	if (stream_thread_.joinable())
+		stream_thread_.join();
+}
+
+void curl_downloader::start(const url& u, const fs::path& path)
+{
+	url_ = u;
+	path_ = path;
+	ok_ = false;
+	bytes_ = 0;
+	received_ = 0;
+	discard_ = false;
+	hash_.reset();
+	hash_hex_.clear();
+
+	not_modified_ = false;
+	response_etag_.clear();
+	last_modified_.clear();
+
+	stats_ = {};
+	stats_.task = cx_.task_name();
+	stats_.url = u.string();
+
+	cx_.debug(context::net, "downloading {} to {}", url_, path_);
+
+	if (conf::dry())
+		return;
+
+	{
+		std::scoped_lock lock(done_mutex_);
+		done_ = false;
+	}
+
+	record_stats_ = true;
+	span_ = std::make_unique<span>("download", u.filename());
+
+	if (stream_)
+	{
+		on_disk_ = 0;
+		generation_ = 0;
+		stream_thread_ = start_thread([&]{ pump(); });
+	}
+
+	download_engine::instance().post([&]{ begin(); });
+}
+
+void curl_downloader::join()
+{
+	{
+		std::unique_lock lock(done_mutex_);
+		done_cv_.wait(lock, [&]{ return done_; });
+	}
+
+	if (stream_thread_.joinable())
+		stream_thread_.join();
+
+	if (!record_stats_)
+		return;
+
+	record_stats_ = false;
+
+	using namespace std::chrono;
+
+	auto ms = [](auto d)
+	{
+		return duration_cast<milliseconds>(d).count();
+	};
+
+	auto mbs = [](double bps)
+	{
+		return bps / 1024 / 1024;
+	};
+
+	cx_.debug(context::net,
+		"{} {}: {} bytes in {}ms, {:.2f}MB/s average, {:.2f}MB/s peak, "
+		"dns {}ms, connect {}ms, tls {}ms, first byte {}ms, {} retries",
+		(stats_.ok ? "downloaded" : "failed"), stats_.url,
+		stats_.bytes, ms(stats_.total),
+		mbs(stats_.average_rate()), mbs(stats_.peak_rate),
+		ms(stats_.dns), ms(stats_.connect), ms(stats_.tls), ms(stats_.ttfb),
+		stats_.retries);
+
+	// join() is called from the thread that started the download, which is
+	// where the task's sink is
+	resource_usage u;
+	u.downloads = 1;
+	u.download_bytes = stats_.bytes;
+	u.download_time = stats_.total;
+	u.download_retries = stats_.retries;
+	usage_sink::add(u);
+
+	download_stats::record(stats_);
+}
+
+void curl_downloader::interrupt()
+{
+	cx_.debug(context::interruption, "will interrupt curl");
+	interrupt_ = true;
+
+	// the callbacks only see the flag when curl calls them
+	download_engine::instance().abort(this);
+}
+
+bool curl_downloader::ok() const
+{
+	return ok_;
+}
+
+void curl_downloader::cancel()
+{
+	cx_.debug(context::interruption, "cancelling download of {}", url_);
+	discard_ = true;
+	interrupt_ = true;
+
+	download_engine::instance().abort(this);
+}
+
+bool curl_downloader::finished() const
+{
+	std::scoped_lock lock(done_mutex_);
+	return done_;
+}
+
+std::uint64_t curl_downloader::bytes_received() const
+{
+	return received_;
+}
+
+void curl_downloader::quiet_http_errors(bool b)
+{
+	quiet_http_errors_ = b;
+}
+
+void curl_downloader::stream_to(std::shared_ptr<download_stream> s)
+{
+	stream_ = std::move(s);
+}
+
+void curl_downloader::if_changed(std::string etag, std::string last_modified)
+{
+	if_none_match_ = std::move(etag);
+	if_modified_since_ = std::move(last_modified);
+}
+
+bool curl_downloader::not_modified() const
+{
+	return not_modified_;
+}
+
+const std::string& curl_downloader::etag() const
+{
+	return response_etag_;
+}
+
+const std::string& curl_downloader::last_modified() const
+{
+	return last_modified_;
+}
+
+void curl_downloader::compute_hash(bool b)
+{
+	compute_hash_ = b;
+}
+
+const std::string& curl_downloader::hash() const
+{
+	return hash_hex_;
+}
+
+const download_stats& curl_downloader::stats() const
+{
+	return stats_;
+}
+
+void curl_downloader::setup_handle(CURL* c, const char* u)
+{
+	curl_easy_setopt(c, CURLOPT_URL, u);
+	curl_easy_setopt(c, CURLOPT_PROGRESSFUNCTION, on_progress_static);
+	curl_easy_setopt(c, CURLOPT_PROGRESSDATA, this);
+	curl_easy_setopt(c, CURLOPT_XFERINFOFUNCTION, on_xfer_static);
+	curl_easy_setopt(c, CURLOPT_XFERINFODATA, this);
+	curl_easy_setopt(c, CURLOPT_NOPROGRESS, 0l);
+	curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1l);
+
+	if (context::enabled(context::level::dump))
+	{
+		curl_easy_setopt(c, CURLOPT_DEBUGFUNCTION, on_debug_static);
+		curl_easy_setopt(c, CURLOPT_DEBUGDATA, this);
+		curl_easy_setopt(c, CURLOPT_VERBOSE, 1l);
+	}
+}
+
+void curl_downloader::pump()
+{
+	using namespace std::chrono;
+
+	std::vector<char> buffer(1024 * 1024);
+	handle_ptr in;
+	std::uint64_t pos = 0;
+	std::size_t generation = generation_;
+	bool ok = false;
+
+	auto open = [&](const fs::path& p)
+	{
+		// the downloader has the file open for writing and renames it when
+		// it's done
+		HANDLE h = ::CreateFileW(
+			p.native().c_str(), GENERIC_READ,
+			FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+
+		if (h != INVALID_HANDLE_VALUE)
+			in.reset(h);
+	};
+
+	for (;;)
+	{
+		if (generation_ != generation)
+		{
+			// the file was created again, what's in the pipe is garbage if
+			// anything was read
+			if (pos > 0)
+			{
+				cx_.debug(context::net,
+					"download of {} started over, can't stream it", url_);
+
+				break;
+			}
+
+			in.reset();
+			generation = generation_;
+		}
+
+		// in this order, on_disk_ is final once the download is done
+		const bool done = finished();
+		const std::uint64_t available = on_disk_;
+
+		if (pos < available)
+		{
+			if (!in)
+			{
+				open(part_);
+
+				if (!in && done)
+					open(path_);
+
+				if (!in)
+				{
+					cx_.debug(context::net, "can't open {} to stream it", part_);
+					break;
+				}
+			}
+
+			OVERLAPPED ov = {};
+			ov.Offset = static_cast<DWORD>(pos & 0xffffffff);
+			ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+
+			const auto n = static_cast<DWORD>(
+				std::min<std::uint64_t>(buffer.size(), available - pos));
+
+			DWORD read = 0;
+			if (!::ReadFile(in.get(), buffer.data(), n, &read, &ov) || read == 0)
+			{
+				const auto e = GetLastError();
+				cx_.debug(context::net,
+					"can't read {} to stream it, {}", part_, error_message(e));
+
+				break;
+			}
+
+			if (!stream_->write(buffer.data(), read))
+			{
+				cx_.debug(context::net, "stream for {} was closed", url_);
+				break;
+			}
+
+			pos += read;
+			continue;
+		}
+
+		if (done)
+		{
+			ok = ok_;
+			break;
+		}
+
+		std::this_thread::sleep_for(20ms);
+	}
+
+	cx_.trace(context::net, "streamed {} bytes of {}", pos, url_);
+	stream_->finish(ok);
+}
+
+void curl_downloader::add_times(CURL* c)
+{
+	auto get = [&](CURLINFO i)
+	{
+		curl_off_t us = 0;
+		if (curl_easy_getinfo(c, i, &us) != CURLE_OK)
+			us = 0;
+
+		return std::chrono::microseconds(us);
+	};
+
+	// these are all cumulative from the start of the transfer, so each phase
+	// is the difference with the previous one; tls is 0 for plain http
+	const auto dns = get(CURLINFO_NAMELOOKUP_TIME_T);
+	const auto connect = get(CURLINFO_CONNECT_TIME_T);
+	const auto tls = get(CURLINFO_APPCONNECT_TIME_T);
+	const auto ttfb = get(CURLINFO_STARTTRANSFER_TIME_T);
+
+	stats_.dns = std::max(stats_.dns, dns);
+	stats_.connect = std::max(stats_.connect, connect - dns);
+
+	if (tls.count() > 0)
+		stats_.tls = std::max(stats_.tls, tls - connect);
+
+	stats_.ttfb = std::max(stats_.ttfb, ttfb);
+}
+
+void curl_downloader::count_bytes(std::size_t n) noexcept
+{
+	using namespace std::chrono;
+
+	stats_.bytes += n;
+	received_ += n;
+	window_bytes_ += n;
+
+	const auto now = steady_clock::now();
+	const auto elapsed = duration<double>(now - window_start_).count();
+
+	if (elapsed >= 1.0)
+	{
+		stats_.peak_rate = std::max(
+			stats_.peak_rate, static_cast<double>(window_bytes_) / elapsed);
+
+		window_start_ = now;
+		window_bytes_ = 0;
+	}
+}
+
+fs::path curl_downloader::part_file(const fs::path& file)
+{
+	return file.native() + L".part";
+}
+
+fs::path curl_downloader::part_info_file(const fs::path& file)
+{
+	return file.native() + L".part.info";
+}
+
+void curl_downloader::begin()
+{
+	started_at_ = std::chrono::steady_clock::now();
+	window_start_ = started_at_;
+	window_bytes_ = 0;
+
+	if (interrupt_)
+	{
+		finish(false);
+		return;
+	}
+
+	part_ = part_file(path_);
+	resume_from_ = 0;
+	segments_.clear();
+
+	bool partial = load_part_info();
+
+	if (partial && stream_ && !segments_.empty())
+	{
+		// segments aren't contiguous, the stream needs the file in order
+		cx_.debug(context::net,
+			"partial download {} is segmented, can't stream it", part_);
+
+		delete_partial();
+		segments_.clear();
+		partial = false;
+	}
+
+	const bool segmented = !stream_ &&
+		conf::get_global_int("global", "download_segments") > 1;
+
+	// a conditional request is a single GET that's usually answered with a
+	// 304, there's no point in probing first
+	const bool conditional =
+		!if_none_match_.empty() || !if_modified_since_.empty();
+
+	if (conditional && partial)
+	{
+		delete_partial();
+		segments_.clear();
+		resume_from_ = 0;
+		partial = false;
+	}
+
+	if (!conditional && (partial || segmented))
+		start_probe(partial);
+	else
+		start_single();
+}
+
+bool curl_downloader::load_part_info()
+{
+	saved_etag_.clear();
+	saved_length_ = 0;
+
+	const auto info = part_info_file(path_);
+
+	if (!fs::exists(part_) || !fs::exists(info))
+		return false;
+
+	std::error_code ec;
+	const auto part_size = fs::file_size(part_, ec);
+	if (ec)
+		return false;
+
+	std::ifstream in(info);
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		const auto sep = line.find('=');
+		if (sep == std::string::npos)
+			continue;
+
+		const auto k = trim_copy(line.substr(0, sep));
+		const auto v = trim_copy(line.substr(sep + 1));
+
+		if (k == "etag")
+		{
+			saved_etag_ = v;
+		}
+		else if (k == "length")
+		{
+			const auto r = std::from_chars(
+				v.data(), v.data() + v.size(), saved_length_);
+
+			if (r.ec != std::errc())
+				saved_length_ = 0;
+		}
+		else if (k == "segment")
+		{
+			// offset size written
+			std::istringstream ss(v);
+			segment s;
+			ss >> s.offset >> s.size >> s.written;
+
+			if (ss && s.written <= s.size)
+				segments_.push_back(std::move(s));
+		}
+	}
+
+	if (saved_etag_.empty() || saved_length_ == 0)
+		return false;
+
+	if (segments_.empty())
+	{
+		// a single stream is written sequentially, the size of the file is
+		// what was received, even if mob was killed before saving the info
+		resume_from_ = part_size;
+	}
+	else if (part_size != saved_length_)
+	{
+		// segments are written in a preallocated file
+		segments_.clear();
+		return false;
+	}
+
+	cx_.debug(context::net,
+		"found partial download {}, etag {}, {} bytes",
+		part_, saved_etag_, saved_length_);
+
+	return true;
+}
+
+void curl_downloader::save_part_info()
+{
+	if (etag_.empty())
+		return;
+
+	std::string s =
+		"etag = " + etag_ + "\n" +
+		"length = " + std::to_string(length_) + "\n";
+
+	for (auto&& seg : segments_)
+	{
+		s += "segment = " +
+			std::to_string(seg.offset) + " " +
+			std::to_string(seg.size) + " " +
+			std::to_string(seg.written) + "\n";
+	}
+
+	std::ofstream out(part_info_file(path_), std::ios::binary);
+	out << s;
+
+	if (!out)
+	{
+		cx_.debug(context::net,
+			"can't write {}, download can't be resumed",
+			part_info_file(path_));
+	}
+}
+
+void curl_downloader::delete_partial() const
+{
+	std::error_code ec;
+	fs::remove(part_, ec);
+	fs::remove(part_info_file(path_), ec);
+}
+
+void curl_downloader::start_probe(bool partial)
+{
+	cx_.trace(context::net, "curl: probing {}", url_);
+
+	auto* c = curl_easy_init();
+	ranges_ = false;
+	etag_.clear();
+
+	setup_handle(c, url_.c_str());
+	curl_easy_setopt(c, CURLOPT_NOBODY, 1l);
+	curl_easy_setopt(c, CURLOPT_HEADERFUNCTION, on_header_static);
+	curl_easy_setopt(c, CURLOPT_HEADERDATA, this);
+
+	download_engine::instance().add(c, this, true, [&, partial](auto h, auto r, auto e)
+	{
+		on_probe_done(h, r, e, partial);
+	});
+}
+
+void curl_downloader::on_probe_done(
+	CURL* c, CURLcode r, std::string_view error, bool partial)
+{
+	// segments smaller than this aren't worth the additional connections
+	const std::uint64_t min_segment_size = 8 * 1024 * 1024;
+
+	add_times(c);
+
+	if (interrupt_)
+	{
+		cx_.trace(context::net, "curl: {} interrupted", url_);
+		finish(false);
+		return;
+	}
+
+	auto from_scratch = [&]
+	{
+		if (partial)
+		{
+			cx_.debug(context::net,
+				"partial download {} can't be resumed", part_);
+
+			delete_partial();
+			resume_from_ = 0;
+			segments_.clear();
+		}
+
+		start_single();
+	};
+
+	if (r != CURLE_OK)
+	{
+		cx_.trace(context::net,
+			"curl: probe failed, {}, {}",
+			curl_easy_strerror(r), trim_copy(error));
+
+		from_scratch();
+		return;
+	}
+
+	long h = 0;
+	curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &h);
+
+	curl_off_t cl = -1;
+	curl_easy_getinfo(c, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &cl);
+
+	char* effective = nullptr;
+	curl_easy_getinfo(c, CURLINFO_EFFECTIVE_URL, &effective);
+
+	if (h != 200 || cl <= 0 || !ranges_)
+	{
+		cx_.trace(context::net,
+			"curl: no ranges for {} (http {}, length {}, ranges {})",
+			url_, h, cl, ranges_);
+
+		from_scratch();
+		return;
+	}
+
+	length_ = static_cast<std::uint64_t>(cl);
+	final_url_ = (effective ? effective : url_.string());
+
+	cx_.trace(context::net,
+		"curl: {} accepts ranges, {} bytes at {}, etag {}",
+		url_, length_, final_url_, etag_);
+
+	if (partial)
+	{
+		if (etag_ == saved_etag_ && length_ == saved_length_)
+		{
+			if (!segments_.empty())
+			{
+				cx_.debug(context::net, "resuming segmented download {}", part_);
+				start_segments(true);
+			}
+			else
+			{
+				cx_.debug(context::net,
+					"resuming download {} at {} bytes", part_, resume_from_);
+
+				start_single();
+			}
+
+			return;
+		}
+
+		cx_.debug(context::net,
+			"remote file changed since {} was started (etag {}, length {})",
+			part_, saved_etag_, saved_length_);
+
+		delete_partial();
+		resume_from_ = 0;
+		segments_.clear();
+	}
+
+	const auto segments = static_cast<std::uint64_t>(
+		std::max(1, conf::get_global_int("global", "download_segments")));
+
+	const auto n = std::min(segments, length_ / min_segment_size);
+
+	if (n <= 1 || stream_)
+	{
+		start_single();
+		return;
+	}
+
+	const std::uint64_t segment_size = length_ / n;
+
+	segments_.resize(static_cast<std::size_t>(n));
+
+	for (std::size_t i=0; i<segments_.size(); ++i)
+	{
+		auto& s = segments_[i];
+
+		s.offset = i * segment_size;
+		s.size = (i == segments_.size() - 1 ? length_ - s.offset : segment_size);
+		s.written = 0;
+	}
+
+	start_segments(false);
+}
+
+size_t curl_downloader::on_header_static(
+	char* ptr, size_t size, size_t nmemb, void* user) noexcept
+{
+	// headers are given one by one, including the ones from redirections, so
+	// this only looks at the last response
+	const std::string_view line(ptr, size * nmemb);
+	auto* self = static_cast<curl_downloader*>(user);
+
+	if (line.starts_with("HTTP/"))
+	{
+		self->ranges_ = false;
+		self->etag_.clear();
+		self->response_etag_.clear();
+		self->last_modified_.clear();
+	}
+	else
+	{
+		std::string lc(line);
+		std::transform(lc.begin(), lc.end(), lc.begin(), [](unsigned char ch)
+		{
+			return static_cast<char>(std::tolower(ch));
+		});
+
+		if (lc.starts_with("accept-ranges:"))
+		{
+			self->ranges_ = (lc.find("bytes") != std::string::npos);
+		}
+		else if (lc.starts_with("etag:"))
+		{
+			// weak etags can't be used with If-Range, but they're fine for
+			// If-None-Match
+			auto v = trim_copy(line.substr(5));
+			self->response_etag_ = v;
+
+			if (!v.starts_with("W/"))
+				self->etag_ = std::move(v);
+		}
+		else if (lc.starts_with("last-modified:"))
+		{
+			self->last_modified_ = trim_copy(line.substr(14));
+		}
+	}
+
+	return size * nmemb;
 }
 
-const char* url::c_str() const
+void curl_downloader::start_segments(bool resume)
 {
-	return s_.c_str();
-}
+	const auto count = segments_.size();
 
-const std::string& url::string() const
-{
-	return s_;
-}
+	cx_.trace(context::net,
+		"curl: downloading {} in {} segments", url_, count);
 
-bool url::empty() const
-{
-	return s_.empty();
-}
+	op::create_directories(cx_, path_.parent_path());
 
-std::string url::filename() const
-{
-	std::string path;
+	HANDLE h = ::CreateFileW(
+		part_.native().c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+		nullptr, (resume ? OPEN_EXISTING : CREATE_ALWAYS),
+		FILE_ATTRIBUTE_NORMAL|FILE_FLAG_OVERLAPPED, 0);
 
+	if (h == INVALID_HANDLE_VALUE)
 	{
-		auto* h = curl_url();
-		guard g([&]{ curl_url_cleanup(h); });
+		const auto e = GetLastError();
 
-		auto r = curl_url_set(h, CURLUPART_URL, s_.c_str(), 0);
+		cx_.error(context::net,
+			"failed to open {}, {}", part_, error_message(e));
 
-		if (r != CURLUE_OK)
-			gcx().bail_out(context::net, "bad url '{}'", s_);
+		finish(false);
+		return;
+	}
 
-		char* buffer = nullptr;
-		r = curl_url_get(h, CURLUPART_PATH, &buffer, 0);
+	file_.reset(h);
 
-		if (r != CURLUE_OK)
-			gcx().bail_out(context::net, "bad url '{}'", s_);
+	if (!resume)
+	{
+		// preallocated so the segments can be written at their offset in any
+		// order
+		preallocate(h, length_);
 
-		guard g2([&]{ curl_free(buffer); });
+		if (!set_file_size(h, length_))
+		{
+			const auto e = GetLastError();
+			cx_.debug(context::net,
+				"failed to allocate {} bytes for {}, {}",
+				length_, part_, error_message(e));
 
-		path = buffer;
+			file_.reset();
+			segments_.clear();
+			start_single();
+			return;
+		}
 	}
 
-	const auto pos = path.find_last_of("/");
+	// the info is saved right away so the segments can be resumed even if
+	// mob is killed, although they'll start from their beginning
+	save_part_info();
 
-	if (pos == std::string::npos)
-		return path;
-	else
-		return path.substr(pos + 1);
-}
+	segments_left_ = 0;
+	segments_ok_ = true;
+	hash_.reset();
+
+	for (auto&& s : segments_)
+	{
+		if (s.written < s.size)
+			++segments_left_;
+	}
 
+	if (segments_left_ == 0)
+	{
+		on_segments_done();
+		return;
+	}
 
-curl_downloader::curl_downloader(const context* cx)
-	: cx_(cx ? *cx : gcx()), bytes_(0), interrupt_(false), ok_(false)
-{
+	for (auto&& s : segments_)
+	{
+		if (s.written >= s.size)
+			continue;
+
+		s.self = this;
+
+		const std::string range =
+			std::to_string(s.offset + s.written) + "-" +
+			std::to_string(s.offset + s.size - 1);
+
+		s.writer = std::make_unique<overlapped_writer>(h, s.offset + s.written);
+
+		auto* c = curl_easy_init();
+
+		setup_handle(c, final_url_.c_str());
+		curl_easy_setopt(c, CURLOPT_RANGE, range.c_str());
+		curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, on_segment_write_static);
+		curl_easy_setopt(c, CURLOPT_WRITEDATA, &s);
+
+		// each segment needs its own connection, multiplexing them on the
+		// same one wouldn't be faster than a single stream
+		download_engine::instance().add(c, this, false, [&](auto h, auto r, auto e)
+		{
+			on_segment_done(s, h, r, e);
+		});
+	}
 }
 
-void curl_downloader::start(const url& u, const fs::path& path)
+void curl_downloader::on_segment_done(
+	segment& s, CURL* c, CURLcode r, std::string_view error)
 {
-	url_ = u;
-	path_ = path;
-	ok_ = false;
+	long http = 0;
+	curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &http);
 
-	cx_.debug(context::net, "downloading {} to {}", url_, path_);
+	add_times(c);
 
-	if (conf::dry())
-		return;
+	// what was received must be on disk before the info is saved, even if
+	// the download was interrupted
+	if (s.writer)
+	{
+		if (!s.writer->flush())
+		{
+			cx_.error(context::net,
+				"failed to write to {}, {}",
+				part_, error_message(s.writer->error()));
+
+			segments_ok_ = false;
+		}
+
+		s.writer.reset();
+	}
+
+	if (interrupt_)
+	{
+		// not a failure, the segment can be resumed
+	}
+	else if (r != CURLE_OK)
+	{
+		cx_.debug(context::net,
+			"curl: segment at {}: {}, {}",
+			s.offset, curl_easy_strerror(r), trim_copy(error));
+
+		segments_ok_ = false;
+	}
+	else if (http != 206 || s.written != s.size)
+	{
+		cx_.debug(context::net,
+			"curl: segment at {}: http {}, got {} bytes out of {}",
+			s.offset, http, s.written, s.size);
+
+		segments_ok_ = false;
+	}
+
+	// a failed segment interrupts the others, they'd be downloaded again in
+	// a single stream anyway
+	if (!segments_ok_)
+		interrupt_segments_ = true;
 
-	thread_ = start_thread([&]{ run(); });
+	--segments_left_;
+	if (segments_left_ == 0)
+		on_segments_done();
 }
 
-void curl_downloader::join()
+void curl_downloader::on_segments_done()
 {
-	if (thread_.joinable())
-		thread_.join();
+	file_.reset();
+	interrupt_segments_ = false;
+
+	if (interrupt_)
+	{
+		cx_.trace(context::net, "curl: {} interrupted", url_);
+		finish(false);
+		return;
+	}
+
+	if (!segments_ok_)
+	{
+		cx_.debug(context::net,
+			"curl: segmented download failed, trying single stream");
+
+		delete_partial();
+		segments_.clear();
+		resume_from_ = 0;
+		++stats_.retries;
+
+		start_single();
+		return;
+	}
+
+	bytes_ = static_cast<std::size_t>(length_);
+
+	cx_.trace(context::net,
+		"curl: {} segments done {}, transferred {} bytes",
+		segments_.size(), url_, bytes_);
+
+	finish(true);
 }
 
-void curl_downloader::interrupt()
+size_t curl_downloader::on_segment_write_static(
+	char* ptr, size_t size, size_t nmemb, void* user) noexcept
 {
-	cx_.debug(context::interruption, "will interrupt curl");
-	interrupt_ = true;
+	auto& s = *static_cast<segment*>(user);
+
+	if (s.self->interrupt_ || s.self->interrupt_segments_)
+		return (size * nmemb) + 1; // force failure
+
+	if (!s.self->on_segment_write(s, ptr, size * nmemb))
+		return (size * nmemb) + 1; // force failure
+
+	return size * nmemb;
 }
 
-bool curl_downloader::ok() const
+bool curl_downloader::on_segment_write(
+	segment& s, char* ptr, std::size_t n) noexcept
 {
-	return ok_;
+	// a server that ignores the range would send the whole file
+	if (s.written + n > s.size)
+		return false;
+
+	if (!s.writer->write(ptr, n))
+	{
+		cx_.error(context::net,
+			"failed to write to {}, {}",
+			part_, error_message(s.writer->error()));
+
+		interrupt_ = true;
+		return false;
+	}
+
+	s.written += n;
+	count_bytes(n);
+
+	return true;
 }
 
-void curl_downloader::run()
+void curl_downloader::start_single()
 {
-	cx_.trace(context::net, "curl: initializing {}", url_);
+	cx_.trace(context::net, "curl: performing {}", url_);
 
 	auto* c = curl_easy_init();
-	guard g([&]{ curl_easy_cleanup(c); });
 
-	char error_buffer[CURL_ERROR_SIZE + 1] = {};
-
-	curl_easy_setopt(c, CURLOPT_URL, url_.c_str());
+	setup_handle(c, url_.c_str());
 	curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, on_write_static);
 	curl_easy_setopt(c, CURLOPT_WRITEDATA, this);
-	curl_easy_setopt(c, CURLOPT_PROGRESSFUNCTION, on_progress_static);
-	curl_easy_setopt(c, CURLOPT_PROGRESSDATA, this);
-	curl_easy_setopt(c, CURLOPT_XFERINFOFUNCTION, on_xfer_static);
-	curl_easy_setopt(c, CURLOPT_XFERINFODATA, this);
-	curl_easy_setopt(c, CURLOPT_NOPROGRESS, 0l);
-	curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1l);
-	curl_easy_setopt(c, CURLOPT_ERRORBUFFER, error_buffer);
 
-	if (context::enabled(context::level::dump))
+	if (resume_from_ > 0)
 	{
-		curl_easy_setopt(c, CURLOPT_DEBUGFUNCTION, on_debug_static);
-		curl_easy_setopt(c, CURLOPT_DEBUGDATA, this);
-		curl_easy_setopt(c, CURLOPT_VERBOSE, 1l);
+		// If-Range makes the server send the whole file with a 200 if it has
+		// changed, see on_write()
+		curl_easy_setopt(c, CURLOPT_RESUME_FROM_LARGE,
+			static_cast<curl_off_t>(resume_from_));
+
+		headers_ = curl_slist_append(headers_, ("If-Range: " + etag_).c_str());
+	}
+	else
+	{
+		// etag of the response, so an interrupted download can be resumed
+		etag_.clear();
 	}
 
-	file_deleter output_deleter(cx_, path_);
+	if (!if_none_match_.empty())
+	{
+		headers_ = curl_slist_append(
+			headers_, ("If-None-Match: " + if_none_match_).c_str());
+	}
 
-	cx_.trace(context::net, "curl: performing {}", url_);
-	const auto r = curl_easy_perform(c);
+	if (!if_modified_since_.empty())
+	{
+		headers_ = curl_slist_append(
+			headers_, ("If-Modified-Since: " + if_modified_since_).c_str());
+	}
+
+	if (headers_)
+		curl_easy_setopt(c, CURLOPT_HTTPHEADER, headers_);
+
+	curl_easy_setopt(c, CURLOPT_HEADERFUNCTION, on_header_static);
+	curl_easy_setopt(c, CURLOPT_HEADERDATA, this);
+
+	bytes_ = 0;
+	single_ = c;
+
+	if (compute_hash_)
+	{
+		hash_ = std::make_unique<sha256>();
+
+		// what's already there is read once, the rest is hashed as it's
+		// received
+		if (resume_from_ > 0)
+			hash_->update_from_file(part_, resume_from_);
+	}
+
+	download_engine::instance().add(c, this, true, [&](auto h, auto r, auto e)
+	{
+		on_single_done(h, r, e);
+	});
+}
+
+void curl_downloader::on_single_done(
+	CURL* c, CURLcode r, std::string_view error)
+{
 	cx_.trace(context::net, "curl: transfer finished {}", url_);
 
+	single_ = nullptr;
+	add_times(c);
+
+	if (headers_)
+	{
+		curl_slist_free_all(headers_);
+		headers_ = nullptr;
+	}
+
+	bool written = true;
+
+	if (writer_)
+	{
+		written = writer_->flush();
+		on_disk_ = writer_->completed();
+
+		if (!written)
+		{
+			cx_.error(context::net,
+				"failed to write to {}, {}",
+				part_, error_message(writer_->error()));
+		}
+
+		writer_.reset();
+	}
+
 	if (file_)
 	{
 		::FlushFileBuffers(file_.get());
@@ -155,6 +1731,13 @@ void curl_downloader::run()
 	if (interrupt_)
 	{
 		cx_.trace(context::net, "curl: {} interrupted", url_);
+		finish(false);
+		return;
+	}
+
+	if (!written)
+	{
+		finish(false);
 		return;
 	}
 
@@ -163,14 +1746,26 @@ void curl_downloader::run()
 		long h = 0;
 		curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &h);
 
-		if (h == 200)
+		if (h == 304 && (!if_none_match_.empty() || !if_modified_since_.empty()))
+		{
+			cx_.trace(context::net, "curl: {} not modified", url_);
+
+			not_modified_ = true;
+			finish(true);
+			return;
+		}
+		else if (h == 200 || h == 206)
 		{
 			cx_.trace(context::net,
-				"curl: http 200 {}, transferred {} bytes",
-				url_, bytes_);
+				"curl: http {} {}, transferred {} bytes",
+				h, url_, bytes_);
 
-			ok_ = true;
-			output_deleter.cancel();
+			finish(true);
+			return;
+		}
+		else if (quiet_http_errors_)
+		{
+			cx_.debug(context::net, "curl: http {} {}", h, url_);
 		}
 		else
 		{
@@ -181,8 +1776,107 @@ void curl_downloader::run()
 	{
 		cx_.error(context::net,
 			"curl: {}, {} {}",
-			curl_easy_strerror(r), trim_copy(error_buffer), url_);
+			curl_easy_strerror(r), trim_copy(error), url_);
+	}
+
+	finish(false);
+}
+
+void curl_downloader::finish(bool ok)
+{
+	live_status::instance().end_download(stats_.task);
+	span_.reset();
+
+	// waits for pending writes before closing the file
+	writer_.reset();
+	file_.reset();
+
+	// the conditions only apply to one download
+	if_none_match_.clear();
+	if_modified_since_.clear();
+
+	if (ok && not_modified_)
+	{
+		// nothing was downloaded, the file is left alone
+		delete_partial();
+	}
+	else if (ok && compute_hash_)
+	{
+		if (!hash_)
+		{
+			hash_ = std::make_unique<sha256>();
+
+			if (!hash_->update_from_file(part_))
+			{
+				cx_.error(context::net, "can't read {} to hash it", part_);
+				ok = false;
+			}
+		}
+
+		if (ok)
+		{
+			hash_hex_ = hash_->finish();
+			cx_.trace(context::net, "sha256 of {} is {}", url_, hash_hex_);
+		}
+
+		hash_.reset();
+	}
+
+	if (ok && not_modified_)
+	{
+		// nothing to do
+	}
+	else if (ok)
+	{
+		// the file only appears in the cache once it's complete
+		std::error_code ec;
+		fs::remove(path_, ec);
+		fs::rename(part_, path_, ec);
+
+		if (ec)
+		{
+			cx_.error(context::net,
+				"can't rename {} to {}, {}", part_, path_, ec.message());
+
+			ok = false;
+		}
+
+		fs::remove(part_info_file(path_), ec);
+	}
+	else if (interrupt_ && !discard_ && !etag_.empty() && fs::exists(part_))
+	{
+		cx_.debug(context::net, "keeping partial download {}", part_);
+		save_part_info();
+	}
+	else if (fs::exists(part_))
+	{
+		cx_.debug(context::net, "download failed, deleting {}", part_);
+		delete_partial();
+	}
+
+	ok_ = ok;
+
+	{
+		using namespace std::chrono;
+
+		stats_.ok = ok;
+		stats_.total = duration_cast<microseconds>(
+			steady_clock::now() - started_at_);
+
+		// downloads shorter than the window never updated the peak
+		const auto elapsed = duration<double>(
+			steady_clock::now() - window_start_).count();
+
+		if (stats_.peak_rate == 0 && elapsed > 0)
+			stats_.peak_rate = static_cast<double>(window_bytes_) / elapsed;
+	}
+
+	{
+		std::scoped_lock lock(done_mutex_);
+		done_ = true;
 	}
+
+	done_cv_.notify_all();
 }
 
 size_t curl_downloader::on_write_static(
@@ -211,40 +1905,90 @@ void curl_downloader::on_write(char* ptr, std::size_t n) noexcept
 {
 	if (!file_)
 	{
-		op::create_directories(cx_, path_.parent_path());
+		op::create_directories(cx_, part_.parent_path());
+
+		long http = 0;
+		curl_easy_getinfo(single_, CURLINFO_RESPONSE_CODE, &http);
+
+		// the server sends the whole file when the etag in If-Range doesn't
+		// match anymore
+		const bool append = (resume_from_ > 0 && http == 206);
+
+		if (resume_from_ > 0 && !append)
+		{
+			cx_.debug(context::net,
+				"server didn't resume {} (http {}), starting over", url_, http);
+
+			resume_from_ = 0;
+			++stats_.retries;
+
+			if (hash_)
+				hash_ = std::make_unique<sha256>();
+		}
 
-		cx_.trace(context::net, "opening {}", path_);
+		cx_.trace(context::net, "opening {}", part_);
 
 		HANDLE h = ::CreateFileW(
-			path_.native().c_str(), GENERIC_WRITE, FILE_SHARE_READ,
-			nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+			part_.native().c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+			nullptr, (append ? OPEN_ALWAYS : CREATE_ALWAYS),
+			FILE_ATTRIBUTE_NORMAL|FILE_FLAG_OVERLAPPED, 0);
 
 		if (h == INVALID_HANDLE_VALUE)
 		{
 			const auto e = GetLastError();
 
 			cx_.error(context::net,
-				"failed to open {}, {}", path_, error_message(e));
+				"failed to open {}, {}", part_, error_message(e));
 
 			interrupt_ = true;
 			return;
 		}
 
 		file_.reset(h);
+
+		// anything past what was resumed is garbage
+		if (append)
+			set_file_size(h, resume_from_);
+
+		curl_off_t cl = -1;
+		curl_easy_getinfo(single_, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &cl);
+
+		// the size of the file stays what was written so far, in case the
+		// download is interrupted and resumed
+		if (cl > 0)
+			preallocate(h, static_cast<std::uint64_t>(cl) + resume_from_);
+
+		writer_ = std::make_unique<overlapped_writer>(h, resume_from_);
+
+		// see pump()
+		on_disk_ = resume_from_;
+		++generation_;
+
+		// saved before writing anything, in case mob is killed
+		if (!etag_.empty())
+		{
+			length_ = (cl > 0 ? static_cast<std::uint64_t>(cl) : 0) + resume_from_;
+			save_part_info();
+		}
 	}
 
 	bytes_ += n;
+	count_bytes(n);
 
-	DWORD written = 0;
-	if (!::WriteFile(file_.get(), ptr, static_cast<DWORD>(n), &written, nullptr))
-	{
-		const auto e = GetLastError();
+	if (hash_)
+		hash_->update({ptr, n});
 
+	if (!writer_->write(ptr, n))
+	{
 		cx_.error(context::net,
-			"failed to write to {}, {}", path_, error_message(e));
+			"failed to write to {}, {}",
+			part_, error_message(writer_->error()));
 
 		interrupt_ = true;
 	}
+
+	if (stream_)
+		on_disk_ = writer_->completed();
 }
 
 int curl_downloader::on_progress_static(
@@ -272,6 +2016,15 @@ int curl_downloader::on_xfer_static(
 		return 1;
 	}
 
+	// the arguments are for this transfer only, which is a single segment
+	// for segmented downloads, so the totals of the downloader are used
+	if (live_status::active())
+	{
+		live_status::instance().set_download(
+			self->stats_.task,
+			self->resume_from_ + self->stats_.bytes, self->length_);
+	}
+
 	return 0;
 }
 
@@ -29,32 +29,473 @@ public:
 
 	std::string filename() const;
 
+	// lowercase host name, without the port
+	//
+	std::string host() const;
+
 private:
 	std::string s_;
 };
 
 
+class curl_downloader;
+
+// sends `body` to the url with a POST and waits for the response, used to
+// push build metrics; logs a warning and returns false if the request fails
+// or the server returns an error
+//
+bool http_post(
+	const context& cx, const url& u,
+	std::string_view body, const std::string& content_type);
+
+
+// a pipe through which a file is given to a process while it's being
+// downloaded, see curl_downloader::stream_to()
+//
+class download_stream
+{
+public:
+	using accept_fun = std::function<bool (const fs::path&)>;
+
+	// `accept` is given the path of the file before it's downloaded, the
+	// stream isn't used if it returns false
+	//
+	download_stream(accept_fun accept);
+	~download_stream();
+
+	// non-copyable
+	download_stream(const download_stream&) = delete;
+	download_stream& operator=(const download_stream&) = delete;
+
+	bool accepts(const fs::path& file) const;
+
+	// read end of the pipe, given to the process as its stdin
+	//
+	HANDLE read_handle() const;
+
+	// closes the read end once the process has exited, so writes fail
+	// instead of blocking forever
+	//
+	void close_read();
+
+	// blocks until everything is in the pipe, returns false if the process
+	// is gone
+	//
+	bool write(const char* p, std::size_t n);
+
+	// closes the write end, which the process sees as the end of the file,
+	// and wakes up wait(); only the first call does anything
+	//
+	void finish(bool ok);
+	bool finished() const;
+
+	// waits for finish(), returns whether the whole file went through the
+	// pipe
+	//
+	bool wait() const;
+
+private:
+	accept_fun accept_;
+	HANDLE read_, write_;
+	mutable std::mutex mutex_;
+	mutable std::condition_variable cv_;
+	bool done_, ok_;
+};
+
+
+// timings and throughput of one download, recorded by curl_downloader::join()
+// and written next to the timings file by `build`
+//
+struct download_stats
+{
+	std::string task;
+	std::string url;
+	bool ok = false;
+
+	// bytes received, excluding what was already there for a resumed download
+	std::uint64_t bytes = 0;
+
+	// from curl, the worst of all the transfers that were needed for this
+	// download (probe, segments, etc.); connections that are reused have
+	// zero for dns, connect and tls
+	std::chrono::microseconds dns{}, connect{}, tls{}, ttfb{};
+
+	// wall time from start() to the end of the last transfer
+	std::chrono::microseconds total{};
+
+	// highest number of bytes per second received over a one second window
+	double peak_rate = 0;
+
+	// segmented downloads that fell back to a single stream, servers that
+	// didn't resume a partial download, etc.
+	std::size_t retries = 0;
+
+	// bytes per second over the whole download
+	//
+	double average_rate() const;
+
+	// adds the stats to the list returned by all(), thread-safe
+	//
+	static void record(download_stats s);
+	static std::vector<download_stats> all();
+};
+
+// all downloads are done by a single thread that runs a curl multi handle,
+// which keeps connections alive between transfers to the same host and shares
+// the dns and tls session caches; http/2 connections are multiplexed
+//
+class download_engine
+{
+public:
+	using done_fun = std::function<void (CURL*, CURLcode, std::string_view)>;
+
+	static download_engine& instance();
+
+	~download_engine();
+
+	// runs the function on the engine thread
+	//
+	void post(std::function<void ()> f);
+
+	// adds a transfer, must be called from the engine thread; `done` is
+	// called from the engine thread with the result and the content of the
+	// error buffer, after which the handle is cleaned up
+	//
+	// `multiplex` should be false for transfers that need their own
+	// connection, like the segments of a file; `owner` is for abort()
+	//
+	void add(CURL* c, const void* owner, bool multiplex, done_fun done);
+
+	// aborts all the transfers added with the given owner as soon as the
+	// engine thread wakes up, their `done` is called with
+	// CURLE_ABORTED_BY_CALLBACK; can be called from any thread
+	//
+	void abort(const void* owner);
+
+	// stops the thread and cancels all transfers
+	//
+	void stop();
+
+private:
+	struct transfer
+	{
+		const void* owner = nullptr;
+		done_fun done;
+		char error[CURL_ERROR_SIZE + 1] = {};
+	};
+
+	CURLM* multi_;
+	CURLSH* share_;
+	std::thread thread_;
+	std::atomic<bool> quit_;
+	std::atomic<bool> started_;
+
+	std::mutex posted_mutex_;
+	std::condition_variable posted_cv_;
+	std::vector<std::function<void ()>> posted_;
+
+	// only used by the engine thread
+	std::map<CURL*, std::unique_ptr<transfer>> transfers_;
+
+	download_engine();
+
+	void run();
+	void run_posted();
+	void check_done();
+	void cancel_all();
+
+	// removes the transfer and calls its `done`
+	//
+	void finish(CURL* c, CURLcode r, std::string_view error);
+};
+
+
+// sequential writes to a file opened with FILE_FLAG_OVERLAPPED, starting at
+// a given offset; data is copied into large page-aligned buffers that are
+// written asynchronously once they're full, so the caller only waits on the
+// disk when all the buffers are still being written
+//
+// multiple writers can share the same handle as long as they write to
+// different ranges, see curl_downloader's segments
+//
+class overlapped_writer
+{
+public:
+	overlapped_writer(HANDLE h, std::uint64_t offset);
+
+	// waits for pending writes, but doesn't write what's left in the current
+	// buffer, see flush()
+	//
+	~overlapped_writer();
+
+	// non-copyable
+	overlapped_writer(const overlapped_writer&) = delete;
+	overlapped_writer& operator=(const overlapped_writer&) = delete;
+
+	// returns false if a previous write failed, see error()
+	//
+	bool write(const char* p, std::size_t n);
+
+	// offset up to which all the writes have completed
+	//
+	std::uint64_t completed() const;
+
+	// writes what's left and waits for all pending writes
+	//
+	bool flush();
+
+	// the error of the first write that failed, 0 if none
+	//
+	DWORD error() const;
+
+private:
+	struct buffer
+	{
+		char* data = nullptr;
+		std::size_t used = 0;
+		std::uint64_t offset = 0;
+		OVERLAPPED ov = {};
+		bool pending = false;
+	};
+
+	HANDLE h_;
+	std::uint64_t offset_;
+	std::vector<buffer> buffers_;
+	std::size_t current_;
+	DWORD error_;
+
+	// starts writing the buffer at the current offset
+	//
+	bool submit(buffer& b);
+
+	// waits for the buffer's write to complete, if any
+	//
+	bool wait(buffer& b);
+};
+
+
 class curl_downloader
 {
 public:
 	curl_downloader(const context* cx=nullptr);
+	~curl_downloader();
 
 	void start(const url& u, const fs::path& file);
+	// waits for the download to finish; the first call after start() adds
+	// the stats to the current usage sink and to download_stats::all()
+	//
 	void join();
+
 	void interrupt();
 	bool ok() const;
 
+	// interrupts the download and deletes what was downloaded instead of
+	// keeping it to be resumed, used for downloads that lost a race, see
+	// downloader
+	//
+	void cancel();
+
+	// whether the download is done, successfully or not; join() still has to
+	// be called
+	//
+	bool finished() const;
+
+	// bytes received so far, can be called from any thread
+	//
+	std::uint64_t bytes_received() const;
+
+	// http errors are logged as debug instead of errors, for downloads that
+	// are allowed to be missing
+	//
+	void quiet_http_errors(bool b);
+
+	// the file is also written to the stream as it's downloaded, which
+	// forces a single connection; the stream is finished when the download
+	// is, or as soon as something goes wrong, like a download that has to
+	// start over
+	//
+	void stream_to(std::shared_ptr<download_stream> s);
+
+	// the next download is only done if the file on the server doesn't match
+	// the given etag or is more recent than the given date, which are the
+	// values of the ETag and Last-Modified headers from a previous download,
+	// see etag() and last_modified(); either can be empty
+	//
+	// a file that hasn't changed is left alone and not_modified() returns
+	// true, the download is considered successful
+	//
+	void if_changed(std::string etag, std::string last_modified);
+
+	// whether the server replied with 304 Not Modified, see if_changed()
+	//
+	bool not_modified() const;
+
+	// the ETag and Last-Modified headers from the last response, if any
+	//
+	const std::string& etag() const;
+	const std::string& last_modified() const;
+
+	// whether the sha-256 of the file is computed, see hash()
+	//
+	void compute_hash(bool b);
+
+	// lowercase hex sha-256 of the downloaded file, empty if compute_hash()
+	// wasn't called or the download failed
+	//
+	const std::string& hash() const;
+
+	// a download is written to this file and renamed once it's complete
+	//
+	static fs::path part_file(const fs::path& file);
+
+	// etag, length and progress of each segment for a partial download, used
+	// to resume it on the next run
+	//
+	static fs::path part_info_file(const fs::path& file);
+
+	// stats of the last download, complete once join() returns
+	//
+	const download_stats& stats() const;
+
 private:
+	// one byte range of the file for segmented downloads, see
+	// start_segments()
+	struct segment
+	{
+		curl_downloader* self = nullptr;
+		std::uint64_t offset = 0;
+		std::uint64_t size = 0;
+		std::uint64_t written = 0;
+		std::unique_ptr<overlapped_writer> writer;
+	};
+
 	const context& cx_;
 	url url_;
 	fs::path path_;
 	handle_ptr file_;
-	std::thread thread_;
+	std::unique_ptr<overlapped_writer> writer_;
 	std::size_t bytes_;
 	std::atomic<bool> interrupt_;
+	std::atomic<bool> discard_;
+	std::atomic<std::uint64_t> received_;
 	bool ok_;
+	bool quiet_http_errors_;
+	bool compute_hash_;
 
-	void run();
+	// see stream_to(), the file is read by pump() on its own thread as long
+	// as on_disk_ grows; generation_ changes every time the file is created
+	std::shared_ptr<download_stream> stream_;
+	std::thread stream_thread_;
+	std::atomic<std::uint64_t> on_disk_;
+	std::atomic<std::size_t> generation_;
+
+	// filled on the engine thread, recorded by join()
+	download_stats stats_;
+
+	// from start() to finish()
+	std::unique_ptr<span> span_;
+	bool record_stats_;
+	std::chrono::steady_clock::time_point started_at_;
+	std::chrono::steady_clock::time_point window_start_;
+	std::uint64_t window_bytes_;
+
+	// updated while a single stream is written; segments are written out of
+	// order, so they're hashed from the file once they're done
+	std::unique_ptr<sha256> hash_;
+	std::string hash_hex_;
+
+	// the state of the transfer, only used from the engine thread
+	bool ranges_;
+	std::uint64_t length_;
+	std::string final_url_;
+	std::string etag_;
+
+	// see if_changed(); response_etag_ can be a weak etag, unlike etag_,
+	// which is used for If-Range
+	std::string if_none_match_;
+	std::string if_modified_since_;
+	std::string response_etag_;
+	std::string last_modified_;
+	bool not_modified_;
+
+	// from the info file of a partial download, see load_part_info()
+	std::string saved_etag_;
+	std::uint64_t saved_length_;
+
+	fs::path part_;
+	std::uint64_t resume_from_;
+	CURL* single_;
+	curl_slist* headers_;
+	std::vector<segment> segments_;
+	std::size_t segments_left_;
+	bool segments_ok_;
+	bool interrupt_segments_;
+
+	// set by finish(), waited on by join()
+	mutable std::mutex done_mutex_;
+	std::condition_variable done_cv_;
+	bool done_;
+
+
+	// called on the engine thread by start(), either probes the url for
+	// segmented downloads or starts a single stream
+	//
+	void begin();
+
+	// reads the info file of an interrupted download, returns false if
+	// there's nothing that can be resumed
+	//
+	bool load_part_info();
+	void save_part_info();
+	void delete_partial() const;
+
+	// sends a HEAD request to see if the server accepts byte ranges for this
+	// file and whether its etag still matches the partial download
+	//
+	void start_probe(bool partial);
+
+	void on_probe_done(
+		CURL* c, CURLcode r, std::string_view error, bool partial);
+
+	// downloads byte ranges concurrently into a preallocated file, or
+	// resumes the segments of a partial download; falls back to
+	// start_single() if anything fails
+	//
+	void start_segments(bool resume);
+	void on_segment_done(
+		segment& s, CURL* c, CURLcode r, std::string_view error);
+	void on_segments_done();
+
+	void start_single();
+	void on_single_done(CURL* c, CURLcode r, std::string_view error);
+
+	// closes the file, deletes it if the download failed and wakes up join()
+	//
+	void finish(bool ok);
+
+	void setup_handle(CURL* c, const char* u);
+
+	// reads the file as it's written and gives it to the stream, runs on
+	// stream_thread_
+	//
+	void pump();
+
+	// keeps the worst of the connection timings of the given transfer in
+	// stats_
+	//
+	void add_times(CURL* c);
+
+	// adds to the bytes received and updates the peak rate
+	//
+	void count_bytes(std::size_t n) noexcept;
+
+	static size_t on_header_static(
+		char* ptr, size_t size, size_t nmemb, void* user) noexcept;
+
+	static size_t on_segment_write_static(
+		char* ptr, size_t size, size_t nmemb, void* user) noexcept;
+
+	bool on_segment_write(segment& s, char* ptr, std::size_t n) noexcept;
 
 	static size_t on_write_static(
 		char* ptr, size_t size, size_t nmemb, void* user) noexcept;
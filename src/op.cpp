@@ -9,17 +9,290 @@
 namespace mob::op
 {
 
+trash& trash::instance()
+{
+	static trash t;
+	return t;
+}
+
+// the deletion mostly waits on the disk, a few threads are enough to keep it
+// busy
+//
+trash::trash()
+	: pool_(4), quit_(false), next_(0)
+{
+}
+
+trash::~trash()
+{
+	stop();
+}
+
+fs::path trash::dir()
+{
+	return paths::prefix() / ".mob-trash";
+}
+
+bool trash::add(const context& cx, const fs::path& p)
+{
+	if (quit_)
+		return false;
+
+	std::error_code ec;
+	fs::create_directories(dir(), ec);
+
+	// unique across runs, a previous one might have left things in there
+	const fs::path target = dir() / (
+		path_to_utf8(p.filename()) + "." +
+		std::to_string(GetTickCount64()) + "." +
+		std::to_string(next_++));
+
+	// no MOVEFILE_COPY_ALLOWED, this has to be a rename
+	if (!MoveFileExW(p.native().c_str(), target.native().c_str(), 0))
+	{
+		const auto e = GetLastError();
+
+		cx.trace(context::fs,
+			"can't move {} to trash, {}; deleting now", p, error_message(e));
+
+		return false;
+	}
+
+	cx.trace(context::fs, "moved {} to {}", p, target);
+	queue(cx, target);
+
+	return true;
+}
+
+void trash::resume(const context& cx)
+{
+	std::error_code ec;
+	if (!fs::exists(dir(), ec))
+		return;
+
+	for (auto&& e : fs::directory_iterator(dir(), ec))
+	{
+		cx.debug(context::fs, "deleting {} left in trash", e.path());
+		queue(cx, e.path());
+	}
+}
+
+void trash::stop()
+{
+	quit_ = true;
+	pool_.join();
+}
+
+void trash::queue(const context& cx, const fs::path& p)
+{
+	std::vector<fs::path> entries;
+
+	std::error_code ec;
+	for (auto&& e : fs::directory_iterator(p, ec))
+		entries.push_back(e.path());
+
+	if (entries.empty())
+	{
+		// remove() handles read-only directories
+		pool_.add([this, p]{ remove(p); });
+		return;
+	}
+
+	cx.trace(context::fs,
+		"deleting {} entries in {} in the background", entries.size(), p);
+
+	auto remaining = std::make_shared<std::atomic<std::size_t>>(entries.size());
+
+	for (auto&& e : entries)
+	{
+		pool_.add([this, p, e, remaining]
+		{
+			// also lowers the I/O priority
+			SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+			guard g([&]{
+				SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+			});
+
+			if (!remove(e))
+				return;
+
+			if (--(*remaining) == 0)
+				remove(p);
+		});
+	}
+}
+
+bool trash::remove(const fs::path& p)
+{
+	if (quit_)
+		return false;
+
+	const DWORD attr = GetFileAttributesW(p.native().c_str());
+	if (attr == INVALID_FILE_ATTRIBUTES)
+		return true;
+
+	if (attr & FILE_ATTRIBUTE_READONLY)
+	{
+		SetFileAttributesW(
+			p.native().c_str(), attr & ~DWORD(FILE_ATTRIBUTE_READONLY));
+	}
+
+	// junctions and symlinks are removed without following them
+	const bool is_dir =
+		(attr & FILE_ATTRIBUTE_DIRECTORY) &&
+		!(attr & FILE_ATTRIBUTE_REPARSE_POINT);
+
+	if (is_dir)
+	{
+		std::vector<fs::path> children;
+
+		std::error_code ec;
+		for (auto&& e : fs::directory_iterator(p, ec))
+			children.push_back(e.path());
+
+		for (auto&& c : children)
+		{
+			if (!remove(c))
+				return false;
+		}
+	}
+
+	// failures are ignored, whatever is left is retried on the next run
+	if (attr & FILE_ATTRIBUTE_DIRECTORY)
+		RemoveDirectoryW(p.native().c_str());
+	else
+		DeleteFileW(p.native().c_str());
+
+	return true;
+}
+
+
 void do_touch(const context& cx, const fs::path& p);
 void do_create_directories(const context& cx, const fs::path& p);
 void do_delete_directory(const context& cx, const fs::path& p);
 void do_delete_file(const context& cx, const fs::path& p);
 void do_copy_file_to_dir(const context& cx, const fs::path& f, const fs::path& d);
 void do_copy_file_to_file(const context& cx, const fs::path& f, const fs::path& d);
+void do_copy_file(const context& cx, const fs::path& src, const fs::path& dest);
+bool do_hardlink_file(const context& cx, const fs::path& src, const fs::path& dest);
+bool do_clone_file(const context& cx, const fs::path& src, const fs::path& dest);
 void do_remove_readonly(const context& cx, const fs::path& p);
 void do_rename(const context& cx, const fs::path& src, const fs::path& dest);
 void check(const context& cx, const fs::path& p);
 
 
+static std::mutex g_fs_stats_mutex;
+static std::vector<fs_stats> g_fs_stats;
+
+void fs_stats::record(
+	const context& cx, const char* op,
+	std::uint64_t files, std::uint64_t bytes, std::chrono::nanoseconds time)
+{
+	resource_usage u;
+	u.fs_ops = 1;
+	u.fs_files = files;
+	u.fs_bytes = bytes;
+	u.fs_time = time;
+	usage_sink::add(u);
+
+	const auto task = cx.task_name();
+
+	std::scoped_lock lock(g_fs_stats_mutex);
+
+	// few tasks and ops, a linear search is fine
+	auto itor = std::find_if(g_fs_stats.begin(), g_fs_stats.end(),
+		[&](auto&& s){ return s.task == task && s.op == op; });
+
+	if (itor == g_fs_stats.end())
+	{
+		g_fs_stats.push_back({task, op});
+		itor = g_fs_stats.end() - 1;
+	}
+
+	++itor->calls;
+	itor->files += files;
+	itor->bytes += bytes;
+	itor->time += time;
+}
+
+std::vector<fs_stats> fs_stats::all()
+{
+	std::scoped_lock lock(g_fs_stats_mutex);
+	return g_fs_stats;
+}
+
+
+static std::mutex g_installed_mutex;
+static std::map<std::string, std::set<fs::path>> g_installed;
+
+// remembers `dest` as an output of the task if it's in the install directory
+//
+void record_installed(const context& cx, const fs::path& dest)
+{
+	static const auto install = paths::install().lexically_normal().native();
+
+	const auto p = dest.lexically_normal();
+	if (p.native().compare(0, install.size(), install) != 0)
+		return;
+
+	std::scoped_lock lock(g_installed_mutex);
+	g_installed[cx.task_name()].insert(p);
+}
+
+std::vector<fs::path> take_installed_files(const std::string& task)
+{
+	std::scoped_lock lock(g_installed_mutex);
+
+	auto itor = g_installed.find(task);
+	if (itor == g_installed.end())
+		return {};
+
+	std::vector<fs::path> v(itor->second.begin(), itor->second.end());
+	g_installed.erase(itor);
+
+	return v;
+}
+
+// for the journal, 0 if the file doesn't exist
+//
+std::uint64_t size_or_zero(const fs::path& p)
+{
+	std::error_code ec;
+	const auto n = fs::file_size(p, ec);
+	return (ec ? 0 : n);
+}
+
+// times an operation and records it when it goes out of scope, including
+// when it bails out
+//
+class journal
+{
+public:
+	std::uint64_t files = 0;
+	std::uint64_t bytes = 0;
+
+	journal(const context& cx, const char* op)
+		: cx_(cx), op_(op), start_(std::chrono::steady_clock::now())
+	{
+	}
+
+	~journal()
+	{
+		fs_stats::record(
+			cx_, op_, files, bytes, std::chrono::steady_clock::now() - start_);
+	}
+
+	// non-copyable
+	journal(const journal&) = delete;
+	journal& operator=(const journal&) = delete;
+
+private:
+	const context& cx_;
+	const char* op_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+
 void touch(const context& cx, const fs::path& p)
 {
 	cx.trace(context::fs, "touching {}", p);
@@ -61,8 +334,16 @@ void delete_directory(const context& cx, const fs::path& p, flags f)
 	if (fs::exists(p) && !fs::is_directory(p))
 		cx.bail_out(context::fs, "{} is not a dir", p);
 
+	journal j(cx, "delete");
+	j.files = 1;
+
 	if (!conf::dry())
+	{
+		if (conf::background_delete() && trash::instance().add(cx, p))
+			return;
+
 		do_delete_directory(cx, p);
+	}
 }
 
 void delete_file(const context& cx, const fs::path& p, flags f)
@@ -93,6 +374,9 @@ void delete_file(const context& cx, const fs::path& p, flags f)
 		return;
 	}
 
+	journal j(cx, "delete");
+	j.files = 1;
+
 	if (!conf::dry())
 		do_delete_file(cx, p);
 }
@@ -142,6 +426,178 @@ void remove_readonly(const context& cx, const fs::path& first)
 	}
 }
 
+std::wstring lowercase_name(std::wstring s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), ::towlower);
+	return s;
+}
+
+// hashes of file contents for `compare_contents`, keyed on the size and time
+// of the file so it's only read again when it changes
+//
+// they're kept in one sidecar file per directory in build/.mob-hashes instead
+// of next to the files, which would end up in the install directory and in
+// the release archives
+//
+class content_hashes
+{
+public:
+	static content_hashes& instance()
+	{
+		static content_hashes h;
+		return h;
+	}
+
+	~content_hashes()
+	{
+		flush();
+	}
+
+	std::string get(
+		const fs::path& file, std::uintmax_t size, std::uint64_t time)
+	{
+		const auto name = lowercase_name(file.filename().native());
+
+		{
+			std::scoped_lock lock(m_);
+
+			auto& d = load(file.parent_path());
+			auto itor = d.files.find(name);
+
+			if (itor != d.files.end())
+			{
+				if (itor->second.size == size && itor->second.time == time)
+					return itor->second.hash;
+			}
+		}
+
+		// not locked, this reads the whole file
+		const std::string h = hash_file(file);
+		if (h.empty())
+			return {};
+
+		{
+			std::scoped_lock lock(m_);
+
+			auto& d = load(file.parent_path());
+			d.files[name] = {size, time, h};
+			d.dirty = true;
+		}
+
+		return h;
+	}
+
+	void flush()
+	{
+		std::scoped_lock lock(m_);
+
+		for (auto&& [dir, d] : dirs_)
+		{
+			if (!d.dirty)
+				continue;
+
+			std::error_code ec;
+			fs::create_directories(d.sidecar.parent_path(), ec);
+
+			std::ofstream out(d.sidecar, std::ios::binary);
+
+			for (auto&& [name, e] : d.files)
+			{
+				out
+					<< utf16_to_utf8(name) << "\t"
+					<< e.size << "\t" << e.time << "\t" << e.hash << "\n";
+			}
+
+			d.dirty = false;
+		}
+	}
+
+private:
+	struct entry
+	{
+		std::uintmax_t size;
+		std::uint64_t time;
+		std::string hash;
+	};
+
+	struct dir_entries
+	{
+		fs::path sidecar;
+		std::map<std::wstring, entry> files;
+		bool dirty = false;
+	};
+
+	std::mutex m_;
+	std::map<fs::path, dir_entries> dirs_;
+
+	content_hashes() = default;
+
+	// m_ must be locked
+	//
+	dir_entries& load(const fs::path& dir)
+	{
+		auto itor = dirs_.find(dir);
+		if (itor != dirs_.end())
+			return itor->second;
+
+		dir_entries& d = dirs_[dir];
+
+		d.sidecar = paths::build() / ".mob-hashes" /
+			(hash_string(utf16_to_utf8(lowercase_name(dir.native()))) + ".txt");
+
+		std::ifstream in(d.sidecar, std::ios::binary);
+		std::string line;
+
+		while (std::getline(in, line))
+		{
+			const auto cs = split(line, "\t");
+			if (cs.size() != 4)
+				continue;
+
+			// hashes from before hash_file() used sha256 are computed again
+			if (cs[3].size() != 64)
+				continue;
+
+			entry e;
+			e.size = std::stoull(cs[1]);
+			e.time = std::stoull(cs[2]);
+			e.hash = cs[3];
+
+			d.files[utf8_to_utf16(cs[0])] = std::move(e);
+		}
+
+		return d;
+	}
+};
+
+// for `compare_contents`, called when the source is newer but has the same
+// size; a rebuild that gave the same file shouldn't be copied again, which
+// would only make the target newer and trigger more work downstream
+//
+bool same_contents(
+	const context& cx,
+	const fs::path& src, std::uintmax_t size, std::uint64_t src_time,
+	const fs::path& dest, std::uint64_t dest_time)
+{
+	if (!conf::compare_contents())
+		return false;
+
+	auto& ch = content_hashes::instance();
+
+	const auto sh = ch.get(src, size, src_time);
+	if (sh.empty())
+		return false;
+
+	const auto dh = ch.get(dest, size, dest_time);
+	if (dh.empty() || sh != dh)
+		return false;
+
+	cx.trace(context::bypass,
+		"src {} is newer than dest {} but has the same contents", src, dest);
+
+	return true;
+}
+
 bool is_source_better(
 	const context& cx, const fs::path& src, const fs::path& dest)
 {
@@ -176,7 +632,7 @@ bool is_source_better(
 	if (src_size != dest_size)
 	{
 		cx.trace(context::fs,
-			"src {} bytes, dest {} bytes; different, copying",
+			"src {} {} bytes, dest {} {} bytes; different, copying",
 			src, src_size, dest, dest_size);
 
 		return true;
@@ -205,6 +661,15 @@ bool is_source_better(
 
 	if (src_time > dest_time)
 	{
+		const auto st = static_cast<std::uint64_t>(
+			src_time.time_since_epoch().count());
+
+		const auto dt = static_cast<std::uint64_t>(
+			dest_time.time_since_epoch().count());
+
+		if (same_contents(cx, src, src_size, st, dest, dt))
+			return false;
+
 		cx.trace(context::fs,
 			"src {} is newer than dest {}; copying",
 			src, dest);
@@ -228,6 +693,10 @@ void rename(const context& cx, const fs::path& src, const fs::path& dest)
 	}
 
 	cx.trace(context::fs, "renaming {} to {}", src, dest);
+
+	journal j(cx, "rename");
+	j.files = 1;
+
 	do_rename(cx, src, dest);
 }
 
@@ -247,6 +716,10 @@ void move_to_directory(
 	}
 
 	cx.trace(context::fs, "moving {} to {}", src, target);
+
+	journal j(cx, "rename");
+	j.files = 1;
+
 	do_rename(cx, src, target);
 }
 
@@ -281,11 +754,18 @@ void copy_file_to_dir_if_better(
 			cx.bail_out(context::fs, "can't copy to {}, not a dir", dir);
 	}
 
+	journal j(cx, "copy");
+
 	const auto target = dir / file.filename();
+	record_installed(cx, target);
+
 	if (is_source_better(cx, file, target))
 	{
 		cx.trace(context::fs, "{} -> {}", file, dir);
 
+		j.files = 1;
+		j.bytes = size_or_zero(file);
+
 		if (!conf::dry())
 			do_copy_file_to_dir(cx, file, dir);
 	}
@@ -329,10 +809,16 @@ void copy_file_to_file_if_better(
 		}
 	}
 
+	journal j(cx, "copy");
+	record_installed(cx, dest);
+
 	if (is_source_better(cx, src, dest))
 	{
 		cx.trace(context::fs, "{} -> {}", src, dest);
 
+		j.files = 1;
+		j.bytes = size_or_zero(src);
+
 		if (!conf::dry())
 			do_copy_file_to_file(cx, src, dest);
 	}
@@ -342,68 +828,260 @@ void copy_file_to_file_if_better(
 	}
 }
 
-void copy_glob_to_dir_if_better(
-	const context& cx,
-	const fs::path& src_glob, const fs::path& dest_dir, flags f)
+// size and time of a file from a directory enumeration
+//
+struct file_meta
 {
-	const auto file_parent = src_glob.parent_path();
-	const auto wildcard = src_glob.filename().native();
-
-	if (!fs::exists(file_parent))
-	{
-		cx.bail_out(context::fs,
-			"can't copy glob {} to {}, parent directory {} doesn't exist",
-			src_glob, dest_dir, file_parent);
-	}
+	std::uintmax_t size = 0;
+	std::uint64_t time = 0;
+};
 
+// lowercase names of files in a directory and their metadata
+//
+using dir_meta = std::map<std::wstring, file_meta>;
 
-	for (auto&& e : fs::directory_iterator(file_parent))
-	{
-		const auto name = e.path().filename().native();
+// a file to copy, the directory it goes to and what's known about both
+//
+struct glob_file
+{
+	fs::path src;
+	fs::path dest_dir;
+	file_meta meta;
+	std::shared_ptr<const dir_meta> dest_meta;
+};
 
-		if (!PathMatchSpecW(name.c_str(), wildcard.c_str()))
-		{
-			cx.trace(context::fs,
-				"{} did not match {}; skipping", name, wildcard);
+file_meta find_data_meta(const WIN32_FIND_DATAW& fd)
+{
+	file_meta m;
 
-			continue;
-		}
+	m.size =
+		(std::uintmax_t(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
 
-		if (e.is_regular_file())
-		{
-			if (f & copy_files)
-			{
-				copy_file_to_dir_if_better(cx, e.path(), dest_dir);
-			}
-			else
-			{
-				cx.trace(context::fs,
-					"file {} matched {} but files are not copied",
-					name, wildcard);
-			}
-		}
-		else if (e.is_directory())
-		{
-			if (f & copy_dirs)
-			{
-				const fs::path sub = dest_dir / e.path().filename();
+	m.time =
+		(std::uint64_t(fd.ftLastWriteTime.dwHighDateTime) << 32) |
+		fd.ftLastWriteTime.dwLowDateTime;
 
-				create_directories(cx, sub);
-				copy_glob_to_dir_if_better(cx, e.path() / "*", sub, f);
-			}
-			else
-			{
-				cx.trace(context::fs,
-					"directory {} matched {} but directories are not copied",
-					name, wildcard);
-			}
-		}
-	}
+	return m;
 }
 
-void swap_files(
-	const context& cx, const fs::path& src, const fs::path& dest,
-	const fs::path& backup, flags)
+// calls f() for everything in the directory except . and .., using one
+// enumeration that gets names, attributes, sizes and times at once, instead
+// of opening every file to stat it
+//
+template <class F>
+void for_each_find_data(const fs::path& dir, F&& f)
+{
+	WIN32_FIND_DATAW fd = {};
+
+	HANDLE h = FindFirstFileExW(
+		(dir / "*").native().c_str(), FindExInfoBasic, &fd,
+		FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+
+	if (h == INVALID_HANDLE_VALUE)
+		return;
+
+	guard g([&]{ FindClose(h); });
+
+	do
+	{
+		const std::wstring_view name = fd.cFileName;
+		if (name == L"." || name == L"..")
+			continue;
+
+		f(fd);
+	}
+	while (FindNextFileW(h, &fd));
+}
+
+std::shared_ptr<const dir_meta> find_dir_meta(const fs::path& dir)
+{
+	auto m = std::make_shared<dir_meta>();
+
+	for_each_find_data(dir, [&](auto&& fd)
+	{
+		if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+			(*m)[lowercase_name(fd.cFileName)] = find_data_meta(fd);
+	});
+
+	return m;
+}
+
+// same as the other is_source_better(), but with what was found while
+// enumerating the directories
+//
+bool is_source_better(
+	const context& cx, const glob_file& f, const fs::path& dest)
+{
+	auto itor = f.dest_meta->find(lowercase_name(f.src.filename().native()));
+
+	if (itor == f.dest_meta->end())
+	{
+		cx.trace(context::fs, "target {} doesn't exist; copying", dest);
+		return true;
+	}
+
+	const auto& dm = itor->second;
+
+	if (f.meta.size != dm.size)
+	{
+		cx.trace(context::fs,
+			"src {} {} bytes, dest {} {} bytes; different, copying",
+			f.src, f.meta.size, dest, dm.size);
+
+		return true;
+	}
+
+	if (f.meta.time > dm.time)
+	{
+		if (same_contents(cx, f.src, f.meta.size, f.meta.time, dest, dm.time))
+			return false;
+
+		cx.trace(context::fs,
+			"src {} is newer than dest {}; copying", f.src, dest);
+
+		return true;
+	}
+
+	// same size, same date
+	return false;
+}
+
+// source files matching the glob and the directory they're copied to,
+// recursively; target directories are created while walking so the copies
+// don't have to
+//
+void find_glob_files(
+	const context& cx,
+	const fs::path& src_glob, const fs::path& dest_dir, flags f,
+	std::vector<glob_file>& files)
+{
+	const auto file_parent = src_glob.parent_path();
+	const auto wildcard = src_glob.filename().native();
+
+	if (!fs::exists(file_parent))
+	{
+		cx.bail_out(context::fs,
+			"can't copy glob {} to {}, parent directory {} doesn't exist",
+			src_glob, dest_dir, file_parent);
+	}
+
+	// enumerated once for all the files going there
+	std::shared_ptr<const dir_meta> dest_meta;
+
+	for_each_find_data(file_parent, [&](auto&& fd)
+	{
+		const std::wstring name = fd.cFileName;
+
+		if (!PathMatchSpecW(name.c_str(), wildcard.c_str()))
+		{
+			cx.trace(context::fs,
+				"{} did not match {}; skipping", name, wildcard);
+
+			return;
+		}
+
+		if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+		{
+			if (f & copy_files)
+			{
+				if (!dest_meta)
+					dest_meta = find_dir_meta(dest_dir);
+
+				files.push_back({
+					file_parent / name, dest_dir,
+					find_data_meta(fd), dest_meta});
+			}
+			else
+			{
+				cx.trace(context::fs,
+					"file {} matched {} but files are not copied",
+					name, wildcard);
+			}
+		}
+		else
+		{
+			if (f & copy_dirs)
+			{
+				const fs::path sub = dest_dir / name;
+
+				create_directories(cx, sub);
+				find_glob_files(cx, file_parent / name / "*", sub, f, files);
+			}
+			else
+			{
+				cx.trace(context::fs,
+					"directory {} matched {} but directories are not copied",
+					name, wildcard);
+			}
+		}
+	});
+}
+
+void copy_glob_to_dir_if_better(
+	const context& cx,
+	const fs::path& src_glob, const fs::path& dest_dir, flags f)
+{
+	// copying is mostly waiting on the disk, more than a few at the same
+	// time just fight over it
+	const std::size_t copy_jobs = 8;
+
+	check(cx, src_glob.parent_path());
+	check(cx, dest_dir);
+
+	const auto start = std::chrono::steady_clock::now();
+	journal j(cx, "copy");
+
+	std::vector<glob_file> files;
+	find_glob_files(cx, src_glob, dest_dir, f, files);
+
+	if (!files.empty() && !fs::exists(dest_dir))
+		create_directories(cx, dest_dir);
+
+	std::atomic<std::size_t> copied = 0;
+	std::atomic<std::uintmax_t> bytes = 0;
+
+	parallel_for(files.size(), copy_jobs, [&](std::size_t i)
+	{
+		const auto& gf = files[i];
+		const auto target = gf.dest_dir / gf.src.filename();
+		record_installed(cx, target);
+
+		if (is_source_better(cx, gf, target))
+		{
+			cx.trace(context::fs, "{} -> {}", gf.src, gf.dest_dir);
+
+			bytes += gf.meta.size;
+			++copied;
+
+			if (!conf::dry())
+				do_copy_file(cx, gf.src, target);
+		}
+		else
+		{
+			cx.trace(context::bypass, "(skipped) {} -> {}", gf.src, gf.dest_dir);
+		}
+	});
+
+	j.files = copied;
+	j.bytes = bytes;
+
+	if (copied == 0)
+		return;
+
+	const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	cx.debug(context::fs,
+		"copied {} of {} files from {} to {}, {} bytes in {}ms",
+		copied.load(), files.size(), src_glob, dest_dir, bytes.load(), ms);
+
+	if (conf::compare_contents())
+		content_hashes::instance().flush();
+}
+
+void swap_files(
+	const context& cx, const fs::path& src, const fs::path& dest,
+	const fs::path& backup, flags)
 {
 	cx.trace(context::fs, "swapping {} and {}", src, dest);
 
@@ -438,31 +1116,78 @@ void swap_files(
 	op::rename(cx, dest, src);
 }
 
-std::string read_text_file_impl(const context& cx, const fs::path& p, flags f)
+// size of the utf8 chunks converted and written at a time by
+// write_text_file()
+//
+static constexpr std::size_t write_chunk_size = 64 * 1024;
+
+
+// removes the \r of every \r\n, in place
+//
+void strip_crlf(std::string& s)
 {
-	cx.trace(context::fs, "reading {}", p);
+	auto out = s.begin();
+
+	for (auto itor=s.begin(); itor!=s.end(); ++itor)
+	{
+		if (*itor == '\r' && (itor + 1) != s.end() && *(itor + 1) == '\n')
+			continue;
+
+		*out++ = *itor;
+	}
 
-	std::string s;
-	std::ifstream in(p, std::ios::binary);
+	s.erase(out, s.end());
+}
 
-	in.seekg(0, std::ios::end);
-	s.resize(static_cast<std::size_t>(in.tellg()));
-	in.seekg(0, std::ios::beg);
-	in.read(&s[0], static_cast<std::streamsize>(s.size()));
+// calls `f` with each non-empty line in `s`, split on \r and \n
+//
+template <class Char, class F>
+void for_each_raw_line(std::basic_string_view<Char> s, F&& f)
+{
+	std::size_t start = 0;
 
-	if (in.bad())
+	for (std::size_t i=0; i<=s.size(); ++i)
 	{
-		if (f & optional)
-			cx.debug(context::fs, "can't read from {} (optional)", p);
-		else
-			cx.bail_out(context::fs, "can't read from {}", p);
+		if (i < s.size() && s[i] != Char('\n') && s[i] != Char('\r'))
+			continue;
+
+		if (i > start)
+			f(s.substr(start, i - start));
+
+		start = i + 1;
 	}
-	else
+}
+
+// the end of the longest prefix of `s` that's at most `n` bytes without
+// cutting a utf8 sequence in half
+//
+std::size_t utf8_chunk_end(std::string_view s, std::size_t n)
+{
+	if (n >= s.size())
+		return s.size();
+
+	// continuation bytes are 10xxxxxx
+	while (n > 0 && (static_cast<unsigned char>(s[n]) & 0xc0) == 0x80)
+		--n;
+
+	return n;
+}
+
+bool map_text_file(
+	const context& cx, const mapped_file& m, const fs::path& p, flags f)
+{
+	if (m.ok())
 	{
-		cx.trace(context::fs, "finished reading {}, {} bytes", p, s.size());
+		cx.trace(context::fs, "mapped {}, {} bytes", p, m.bytes().size());
+		return true;
 	}
 
-	return s;
+	if (f & optional)
+		cx.debug(context::fs, "can't read from {} (optional)", p);
+	else
+		cx.bail_out(context::fs, "can't read from {}", p);
+
+	return false;
 }
 
 std::string read_text_file(
@@ -470,28 +1195,129 @@ std::string read_text_file(
 {
 	cx.trace(context::fs, "reading {}", p);
 
-	std::string bytes = read_text_file_impl(cx, p, f);
-	if (bytes.empty())
-		return bytes;
+	mapped_file m(p);
+	if (!map_text_file(cx, m, p, f))
+		return {};
 
-	std::string utf8 = bytes_to_utf8(e, bytes);
-	utf8 = replace_all(utf8, "\r\n", "\n");
+	std::string utf8;
+	std::wstring scratch;
+
+	bytes_to_utf8(e, m.bytes(), utf8, scratch);
+	strip_crlf(utf8);
+
+	cx.trace(context::fs, "finished reading {}, {} bytes", p, utf8.size());
 
 	return utf8;
 }
 
+void for_each_text_line(
+	const context& cx, encodings e, const fs::path& p,
+	const std::function<void (std::string_view)>& fun, flags f)
+{
+	cx.trace(context::fs, "reading lines from {}", p);
+
+	mapped_file m(p);
+	if (!map_text_file(cx, m, p, f))
+		return;
+
+	const std::string_view bytes = m.bytes();
+
+	// reused for every line
+	std::string utf8;
+	std::wstring scratch;
+
+	std::size_t lines = 0;
+
+	switch (e)
+	{
+		case encodings::utf16:
+		{
+			const std::wstring_view ws(
+				reinterpret_cast<const wchar_t*>(bytes.data()),
+				bytes.size() / sizeof(wchar_t));
+
+			for_each_raw_line(ws, [&](std::wstring_view line)
+			{
+				utf16_to_utf8(line, utf8);
+				fun(utf8);
+				++lines;
+			});
+
+			break;
+		}
+
+		case encodings::acp:
+		case encodings::oem:
+		{
+			for_each_raw_line(bytes, [&](std::string_view line)
+			{
+				bytes_to_utf8(e, line, utf8, scratch);
+				fun(utf8);
+				++lines;
+			});
+
+			break;
+		}
+
+		case encodings::utf8:
+		case encodings::dont_know:
+		default:
+		{
+			for_each_raw_line(bytes, [&](std::string_view line)
+			{
+				fun(line);
+				++lines;
+			});
+
+			break;
+		}
+	}
+
+	cx.trace(context::fs, "finished reading {}, {} lines", p, lines);
+}
+
 void write_text_file(
 	const context& cx, encodings e, const fs::path& p,
 	std::string_view utf8, flags f)
 {
 	check(cx, p);
 
-	const std::string bytes = utf8_to_bytes(e, utf8);
-	cx.trace(context::fs, "writing {} bytes to {}", bytes.size(), p);
+	cx.trace(context::fs, "writing {} utf8 bytes to {}", utf8.size(), p);
+
+	// reused for every chunk
+	std::string bytes;
+	std::wstring scratch;
+
+	std::size_t written = 0;
 
 	{
 		std::ofstream out(p, std::ios::binary);
-		out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+
+		const bool convert =
+			(e != encodings::utf8 && e != encodings::dont_know);
+
+		std::string_view rest = utf8;
+
+		while (!rest.empty() && out.good())
+		{
+			const auto n = utf8_chunk_end(rest, write_chunk_size);
+
+			// a chunk that's all continuation bytes is broken utf8 anyway
+			const auto chunk = rest.substr(0, (n == 0 ? rest.size() : n));
+			rest.remove_prefix(chunk.size());
+
+			std::string_view b = chunk;
+
+			if (convert)
+			{
+				utf8_to_bytes(e, chunk, bytes, scratch);
+				b = bytes;
+			}
+
+			out.write(b.data(), static_cast<std::streamsize>(b.size()));
+			written += b.size();
+		}
+
 		out.close();
 
 		if (out.bad())
@@ -507,29 +1333,57 @@ void write_text_file(
 		}
 	}
 
-	cx.trace(context::fs,
-		"finished writing {} bytes to {}", bytes.size(), p);
+	cx.trace(context::fs, "finished writing {} bytes to {}", written, p);
+}
+
+// compression method, level and solid block size from the ini, and the
+// number of threads
+//
+void add_compression_args(process& p, std::size_t threads)
+{
+	const auto method = conf::get_global("global", "archive_method");
+	if (!method.empty())
+		p.arg("-m0=", method, process::nospace);
+
+	p.arg("-mx=", std::to_string(conf::get_global_int("global", "archive_level")),
+		process::nospace);
+
+	const auto solid = conf::get_global("global", "archive_solid");
+	if (!solid.empty())
+		p.arg("-ms=", solid, process::nospace);
+
+	if (threads > 0)
+		p.arg("-mmt=", std::to_string(threads), process::nospace);
 }
 
 void archive_from_glob(
 	const context& cx,
 	const fs::path& src_glob, const fs::path& dest_file,
-	const std::vector<std::string>& ignore)
+	const std::vector<std::string>& ignore, std::size_t threads)
 {
 	cx.trace(context::fs, "archiving {} into {}", src_glob, dest_file);
 
+	journal j(cx, "archive");
+
 	if (conf::dry())
 		return;
 
+	guard size([&]
+	{
+		j.files = 1;
+		j.bytes = size_or_zero(dest_file);
+	});
+
 	op::create_directories(cx, dest_file.parent_path());
 
 	auto p = process()
 		.binary(extractor::binary())
 		.arg("a")
 		.arg(dest_file)
-		.arg("-r")
-		.arg("-mx=5")
-		.arg(src_glob);
+		.arg("-r");
+
+	add_compression_args(p, threads);
+	p.arg(src_glob);
 
 	for (auto&& i : ignore)
 		p.arg("-xr!", i, process::nospace);
@@ -541,15 +1395,23 @@ void archive_from_glob(
 void archive_from_files(
 	const context& cx,
 	const std::vector<fs::path>& files, const fs::path& files_root,
-	const fs::path& dest_file)
+	const fs::path& dest_file, std::size_t threads)
 {
 	cx.trace(context::fs,
 		"archiving {} files rooted in {} into {}",
 		files.size(), files_root, dest_file);
 
+	journal j(cx, "archive");
+
 	if (conf::dry())
 		return;
 
+	guard size([&]
+	{
+		j.files = files.size();
+		j.bytes = size_or_zero(dest_file);
+	});
+
 	std::string list_file_text;
 	std::error_code ec;
 
@@ -586,10 +1448,163 @@ void archive_from_files(
 		.arg("@", list_file, process::nospace)
 		.cwd(files_root);
 
+	add_compression_args(p, threads);
+
 	p.run();
 	p.join();
 }
 
+// relative path and metadata of every file matched by the glob, recursively,
+// for update_archive_from_glob(); names matching an ignore wildcard are
+// skipped, like 7z's -xr!
+//
+void find_archive_files(
+	const fs::path& root, const fs::path& src_glob,
+	const std::vector<std::string>& ignore,
+	std::vector<std::pair<fs::path, file_meta>>& files)
+{
+	const auto dir = src_glob.parent_path();
+	const auto wildcard = src_glob.filename().native();
+
+	for_each_find_data(dir, [&](auto&& fd)
+	{
+		const std::wstring name = fd.cFileName;
+
+		if (!PathMatchSpecW(name.c_str(), wildcard.c_str()))
+			return;
+
+		for (auto&& i : ignore)
+		{
+			if (PathMatchSpecW(name.c_str(), utf8_to_utf16(i).c_str()))
+				return;
+		}
+
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			find_archive_files(root, dir / name / "*", ignore, files);
+		}
+		else
+		{
+			files.push_back({
+				fs::relative(dir / name, root), find_data_meta(fd)});
+		}
+	});
+}
+
+void update_archive_from_glob(
+	const context& cx,
+	const fs::path& src_glob, const fs::path& dest_file,
+	const std::vector<std::string>& ignore, std::size_t threads)
+{
+	if (!fs::exists(src_glob.parent_path()))
+	{
+		cx.bail_out(context::fs,
+			"can't archive glob {}, parent directory doesn't exist",
+			src_glob);
+	}
+
+	const auto manifest = paths::build() / ".mob-archives" /
+		(hash_string(utf16_to_utf8(lowercase_name(dest_file.native()))) +
+		".txt");
+
+	std::vector<std::pair<fs::path, file_meta>> files;
+	find_archive_files(src_glob.parent_path(), src_glob, ignore, files);
+
+	std::sort(files.begin(), files.end(), [](auto&& a, auto&& b)
+	{
+		return a.first < b.first;
+	});
+
+	// hashes are cached with the size and time of the files, only new or
+	// modified files are read
+	std::vector<std::string> hashes(files.size());
+
+	parallel_for(files.size(), 8, [&](std::size_t i)
+	{
+		const auto& [rp, m] = files[i];
+
+		hashes[i] = content_hashes::instance().get(
+			src_glob.parent_path() / rp, m.size, m.time);
+	});
+
+	content_hashes::instance().flush();
+
+	std::string text;
+
+	for (std::size_t i=0; i<files.size(); ++i)
+	{
+		text +=
+			path_to_utf8(files[i].first) + "\t" +
+			std::to_string(files[i].second.size) + "\t" +
+			hashes[i] + "\n";
+	}
+
+	if (fs::exists(dest_file))
+	{
+		std::string old;
+
+		{
+			std::ifstream in(manifest, std::ios::binary);
+			old.assign(std::istreambuf_iterator<char>(in), {});
+		}
+
+		if (old == text)
+		{
+			cx.debug(context::bypass,
+				"{} is up to date with {}, {} files", dest_file,
+				src_glob, files.size());
+
+			return;
+		}
+
+		cx.trace(context::fs,
+			"updating archive {} from {}", dest_file, src_glob);
+
+		journal j(cx, "archive");
+
+		if (conf::dry())
+			return;
+
+		guard size([&]
+		{
+			j.files = 1;
+			j.bytes = size_or_zero(dest_file);
+		});
+
+		// q0 drops entries that are not on disk anymore, x2 replaces entries
+		// that are newer than the file on disk; everything else keeps the
+		// existing entry if the times match
+		auto p = process()
+			.binary(extractor::binary())
+			.arg("u")
+			.arg(dest_file)
+			.arg("-r")
+			.arg("-uq0x2");
+
+		add_compression_args(p, threads);
+		p.arg(src_glob);
+
+		for (auto&& i : ignore)
+			p.arg("-xr!", i, process::nospace);
+
+		p.run();
+		p.join();
+	}
+	else
+	{
+		archive_from_glob(cx, src_glob, dest_file, ignore, threads);
+	}
+
+	if (conf::dry())
+		return;
+
+	std::error_code ec;
+	fs::create_directories(manifest.parent_path(), ec);
+
+	std::ofstream out(manifest, std::ios::binary);
+	out << text;
+}
+
 
 void do_touch(const context& cx, const fs::path& p)
 {
@@ -649,33 +1664,236 @@ void do_copy_file_to_dir(
 	if (!fs::exists(d))
 		op::create_directories(cx, d);
 
+	do_copy_file(cx, f, d / f.filename());
+}
+
+void do_copy_file_to_file(
+	const context& cx, const fs::path& src, const fs::path& dest)
+{
+	op::create_directories(cx, dest.parent_path());
+	do_copy_file(cx, src, dest);
+}
+
+void do_copy_file(
+	const context& cx, const fs::path& src, const fs::path& dest)
+{
+	// unbuffered copies don't go through the cache, which is faster for large
+	// files that won't be read again soon, but slower for small ones
+	const std::uintmax_t unbuffered_size = 8 * 1024 * 1024;
+
+	// only for files going into the install directory; copies elsewhere are
+	// often edited or built over afterwards
+	//
+	// a hardlink shares its data with the source, so a linker or msbuild
+	// writing its output in place changes the installed file too, and
+	// editing an installed file changes the build tree; this is why the
+	// default is `copy`, see the readme
+	const std::string install = path_to_utf8(paths::install());
+	const std::string d = path_to_utf8(dest);
+
+	if (d.size() > install.size() &&
+		_strnicmp(d.c_str(), install.c_str(), install.size()) == 0)
+	{
+		const auto mode = conf::install_mode();
+
+		if (mode == "hardlink")
+		{
+			static std::once_flag warned;
+
+			std::call_once(warned, [&]
+			{
+				cx.warning(context::fs,
+					"install_mode is hardlink, installed files share their "
+					"contents with the build directories");
+			});
+
+			if (do_hardlink_file(cx, src, dest))
+				return;
+		}
+
+		if (mode == "clone" && do_clone_file(cx, src, dest))
+			return;
+	}
+
 	std::error_code ec;
-	fs::copy_file(
-		f, d / f.filename(),
-		fs::copy_options::overwrite_existing, ec);
+	const auto size = fs::file_size(src, ec);
 
-	if (ec)
+	COPYFILE2_EXTENDED_PARAMETERS params = {};
+	params.dwSize = sizeof(params);
+
+	if (!ec && size >= unbuffered_size)
+		params.dwCopyFlags = COPY_FILE_NO_BUFFERING;
+
+	const HRESULT r = CopyFile2(
+		src.native().c_str(), dest.native().c_str(), &params);
+
+	if (FAILED(r))
 	{
 		cx.bail_out(context::fs,
-			"can't copy {} to {}, {}", f, d, ec.message());
+			"can't copy {} to {}, {}",
+			src, dest, error_message(HRESULT_CODE(r)));
 	}
 }
 
-void do_copy_file_to_file(
+bool do_hardlink_file(
 	const context& cx, const fs::path& src, const fs::path& dest)
 {
-	op::create_directories(cx, dest.parent_path());
+	// links can't replace a file
+	if (fs::exists(dest))
+	{
+		if (!DeleteFileW(dest.native().c_str()))
+		{
+			const auto e = GetLastError();
 
-	std::error_code ec;
-	fs::copy_file(
-		src, dest,
-		fs::copy_options::overwrite_existing, ec);
+			cx.trace(context::fs,
+				"can't delete {} to hardlink it, {}; copying",
+				dest, error_message(e));
 
-	if (ec)
+			return false;
+		}
+	}
+
+	if (!CreateHardLinkW(dest.native().c_str(), src.native().c_str(), nullptr))
 	{
-		cx.bail_out(context::fs,
-			"can't copy {} to {}, {}", src, dest, ec.message());
+		// typically across volumes
+		const auto e = GetLastError();
+
+		cx.trace(context::fs,
+			"can't hardlink {} to {}, {}; copying",
+			src, dest, error_message(e));
+
+		return false;
 	}
+
+	return true;
+}
+
+bool do_clone_file(
+	const context& cx, const fs::path& src, const fs::path& dest)
+{
+	// block cloning shares the clusters of the source file with the new file,
+	// which only works on the same ReFS volume, including dev drives
+
+	HANDLE hs = CreateFileW(
+		src.native().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, 0, 0);
+
+	if (hs == INVALID_HANDLE_VALUE)
+		return false;
+
+	guard close_src([&]{ CloseHandle(hs); });
+
+	BY_HANDLE_FILE_INFORMATION info = {};
+	if (!GetFileInformationByHandle(hs, &info))
+		return false;
+
+	const std::uint64_t size =
+		(std::uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+
+	// regions have to be aligned on clusters, which ReFS gives here
+	FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity = {};
+	DWORD bytes = 0;
+
+	if (!DeviceIoControl(
+		hs, FSCTL_GET_INTEGRITY_INFORMATION, nullptr, 0,
+		&integrity, sizeof(integrity), &bytes, nullptr))
+	{
+		const auto e = GetLastError();
+
+		cx.trace(context::fs,
+			"can't clone {}, not on ReFS ({}); copying",
+			src, error_message(e));
+
+		return false;
+	}
+
+	HANDLE hd = CreateFileW(
+		dest.native().c_str(), GENERIC_READ|GENERIC_WRITE|DELETE, 0,
+		nullptr, CREATE_ALWAYS, info.dwFileAttributes & ~FILE_ATTRIBUTE_READONLY,
+		0);
+
+	if (hd == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool ok = false;
+
+	guard close_dest([&]
+	{
+		if (!ok)
+		{
+			// the file is removed on close if cloning failed
+			FILE_DISPOSITION_INFO di = {TRUE};
+			SetFileInformationByHandle(hd, FileDispositionInfo, &di, sizeof(di));
+		}
+
+		CloseHandle(hd);
+	});
+
+	// the destination must be sparse if the source is and have the same
+	// integrity settings
+	if (info.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE)
+	{
+		if (!DeviceIoControl(
+			hd, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytes, nullptr))
+		{
+			return false;
+		}
+	}
+
+	FSCTL_SET_INTEGRITY_INFORMATION_BUFFER set_integrity = {};
+	set_integrity.ChecksumAlgorithm = integrity.ChecksumAlgorithm;
+	set_integrity.Flags = integrity.Flags;
+
+	DeviceIoControl(
+		hd, FSCTL_SET_INTEGRITY_INFORMATION,
+		&set_integrity, sizeof(set_integrity), nullptr, 0, &bytes, nullptr);
+
+	FILE_END_OF_FILE_INFO eof = {};
+	eof.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+
+	if (!SetFileInformationByHandle(hd, FileEndOfFileInfo, &eof, sizeof(eof)))
+		return false;
+
+	const std::uint64_t cluster = integrity.ClusterSizeInBytes;
+	if (cluster == 0)
+		return false;
+
+	// clone in chunks that are under the 4GB limit for one call, the last one
+	// is rounded up to a cluster
+	const std::uint64_t chunk = 1024ull * 1024 * 1024;
+
+	for (std::uint64_t offset=0; offset<size; offset+=chunk)
+	{
+		std::uint64_t n = std::min(chunk, size - offset);
+		n = (n + cluster - 1) / cluster * cluster;
+
+		DUPLICATE_EXTENTS_DATA dd = {};
+		dd.FileHandle = hs;
+		dd.SourceFileOffset.QuadPart = static_cast<LONGLONG>(offset);
+		dd.TargetFileOffset.QuadPart = static_cast<LONGLONG>(offset);
+		dd.ByteCount.QuadPart = static_cast<LONGLONG>(n);
+
+		if (!DeviceIoControl(
+			hd, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &dd, sizeof(dd),
+			nullptr, 0, &bytes, nullptr))
+		{
+			const auto e = GetLastError();
+
+			cx.trace(context::fs,
+				"can't clone {} to {}, {}; copying",
+				src, dest, error_message(e));
+
+			return false;
+		}
+	}
+
+	// same times as the source, like a copy, so is_source_better() works
+	SetFileTime(
+		hd, &info.ftCreationTime, &info.ftLastAccessTime,
+		&info.ftLastWriteTime);
+
+	ok = true;
+	return true;
 }
 
 void do_remove_readonly(const context& cx, const fs::path& p)
@@ -19,6 +19,48 @@ enum flags
 MOB_ENUM_OPERATORS(flags);
 
 
+// filesystem operations of one kind done by one task, summed; every copy,
+// deletion, rename and archive is recorded, including in --dry, where the
+// bytes are what would have been copied
+//
+struct fs_stats
+{
+	std::string task;
+
+	// "copy", "delete", "rename" or "archive"
+	std::string op;
+
+	std::uint64_t calls = 0;
+
+	// files copied or deleted, not counting the ones that were skipped
+	std::uint64_t files = 0;
+
+	// bytes copied or written to archives
+	std::uint64_t bytes = 0;
+
+	std::chrono::nanoseconds time{};
+
+	// adds to the stats for the task and operation, and to the current usage
+	// sink; thread-safe
+	//
+	static void record(
+		const context& cx, const char* op,
+		std::uint64_t files, std::uint64_t bytes,
+		std::chrono::nanoseconds time);
+
+	// in the order the task/op pairs were first seen
+	//
+	static std::vector<fs_stats> all();
+};
+
+
+// removes and returns the destination files under the install directory of
+// all the copies done for the given task since the last call, whether the
+// copy was needed or not; see task::outputs_exist()
+//
+std::vector<fs::path> take_installed_files(const std::string& task);
+
+
 void touch(const context& cx, const fs::path& p);
 
 void create_directories(
@@ -54,25 +96,113 @@ void copy_glob_to_dir_if_better(
 	const context& cx,
 	const fs::path& src_glob, const fs::path& dest_dir, flags f);
 
+// whether copying src over dest would change anything, used by the
+// *_if_better() functions
+//
+bool is_source_better(
+	const context& cx, const fs::path& src, const fs::path& dest);
+
 void swap_files(
 	const context& cx, const fs::path& src, const fs::path& dest,
 	const fs::path& backup={}, flags f=noflags);
 
+// the file is memory mapped and converted straight into the returned string,
+// with \r\n replaced by \n
+//
 std::string read_text_file(
 	const context& cx, encodings e, const fs::path& p, flags f=noflags);
 
+// calls `fun` with each non-empty line of the file converted to utf8, same as
+// for_each_line(); the file is memory mapped and lines are converted one at a
+// time, so memory stays bounded by the longest line instead of the size of
+// the file; the view is only valid during the call
+//
+void for_each_text_line(
+	const context& cx, encodings e, const fs::path& p,
+	const std::function<void (std::string_view)>& fun, flags f=noflags);
+
+// converts and writes the utf8 text in chunks
+//
 void write_text_file(
 	const context& cx, encodings e, const fs::path& p, std::string_view utf8,
 	flags f=noflags);
 
+// archives use the compression settings from the `archive_*` options; 7z
+// uses as many threads as it wants if `threads` is 0
+//
 void archive_from_glob(
 	const context& cx,
 	const fs::path& src_glob, const fs::path& dest_file,
-	const std::vector<std::string>& ignore);
+	const std::vector<std::string>& ignore, std::size_t threads=0);
 
 void archive_from_files(
 	const context& cx,
 	const std::vector<fs::path>& files, const fs::path& files_root,
-	const fs::path& dest_file);
+	const fs::path& dest_file, std::size_t threads=0);
+
+// same as archive_from_glob(), but keeps a manifest of the archived files
+// with their size and hash in the build directory; an existing archive is
+// left alone if nothing changed since it was created and only changed
+// entries are updated otherwise
+//
+void update_archive_from_glob(
+	const context& cx,
+	const fs::path& src_glob, const fs::path& dest_file,
+	const std::vector<std::string>& ignore, std::size_t threads=0);
+
+
+// used by delete_directory() when `background_delete` is set: directories are
+// renamed into a `.mob-trash` directory in the prefix, which is instant on the
+// same volume, and deleted on low priority background threads
+//
+// deleting stops on exit and anything left in the trash is deleted on the
+// next run
+//
+class trash
+{
+public:
+	static trash& instance();
+
+	// stops
+	~trash();
+
+	// non-copyable
+	trash(const trash&) = delete;
+	trash& operator=(const trash&) = delete;
+
+	// path of the trash directory
+	//
+	static fs::path dir();
+
+	// moves the directory into the trash and queues it for deletion; returns
+	// false if it can't be moved, such as when it's on another volume
+	//
+	bool add(const context& cx, const fs::path& p);
+
+	// queues whatever was left in the trash by a previous run
+	//
+	void resume(const context& cx);
+
+	// stops deleting after the current files, what's left stays in the
+	// trash
+	//
+	void stop();
+
+private:
+	thread_pool pool_;
+	std::atomic<bool> quit_;
+	std::atomic<std::size_t> next_;
+
+	trash();
+
+	// queues a job per entry in the directory, the directory itself is
+	// removed by the last one
+	//
+	void queue(const context& cx, const fs::path& p);
+
+	// deletes the file or the tree, returns false when stopped
+	//
+	bool remove(const fs::path& p);
+};
 
 }	// namespace
@@ -52,6 +52,7 @@
 #include <fstream>
 #include <sstream>
 #include <mutex>
+#include <shared_mutex>
 #include <regex>
 #include <map>
 #include <optional>
@@ -60,6 +61,9 @@
 #include <vector>
 #include <array>
 #include <set>
+#include <deque>
+#include <future>
+#include <condition_variable>
 #include <charconv>
 
 #include <Shlobj.h>
@@ -67,6 +71,8 @@
 #include <io.h>
 #include <fcntl.h>
 #include <imagehlp.h>
+#include <bcrypt.h>
+#include <winioctl.h>
 
 #include <curl/curl.h>
 #include <clipp.h>
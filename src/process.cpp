@@ -8,9 +8,18 @@
 namespace mob
 {
 
+// default timeout for the named pipes, not used for waiting on processes
 const DWORD wait_timeout = 50;
 static std::atomic<int> g_next_pipe_id(0);
 
+// reads start with a small buffer, most processes only output a few lines;
+// it doubles every time a read fills it, up to the size of the pipe
+static constexpr std::size_t initial_pipe_buffer = 4 * 1024;
+static constexpr std::size_t max_pipe_buffer = 64 * 1024;
+
+// idle pipes kept by the pool, more than that are closed
+static constexpr std::size_t max_idle_pipes = 16;
+
 
 HANDLE get_bit_bucket()
 {
@@ -18,221 +27,495 @@ HANDLE get_bit_bucket()
 	return ::CreateFileW(L"NUL", GENERIC_WRITE, 0, &sa, OPEN_EXISTING, 0, 0);
 }
 
-async_pipe::async_pipe(const context& cx)
-	: cx_(cx), pending_(false), closed_(true)
+
+pipe_pool& pipe_pool::instance()
+{
+	static pipe_pool p;
+	return p;
+}
+
+std::unique_ptr<pipe_instance> pipe_pool::acquire(
+	const context& cx, HANDLE port)
 {
-	buffer_ = std::make_unique<char[]>(buffer_size);
-	std::memset(buffer_.get(), 0, buffer_size);
+	{
+		std::scoped_lock lock(m_);
+
+		if (!idle_.empty())
+		{
+			auto p = std::move(idle_.back());
+			idle_.pop_back();
+			return p;
+		}
+	}
 
-	std::memset(&ov_, 0, sizeof(ov_));
+	return create(cx, port);
 }
 
-bool async_pipe::closed() const
+void pipe_pool::release(std::unique_ptr<pipe_instance> p)
 {
-	return closed_;
+	// drops anything that's left and a child that still has the other end,
+	// the pipe goes back to listening on the next ConnectNamedPipe()
+	::DisconnectNamedPipe(p->server.get());
+	p->key = 0;
+
+	std::scoped_lock lock(m_);
+
+	if (idle_.size() < max_idle_pipes)
+		idle_.push_back(std::move(p));
 }
 
-handle_ptr async_pipe::create()
+std::unique_ptr<pipe_instance> pipe_pool::create(
+	const context& cx, HANDLE port)
 {
-	// creating pipe
-	handle_ptr out(create_pipe());
-	if (out.get() == INVALID_HANDLE_VALUE)
-		return {};
+	auto p = std::make_unique<pipe_instance>();
+
+	// the pid is in case multiple mob processes are running
+	const auto pipe_id = g_next_pipe_id.fetch_add(1) + 1;
 
-	ov_.hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	p->name =
+		LR"(\\.\pipe\mob_pipe)" +
+		std::to_wstring(::GetCurrentProcessId()) + L"_" +
+		std::to_wstring(pipe_id);
 
-	if (ov_.hEvent == NULL)
+	// the read end isn't inheritable, it's kept for many processes
+	HANDLE h = ::CreateNamedPipeW(
+		p->name.c_str(),
+		PIPE_ACCESS_DUPLEX|FILE_FLAG_OVERLAPPED|FILE_FLAG_FIRST_PIPE_INSTANCE,
+		PIPE_TYPE_BYTE|PIPE_READMODE_BYTE|PIPE_WAIT,
+		1, max_pipe_buffer, max_pipe_buffer, wait_timeout, nullptr);
+
+	if (h == INVALID_HANDLE_VALUE)
 	{
 		const auto e = GetLastError();
-		cx_.bail_out(context::cmd,
-			"CreateEvent failed, {}", error_message(e));
+		cx.bail_out(context::cmd, "CreateNamedPipeW failed, {}", error_message(e));
+	}
+
+	p->server.reset(h);
+
+	p->connected.reset(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+	if (!p->connected)
+	{
+		const auto e = GetLastError();
+		cx.bail_out(context::cmd, "CreateEventW failed, {}", error_message(e));
+	}
+
+	if (!::CreateIoCompletionPort(
+		p->server.get(), port, process_port::pipe_key, 0))
+	{
+		const auto e = GetLastError();
+		cx.bail_out(context::cmd,
+			"CreateIoCompletionPort for pipe failed, {}", error_message(e));
+	}
+
+	// not zeroed, reads only look at what they've received
+	p->buffer.reset(new char[initial_pipe_buffer]);
+	p->buffer_size = initial_pipe_buffer;
+
+	return p;
+}
+
+
+async_pipe::async_pipe(const context& cx)
+	: cx_(cx), pending_(false), finishing_(false), closed_(true)
+{
+}
+
+async_pipe::~async_pipe()
+{
+	if (!pipe_)
+		return;
+
+	if (pending_)
+	{
+		// the port keeps clients alive until their pipes are closed, so this
+		// only happens when mob exits; the kernel might still write into the
+		// buffer
+		static_cast<void>(pipe_.release());
+		return;
 	}
 
-	event_.reset(ov_.hEvent);
+	// created but never started, the process failed to start
+	close();
+}
+
+bool async_pipe::closed() const
+{
+	return closed_;
+}
+
+bool async_pipe::has_data() const
+{
+	return !data_.empty();
+}
+
+bool async_pipe::owns(const OVERLAPPED* ov) const
+{
+	return (pipe_ && ov == &pipe_->ov);
+}
+
+handle_ptr async_pipe::create(HANDLE port, ULONG_PTR key)
+{
+	pipe_ = pipe_pool::instance().acquire(cx_, port);
+	pipe_->key = key;
+
+	handle_ptr out(connect());
 	closed_ = false;
 
 	return out;
 }
 
-std::string_view async_pipe::read(bool finish)
+void async_pipe::start()
+{
+	if (!closed_)
+		queue_read();
+}
+
+std::string async_pipe::take()
 {
-	std::string_view s;
+	return std::exchange(data_, {});
+}
 
-	if (closed_)
-		return s;
+void async_pipe::finish()
+{
+	if (closed_ || finishing_)
+		return;
 
+	finishing_ = true;
+
+	// a read that's still pending means there's nothing left in the pipe
+	// right now; cancelling it makes it complete with an error, which closes
+	// the pipe
 	if (pending_)
-		s = check_pending();
-	else
-		s = try_read();
+		::CancelIoEx(pipe_->server.get(), &pipe_->ov);
+}
+
+void async_pipe::on_completion(bool ok, DWORD bytes)
+{
+	pending_ = false;
 
-	if (finish && s.empty())
+	if (!ok)
 	{
-		::CancelIo(stdout_.get());
-		closed_ = true;
+		// broken pipe means the process is finished, aborted means finish()
+		// cancelled the read
+		close();
+		return;
 	}
 
-	return s;
+	MOB_ASSERT(bytes <= pipe_->buffer_size);
+	data_.append(pipe_->buffer.get(), bytes);
+
+	// the process is producing more than the buffer can take at a time, the
+	// bigger buffer stays with the pipe when it goes back to the pool
+	if (bytes == pipe_->buffer_size && pipe_->buffer_size < max_pipe_buffer)
+	{
+		pipe_->buffer_size = std::min(pipe_->buffer_size * 2, max_pipe_buffer);
+		pipe_->buffer.reset(new char[pipe_->buffer_size]);
+	}
+
+	queue_read();
 }
 
-HANDLE async_pipe::create_pipe()
+void async_pipe::queue_read()
 {
-	const auto pipe_id = g_next_pipe_id.fetch_add(1) + 1;
-
-	const std::wstring pipe_name =
-		LR"(\\.\pipe\mob_pipe)" + std::to_wstring(pipe_id);
+	// the completion is always posted to the port, even if ReadFile()
+	// succeeds right away
+	const auto r = ::ReadFile(
+		pipe_->server.get(), pipe_->buffer.get(),
+		static_cast<DWORD>(pipe_->buffer_size), nullptr, &pipe_->ov);
 
-	SECURITY_ATTRIBUTES sa = {};
-	sa.nLength = sizeof(SECURITY_ATTRIBUTES);
-	sa.bInheritHandle = TRUE;
+	if (r)
+	{
+		pending_ = true;
+		return;
+	}
 
-	handle_ptr pipe;
+	const auto e = GetLastError();
 
-	// creating pipe
+	switch (e)
 	{
-		HANDLE pipe_handle = ::CreateNamedPipeW(
-			pipe_name.c_str(),
-			PIPE_ACCESS_DUPLEX|FILE_FLAG_OVERLAPPED|FILE_FLAG_FIRST_PIPE_INSTANCE,
-			PIPE_TYPE_BYTE|PIPE_READMODE_BYTE|PIPE_WAIT,
-			1, buffer_size, buffer_size, wait_timeout, &sa);
+		case ERROR_IO_PENDING:
+		{
+			pending_ = true;
+
+			// nothing is immediately available
+			if (finishing_)
+				::CancelIoEx(pipe_->server.get(), &pipe_->ov);
 
-		if (pipe_handle == INVALID_HANDLE_VALUE)
+			break;
+		}
+
+		case ERROR_BROKEN_PIPE:
 		{
-			const auto e = GetLastError();
-			cx_.bail_out(context::cmd,
-				"CreateNamedPipeW failed, {}", error_message(e));
+			// broken pipe means the process is finished
+			close();
+			break;
 		}
 
-		pipe.reset(pipe_handle);
+		default:
+		{
+			cx_.error(context::cmd,
+				"async_pipe read failed, {}", error_message(e));
+
+			close();
+			break;
+		}
 	}
+}
 
-	{
-		// duplicating the handle to read from it
-		HANDLE output_read = INVALID_HANDLE_VALUE;
+void async_pipe::close()
+{
+	closed_ = true;
 
-		const auto r = DuplicateHandle(
-			GetCurrentProcess(), pipe.get(), GetCurrentProcess(), &output_read,
-			0, TRUE, DUPLICATE_SAME_ACCESS);
+	if (pipe_)
+		pipe_pool::instance().release(std::move(pipe_));
+}
 
-		if (!r)
+HANDLE async_pipe::connect()
+{
+	auto& ov = pipe_->ov;
+
+	// with the low bit of the event set, the completion of the connection
+	// isn't posted to the port, it's waited on below
+	std::memset(&ov, 0, sizeof(ov));
+	::ResetEvent(pipe_->connected.get());
+	ov.hEvent = reinterpret_cast<HANDLE>(
+		reinterpret_cast<ULONG_PTR>(pipe_->connected.get()) | 1);
+
+	if (!::ConnectNamedPipe(pipe_->server.get(), &ov))
+	{
+		const auto e = GetLastError();
+
+		if (e != ERROR_IO_PENDING)
 		{
-			const auto e = GetLastError();
 			cx_.bail_out(context::cmd,
-				"DuplicateHandle for pipe failed, {}", error_message(e));
+				"ConnectNamedPipe failed, {}", error_message(e));
 		}
-
-		stdout_.reset(output_read);
 	}
 
-
 	// creating handle to pipe which is passed to CreateProcess()
+	SECURITY_ATTRIBUTES sa = {};
+	sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+	sa.bInheritHandle = TRUE;
+
 	HANDLE output_write = ::CreateFileW(
-		pipe_name.c_str(), FILE_WRITE_DATA|SYNCHRONIZE, 0,
+		pipe_->name.c_str(), FILE_WRITE_DATA|SYNCHRONIZE, 0,
 		&sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
 
 	if (output_write == INVALID_HANDLE_VALUE)
 	{
 		const auto e = GetLastError();
+
+		// the pipe goes back to the pool, the connection can't be left
+		// pending
+		DWORD dummy = 0;
+		::CancelIoEx(pipe_->server.get(), &ov);
+		::GetOverlappedResult(pipe_->server.get(), &ov, &dummy, TRUE);
+
 		cx_.bail_out(context::cmd,
 			"CreateFileW for pipe failed, {}", error_message(e));
 	}
 
+	DWORD dummy = 0;
+	if (!::GetOverlappedResult(pipe_->server.get(), &ov, &dummy, TRUE))
+	{
+		const auto e = GetLastError();
+		::CloseHandle(output_write);
+
+		cx_.bail_out(context::cmd,
+			"connecting pipe failed, {}", error_message(e));
+	}
+
+	// reads complete on the port
+	std::memset(&ov, 0, sizeof(ov));
+
 	return output_write;
 }
 
-std::string_view async_pipe::try_read()
+
+
+process_port::client::client(const context& cx)
+	: stdout_pipe(cx), stderr_pipe(cx)
+{
+}
+
+void process_port::client::unwatch()
+{
+	if (wait)
+	{
+		// waits for the callback to finish if it's running
+		::UnregisterWaitEx(wait, INVALID_HANDLE_VALUE);
+		wait = nullptr;
+	}
+}
+
+process_port& process_port::instance()
+{
+	static process_port p;
+	return p;
+}
+
+process_port::process_port()
 {
-	DWORD bytes_read = 0;
+	HANDLE h = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 1);
 
-	if (!::ReadFile(stdout_.get(), buffer_.get(), buffer_size, &bytes_read, &ov_))
+	if (!h)
 	{
 		const auto e = GetLastError();
+		gcx().bail_out(context::cmd,
+			"CreateIoCompletionPort failed, {}", error_message(e));
+	}
 
-		switch (e)
-		{
-			case ERROR_IO_PENDING:
-			{
-				pending_ = true;
-				break;
-			}
+	port_.reset(h);
+	thread_ = start_thread([&]{ run(); });
+}
 
-			case ERROR_BROKEN_PIPE:
-			{
-				// broken pipe means the process is finished
-				closed_ = true;
-				break;
-			}
+process_port::~process_port()
+{
+	// a null key and overlapped tells the thread to exit
+	::PostQueuedCompletionStatus(port_.get(), 0, 0, nullptr);
 
-			default:
-			{
-				cx_.bail_out(context::cmd,
-					"async_pipe read failed, {}", error_message(e));
-				break;
-			}
-		}
+	if (thread_.joinable())
+		thread_.join();
+}
 
-		return {};
-	}
+HANDLE process_port::handle() const
+{
+	return port_.get();
+}
+
+std::shared_ptr<process_port::client> process_port::add(const context& cx)
+{
+	auto c = std::make_shared<client>(cx);
 
-	MOB_ASSERT(bytes_read <= buffer_size);
+	std::scoped_lock lock(m_);
+	clients_.emplace(c.get(), c);
 
-	return {buffer_.get(), bytes_read};
+	return c;
 }
 
-std::string_view async_pipe::check_pending()
+bool process_port::watch_job(HANDLE job, client& c)
 {
-	DWORD bytes_read = 0;
+	JOBOBJECT_ASSOCIATE_COMPLETION_PORT info = {};
+	info.CompletionKey = &c;
+	info.CompletionPort = port_.get();
 
-	const auto r = WaitForSingleObject(event_.get(), wait_timeout);
+	return ::SetInformationJobObject(
+		job, JobObjectAssociateCompletionPortInformation,
+		&info, sizeof(info));
+}
 
-	if (r == WAIT_FAILED) {
+void process_port::watch_process(HANDLE process, client& c)
+{
+	auto callback = [](void* p, BOOLEAN)
+	{
+		auto& c = *static_cast<client*>(p);
+
+		// same as what a job posts, see on_completion()
+		::PostQueuedCompletionStatus(
+			process_port::instance().handle(), JOB_OBJECT_MSG_EXIT_PROCESS,
+			reinterpret_cast<ULONG_PTR>(&c),
+			reinterpret_cast<OVERLAPPED*>(static_cast<ULONG_PTR>(c.pid)));
+	};
+
+	if (!::RegisterWaitForSingleObject(
+		&c.wait, process, callback, &c, INFINITE,
+		WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD))
+	{
 		const auto e = GetLastError();
-		cx_.bail_out(context::cmd,
-			"WaitForSingleObject in async_pipe failed, {}", error_message(e));
+		gcx().bail_out(context::cmd,
+			"RegisterWaitForSingleObject failed, {}", error_message(e));
 	}
+}
 
-	if (!::GetOverlappedResult(stdout_.get(), &ov_, &bytes_read, FALSE))
+void process_port::run()
+{
+	for (;;)
 	{
-		const auto e = GetLastError();
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED* ov = nullptr;
 
-		switch (e)
+		const auto r = ::GetQueuedCompletionStatus(
+			port_.get(), &bytes, &key, &ov, INFINITE);
+
+		if (key == 0 && ov == nullptr)
 		{
-			case ERROR_IO_INCOMPLETE:
-			{
+			if (r)
 				break;
-			}
 
-			case WAIT_TIMEOUT:
-			{
-				break;
-			}
+			const auto e = GetLastError();
+			gcx().error(context::cmd,
+				"GetQueuedCompletionStatus failed, {}", error_message(e));
 
-			case ERROR_BROKEN_PIPE:
-			{
-				// broken pipe means the process is finished
-				closed_ = true;
-				break;
-			}
+			break;
+		}
 
-			default:
-			{
-				cx_.bail_out(context::cmd,
-					"GetOverlappedResult failed in async_pipe, {}",
-					error_message(e));
+		// pipes are shared by all the clients over time, the instance knows
+		// which one it's currently given to
+		if (key == pipe_key)
+			key = CONTAINING_RECORD(ov, pipe_instance, ov)->key;
 
-				break;
-			}
-		}
+		on_completion(reinterpret_cast<client*>(key), r, bytes, ov);
+	}
+}
 
-		return {};
+void process_port::on_completion(
+	client* key, bool ok, DWORD bytes, OVERLAPPED* ov)
+{
+	std::shared_ptr<client> c;
+
+	{
+		// jobs can still post notifications about other processes after the
+		// client is gone
+		std::scoped_lock lock(m_);
+
+		auto itor = clients_.find(key);
+		if (itor == clients_.end())
+			return;
+
+		c = itor->second;
 	}
 
-	MOB_ASSERT(bytes_read <= buffer_size);
+	bool done = false;
 
-	::ResetEvent(event_.get());
-	pending_ = false;
+	{
+		std::scoped_lock lock(c->m);
+
+		if (c->stdout_pipe.owns(ov))
+		{
+			c->stdout_pipe.on_completion(ok, bytes);
+		}
+		else if (c->stderr_pipe.owns(ov))
+		{
+			c->stderr_pipe.on_completion(ok, bytes);
+		}
+		else
+		{
+			// job notification, the overlapped is the process id; processes
+			// started by the child are also in the job, only the child itself
+			// matters
+			const auto pid = static_cast<DWORD>(reinterpret_cast<ULONG_PTR>(ov));
 
-	return {buffer_.get(), bytes_read};
+			const bool exit =
+				bytes == JOB_OBJECT_MSG_EXIT_PROCESS ||
+				bytes == JOB_OBJECT_MSG_ABNORMAL_EXIT_PROCESS;
+
+			if (exit && pid == c->pid)
+				c->exited = true;
+		}
+
+		done =
+			c->exited &&
+			c->stdout_pipe.closed() && c->stderr_pipe.closed();
+	}
+
+	c->cv.notify_all();
+
+	if (done)
+	{
+		std::scoped_lock lock(m_);
+		clients_.erase(key);
+	}
 }
 
 
@@ -246,8 +529,9 @@ process::impl& process::impl::operator=(const impl& i)
 	handle = {};
 	job = {};
 	interrupt = i.interrupt.load();
-	stdout_pipe = {};
-	stderr_pipe = {};
+	client = {};
+	output_log = {};
+	run_span = {};
 
 	return *this;
 }
@@ -255,7 +539,9 @@ process::impl& process::impl::operator=(const impl& i)
 
 process::process() :
 	cx_(&gcx()), unicode_(false), chcp_(-1), flags_(process::noflags),
-	stdout_(context::level::trace), stderr_(context::level::error), code_(0)
+	stdin_handle_(nullptr), priority_(priorities::task_default),
+	stdout_(context::level::trace), stderr_(context::level::error),
+	tail_size_(0), code_(0)
 {
 	success_.insert(0);
 }
@@ -388,6 +674,36 @@ process& process::external_error_log(const fs::path& p)
 	return *this;
 }
 
+process& process::stdin_file(const fs::path& p)
+{
+	stdin_file_ = p;
+	return *this;
+}
+
+process& process::stdin_handle(HANDLE h)
+{
+	stdin_handle_ = h;
+	return *this;
+}
+
+process& process::priority(priorities p)
+{
+	priority_ = p;
+	return *this;
+}
+
+process& process::background_io(bool b)
+{
+	background_io_ = b;
+	return *this;
+}
+
+process& process::affinity(std::uint64_t mask)
+{
+	affinity_ = mask;
+	return *this;
+}
+
 process& process::flags(flags_t f)
 {
 	flags_ = f;
@@ -419,6 +735,17 @@ std::string process::make_name() const
 	return make_cmd();
 }
 
+std::string process::make_span_name() const
+{
+	if (!name_.empty())
+		return name_;
+
+	if (!bin_.empty())
+		return path_to_utf8(bin_.filename());
+
+	return raw_.substr(0, raw_.find(' '));
+}
+
 std::string process::make_cmd() const
 {
 	if (!raw_.empty())
@@ -443,6 +770,7 @@ void process::run()
 	if (conf::dry())
 		return;
 
+	impl_.run_span = std::make_unique<span>("process", make_span_name());
 	do_run(what);
 }
 
@@ -481,20 +809,38 @@ void process::do_run(const std::string& what)
 	stdout_.buffer = encoded_buffer(stdout_.encoding);
 	stderr_.buffer = encoded_buffer(stderr_.encoding);
 
+	logs_.clear();
+	tail_.clear();
+	tail_size_ = static_cast<std::size_t>(
+		std::max(0, conf::get_global_int("global", "output_tail")));
+
 	STARTUPINFOW si = { .cb=sizeof(si) };
 	PROCESS_INFORMATION pi = {};
 
 	handle_ptr stdout_pipe, stderr_pipe, stdin_pipe;
 
-	impl_.stdout_pipe.reset(new async_pipe(*cx_));
-	impl_.stderr_pipe.reset(new async_pipe(*cx_));
+	auto& port = process_port::instance();
+	impl_.client = port.add(*cx_);
+
+	auto& c = *impl_.client;
+	const auto key = reinterpret_cast<ULONG_PTR>(&c);
+
+	// exit notifications for processes in the job go to the port
+	if (impl_.job && !port.watch_job(impl_.job.get(), c))
+	{
+		const auto e = GetLastError();
+		cx_->warning(context::cmd,
+			"can't associate job with completion port, {}", error_message(e));
+
+		impl_.job = {};
+	}
 
 	switch (stdout_.flags)
 	{
 		case forward_to_log:
 		case keep_in_string:
 		{
-			stdout_pipe = impl_.stdout_pipe->create();
+			stdout_pipe = c.stdout_pipe.create(port.handle(), key);
 			si.hStdOutput = stdout_pipe.get();
 			break;
 		}
@@ -517,7 +863,7 @@ void process::do_run(const std::string& what)
 		case forward_to_log:
 		case keep_in_string:
 		{
-			stderr_pipe = impl_.stderr_pipe->create();
+			stderr_pipe = c.stderr_pipe.create(port.handle(), key);
 			si.hStdError = stderr_pipe.get();
 			break;
 		}
@@ -535,15 +881,66 @@ void process::do_run(const std::string& what)
 		}
 	}
 
-	stdin_pipe.reset(get_bit_bucket());
-	si.hStdInput = stdin_pipe.get();
-
-	si.dwFlags = STARTF_USESTDHANDLES;
+	if (stdin_handle_)
+	{
+		HANDLE h = INVALID_HANDLE_VALUE;
 
-	const std::wstring cmd = utf8_to_utf16(this_env::get("COMSPEC"));
-	std::wstring args = make_cmd_args(what);
+		const auto r = ::DuplicateHandle(
+			GetCurrentProcess(), stdin_handle_, GetCurrentProcess(), &h,
+			0, TRUE, DUPLICATE_SAME_ACCESS);
 
-	const wchar_t* cwd_p = nullptr;
+		if (!r)
+		{
+			const auto e = GetLastError();
+
+			cx_->bail_out(context::cmd,
+				"can't duplicate stdin handle, {}", error_message(e));
+		}
+
+		stdin_pipe.reset(h);
+	}
+	else if (stdin_file_.empty())
+	{
+		stdin_pipe.reset(get_bit_bucket());
+	}
+	else
+	{
+		SECURITY_ATTRIBUTES sa { .nLength = sizeof(sa), .bInheritHandle = TRUE };
+
+		stdin_pipe.reset(::CreateFileW(
+			stdin_file_.native().c_str(), GENERIC_READ, FILE_SHARE_READ, &sa,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0));
+
+		if (stdin_pipe.get() == INVALID_HANDLE_VALUE)
+		{
+			const auto e = GetLastError();
+
+			cx_->bail_out(context::cmd,
+				"can't open {} for stdin, {}", stdin_file_, error_message(e));
+		}
+	}
+
+	si.hStdInput = stdin_pipe.get();
+
+	si.dwFlags = STARTF_USESTDHANDLES;
+
+	std::wstring cmd, args;
+
+	if (const auto direct=find_direct_binary(); direct.empty())
+	{
+		cmd = utf8_to_utf16(this_env::get("COMSPEC"));
+		args = make_cmd_args(what);
+	}
+	else
+	{
+		// the arguments are already quoted, they're the same for cmd
+		cx_->trace(context::cmd, "running {} directly", direct);
+
+		cmd = direct.native();
+		args = L"\"" + cmd + L"\"" + utf8_to_utf16(cmd_);
+	}
+
+	const wchar_t* cwd_p = nullptr;
 	std::wstring cwd_s;
 
 	if (!cwd_.empty())
@@ -557,10 +954,12 @@ void process::do_run(const std::string& what)
 
 	cx_->trace(context::cmd, "creating process");
 
+	// suspended so it can be put in the job before it has a chance to exit,
+	// or the exit notification would never be posted to the port
 	const auto r = ::CreateProcessW(
 		cmd.c_str(), args.data(),
 		nullptr, nullptr, TRUE,
-		CREATE_NEW_PROCESS_GROUP|CREATE_UNICODE_ENVIRONMENT,
+		CREATE_NEW_PROCESS_GROUP|CREATE_UNICODE_ENVIRONMENT|CREATE_SUSPENDED,
 		env_.get_unicode_pointers(), cwd_p, &si, &pi);
 
 	if (!r)
@@ -570,6 +969,11 @@ void process::do_run(const std::string& what)
 			"failed to start '{}', {}", args, error_message(e));
 	}
 
+	{
+		std::scoped_lock lock(c.m);
+		c.pid = pi.dwProcessId;
+	}
+
 	if (impl_.job)
 	{
 		if (!::AssignProcessToJobObject(impl_.job.get(), pi.hProcess))
@@ -577,15 +981,295 @@ void process::do_run(const std::string& what)
 			const auto e = GetLastError();
 			cx_->warning(context::cmd,
 				"can't assign process to job, {}", error_message(e));
+
+			impl_.job = {};
 		}
 	}
 
+	if (!impl_.job)
+		port.watch_process(pi.hProcess, c);
+
+	set_limits(pi.hProcess);
+
 	cx_->trace(context::cmd, "pid {}", pi.dwProcessId);
 
+	if (conf::bool_global_by_name("output_logs"))
+		open_output_log(pi.dwProcessId);
+
+	{
+		std::scoped_lock lock(c.m);
+		c.stdout_pipe.start();
+		c.stderr_pipe.start();
+	}
+
+	::ResumeThread(pi.hThread);
 	::CloseHandle(pi.hThread);
+
 	impl_.handle.reset(pi.hProcess);
 }
 
+process::priorities parse_priority(const context& cx, const std::string& s)
+{
+	if (s == "idle")
+		return process::priorities::idle;
+	else if (s == "below_normal")
+		return process::priorities::below_normal;
+	else if (s == "normal")
+		return process::priorities::normal;
+	else if (s == "above_normal")
+		return process::priorities::above_normal;
+	else if (s == "high")
+		return process::priorities::high;
+
+	cx.bail_out(context::conf,
+		"bad priority '{}', must be idle, below_normal, normal, "
+		"above_normal or high", s);
+}
+
+// a comma-separated list of processor numbers or ranges, such as "0-7,12"
+//
+std::uint64_t parse_affinity(const context& cx, const std::string& s)
+{
+	std::uint64_t mask = 0;
+
+	auto to_int = [&](std::string_view n)
+	{
+		const auto t = trim_copy(n);
+		int i = -1;
+
+		const auto r = std::from_chars(t.data(), t.data() + t.size(), i);
+
+		const bool ok =
+			(r.ec == std::errc() && r.ptr == t.data() + t.size()) &&
+			(i >= 0 && i < 64);
+
+		if (!ok)
+		{
+			cx.bail_out(context::conf,
+				"bad processor '{}' in affinity '{}'", t, s);
+		}
+
+		return i;
+	};
+
+	for (auto&& part : split(s, ","))
+	{
+		const auto dash = part.find('-');
+
+		if (dash == std::string::npos)
+		{
+			mask |= (std::uint64_t(1) << to_int(part));
+		}
+		else
+		{
+			const int first = to_int(std::string_view(part).substr(0, dash));
+			const int last = to_int(std::string_view(part).substr(dash + 1));
+
+			for (int i=first; i<=last; ++i)
+				mask |= (std::uint64_t(1) << i);
+		}
+	}
+
+	return mask;
+}
+
+DWORD priority_class(process::priorities p)
+{
+	switch (p)
+	{
+		case process::priorities::idle:
+			return IDLE_PRIORITY_CLASS;
+
+		case process::priorities::below_normal:
+			return BELOW_NORMAL_PRIORITY_CLASS;
+
+		case process::priorities::above_normal:
+			return ABOVE_NORMAL_PRIORITY_CLASS;
+
+		case process::priorities::high:
+			return HIGH_PRIORITY_CLASS;
+
+		case process::priorities::normal:
+		case process::priorities::task_default:
+		default:
+			return NORMAL_PRIORITY_CLASS;
+	}
+}
+
+void set_io_priority(const context& cx, HANDLE h)
+{
+	// PROCESS_MODE_BACKGROUND_BEGIN only works on the current process, so the
+	// i/o priority is set with the same undocumented call used by the
+	// task manager; processes started by the child inherit both priorities
+	using NtSetInformationProcess_type =
+		LONG (NTAPI*)(HANDLE, ULONG, PVOID, ULONG);
+
+	static auto* NtSetInformationProcess =
+		reinterpret_cast<NtSetInformationProcess_type>(::GetProcAddress(
+			::GetModuleHandleW(L"ntdll.dll"), "NtSetInformationProcess"));
+
+	// ProcessIoPriority and IoPriorityVeryLow
+	const ULONG ProcessIoPriority = 33;
+	ULONG io_priority = 0;
+
+	if (NtSetInformationProcess)
+	{
+		const auto r = NtSetInformationProcess(
+			h, ProcessIoPriority, &io_priority, sizeof(io_priority));
+
+		if (r < 0)
+			cx.debug(context::cmd, "can't set i/o priority, status {}", r);
+	}
+
+	MEMORY_PRIORITY_INFORMATION mp = {};
+	mp.MemoryPriority = MEMORY_PRIORITY_LOW;
+
+	if (!::SetProcessInformation(h, ProcessMemoryPriority, &mp, sizeof(mp)))
+	{
+		const auto e = GetLastError();
+		cx.debug(context::cmd,
+			"can't set memory priority, {}", error_message(e));
+	}
+}
+
+void process::set_limits(HANDLE process_handle)
+{
+	std::vector<std::string> task_names;
+	if (!cx_->task_name().empty())
+		task_names.push_back(cx_->task_name());
+
+	auto p = priority_;
+	if (p == priorities::task_default)
+	{
+		static const auto id = conf::task_option_id("priority");
+		p = parse_priority(*cx_, conf::task_option(task_names, id));
+	}
+
+	static const auto affinity_id = conf::task_option_id("affinity");
+	static const auto background_io_id = conf::task_option_id("background_io");
+
+	const std::uint64_t mask = (affinity_ ?
+		*affinity_ :
+		parse_affinity(*cx_, conf::task_option(task_names, affinity_id)));
+
+	const bool bg = (background_io_ ?
+		*background_io_ :
+		conf::bool_task_option(task_names, background_io_id));
+
+	if (p != priorities::normal || mask != 0)
+	{
+		cx_->trace(context::cmd,
+			"priority class {:#x}, affinity {:#x}", priority_class(p), mask);
+
+		// the limits in the job also apply to processes started by the child,
+		// which is where most of the work is done (cl.exe, link.exe, etc.)
+		JOBOBJECT_BASIC_LIMIT_INFORMATION limits = {};
+
+		if (p != priorities::normal)
+		{
+			limits.LimitFlags |= JOB_OBJECT_LIMIT_PRIORITY_CLASS;
+			limits.PriorityClass = priority_class(p);
+		}
+
+		if (mask != 0)
+		{
+			limits.LimitFlags |= JOB_OBJECT_LIMIT_AFFINITY;
+			limits.Affinity = static_cast<ULONG_PTR>(mask);
+		}
+
+		const bool set_on_job = impl_.job && ::SetInformationJobObject(
+			impl_.job.get(), JobObjectBasicLimitInformation,
+			&limits, sizeof(limits));
+
+		if (!set_on_job)
+		{
+			const auto e = GetLastError();
+			cx_->debug(context::cmd,
+				"can't set job limits, {}; setting on process only",
+				error_message(e));
+
+			if (p != priorities::normal)
+				::SetPriorityClass(process_handle, priority_class(p));
+
+			if (mask != 0)
+			{
+				::SetProcessAffinityMask(
+					process_handle, static_cast<DWORD_PTR>(mask));
+			}
+		}
+	}
+
+	if (bg)
+	{
+		cx_->trace(context::cmd, "background i/o");
+		set_io_priority(*cx_, process_handle);
+	}
+}
+
+fs::path process::find_direct_binary() const
+{
+	// raw commands and pipelines need the shell, and so do code pages: the
+	// console is shared with all the other processes running concurrently,
+	// so it can't be changed from here
+	if (!raw_.empty() || chcp_ != -1 || unicode_)
+		return {};
+
+	if (!conf::bool_global_by_name("direct_exec"))
+		return {};
+
+	// batch files are run by cmd anyway
+	auto is_batch = [](const fs::path& p)
+	{
+		const auto ext = path_to_utf8(p.extension());
+		return (_stricmp(ext.c_str(), ".bat") == 0 || _stricmp(ext.c_str(), ".cmd") == 0);
+	};
+
+	if (bin_.has_parent_path())
+	{
+		if (is_batch(bin_) || !fs::exists(bin_))
+			return {};
+
+		return bin_;
+	}
+
+	// bare names like git.exe are looked up in the PATH of the child, which
+	// is what cmd would do; CreateProcess() would use mob's own PATH
+	std::string path = env_.get("PATH");
+	if (path.empty())
+		path = this_env::get("PATH");
+
+	std::vector<std::string> exts = {""};
+	if (!bin_.has_extension())
+		exts = {".com", ".exe", ".bat", ".cmd"};
+
+	// cmd looks in the current directory first
+	std::vector<fs::path> dirs = {cwd_.empty() ? fs::current_path() : cwd_};
+
+	for (auto&& dir : split(path, ";"))
+		dirs.push_back(utf8_to_utf16(trim_copy(dir, "\"")));
+
+	for (auto&& dir : dirs)
+	{
+		for (auto&& ext : exts)
+		{
+			fs::path p = dir / bin_;
+			p += utf8_to_utf16(ext);
+
+			std::error_code ec;
+			if (!fs::is_regular_file(p, ec))
+				continue;
+
+			if (is_batch(p))
+				return {};
+
+			return p;
+		}
+	}
+
+	// let cmd complain
+	return {};
+}
+
 std::wstring process::make_cmd_args(const std::string& what) const
 {
 	std::wstring s;
@@ -603,10 +1287,62 @@ std::wstring process::make_cmd_args(const std::string& what) const
 	return s;
 }
 
+// jobs of the processes that had keep_leftovers, see terminate_leftovers()
+static std::mutex g_leftovers_mutex;
+static std::vector<handle_ptr> g_leftovers;
+
+void process::terminate_leftovers()
+{
+	std::vector<handle_ptr> v;
+
+	{
+		std::scoped_lock lock(g_leftovers_mutex);
+		v.swap(g_leftovers);
+	}
+
+	std::size_t count = 0;
+
+	for (auto&& job : v)
+	{
+		JOBOBJECT_BASIC_ACCOUNTING_INFORMATION info = {};
+
+		const auto r = ::QueryInformationJobObject(
+			job.get(), JobObjectBasicAccountingInformation,
+			&info, sizeof(info), nullptr);
+
+		if (r && info.ActiveProcesses == 0)
+			continue;
+
+		if (!::TerminateJobObject(job.get(), 0xff))
+		{
+			const auto e = GetLastError();
+			gcx().warning(context::cmd,
+				"failed to terminate job, {}", error_message(e));
+
+			continue;
+		}
+
+		count += (r ? info.ActiveProcesses : 1);
+	}
+
+	gcx().debug(context::cmd,
+		"terminated {} leftover processes in {} jobs", count, v.size());
+}
+
 void process::interrupt()
 {
 	impl_.interrupt = true;
 	cx_->trace(context::cmd, "will interrupt");
+
+	if (auto c=impl_.client)
+	{
+		{
+			// join() checks the flag with the lock held
+			std::scoped_lock lock(c->m);
+		}
+
+		c->cv.notify_all();
+	}
 }
 
 void process::join()
@@ -614,29 +1350,80 @@ void process::join()
 	if (!impl_.handle)
 		return;
 
+	auto& c = *impl_.client;
+
 	bool interrupted = false;
-	guard g([&] { impl_.handle = {}; });
+	bool finishing = false;
+
+	guard g([&]
+	{
+		c.unwatch();
+		impl_.handle = {};
+		impl_.run_span = {};
+
+		if (impl_.job && is_set(flags_, keep_leftovers))
+		{
+			std::scoped_lock lock(g_leftovers_mutex);
+			g_leftovers.push_back(std::move(impl_.job));
+		}
+	});
 
 	cx_->trace(context::cmd, "joining");
 
 	for (;;)
 	{
-		const auto r = WaitForSingleObject(impl_.handle.get(), wait_timeout);
+		std::unique_lock lock(c.m);
 
-		if (r == WAIT_OBJECT_0)
+		// woken up by the port thread for output and exit, and by interrupt()
+		c.cv.wait(lock, [&]
 		{
-			on_completed();
-			break;
+			if (c.stdout_pipe.has_data() || c.stderr_pipe.has_data())
+				return true;
+
+			if (impl_.interrupt && !interrupted)
+				return true;
+
+			if (c.exited)
+			{
+				if (!finishing)
+					return true;
+
+				return (c.stdout_pipe.closed() && c.stderr_pipe.closed());
+			}
+
+			return false;
+		});
+
+		const std::string out = c.stdout_pipe.take();
+		const std::string err = c.stderr_pipe.take();
+
+		if (c.exited && !finishing)
+		{
+			// reads whatever is left in the pipes; processes started by the
+			// child might still have them open, so this doesn't wait for them
+			// to be closed
+			c.stdout_pipe.finish();
+			c.stderr_pipe.finish();
+			finishing = true;
 		}
-		else if (r == WAIT_TIMEOUT)
+
+		const bool done =
+			c.exited && c.stdout_pipe.closed() && c.stderr_pipe.closed();
+
+		lock.unlock();
+
+		read_pipes(false, out, err);
+
+		if (impl_.interrupt && !interrupted)
 		{
-			on_timeout(interrupted);
+			on_interrupt();
+			interrupted = true;
 		}
-		else
+
+		if (done)
 		{
-			const auto e = GetLastError();
-			cx_->bail_out(context::cmd,
-				"failed to wait on process", error_message(e));
+			on_completed();
+			break;
 		}
 	}
 
@@ -644,22 +1431,26 @@ void process::join()
 		cx_->trace(context::cmd, "process interrupted and finished");
 }
 
-void process::read_pipes(bool finish)
+void process::read_pipes(
+	bool finish, std::string_view out, std::string_view err)
 {
-	read_pipe(finish, stdout_, *impl_.stdout_pipe, context::std_out);
-	read_pipe(finish, stderr_, *impl_.stderr_pipe, context::std_err);
+	read_pipe(finish, stdout_, out, context::std_out);
+	read_pipe(finish, stderr_, err, context::std_err);
 }
 
 void process::read_pipe(
-	bool finish, stream& s, async_pipe& pipe, context::reason r)
+	bool finish, stream& s, std::string_view bytes, context::reason r)
 {
 	switch (s.flags)
 	{
 		case forward_to_log:
 		{
-			s.buffer.add(pipe.read(finish));
+			const DWORD pid = (impl_.handle ?
+				::GetProcessId(impl_.handle.get()) : 0);
+
+			s.buffer.add(bytes);
 
-			s.buffer.next_utf8_lines(finish, [&](std::string&& line)
+			s.buffer.next_utf8_lines(finish, [&](std::string_view line)
 			{
 				filter f(line, r, s.level, false);
 
@@ -671,9 +1462,9 @@ void process::read_pipe(
 				}
 
 				if (!is_set(flags_, ignore_output_on_success))
-					cx_->log_string(f.r, f.lv, f.line);
+					cx_->log_process_string(f.r, f.lv, f.line, pid);
 
-				logs_[f.lv].emplace_back(std::move(line));
+				keep_line(f.lv, f.line);
 			});
 
 			break;
@@ -681,7 +1472,7 @@ void process::read_pipe(
 
 		case keep_in_string:
 		{
-			s.buffer.add(pipe.read(finish));
+			s.buffer.add(bytes);
 			break;
 		}
 
@@ -691,8 +1482,57 @@ void process::read_pipe(
 	}
 }
 
+void process::open_output_log(DWORD pid)
+{
+	const auto dir = paths::prefix() / "logs";
+	op::create_directories(*cx_, dir);
+
+	output_log_file_ = dir / (name() + "-" + std::to_string(pid) + ".log");
+
+	impl_.output_log = std::make_unique<std::ofstream>(
+		output_log_file_, std::ios::binary);
+
+	if (!*impl_.output_log)
+	{
+		cx_->warning(context::cmd, "can't open {}", output_log_file_);
+		impl_.output_log = {};
+		output_log_file_.clear();
+		return;
+	}
+
+	*impl_.output_log << make_cmd() << "\n\n";
+}
+
+void process::keep_line(context::level lv, std::string_view line)
+{
+	if (lv >= context::level::warning)
+		logs_[lv].emplace_back(line);
+
+	if (impl_.output_log)
+		*impl_.output_log << line << "\n";
+
+	if (tail_size_ == 0)
+		return;
+
+	if (tail_.size() < tail_size_)
+	{
+		tail_.emplace_back(line);
+	}
+	else
+	{
+		// reuses the oldest string
+		std::string s = std::move(tail_.front());
+		tail_.pop_front();
+
+		s.assign(line);
+		tail_.push_back(std::move(s));
+	}
+}
+
 void process::on_completed()
 {
+	usage_sink::add(query_usage());
+
 	if (impl_.interrupt)
 		return;
 
@@ -701,20 +1541,14 @@ void process::on_completed()
 		const auto e = GetLastError();
 
 		cx_->error(context::cmd,
-			"failed to get exit code, ", error_message(e));
+			"failed to get exit code, {}", error_message(e));
 
 		code_ = 0xffff;
 	}
 
-	read_pipes(false);
-
-	for (;;)
-	{
-		read_pipes(true);
-
-		if (impl_.stdout_pipe->closed() && impl_.stderr_pipe->closed())
-			break;
-	}
+	// everything was read by join(), this flushes the last lines if they
+	// didn't end with a newline
+	read_pipes(true, {}, {});
 
 	// success
 	if (success_.contains(static_cast<int>(code_)))
@@ -761,36 +1595,102 @@ void process::on_completed()
 	}
 }
 
-void process::on_timeout(bool& already_interrupted)
+resource_usage process::query_usage() const
 {
-	read_pipes(false);
+	using namespace std::chrono;
+
+	// FILETIME and the job times are in 100ns units
+	auto to_ns = [](std::uint64_t v)
+	{
+		return nanoseconds(v * 100);
+	};
+
+	resource_usage u;
 
-	if (impl_.interrupt && !already_interrupted)
+	if (impl_.job)
 	{
-		const auto pid = GetProcessId(impl_.handle.get());
+		JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION acc = {};
 
-		if (pid == 0)
+		if (::QueryInformationJobObject(
+			impl_.job.get(), JobObjectBasicAndIoAccountingInformation,
+			&acc, sizeof(acc), nullptr))
 		{
-			cx_->trace(context::cmd,
-				"process id is 0, terminating instead");
+			u.user = to_ns(static_cast<std::uint64_t>(
+				acc.BasicInfo.TotalUserTime.QuadPart));
 
-			terminate();
+			u.kernel = to_ns(static_cast<std::uint64_t>(
+				acc.BasicInfo.TotalKernelTime.QuadPart));
+
+			u.read_bytes = acc.IoInfo.ReadTransferCount;
+			u.write_bytes = acc.IoInfo.WriteTransferCount;
+			u.processes = acc.BasicInfo.TotalProcesses;
 		}
-		else
+
+		JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+
+		if (::QueryInformationJobObject(
+			impl_.job.get(), JobObjectExtendedLimitInformation,
+			&limits, sizeof(limits), nullptr))
 		{
-			cx_->trace(context::cmd, "sending sigint to {}", pid);
-			GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, pid);
+			u.peak_memory = limits.PeakJobMemoryUsed;
+		}
+	}
+	else
+	{
+		// not in a job, only the process itself
+		FILETIME creation, exit, kernel, user;
 
-			if (flags_ & terminate_on_interrupt)
+		if (::GetProcessTimes(
+			impl_.handle.get(), &creation, &exit, &kernel, &user))
+		{
+			auto get = [](const FILETIME& ft)
 			{
-				cx_->trace(context::cmd,
-					"terminating process (flag is set)");
+				return
+					(static_cast<std::uint64_t>(ft.dwHighDateTime) << 32) |
+					ft.dwLowDateTime;
+			};
 
-				terminate();
-			}
+			u.user = to_ns(get(user));
+			u.kernel = to_ns(get(kernel));
 		}
 
-		already_interrupted = true;
+		IO_COUNTERS io = {};
+
+		if (::GetProcessIoCounters(impl_.handle.get(), &io))
+		{
+			u.read_bytes = io.ReadTransferCount;
+			u.write_bytes = io.WriteTransferCount;
+		}
+
+		u.processes = 1;
+	}
+
+	return u;
+}
+
+void process::on_interrupt()
+{
+	const auto pid = GetProcessId(impl_.handle.get());
+
+	if (pid == 0)
+	{
+		cx_->trace(context::cmd,
+			"process id is 0, terminating instead");
+
+		terminate();
+	}
+	else
+	{
+		cx_->trace(context::cmd, "sending sigint to {}", pid);
+		GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, pid);
+
+		if (flags_ & terminate_on_interrupt)
+		{
+			cx_->trace(context::cmd,
+				"terminating process (flag is set)");
+
+			terminate();
+		}
 	}
 }
 
@@ -838,19 +1738,24 @@ void process::dump_error_log_file() noexcept
 
 	if (fs::exists(error_log_file_))
 	{
-		std::string log = op::read_text_file(
-			*cx_, encodings::dont_know, error_log_file_, op::optional);
+		// logs like boost's bootstrap.log can be large, they're streamed
+		bool first = true;
 
-		if (log.empty())
-			return;
+		op::for_each_text_line(
+			*cx_, encodings::dont_know, error_log_file_,
+			[&](std::string_view line)
+			{
+				if (first)
+				{
+					cx_->error(context::cmd,
+						"{} failed, content of {}:", make_name(), error_log_file_);
 
-		cx_->error(context::cmd,
-			"{} failed, content of {}:", make_name(), error_log_file_);
+					first = false;
+				}
 
-		for_each_line(log, [&](auto&& line)
-		{
-			cx_->error(context::cmd, "        {}", line);
-		});
+				cx_->error(context::cmd, "        {}", line);
+			},
+			op::optional);
 	}
 	else
 	{
@@ -861,23 +1766,47 @@ void process::dump_error_log_file() noexcept
 
 void process::dump_stderr() noexcept
 {
-	const std::string s = stderr_.buffer.utf8_string();
-
-	if (!s.empty())
+	// lines forwarded to the log are not kept in the buffer, only the tail
+	if (stderr_.flags == forward_to_log)
 	{
-		cx_->error(context::cmd,
-			"{} failed, {}, content of stderr:", make_name(), make_cmd());
-
-		for_each_line(s, [&](auto&& line)
+		if (tail_.empty())
 		{
-			cx_->error(context::cmd, "        {}", line);
-		});
+			cx_->error(context::cmd,
+				"{} failed, output was empty", make_name());
+		}
+		else
+		{
+			cx_->error(context::cmd,
+				"{} failed, {}, last {} lines of output:",
+				make_name(), make_cmd(), tail_.size());
+
+			for (auto&& line : tail_)
+				cx_->error(context::cmd, "        {}", line);
+		}
 	}
 	else
 	{
-		cx_->error(context::cmd,
-			"{} failed, stderr was empty", make_name());
+		const std::string s = stderr_.buffer.utf8_string();
+
+		if (!s.empty())
+		{
+			cx_->error(context::cmd,
+				"{} failed, {}, content of stderr:", make_name(), make_cmd());
+
+			for_each_line(s, [&](auto&& line)
+			{
+				cx_->error(context::cmd, "        {}", line);
+			});
+		}
+		else
+		{
+			cx_->error(context::cmd,
+				"{} failed, stderr was empty", make_name());
+		}
 	}
+
+	if (!output_log_file_.empty())
+		cx_->error(context::cmd, "full output is in {}", output_log_file_);
 }
 
 int process::exit_code() const
@@ -970,9 +1899,29 @@ void encoded_buffer::add(std::string_view bytes)
 	bytes_.append(bytes.begin(), bytes.end());
 }
 
+void encoded_buffer::compact()
+{
+	if (last_ == 0)
+		return;
+
+	if (last_ >= bytes_.size())
+	{
+		// everything was consumed, keeps the capacity
+		bytes_.clear();
+		last_ = 0;
+	}
+	else if (last_ >= bytes_.size() / 2)
+	{
+		// only moves the partial line at the end once most of the buffer has
+		// been consumed, so this stays linear over the whole output
+		bytes_.erase(0, last_);
+		last_ = 0;
+	}
+}
+
 std::string encoded_buffer::utf8_string() const
 {
-	return bytes_to_utf8(e_, bytes_);
+	return bytes_to_utf8(e_, std::string_view(bytes_).substr(last_));
 }
 
 }	// namespace
@@ -10,32 +10,201 @@ namespace mob
 class url;
 
 
+// a named pipe and its read buffer; instances are kept by the pipe_pool once
+// a process is done with them and given to the next one
+//
+struct pipe_instance
+{
+	// first, so the port thread can get back to the instance from the
+	// overlapped of a completion
+	OVERLAPPED ov = {};
+
+	// the read end, associated with the process_port with
+	// process_port::pipe_key
+	handle_ptr server;
+
+	// signalled when a child connects, see async_pipe::connect()
+	handle_ptr connected;
+
+	std::wstring name;
+
+	// grows when reads keep filling it, see async_pipe::on_completion()
+	std::unique_ptr<char[]> buffer;
+	std::size_t buffer_size = 0;
+
+	// key of the process_port::client the pipe is given to, completions for
+	// this pipe are routed to it
+	ULONG_PTR key = 0;
+};
+
+
+// idle pipe instances; creating a named pipe and its buffer for every
+// process is wasted for the many small git and patch queries, and streams
+// that are discarded or inherited don't need one at all
+//
+class pipe_pool
+{
+public:
+	static pipe_pool& instance();
+
+	// an idle pipe with no client, or a new one associated with the port
+	//
+	std::unique_ptr<pipe_instance> acquire(const context& cx, HANDLE port);
+
+	// disconnects the child and keeps the pipe for later, or closes it if
+	// there are already enough idle ones; there must not be any pending read
+	//
+	void release(std::unique_ptr<pipe_instance> p);
+
+private:
+	std::mutex m_;
+	std::vector<std::unique_ptr<pipe_instance>> idle_;
+
+	std::unique_ptr<pipe_instance> create(const context& cx, HANDLE port);
+};
+
+
+// the read end of a pipe connected to a child's stdout or stderr, serviced by
+// the process_port: reads are queued on the port and the port thread calls
+// on_completion() when they're done
+//
+// the pipe comes from the pipe_pool when create() is called and goes back as
+// soon as it's closed, nothing is allocated for streams that never call
+// create()
+//
+// all member functions except create() must be called with the mutex of the
+// process_port::client that owns this pipe held
+//
 class async_pipe
 {
 public:
 	async_pipe(const context& cx);
+	~async_pipe();
+
+	async_pipe(const async_pipe&) = delete;
+	async_pipe& operator=(const async_pipe&) = delete;
+
+	// gets a pipe from the pool and returns the handle to give to the child;
+	// completions are routed to the client with the given key
+	//
+	handle_ptr create(HANDLE port, ULONG_PTR key);
+
+	// queues the first read
+	//
+	void start();
+
+	// whether `ov` is the overlapped structure used by this pipe, used by the
+	// port thread to route completions
+	//
+	bool owns(const OVERLAPPED* ov) const;
 
-	handle_ptr create();
-	std::string_view read(bool finish);
+	// called by the port thread when a read has completed or failed; the
+	// bytes are kept until take() is called and another read is queued
+	//
+	void on_completion(bool ok, DWORD bytes);
+
+	// stops reading as soon as there's nothing left that can be read
+	// immediately; the pipe is closed once the last read completes
+	//
+	void finish();
+
+	// moves out the bytes read since the last call
+	//
+	std::string take();
+
+	bool has_data() const;
 	bool closed() const;
 
 private:
-	static const std::size_t buffer_size = 50'000;
-
 	const context& cx_;
-	handle_ptr stdout_;
-	handle_ptr event_;
-	std::unique_ptr<char[]> buffer_;
-	OVERLAPPED ov_;
+	std::unique_ptr<pipe_instance> pipe_;
+	std::string data_;
 	bool pending_;
+	bool finishing_;
 	bool closed_;
 
-	HANDLE create_pipe();
-	std::string_view try_read();
-	std::string_view check_pending();
+	HANDLE connect();
+	void queue_read();
+
+	// gives the pipe back to the pool
+	//
+	void close();
+};
+
+
+// all the processes started by mob are serviced by a single I/O completion
+// port and one thread that dequeues from it: reads on the stdout and stderr
+// pipes complete on the port and the job object of each process posts its
+// exit notification to it, so process::join() wakes up as soon as there's
+// output or the process has exited instead of polling
+//
+class process_port
+{
+public:
+	// completion key of all the pipes, the client is in the pipe_instance
+	static constexpr ULONG_PTR pipe_key = 1;
+
+	// state shared between a process and the port thread, guarded by `m`;
+	// `cv` is notified every time something changes
+	//
+	struct client
+	{
+		std::mutex m;
+		std::condition_variable cv;
+		async_pipe stdout_pipe;
+		async_pipe stderr_pipe;
+		DWORD pid = 0;
+		bool exited = false;
+
+		// set when the process isn't in a job, see watch_process()
+		HANDLE wait = nullptr;
+
+		client(const context& cx);
+
+		// unregisters the wait from watch_process(), if any
+		//
+		void unwatch();
+	};
+
+	static process_port& instance();
+	~process_port();
+
+	HANDLE handle() const;
+
+	// the port keeps the client alive until the process has exited and both
+	// pipes are closed
+	//
+	std::shared_ptr<client> add(const context& cx);
+
+	// exit notifications from this job will be posted to the port; must be
+	// called before any process is assigned to the job
+	//
+	bool watch_job(HANDLE job, client& c);
+
+	// fallback when the process couldn't be put in a job, a thread pool wait
+	// on the process handle posts the same notification a job would
+	//
+	void watch_process(HANDLE process, client& c);
+
+private:
+	handle_ptr port_;
+	std::thread thread_;
+	std::mutex m_;
+	std::map<client*, std::shared_ptr<client>> clients_;
+
+	process_port();
+	void run();
+	void on_completion(client* c, bool ok, DWORD bytes, OVERLAPPED* ov);
 };
 
 
+// accumulates the output of a process and splits it into utf8 lines
+//
+// lines that have been handed out by next_utf8_lines() are dropped from the
+// buffer, so memory stays bounded by the longest line instead of growing with
+// the whole output; utf8_string() only returns what hasn't been consumed,
+// which is everything for streams that are kept in a string
+//
 class encoded_buffer
 {
 public:
@@ -45,6 +214,10 @@ public:
 
 	std::string utf8_string() const;
 
+	// calls `f` with a std::string_view for each complete line, or for the
+	// remaining bytes if `finished` is true; the view is only valid during
+	// the call
+	//
 	template <class F>
 	void next_utf8_lines(bool finished, F&& f)
 	{
@@ -58,9 +231,13 @@ public:
 						next_line<wchar_t>(finished, bytes_, last_);
 
 					if (utf16.empty())
+					{
+						compact();
 						return;
+					}
 
-					f(utf16_to_utf8(utf16));
+					utf16_to_utf8(utf16, utf8_);
+					f(std::string_view(utf8_));
 					break;
 				}
 
@@ -71,9 +248,13 @@ public:
 						next_line<char>(finished, bytes_, last_);
 
 					if (cp.empty())
+					{
+						compact();
 						return;
+					}
 
-					f(bytes_to_utf8(e_, cp));
+					bytes_to_utf8(e_, cp, utf8_, utf16_);
+					f(std::string_view(utf8_));
 					break;
 				}
 
@@ -85,9 +266,12 @@ public:
 						next_line<char>(finished, bytes_, last_);
 
 					if (utf8.empty())
+					{
+						compact();
 						return;
+					}
 
-					f(std::string(utf8));
+					f(utf8);
 					break;
 				}
 			}
@@ -99,6 +283,13 @@ private:
 	std::string bytes_;
 	std::size_t last_;
 
+	// reused for conversions
+	std::string utf8_;
+	std::wstring utf16_;
+
+	// drops the bytes before last_
+	void compact();
+
 	template <class CharT>
 	std::basic_string_view<CharT> next_line(
 		bool finished, std::string_view bytes, std::size_t& byte_offset)
@@ -170,7 +361,11 @@ public:
 		noflags                  = 0x00,
 		allow_failure            = 0x01,
 		terminate_on_interrupt   = 0x02,
-		ignore_output_on_success = 0x04
+		ignore_output_on_success = 0x04,
+
+		// processes left running in the job when the child exits, like
+		// msbuild nodes, can be killed later by terminate_leftovers()
+		keep_leftovers           = 0x08
 	};
 
 	enum arg_flags
@@ -185,6 +380,18 @@ public:
 		forward_slashes = 0x40
 	};
 
+	enum class priorities
+	{
+		// uses the `priority` option of the task
+		task_default = 0,
+
+		idle,
+		below_normal,
+		normal,
+		above_normal,
+		high
+	};
+
 	enum stream_flags
 	{
 		forward_to_log = 1,
@@ -262,6 +469,30 @@ public:
 
 	process& external_error_log(const fs::path& p);
 
+	// the process reads its standard input from this file instead of NUL
+	//
+	process& stdin_file(const fs::path& p);
+
+	// the process reads its standard input from this handle, which is
+	// duplicated for the process and stays owned by the caller
+	//
+	process& stdin_handle(HANDLE h);
+
+	// priority class enforced on the process and everything it starts; the
+	// default is the `priority` option of the task
+	//
+	process& priority(priorities p);
+
+	// whether the process gets very low i/o and memory priorities; the
+	// default is the `background_io` option of the task
+	//
+	process& background_io(bool b);
+
+	// mask of logical processors the process and everything it starts can
+	// run on, 0 for all; the default is the `affinity` option of the task
+	//
+	process& affinity(std::uint64_t mask);
+
 	process& flags(flags_t f);
 	flags_t flags() const;
 
@@ -301,6 +532,12 @@ public:
 
 	process& env(const mob::env& e);
 
+	// terminates the jobs of the processes that had keep_leftovers, and
+	// everything still running in them; processes that weren't started by
+	// mob are left alone
+	//
+	static void terminate_leftovers();
+
 	void run();
 	void interrupt();
 	void join();
@@ -315,8 +552,13 @@ private:
 		handle_ptr handle;
 		handle_ptr job;
 		std::atomic<bool> interrupt{false};
-		std::unique_ptr<async_pipe> stdout_pipe;
-		std::unique_ptr<async_pipe> stderr_pipe;
+		std::shared_ptr<process_port::client> client;
+
+		// full output of the process, see process::open_output_log()
+		std::unique_ptr<std::ofstream> output_log;
+
+		// from run() to join()
+		std::unique_ptr<span> run_span;
 
 		impl() = default;
 		impl(const impl&);
@@ -351,24 +593,61 @@ private:
 	std::string raw_;
 	std::string cmd_;
 	fs::path error_log_file_;
+	fs::path stdin_file_;
+	HANDLE stdin_handle_;
+	priorities priority_;
+	std::optional<bool> background_io_;
+	std::optional<std::uint64_t> affinity_;
+
+	// only warnings and errors, shown after the process exits
 	std::map<context::level, std::vector<std::string>> logs_;
 
+	// the last `output_tail` lines from both streams, shown if the process
+	// fails
+	std::deque<std::string> tail_;
+	std::size_t tail_size_;
+	fs::path output_log_file_;
+
 	impl impl_;
 	DWORD code_;
 
 	std::string make_name() const;
+
+	// short name for the span of this process, the full command line is
+	// not useful in a trace
+	//
+	std::string make_span_name() const;
 	std::string make_cmd() const;
 	std::wstring make_cmd_args(const std::string& what) const;
+
+	// the binary that can be given directly to CreateProcess(), or empty if
+	// the process has to go through cmd, see do_run()
+	//
+	fs::path find_direct_binary() const;
 	void pipe_into(const process& p);
 
 	void do_run(const std::string& what);
-	void read_pipes(bool finish);
-	void read_pipe(bool finish, stream& s, async_pipe& pipe, context::reason r);
+	void read_pipes(bool finish, std::string_view out, std::string_view err);
+
+	void read_pipe(
+		bool finish, stream& s, std::string_view bytes, context::reason r);
 
 	void on_completed();
-	void on_timeout(bool& already_interrupted);
+	void on_interrupt();
+
+	// resources used by the process and everything it started, from its job
+	//
+	resource_usage query_usage() const;
 	void terminate();
 
+	// sets the priority and affinity limits on the job, and the i/o priority
+	// of the suspended process
+	//
+	void set_limits(HANDLE process_handle);
+
+	void open_output_log(DWORD pid);
+	void keep_line(context::level lv, std::string_view line);
+
 	void dump_error_log_file() noexcept;
 	void dump_stderr() noexcept;
 
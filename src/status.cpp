@@ -0,0 +1,278 @@
+#include "pch.h"
+#include "status.h"
+#include "utility.h"
+#include "context.h"
+
+namespace mob
+{
+
+// how often the lines are redrawn
+static constexpr auto redraw_interval = std::chrono::milliseconds(250);
+
+// longest task name shown, same as the log lines
+static constexpr std::size_t longest_task_name = 15;
+
+static std::atomic<bool> g_active(false);
+
+
+static std::string size_string(std::uint64_t bytes)
+{
+	const double mb = static_cast<double>(bytes) / (1024.0 * 1024.0);
+	return fmt::format("{:.1f} MB", mb);
+}
+
+static std::string elapsed_string(std::chrono::steady_clock::duration d)
+{
+	using namespace std::chrono;
+
+	const auto s = duration_cast<seconds>(d).count();
+
+	if (s < 60)
+		return fmt::format("{}s", s);
+	else
+		return fmt::format("{}m{:02}s", s / 60, s % 60);
+}
+
+
+live_status& live_status::instance()
+{
+	static live_status s;
+	return s;
+}
+
+bool live_status::active()
+{
+	return g_active;
+}
+
+void live_status::start()
+{
+	if (g_active)
+		return;
+
+	if (!enable_console_footer())
+	{
+		gcx().warning(context::generic,
+			"the status view needs a console that supports virtual "
+			"terminal sequences, ignoring");
+
+		return;
+	}
+
+	{
+		std::scoped_lock lock(m_);
+		stop_ = false;
+		start_ = std::chrono::steady_clock::now();
+		estimate_ = {};
+	}
+
+	g_active = true;
+	thread_ = start_thread([&]{ run(); });
+}
+
+void live_status::stop()
+{
+	if (!g_active)
+		return;
+
+	{
+		std::scoped_lock lock(m_);
+		stop_ = true;
+	}
+
+	cv_.notify_all();
+
+	if (thread_.joinable())
+		thread_.join();
+
+	g_active = false;
+	set_console_footer({});
+
+	std::scoped_lock lock(m_);
+	tasks_.clear();
+}
+
+void live_status::set_phase(const std::string& task, std::string phase)
+{
+	if (!g_active)
+		return;
+
+	std::scoped_lock lock(m_);
+
+	auto& e = tasks_[task];
+	e.phase = std::move(phase);
+	e.phase_start = std::chrono::steady_clock::now();
+}
+
+void live_status::set_tool(const std::string& task, std::string tool)
+{
+	if (!g_active)
+		return;
+
+	std::scoped_lock lock(m_);
+
+	auto itor = tasks_.find(task);
+	if (itor != tasks_.end())
+		itor->second.tool = std::move(tool);
+}
+
+void live_status::set_download(
+	const std::string& task, std::uint64_t now, std::uint64_t total)
+{
+	if (!g_active)
+		return;
+
+	std::scoped_lock lock(m_);
+
+	// downloads can come from a thread started by task::parallel(), which
+	// has its own name
+	auto& e = tasks_[task];
+
+	if (!e.downloading)
+	{
+		e.downloading = true;
+		e.dl_last = now;
+		e.dl_last_time = std::chrono::steady_clock::now();
+		e.dl_rate = 0;
+
+		if (e.phase.empty())
+			e.phase_start = e.dl_last_time;
+	}
+
+	e.dl_now = now;
+	e.dl_total = total;
+}
+
+void live_status::end_download(const std::string& task)
+{
+	if (!g_active)
+		return;
+
+	std::scoped_lock lock(m_);
+
+	auto itor = tasks_.find(task);
+	if (itor == tasks_.end())
+		return;
+
+	if (itor->second.phase.empty())
+		tasks_.erase(itor);
+	else
+		itor->second.downloading = false;
+}
+
+void live_status::remove(const std::string& task)
+{
+	if (!g_active)
+		return;
+
+	std::scoped_lock lock(m_);
+	tasks_.erase(task);
+}
+
+void live_status::set_estimate(std::chrono::seconds s)
+{
+	if (!g_active)
+		return;
+
+	std::scoped_lock lock(m_);
+	estimate_ = s;
+}
+
+void live_status::run()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock lock(m_);
+			cv_.wait_for(lock, redraw_interval, [&]{ return stop_; });
+
+			if (stop_)
+				break;
+		}
+
+		set_console_footer(make_lines());
+	}
+}
+
+std::vector<std::string> live_status::make_lines()
+{
+	std::scoped_lock lock(m_);
+
+	std::vector<std::string> lines;
+
+	const auto elapsed = std::chrono::steady_clock::now() - start_;
+
+	std::string first = fmt::format(
+		"mob: {} running, {}", tasks_.size(), elapsed_string(elapsed));
+
+	if (estimate_.count() > 0)
+	{
+		if (elapsed < estimate_)
+		{
+			first += fmt::format(
+				", ~{} left", elapsed_string(estimate_ - elapsed));
+		}
+		else
+		{
+			first += fmt::format(
+				", over the {} predicted", elapsed_string(estimate_));
+		}
+	}
+
+	lines.push_back(first);
+
+	for (auto&& [name, e] : tasks_)
+		lines.push_back(make_line(name, e));
+
+	return lines;
+}
+
+std::string live_status::make_line(const std::string& task, entry& e)
+{
+	using namespace std::chrono;
+
+	const auto now = steady_clock::now();
+
+	std::string s = fmt::format(
+		"  {:<{}} {:<20} {:>7}",
+		task.substr(0, longest_task_name), longest_task_name,
+		e.phase.empty() ? "downloading" : e.phase,
+		elapsed_string(now - e.phase_start));
+
+	if (!e.tool.empty())
+		s += fmt::format("  [{}]", e.tool);
+
+	if (e.downloading)
+	{
+		// smoothed so the number doesn't jump around on every redraw
+		const double dt = duration<double>(now - e.dl_last_time).count();
+
+		if (dt > 0 && e.dl_now >= e.dl_last)
+		{
+			const double rate = static_cast<double>(e.dl_now - e.dl_last) / dt;
+			e.dl_rate = (e.dl_rate == 0 ? rate : e.dl_rate * 0.7 + rate * 0.3);
+		}
+
+		e.dl_last = e.dl_now;
+		e.dl_last_time = now;
+
+		if (e.dl_total > 0)
+		{
+			const auto percent = (e.dl_now * 100) / e.dl_total;
+
+			s += fmt::format(
+				"  {}/{} {}%",
+				size_string(e.dl_now), size_string(e.dl_total), percent);
+		}
+		else
+		{
+			s += "  " + size_string(e.dl_now);
+		}
+
+		s += "  " + size_string(static_cast<std::uint64_t>(e.dl_rate)) + "/s";
+	}
+
+	return s;
+}
+
+}	// namespace
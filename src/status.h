@@ -0,0 +1,92 @@
+#pragma once
+
+namespace mob
+{
+
+// interactive view for `mob build --status`: one line per running task with
+// its phase, how long it's been in that phase, the tool it's running and the
+// progress of its download, if any
+//
+// the lines are drawn at the bottom of the console by a thread a few times
+// per second, see set_console_footer(); while the view is shown, only
+// warnings and errors are logged to the console, the log file still gets
+// everything
+//
+// all the functions are thread-safe and do nothing if the view is not
+// active, so they can be called unconditionally
+//
+class live_status
+{
+public:
+	static live_status& instance();
+
+	// whether start() succeeded and stop() hasn't been called yet
+	//
+	static bool active();
+
+	// starts the redraw thread; warns and does nothing if stdout is not a
+	// console or if it doesn't support virtual terminal sequences
+	//
+	void start();
+
+	// stops the thread and erases the lines
+	//
+	void stop();
+
+	// sets the phase shown for the given task, resets its elapsed time
+	//
+	void set_phase(const std::string& task, std::string phase);
+
+	// tool currently run by the given task, empty for none
+	//
+	void set_tool(const std::string& task, std::string tool);
+
+	// bytes received so far for the given task's download; `total` is 0 if
+	// the length is not known
+	//
+	void set_download(
+		const std::string& task, std::uint64_t now, std::uint64_t total);
+
+	void end_download(const std::string& task);
+
+	// removes the line for the given task
+	//
+	void remove(const std::string& task);
+
+	// predicted duration of the whole build, shown next to the elapsed time
+	//
+	void set_estimate(std::chrono::seconds s);
+
+private:
+	struct entry
+	{
+		std::string phase;
+		std::string tool;
+		std::chrono::steady_clock::time_point phase_start;
+
+		bool downloading = false;
+		std::uint64_t dl_now = 0;
+		std::uint64_t dl_total = 0;
+
+		// for the throughput, updated on every redraw
+		std::uint64_t dl_last = 0;
+		std::chrono::steady_clock::time_point dl_last_time;
+		double dl_rate = 0;
+	};
+
+	std::chrono::steady_clock::time_point start_;
+	std::chrono::seconds estimate_{0};
+	std::map<std::string, entry> tasks_;
+	std::mutex m_;
+	std::condition_variable cv_;
+	std::thread thread_;
+	bool stop_ = false;
+
+	live_status() = default;
+
+	void run();
+	std::vector<std::string> make_lines();
+	std::string make_line(const std::string& task, entry& e);
+};
+
+}	// namespace
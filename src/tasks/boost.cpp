@@ -105,17 +105,7 @@ void boost::fetch_prebuilt()
 {
 	cx().trace(context::generic, "using prebuilt boost");
 
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(prebuilt_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(prebuilt_url()), source_path());
 }
 
 void boost::build_and_install_prebuilt()
@@ -130,17 +120,7 @@ void boost::build_and_install_prebuilt()
 
 void boost::fetch_from_source()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(source_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-		.file(file)
-		.output(source_path()));
-	});
+	download_and_extract(downloader(source_url()), source_path());
 }
 
 void boost::bootstrap()
@@ -172,21 +152,40 @@ void boost::build_and_install_from_source()
 
 	instrument<times::build>([&]
 	{
-		do_b2(
-			{"thread", "date_time", "filesystem", "locale"},
-			"static", "static", arch::x64);
+		// the variants are independent and each one has its own build
+		// directory, see do_b2()
+		parallel({
+			{"boost-static-x64", [&]
+			{
+				do_b2(
+					{"thread", "date_time", "filesystem", "locale"},
+					"static", "static", arch::x64);
+			}},
 
-		do_b2(
-			{"thread", "date_time", "filesystem", "locale"},
-			"static", "static", arch::x86);
+			{"boost-static-x86", [&]
+			{
+				do_b2(
+					{"thread", "date_time", "filesystem", "locale"},
+					"static", "static", arch::x86);
+			}},
 
-		do_b2(
-			{"thread", "date_time", "locale"},
-			"static", "shared", arch::x64);
+			{"boost-shared-x64", [&]
+			{
+				do_b2(
+					{"thread", "date_time", "locale"},
+					"static", "shared", arch::x64);
+			}},
 
-		do_b2(
-			{"thread", "python"},
-			"shared", "shared", arch::x64);
+			{"boost-python", [&]
+			{
+				do_b2(
+					{"thread", "python"},
+					"shared", "shared", arch::x64);
+			}}
+		});
+
+		// a variant that failed interrupts all tasks
+		check_interrupted();
 	});
 
 	instrument<times::install>([&]
@@ -201,8 +200,23 @@ void boost::do_b2(
 	const std::vector<std::string>& components,
 	const std::string& link, const std::string& runtime_link, arch a)
 {
+	// the variants from build_and_install_from_source() run concurrently,
+	// each one asks for its share of the budget so they all start right away
+	const std::size_t variants = 4;
+	const std::size_t total = job_slots::instance().total();
+
+	// held until b2 exits
+	const auto jobs = lease_jobs((total + variants - 1) / variants);
+
+	// b2 uses bin.v2/ by default, variants running concurrently would step on
+	// each other's intermediate files
+	const auto build_dir = source_path() / "bin.v2" /
+		(link + "-" + runtime_link + "-" + address_model_for_arch(a));
+
 	run_tool(process_runner(process()
 		.binary(b2_exe())
+		.arg("-j" + std::to_string(jobs.count()))
+		.arg("--build-dir=",    build_dir)
 		.arg("address-model=",  address_model_for_arch(a))
 		.arg("link=",           link)
 		.arg("runtime-link=",   runtime_link)
@@ -282,10 +296,15 @@ fs::path boost::config_jam_file()
 	return source_path() / "user-config-64.jam";
 }
 
-url boost::prebuilt_url()
+std::string boost::prebuilt_filename() const
 {
 	const auto underscores = replace_all(version(), ".", "_");
-	return make_prebuilt_url("boost_prebuilt_" + underscores + ".7z");
+	return "boost_prebuilt_" + underscores + ".7z";
+}
+
+url boost::prebuilt_url() const
+{
+	return make_prebuilt_url(prebuilt_filename());
 }
 
 url boost::source_url()
@@ -42,17 +42,7 @@ void bzip2::do_clean(clean c)
 
 void bzip2::do_fetch()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(source_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(source_url()), source_path());
 }
 
 url bzip2::source_url()
@@ -54,17 +54,7 @@ void fmt::do_clean(clean c)
 
 void fmt::do_fetch()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(source_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(source_url()), source_path());
 }
 
 cmake fmt::create_cmake_tool(const fs::path& src_path, cmake::ops o)
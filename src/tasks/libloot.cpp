@@ -52,17 +52,7 @@ void libloot::do_clean(clean c)
 
 void libloot::do_fetch()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(source_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(source_url()), source_path());
 }
 
 void libloot::do_build_and_install()
@@ -74,17 +74,7 @@ void lz4::fetch_prebuilt()
 {
 	cx().trace(context::generic, "using prebuilt lz4");
 
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(prebuilt_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(prebuilt_url()), source_path());
 }
 
 void lz4::build_and_install_prebuilt()
@@ -161,9 +151,14 @@ fs::path lz4::out_dir()
 	return solution_dir() / "bin" / "x64_Release";
 }
 
-url lz4::prebuilt_url()
+std::string lz4::prebuilt_filename() const
+{
+	return "lz4_prebuilt_" + version() + ".7z";
+}
+
+url lz4::prebuilt_url() const
 {
-	return make_prebuilt_url("lz4_prebuilt_" + version() + ".7z");
+	return make_prebuilt_url(prebuilt_filename());
 }
 
 }	// namespace
@@ -17,6 +17,51 @@ std::string make_short_name(const std::string& name)
 }
 
 
+modorganizer::profile modorganizer::profile::get(const std::string& name)
+{
+	const std::string section = "profile_" + name;
+
+	// bails out if the section doesn't exist
+	const auto keys = conf::global_keys(section);
+
+	auto get = [&](const std::string& k) -> std::string
+	{
+		if (std::find(keys.begin(), keys.end(), k) == keys.end())
+			return {};
+
+		return conf::get_global(section, k);
+	};
+
+	profile p;
+	p.name = name;
+	p.config = get("config");
+	p.dir = get("dir");
+	p.debug_info = get("debug_info");
+	p.fastlink = get("fastlink");
+	p.incremental = get("incremental");
+	p.ltcg = get("ltcg");
+
+	if (p.config.empty())
+		p.config = "RelWithDebInfo";
+
+	if (!p.debug_info.empty() && p.debug_info != "zi" && p.debug_info != "z7")
+	{
+		gcx().bail_out(context::conf,
+			"{}: debug_info must be 'zi' or 'z7', not '{}'",
+			section, p.debug_info);
+	}
+
+	return p;
+}
+
+bool modorganizer::profile::overrides_flags() const
+{
+	return
+		!debug_info.empty() || !fastlink.empty() ||
+		!incremental.empty() || !ltcg.empty();
+}
+
+
 modorganizer::modorganizer(std::string long_name, flags f)
 	: modorganizer(std::vector<std::string>{long_name}, f)
 {
@@ -64,10 +109,59 @@ fs::path modorganizer::this_source_path() const
 	return super_path() / name();
 }
 
+fs::path modorganizer::get_fingerprint_path() const
+{
+	return this_source_path();
+}
+
+fs::path modorganizer::this_build_path() const
+{
+	return create_this_cmake_tool().build_path();
+}
+
 fs::path modorganizer::this_solution_path() const
 {
-	const auto build_path = create_cmake_tool(this_source_path()).build_path();
-	return build_path / "INSTALL.vcxproj";
+	return this_build_path() / "INSTALL.vcxproj";
+}
+
+modorganizer::profile modorganizer::this_profile() const
+{
+	auto name = task_conf().build_profile();
+	if (name.empty())
+		name = "release";
+
+	return profile::get(name);
+}
+
+cmake::generators modorganizer::generator() const
+{
+	const auto g = task_conf().cmake_generator();
+
+	if (g == "ninja")
+		return cmake::ninja;
+	else if (g == "vs" || g.empty())
+		return cmake::vs;
+
+	cx().bail_out(context::conf,
+		"bad cmake_generator '{}', must be 'vs' or 'ninja'", g);
+}
+
+bool modorganizer::aggregated() const
+{
+	if (!task_conf().aggregate_build())
+		return false;
+
+	// the projects generated for ninja can't be put in an msbuild project
+	if (generator() != cmake::vs)
+	{
+		cx().warning(context::generic,
+			"aggregate_build needs the vs cmake_generator, building {} "
+			"by itself", name());
+
+		return false;
+	}
+
+	return true;
 }
 
 fs::path modorganizer::super_path()
@@ -94,7 +188,12 @@ void modorganizer::do_clean(clean c)
 			run_tool(create_this_cmake_tool(cmake::clean));
 
 		if (is_set(c, clean::rebuild))
-			run_tool(create_this_msbuild_tool(msbuild::clean));
+		{
+			if (generator() == cmake::ninja)
+				run_tool(create_this_ninja_tool(ninja::clean));
+			else
+				run_tool(create_this_msbuild_tool(msbuild::clean));
+		}
 	});
 }
 
@@ -136,21 +235,191 @@ void modorganizer::do_build_and_install()
 		run_tool(create_this_cmake_tool());
 	});
 
+	if (generator() == cmake::vs)
+		write_profile_props();
+
+	if (aggregated())
+	{
+		cx().debug(context::generic,
+			"{} will be built by super_build", this_solution_path());
+
+		auto ps = profile_properties();
+
+		// overrides the configuration given to the aggregate
+		ps.push_back("Configuration=" + this_profile().config);
+
+		super_build::add(*this, this_solution_path(), std::move(ps));
+		return;
+	}
+
 	instrument<times::build>([&]
 	{
-		run_tool(create_this_msbuild_tool());
+		if (generator() == cmake::ninja)
+			run_tool(create_this_ninja_tool());
+		else
+			run_tool(create_this_msbuild_tool());
 	});
 }
 
-cmake modorganizer::create_this_cmake_tool(cmake::ops o)
+cmake modorganizer::create_this_cmake_tool(cmake::ops o) const
+{
+	const auto p = this_profile();
+	const auto g = generator();
+
+	auto t = create_cmake_tool(this_source_path(), o, g);
+	t.build_type(p.config);
+
+	if (!p.dir.empty())
+	{
+		// vsbuild_dev, etc.
+		auto dir = t.build_path();
+		dir += utf8_to_utf16("_" + p.dir);
+		t.output(dir);
+	}
+
+	if (g != cmake::ninja || !p.overrides_flags())
+		return t;
+
+	// the vs generator gets these from the props file, see
+	// write_profile_props()
+	if (!p.debug_info.empty())
+	{
+		t.def("CMAKE_POLICY_DEFAULT_CMP0141", "NEW");
+		t.def("CMAKE_MSVC_DEBUG_INFORMATION_FORMAT",
+			p.debug_info == "z7" ? "Embedded" : "ProgramDatabase");
+	}
+
+	if (!p.ltcg.empty())
+	{
+		t.def("CMAKE_POLICY_DEFAULT_CMP0069", "NEW");
+		t.def("CMAKE_INTERPROCEDURAL_OPTIMIZATION",
+			p.ltcg == "true" ? "ON" : "OFF");
+	}
+
+	if (!p.fastlink.empty() || !p.incremental.empty())
+	{
+		// replaces the defaults for the configuration, which are /debug and
+		// /INCREMENTAL for everything but Release and MinSizeRel
+		const bool release =
+			(p.config == "Release" || p.config == "MinSizeRel");
+
+		std::vector<std::string> flags;
+
+		if (p.fastlink == "true")
+			flags.push_back("/DEBUG:FASTLINK");
+		else if (!release)
+			flags.push_back("/DEBUG");
+
+		bool incremental = !release;
+		if (!p.incremental.empty())
+			incremental = (p.incremental == "true");
+
+		flags.push_back(incremental ? "/INCREMENTAL" : "/INCREMENTAL:NO");
+
+		std::string upper = p.config;
+		std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+
+		for (auto&& what : {"EXE", "SHARED", "MODULE"})
+		{
+			t.def(
+				"CMAKE_" + std::string(what) + "_LINKER_FLAGS_" + upper,
+				"\"" + join(flags, " ") + "\"");
+		}
+	}
+
+	return t;
+}
+
+fs::path modorganizer::this_props_path() const
+{
+	return this_build_path() / "mob_profile.props";
+}
+
+void modorganizer::write_profile_props()
+{
+	const auto p = this_profile();
+	const auto file = this_props_path();
+
+	if (!p.overrides_flags())
+	{
+		op::delete_file(cx(), file, op::optional);
+		return;
+	}
+
+	std::ostringstream props, cl, link;
+
+	if (p.debug_info == "z7")
+		cl << "      <DebugInformationFormat>OldStyle</DebugInformationFormat>\n";
+	else if (p.debug_info == "zi")
+		cl << "      <DebugInformationFormat>ProgramDatabase</DebugInformationFormat>\n";
+
+	if (p.fastlink == "true")
+		link << "      <GenerateDebugInformation>DebugFastLink</GenerateDebugInformation>\n";
+	else if (p.fastlink == "false")
+		link << "      <GenerateDebugInformation>true</GenerateDebugInformation>\n";
+
+	if (!p.incremental.empty())
+		props << "    <LinkIncremental>" << p.incremental << "</LinkIncremental>\n";
+
+	if (!p.ltcg.empty())
+	{
+		props
+			<< "    <WholeProgramOptimization>" << p.ltcg
+			<< "</WholeProgramOptimization>\n";
+
+		cl
+			<< "      <WholeProgramOptimization>" << p.ltcg
+			<< "</WholeProgramOptimization>\n";
+
+		link
+			<< "      <LinkTimeCodeGeneration>"
+			<< (p.ltcg == "true" ? "UseLinkTimeCodeGeneration" : "Default")
+			<< "</LinkTimeCodeGeneration>\n";
+	}
+
+	// imported from Microsoft.Cpp.targets, after the definitions in the
+	// projects generated by cmake, so these win
+	std::ostringstream out;
+
+	out
+		<< "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+		<< "<!-- generated by mob for profile " << p.name << " -->\n"
+		<< "<Project "
+		<< "xmlns=\"http://schemas.microsoft.com/developer/msbuild/2003\">\n"
+		<< "  <PropertyGroup>\n" << props.str() << "  </PropertyGroup>\n"
+		<< "  <ItemDefinitionGroup>\n"
+		<< "    <ClCompile>\n" << cl.str() << "    </ClCompile>\n"
+		<< "    <Link>\n" << link.str() << "    </Link>\n"
+		<< "  </ItemDefinitionGroup>\n"
+		<< "</Project>\n";
+
+	const auto text = out.str();
+
+	// msbuild doesn't care about the date, but this keeps it stable
+	if (fs::exists(file))
+	{
+		if (op::read_text_file(cx(), encodings::utf8, file) == text)
+			return;
+	}
+
+	op::create_directories(cx(), file.parent_path());
+	op::write_text_file(cx(), encodings::utf8, file, text);
+}
+
+std::vector<std::string> modorganizer::profile_properties() const
 {
-	return create_cmake_tool(this_source_path(), o);
+	if (!this_profile().overrides_flags())
+		return {};
+
+	return {"ForceImportBeforeCppTargets=" + path_to_utf8(this_props_path())};
 }
 
-cmake modorganizer::create_cmake_tool(const fs::path& root, cmake::ops o)
+cmake modorganizer::create_cmake_tool(
+	const fs::path& root, cmake::ops o, cmake::generators g)
 {
 	return std::move(cmake(o)
-		.generator(cmake::vs)
+		.generator(g)
+		.build_type("RelWithDebInfo")
 		.def("CMAKE_INSTALL_PREFIX:PATH", paths::install())
 		.def("DEPENDENCIES_DIR",   paths::build())
 		.def("BOOST_ROOT",         boost::source_path())
@@ -169,11 +438,20 @@ cmake modorganizer::create_cmake_tool(const fs::path& root, cmake::ops o)
 		.root(root));
 }
 
+ninja modorganizer::create_this_ninja_tool(ninja::ops o)
+{
+	return std::move(ninja(o)
+		.path(this_build_path())
+		.target("install")
+		.architecture(arch::x64));
+}
+
 msbuild modorganizer::create_this_msbuild_tool(msbuild::ops o)
 {
 	return std::move(msbuild(o)
 		.solution(this_solution_path())
-		.config("RelWithDebInfo")
+		.config(this_profile().config)
+		.parameters(profile_properties())
 		.architecture(arch::x64));
 }
 
@@ -78,32 +78,12 @@ void openssl::fetch_prebuilt()
 {
 	cx().trace(context::generic, "using prebuilt openssl");
 
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(prebuilt_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(prebuilt_url()), source_path());
 }
 
 void openssl::fetch_from_source()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(source_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(source_url()), source_path());
 }
 
 void openssl::build_and_install_prebuilt()
@@ -126,7 +106,7 @@ void openssl::build_and_install_from_source()
 
 	instrument<times::build>([&]
 	{
-		install_engines();
+		build();
 	});
 
 	instrument<times::install>([&]
@@ -148,39 +128,54 @@ void openssl::configure()
 		.arg("--openssldir=", build_path())
 		.arg("--prefix=", build_path())
 		.arg("-FS")
+
+		// one cl per source file, the parallelism comes from jom's jobs
 		.arg("-MP1")
 		.arg("-wd4566")
 		.cwd(source_path())
 		.env(env::vs(arch::x64))));
 }
 
-void openssl::install_engines()
+void openssl::build()
 {
-	const int max_tries = 3;
+	// the race with /J is between the generated headers, like buildinf.h,
+	// and the sources that include them; generating them first is cheap and
+	// leaves the makefile with correct dependencies for everything else
+	run_stage("build_generated", jom::single_job);
+
+	// libssl depends on libcrypto in the makefile, engines on both; each
+	// stage gets as many jobs as the budget allows
+	run_stage("build_libs");
+	run_stage("build_engines");
+
+	// only copies files at this point
+	run_stage("install_engines", jom::single_job);
+}
 
-	for (int tries=0; tries<max_tries; ++tries)
-	{
-		const int exit_code = run_tool(jom()
-			.path(source_path())
-			.target("install_engines")
-			.flag(jom::allow_failure));
+void openssl::run_stage(const std::string& target, jom::flags_t f)
+{
+	const auto start = std::chrono::steady_clock::now();
 
-		if (exit_code == 0)
-			return;
+	const int exit_code = run_tool(jom()
+		.path(source_path())
+		.target(target)
+		.flag(f | jom::allow_failure));
 
-		cx().debug(context::generic,
-			"jom /J regularly fails with openssh because of race conditions; "
-			"trying again");
-	}
+	if (exit_code == 0)
+		return;
+
+	// whatever was built is kept, this only finishes the stage
+	const auto wasted = std::chrono::steady_clock::now() - start;
+	retry_stats::add(name(), target, wasted);
 
-	cx().debug(context::generic,
-		"jom /J has failed more than {} times, "
-		"restarting one last time without /J; that one should work",
-		max_tries);
+	cx().warning(context::generic,
+		"jom {} failed after {}ms, finishing it with a single job",
+		target,
+		std::chrono::duration_cast<std::chrono::milliseconds>(wasted).count());
 
 	run_tool(jom()
 		.path(source_path())
-		.target("install_engines")
+		.target(target)
 		.flag(jom::single_job));
 }
 
@@ -221,9 +216,14 @@ url openssl::source_url()
 		"openssl-" + version() + ".tar.gz";
 }
 
-url openssl::prebuilt_url()
+std::string openssl::prebuilt_filename() const
+{
+	return "openssl-prebuilt-" + version() + ".7z";
+}
+
+url openssl::prebuilt_url() const
 {
-	return make_prebuilt_url("openssl-prebuilt-" + version() + ".7z");
+	return make_prebuilt_url(prebuilt_filename());
 }
 
 std::vector<std::string> openssl::output_names()
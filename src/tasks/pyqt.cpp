@@ -86,17 +86,7 @@ void pyqt::do_build_and_install()
 
 void pyqt::fetch_prebuilt()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(prebuilt_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(prebuilt_url()), source_path());
 }
 
 void pyqt::build_and_install_prebuilt()
@@ -114,17 +104,7 @@ void pyqt::build_and_install_prebuilt()
 
 void pyqt::fetch_from_source()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(source_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(source_url()), source_path());
 }
 
 void pyqt::build_and_install_from_source()
@@ -158,7 +138,6 @@ void pyqt::sip_build()
 			python::build_path(),
 			python::source_path(),
 			python::scripts_path()})
-		.set("CL", " /MP")
 		.set("LIB", ";" + path_to_utf8(paths::install_libs()), env::append)
 		.set("PYTHONHOME", path_to_utf8(python::source_path()));
 
@@ -171,13 +150,16 @@ void pyqt::sip_build()
 	}
 	else
 	{
-		// sip-install.exe has trouble with deleting the build/ directory and
+		// sip-build.exe has trouble with deleting the build/ directory and
 		// trying to recreate it too fast, giving an access denied error; do it
 		// here instead
 		op::delete_directory(cx(), source_path() / "build", op::optional);
 
+		// only generates the makefiles, sip-build runs nmake on the whole
+		// thing, which builds one module after the other
 		run_tool(process_runner(process()
-			.binary(sip::sip_install_exe())
+			.binary(sip::sip_build_exe())
+			.arg("--no-make")
 			.arg("--confirm-license")
 			.arg("--verbose", process::log_trace)
 			.arg("--pep484-pyi")
@@ -189,6 +171,15 @@ void pyqt::sip_build()
 			.cwd(source_path())
 			.env(pyqt_env)));
 
+		build_modules(pyqt_env);
+
+		// everything is built, this copies the modules and the dist-info
+		// into site-packages
+		run_tool(jom()
+			.path(build_path())
+			.target("install")
+			.env(pyqt_env));
+
 		built_bypass.create();
 	}
 
@@ -200,6 +191,60 @@ void pyqt::sip_build()
 		.env(pyqt_env)));
 }
 
+void pyqt::build_modules(const env& pyqt_env)
+{
+	// every module has its own directory and makefile, they don't depend on
+	// each other
+	std::vector<fs::path> dirs;
+
+	if (fs::exists(build_path()))
+	{
+		for (auto&& e : fs::directory_iterator(build_path()))
+		{
+			if (e.is_directory() && fs::exists(e.path() / "Makefile"))
+				dirs.push_back(e.path());
+		}
+	}
+
+	if (dirs.empty())
+	{
+		// dry run
+		cx().debug(context::generic, "no modules in {}", build_path());
+		return;
+	}
+
+	// the budget is split between the modules so the small ones don't wait
+	// for the big ones; jom runs the compiler for each file separately
+	const std::size_t total = job_slots::instance().total();
+	const std::size_t jobs = std::max<std::size_t>(
+		1, (total + dirs.size() - 1) / dirs.size());
+
+	cx().debug(context::generic,
+		"building {} modules with up to {} jobs each", dirs.size(), jobs);
+
+	// each module is a thread with its own span, so its time shows up under
+	// the build phase in `mob timings`
+	std::vector<std::pair<std::string, std::function<void ()>>> v;
+
+	for (auto&& d : dirs)
+	{
+		v.emplace_back(
+			"pyqt-" + path_to_utf8(d.filename()),
+			[this, d, jobs, &pyqt_env]
+			{
+				run_tool(jom()
+					.path(d)
+					.max_jobs(jobs)
+					.env(pyqt_env));
+			});
+	}
+
+	parallel(v);
+
+	// a module that failed interrupts all tasks
+	check_interrupted();
+}
+
 void pyqt::install_sip_file()
 {
 	bypass_file installed_bypass(cx(), source_path(), "installed");
@@ -267,9 +312,44 @@ url pyqt::source_url()
 		"PyQt5-" + version() + ".tar.gz";
 }
 
-url pyqt::prebuilt_url()
+std::string pyqt::prebuilt_filename() const
+{
+	return "PyQt5_gpl-prebuilt-" + version() + ".7z";
+}
+
+fs::path pyqt::prebuilt_root() const
+{
+	// the prebuilt is copied over python, see build_and_install_prebuilt()
+	return python::source_path();
+}
+
+std::vector<fs::path> pyqt::prebuilt_files() const
+{
+	std::vector<fs::path> v;
+
+	// the modules, sip and their dist-info directories
+	if (fs::exists(python::site_packages_path()))
+	{
+		for (auto&& e : fs::directory_iterator(python::site_packages_path()))
+		{
+			if (path_to_utf8(e.path().filename()).starts_with("PyQt5"))
+				v.push_back(e.path());
+		}
+	}
+
+	for (auto&& exe : {"pylupdate5.exe", "pyrcc5.exe"})
+	{
+		const auto p = python::scripts_path() / exe;
+		if (fs::exists(p))
+			v.push_back(p);
+	}
+
+	return v;
+}
+
+url pyqt::prebuilt_url() const
 {
-	return make_prebuilt_url("PyQt5_gpl-prebuilt-" + version() + ".7z");
+	return make_prebuilt_url(prebuilt_filename());
 }
 
 fs::path pyqt::sip_install_file()
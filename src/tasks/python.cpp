@@ -110,17 +110,7 @@ void python::do_build_and_install()
 
 void python::fetch_prebuilt()
 {
-	const auto file = instrument<times::fetch>([&]
-	{
-		return run_tool(downloader(prebuilt_url()));
-	});
-
-	instrument<times::extract>([&]
-	{
-		run_tool(extractor()
-			.file(file)
-			.output(source_path()));
-	});
+	download_and_extract(downloader(prebuilt_url()), source_path());
 }
 
 void python::build_and_install_prebuilt()
@@ -291,9 +281,14 @@ fs::path python::site_packages_path()
 	return source_path() / "Lib" / "site-packages";
 }
 
-url python::prebuilt_url()
+std::string python::prebuilt_filename() const
+{
+	return "python-prebuilt-" + version_without_v() + ".7z";
+}
+
+url python::prebuilt_url() const
 {
-	return make_prebuilt_url("python-prebuilt-" + version_without_v() + ".7z");
+	return make_prebuilt_url(prebuilt_filename());
 }
 
 fs::path python::solution_file()
@@ -34,9 +34,9 @@ fs::path sip::sip_module_exe()
 	return python::scripts_path() / "sip-module.exe";
 }
 
-fs::path sip::sip_install_exe()
+fs::path sip::sip_build_exe()
 {
-	return python::scripts_path() / "sip-install.exe";
+	return python::scripts_path() / "sip-build.exe";
 }
 
 fs::path sip::module_source_path()
@@ -0,0 +1,246 @@
+#include "pch.h"
+#include "tasks.h"
+
+namespace mob
+{
+
+static std::mutex g_projects_mutex;
+static std::vector<std::tuple<task*, fs::path, std::vector<std::string>>>
+	g_projects;
+
+
+// lowercase with backslashes, for comparing paths from msbuild
+//
+static std::wstring normalized(const fs::path& p)
+{
+	std::wstring s = p.lexically_normal().make_preferred().native();
+	std::transform(s.begin(), s.end(), s.begin(), ::towlower);
+	return s;
+}
+
+static std::string xml_escape(std::string s)
+{
+	s = replace_all(s, "&", "&amp;");
+	s = replace_all(s, "<", "&lt;");
+	s = replace_all(s, ">", "&gt;");
+	s = replace_all(s, "\"", "&quot;");
+	return s;
+}
+
+
+super_build::super_build()
+	: basic_task("super_build")
+{
+}
+
+std::string super_build::version()
+{
+	return {};
+}
+
+bool super_build::prebuilt()
+{
+	return false;
+}
+
+fs::path super_build::source_path()
+{
+	return {};
+}
+
+fs::path super_build::aggregate_file()
+{
+	return paths::build() / "modorganizer_super.proj";
+}
+
+void super_build::add(
+	task& t, const fs::path& project, std::vector<std::string> properties)
+{
+	std::scoped_lock lock(g_projects_mutex);
+
+	// `watch` builds the same tasks again, and a round that failed before
+	// this task got to run leaves its projects behind
+	std::erase_if(g_projects, [&](auto&& p){ return std::get<0>(p) == &t; });
+
+	g_projects.push_back({&t, project, std::move(properties)});
+
+	// the task isn't built until this one runs
+	t.defer_inputs();
+}
+
+bool super_build::enabled() const
+{
+	std::scoped_lock lock(g_projects_mutex);
+	return !g_projects.empty();
+}
+
+bool super_build::can_skip_unchanged() const
+{
+	// the projects are different on every run, depending on which tasks
+	// were skipped
+	return false;
+}
+
+void super_build::do_build_and_install()
+{
+	const auto v = sorted_projects();
+
+	// the tasks add their projects again the next time they're built
+	guard g([&]
+	{
+		std::scoped_lock lock(g_projects_mutex);
+		g_projects.clear();
+	});
+
+	instrument<times::configure>([&]
+	{
+		write_aggregate(v);
+	});
+
+	instrument<times::build>([&]
+	{
+		run_tool(msbuild()
+			.solution(aggregate_file())
+			.config("RelWithDebInfo")
+			.architecture(arch::x64)
+			.project_owners([&](auto&& p){ return owner_of(v, p); }));
+	});
+
+	check_interrupted();
+
+	// the tasks are only recorded as built now, if this fails or never runs
+	// they're built again on the next run
+	for (auto&& p : v)
+		p.t->finish_deferred();
+}
+
+std::vector<super_build::project> super_build::sorted_projects() const
+{
+	std::vector<project> v;
+
+	{
+		std::scoped_lock lock(g_projects_mutex);
+
+		for (auto&& [t, f, ps] : g_projects)
+			v.push_back({t, f, ps, 0});
+	}
+
+	auto is_added = [&](const task* t)
+	{
+		for (auto&& p : v)
+		{
+			if (p.t == t)
+				return true;
+		}
+
+		return false;
+	};
+
+	// the wave of a task is one more than the highest wave of the added
+	// tasks it depends on, directly or through other tasks
+	std::map<const task*, std::size_t> waves;
+
+	std::function<std::size_t (const task*)> wave_of = [&](const task* t)
+	{
+		auto itor = waves.find(t);
+		if (itor != waves.end())
+			return itor->second;
+
+		std::size_t w = 0;
+
+		for (auto* d : t->dependencies())
+			w = std::max(w, wave_of(d) + (is_added(d) ? 1 : 0));
+
+		waves[t] = w;
+		return w;
+	};
+
+	for (auto& p : v)
+		p.wave = wave_of(p.t);
+
+	std::stable_sort(v.begin(), v.end(), [](auto&& a, auto&& b) {
+		return (a.wave < b.wave);
+	});
+
+	return v;
+}
+
+void super_build::write_aggregate(const std::vector<project>& v) const
+{
+	std::ostringstream items, calls;
+	std::size_t wave = std::numeric_limits<std::size_t>::max();
+
+	for (auto&& p : v)
+	{
+		if (p.wave != wave)
+		{
+			wave = p.wave;
+
+			// the configuration and platform given to msbuild are global
+			// properties, the projects inherit them
+			calls
+				<< "    <MSBuild Projects=\"@(Wave" << wave << ")\" "
+				<< "BuildInParallel=\"true\" />\n";
+		}
+
+		items
+			<< "    <Wave" << wave << " "
+			<< "Include=\"" << xml_escape(path_to_utf8(p.file)) << "\"";
+
+		if (p.properties.empty())
+		{
+			items << " />\n";
+		}
+		else
+		{
+			items
+				<< ">\n"
+				<< "      <Properties>"
+				<< xml_escape(join(p.properties, ";"))
+				<< "</Properties>\n"
+				<< "    </Wave" << wave << ">\n";
+		}
+
+		cx().trace(context::generic,
+			"{} in wave {}: {}", p.t->name(), wave, p.file);
+	}
+
+	std::ostringstream out;
+
+	out
+		<< "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+		<< "<!-- generated by mob, see super_build -->\n"
+		<< "<Project DefaultTargets=\"Build\" "
+		<< "xmlns=\"http://schemas.microsoft.com/developer/msbuild/2003\">\n"
+		<< "  <ItemGroup>\n"
+		<< items.str()
+		<< "  </ItemGroup>\n"
+		<< "  <Target Name=\"Build\">\n"
+		<< calls.str()
+		<< "  </Target>\n"
+		<< "</Project>\n";
+
+	cx().debug(context::generic,
+		"{} solutions in {} waves", v.size(), (v.empty() ? 0 : wave + 1));
+
+	op::write_text_file(cx(), encodings::utf8, aggregate_file(), out.str());
+}
+
+std::string super_build::owner_of(
+	const std::vector<project>& v, const fs::path& p) const
+{
+	const auto s = normalized(p);
+
+	// the projects of a task are all under the directory of its solution
+	for (auto&& e : v)
+	{
+		const auto dir = normalized(e.file.parent_path()) + L"\\";
+
+		if (s.compare(0, dir.size(), dir) == 0)
+			return e.t->name();
+	}
+
+	return {};
+}
+
+}	// namespace
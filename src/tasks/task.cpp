@@ -3,15 +3,22 @@
 #include "../conf.h"
 #include "../op.h"
 #include "../tools/tools.h"
+#include "../status.h"
 
 namespace mob
 {
 
-class interrupted {};
-
 static std::vector<std::unique_ptr<task>> g_tasks;
 static std::vector<task*> g_all_tasks;
 static std::atomic<bool> g_interrupt = false;
+
+// bumped by run_all_tasks(), the manifest of a task is computed once for
+// each, see task::make_manifest()
+static std::atomic<std::uint64_t> g_manifest_generation = 1;
+
+// when interrupt_all() was first called, to log how long it took for
+// everything to stop
+static std::chrono::steady_clock::time_point g_interrupt_time;
 std::mutex task::interrupt_mutex_;
 
 
@@ -43,6 +50,7 @@ std::vector<task*> get_top_level_tasks()
 std::vector<task*> find_tasks(const std::string& pattern)
 {
 	std::vector<task*> tasks;
+	const auto& g = glob::get(pattern);
 
 	for (auto&& t : g_all_tasks)
 	{
@@ -54,7 +62,7 @@ std::vector<task*> find_tasks(const std::string& pattern)
 		{
 			for (auto&& n : t->names())
 			{
-				if (mob::glob_match(pattern, n))
+				if (g.matches(n))
 				{
 					tasks.push_back(t);
 					break;
@@ -68,6 +76,8 @@ std::vector<task*> find_tasks(const std::string& pattern)
 
 task* find_task(const std::string& pattern)
 {
+	const auto& g = glob::get(pattern);
+
 	for (auto&& t : g_all_tasks)
 	{
 		if (pattern == "super" && t->is_super())
@@ -75,7 +85,7 @@ task* find_task(const std::string& pattern)
 
 		for (auto&& n : t->names())
 		{
-			if (mob::glob_match(pattern, n))
+			if (g.matches(n))
 				return t;
 		}
 	}
@@ -83,38 +93,177 @@ task* find_task(const std::string& pattern)
 	return nullptr;
 }
 
-void run_all_tasks()
+// one per task, used by run_all_tasks()
+//
+struct task_node
 {
-	try
+	task* t = nullptr;
+	std::vector<task_node*> deps;
+
+	// whether this task has been built and installed, or was disabled, or
+	// bailed out; protected by g_nodes_mutex
+	bool done = false;
+};
+
+static std::mutex g_nodes_mutex;
+static std::condition_variable g_nodes_cv;
+
+
+// creates one node per task and resolves their dependencies
+//
+std::vector<task_node> make_task_graph()
+{
+	std::vector<task_node> nodes(g_tasks.size());
+	std::map<task*, task_node*> map;
+
+	for (std::size_t i=0; i<g_tasks.size(); ++i)
+	{
+		nodes[i].t = g_tasks[i].get();
+		map[nodes[i].t] = &nodes[i];
+	}
+
+	for (auto& n : nodes)
 	{
-		for (auto& t : g_tasks)
+		for (auto* d : n.t->dependencies())
 		{
-			t->fetch();
+			auto itor = map.find(d);
+			MOB_ASSERT(itor != map.end());
 
-			if (g_interrupt)
-				throw interrupted();
+			n.deps.push_back(itor->second);
 		}
+	}
+
+	return nodes;
+}
+
+// bails out if there's a cycle anywhere in the graph
+//
+void check_task_graph(const std::vector<task_node>& nodes)
+{
+	// 0=not visited, 1=visiting, 2=visited
+	std::map<const task_node*, int> states;
+
+	std::function<void (const task_node&)> visit = [&](const task_node& n)
+	{
+		int& st = states[&n];
+
+		if (st == 2)
+			return;
+
+		if (st == 1)
+		{
+			gcx().bail_out(context::generic,
+				"dependency cycle involving task {}", n.t->name());
+		}
+
+		st = 1;
+
+		for (auto* d : n.deps)
+			visit(*d);
 
-		for (auto& t : g_tasks)
+		st = 2;
+	};
+
+	for (auto& n : nodes)
+		visit(n);
+}
+
+// waits until all the dependencies of the given node are done, returns false
+// if the tasks were interrupted while waiting
+//
+bool wait_for_dependencies(const task_node& n)
+{
+	auto ready = [&]
+	{
+		for (auto* d : n.deps)
 		{
-			t->join();
+			if (!d->done)
+				return false;
+		}
 
-			if (g_interrupt)
-				throw interrupted();
+		return true;
+	};
 
-			t->build_and_install();
+	std::unique_lock lock(g_nodes_mutex);
 
-			if (g_interrupt)
-				throw interrupted();
+	if (!ready())
+	{
+		std::vector<std::string> names;
+		for (auto* d : n.deps)
+		{
+			if (!d->done)
+				names.push_back(d->t->name());
+		}
 
-			t->join();
+		gcx().debug(context::generic,
+			"{} waiting for {}", n.t->name(), join(names, ", "));
+	}
+
+	g_nodes_cv.wait(lock, [&]{ return g_interrupt || ready(); });
+
+	return !g_interrupt;
+}
 
-			if (g_interrupt)
-				throw interrupted();
+// fetches the task, waits for its dependencies and builds it
+//
+void run_task_node(task_node& n, const std::function<void (task&)>& fetched)
+{
+	guard g([&]
+	{
+		{
+			std::scoped_lock lock(g_nodes_mutex);
+			n.done = true;
 		}
+
+		g_nodes_cv.notify_all();
+	});
+
+	n.t->fetch();
+	n.t->join();
+
+	if (g_interrupt)
+		return;
+
+	if (fetched && n.t->enabled())
+		fetched(*n.t);
+
+	if (!wait_for_dependencies(n))
+		return;
+
+	n.t->build_and_install();
+	n.t->join();
+}
+
+void run_all_tasks(std::function<void (task&)> fetched)
+{
+	// sources can be fetched again by this run, like with `watch`
+	++g_manifest_generation;
+
+	auto nodes = make_task_graph();
+	check_task_graph(nodes);
+
+	std::vector<std::thread> threads;
+
+	for (auto& n : nodes)
+	{
+		threads.push_back(start_thread([&n, &fetched]
+		{
+			run_task_node(n, fetched);
+		}));
 	}
-	catch(interrupted&)
+
+	for (auto& t : threads)
+		t.join();
+
+	if (g_interrupt)
 	{
+		using namespace std::chrono;
+
+		const auto d = duration_cast<milliseconds>(
+			steady_clock::now() - g_interrupt_time);
+
+		gcx().info(context::interruption,
+			"all tasks stopped {}ms after the interruption", d.count());
 	}
 }
 
@@ -166,15 +315,16 @@ std::string to_string(task::clean c)
 
 struct task::thread_context
 {
-	std::thread::id tid;
+	const task* t;
 	context cx;
 
-	thread_context(std::thread::id tid, context cx)
-		: tid(tid), cx(std::move(cx))
-	{
-	}
+	// binding that was active on this thread before this one, restored when
+	// threaded_run() returns
+	const thread_context* previous;
 };
 
+thread_local const task::thread_context* task::thread_context_ = nullptr;
+
 
 task_conf_holder::task_conf_holder(const task& t)
 	: task_(t)
@@ -183,72 +333,128 @@ task_conf_holder::task_conf_holder(const task& t)
 
 std::string task_conf_holder::mo_org() const
 {
-	return conf::task_option_by_name(task_.names(), "mo_org");
+	static const auto id = conf::task_option_id("mo_org");
+	return conf::task_option(task_.names(), id);
 }
 
 std::string task_conf_holder::mo_branch() const
 {
-	return conf::task_option_by_name(task_.names(), "mo_branch");
+	static const auto id = conf::task_option_id("mo_branch");
+	return conf::task_option(task_.names(), id);
 }
 
 bool task_conf_holder::no_pull() const
 {
-	return conf::bool_task_option_by_name(task_.names(), "no_pull");
+	static const auto id = conf::task_option_id("no_pull");
+	return conf::bool_task_option(task_.names(), id);
 }
 
 bool task_conf_holder::revert_ts() const
 {
-	return conf::bool_task_option_by_name(task_.names(), "revert_ts");
+	static const auto id = conf::task_option_id("revert_ts");
+	return conf::bool_task_option(task_.names(), id);
 }
 
 bool task_conf_holder::ignore_ts()const
 {
-	return conf::bool_task_option_by_name(task_.names(), "ignore_ts");
+	static const auto id = conf::task_option_id("ignore_ts");
+	return conf::bool_task_option(task_.names(), id);
 }
 
 std::string task_conf_holder::git_url_prefix() const
 {
-	return conf::task_option_by_name(task_.names(), "git_url_prefix");
+	static const auto id = conf::task_option_id("git_url_prefix");
+	return conf::task_option(task_.names(), id);
 }
 
 bool task_conf_holder::git_shallow() const
 {
-	return conf::bool_task_option_by_name(task_.names(), "git_shallow");
+	static const auto id = conf::task_option_id("git_shallow");
+	return conf::bool_task_option(task_.names(), id);
+}
+
+std::string task_conf_holder::git_filter() const
+{
+	static const auto id = conf::task_option_id("git_filter");
+	return conf::task_option(task_.names(), id);
+}
+
+std::vector<std::string> task_conf_holder::git_sparse() const
+{
+	static const auto id = conf::task_option_id("git_sparse");
+	return split(conf::task_option(task_.names(), id), " ;");
 }
 
 std::string task_conf_holder::git_user() const
 {
-	return conf::task_option_by_name(task_.names(), "git_username");
+	static const auto id = conf::task_option_id("git_username");
+	return conf::task_option(task_.names(), id);
 }
 
 std::string task_conf_holder::git_email() const
 {
-	return conf::task_option_by_name(task_.names(), "git_email");
+	static const auto id = conf::task_option_id("git_email");
+	return conf::task_option(task_.names(), id);
 }
 
 bool task_conf_holder::set_origin_remote() const
 {
-	return conf::bool_task_option_by_name(task_.names(), "set_origin_remote");
+	static const auto id = conf::task_option_id("set_origin_remote");
+	return conf::bool_task_option(task_.names(), id);
 }
 
 std::string task_conf_holder::remote_org() const
 {
-	return conf::task_option_by_name(task_.names(), "remote_org");
+	static const auto id = conf::task_option_id("remote_org");
+	return conf::task_option(task_.names(), id);
 }
 
 std::string task_conf_holder::remote_key() const
 {
-	return conf::task_option_by_name(task_.names(), "remote_key");
+	static const auto id = conf::task_option_id("remote_key");
+	return conf::task_option(task_.names(), id);
 }
 
 bool task_conf_holder::remote_no_push_upstream() const
 {
-	return conf::bool_task_option_by_name(task_.names(), "remote_no_push_upstream");
+	static const auto id = conf::task_option_id("remote_no_push_upstream");
+	return conf::bool_task_option(task_.names(), id);
 }
 
 bool task_conf_holder::remote_push_default_origin() const
 {
-	return conf::bool_task_option_by_name(task_.names(), "remote_push_default_origin");
+	static const auto id = conf::task_option_id("remote_push_default_origin");
+	return conf::bool_task_option(task_.names(), id);
+}
+
+bool task_conf_holder::skip_unchanged() const
+{
+	static const auto id = conf::task_option_id("skip_unchanged");
+	return conf::bool_task_option(task_.names(), id);
+}
+
+bool task_conf_holder::use_artifact_cache() const
+{
+	static const auto id = conf::task_option_id("use_artifact_cache");
+	return conf::bool_task_option(task_.names(), id);
+}
+
+std::string task_conf_holder::cmake_generator() const
+{
+	static const auto id = conf::task_option_id("cmake_generator");
+	return conf::task_option(task_.names(), id);
+}
+
+bool task_conf_holder::aggregate_build() const
+{
+	static const auto id = conf::task_option_id("aggregate_build");
+	return conf::bool_task_option(task_.names(), id);
+}
+
+std::string task_conf_holder::build_profile() const
+{
+	static const auto id = conf::task_option_id("build_profile");
+	return conf::task_option(task_.names(), id);
 }
 
 git task_conf_holder::make_git(git::ops o) const
@@ -262,6 +468,8 @@ git task_conf_holder::make_git(git::ops o) const
 	g.revert_ts_on_pull(revert_ts());
 	g.credentials(git_user(), git_email());
 	g.shallow(git_shallow());
+	g.filter(git_filter());
+	g.sparse(git_sparse());
 
 	if (set_origin_remote())
 	{
@@ -297,13 +505,11 @@ std::array<std::string, 7> time_names()
 
 task::task(std::vector<std::string> names) :
 	instrumentable(names[0], time_names()),
-	names_(std::move(names)), interrupted_(false)
+	names_(std::move(names)), interrupted_(false),
+	cx_(name()), creator_tid_(std::this_thread::get_id()),
+	manifest_generation_(0), deferred_(false), deferred_publish_(false)
 {
-	contexts_.push_back(std::make_unique<thread_context>(
-		std::this_thread::get_id(), context(name())));
-
-	if (name() != "parallel")
-		g_all_tasks.push_back(this);
+	g_all_tasks.push_back(this);
 }
 
 task::~task()
@@ -320,7 +526,8 @@ task::~task()
 
 bool task::enabled() const
 {
-	return conf::bool_task_option_by_name(names(), "enabled");
+	static const auto id = conf::task_option_id("enabled");
+	return conf::bool_task_option(names(), id);
 }
 
 bool task::is_super() const
@@ -328,20 +535,98 @@ bool task::is_super() const
 	return false;
 }
 
-const context& task::cx() const
+std::string task::prebuilt_filename() const
 {
-	static const context bad("?");
+	return {};
+}
+
+fs::path task::prebuilt_root() const
+{
+	return get_source_path();
+}
+
+std::vector<fs::path> task::prebuilt_files() const
+{
+	return {prebuilt_root()};
+}
+
+bool task::can_skip_unchanged() const
+{
+	return true;
+}
+
+void task::defer_inputs()
+{
+	deferred_ = true;
+}
+
+void task::finish_deferred()
+{
+	if (!deferred_)
+		return;
+
+	deferred_ = false;
+	record_inputs(deferred_manifest_, deferred_publish_);
+	deferred_manifest_.reset();
+}
 
+fs::path task::get_fingerprint_path() const
+{
+	return get_source_path();
+}
+
+task& task::depends_on(std::vector<std::string> patterns)
+{
+	deps_.insert(deps_.end(), patterns.begin(), patterns.end());
+	return *this;
+}
+
+const std::vector<std::string>& task::dependency_patterns() const
+{
+	return deps_;
+}
+
+std::vector<task*> task::dependencies() const
+{
+	std::vector<task*> v;
+
+	for (auto&& pattern : deps_)
 	{
-		std::scoped_lock lock(contexts_mutex_);
+		const auto tasks = find_tasks(pattern);
 
-		for (auto& td : contexts_)
+		if (tasks.empty())
 		{
-			if (td->tid == std::this_thread::get_id())
-				return td->cx;
+			gcx().bail_out(context::generic,
+				"task {} depends on '{}', but no task matches",
+				name(), pattern);
 		}
+
+		for (auto* t : tasks)
+		{
+			if (t == this)
+				continue;
+
+			if (std::find(v.begin(), v.end(), t) == v.end())
+				v.push_back(t);
+		}
+	}
+
+	return v;
+}
+
+const context& task::cx() const
+{
+	static const context bad("?");
+
+	for (auto* tc=thread_context_; tc; tc=tc->previous)
+	{
+		if (tc->t == this)
+			return tc->cx;
 	}
 
+	if (std::this_thread::get_id() == creator_tid_)
+		return cx_;
+
 	return bad;
 }
 
@@ -358,9 +643,33 @@ void task::interrupt_all()
 {
 	std::scoped_lock lock(interrupt_mutex_);
 
+	if (!g_interrupt)
+		g_interrupt_time = std::chrono::steady_clock::now();
+
 	g_interrupt = true;
 	for (auto&& t : g_tasks)
 		t->interrupt();
+
+	{
+		// wakes up the tasks waiting on their dependencies
+		std::scoped_lock nodes_lock(g_nodes_mutex);
+	}
+
+	g_nodes_cv.notify_all();
+}
+
+bool task::all_interrupted()
+{
+	return g_interrupt;
+}
+
+void task::reset_interrupt()
+{
+	std::scoped_lock lock(interrupt_mutex_);
+
+	g_interrupt = false;
+	for (auto&& t : g_tasks)
+		t->interrupted_ = false;
 }
 
 const std::string& task::name() const
@@ -377,26 +686,12 @@ void task::threaded_run(std::string thread_name, std::function<void ()> f)
 {
 	try
 	{
-		{
-			std::scoped_lock lock(contexts_mutex_);
+		const thread_context tc{this, context(thread_name), thread_context_};
 
-			contexts_.push_back(std::make_unique<thread_context>(
-				std::this_thread::get_id(), context(thread_name)));
-		}
+		thread_context_ = &tc;
+		guard g([&]{ thread_context_ = tc.previous; });
 
-		guard g([&]
-		{
-			std::scoped_lock lock(contexts_mutex_);
-
-			for (auto itor=contexts_.begin(); itor!=contexts_.end(); ++itor)
-			{
-				if ((*itor)->tid == std::this_thread::get_id())
-				{
-					contexts_.erase(itor);
-					break;
-				}
-			}
-		});
+		span_scope ss("task", thread_name, name());
 
 		f();
 	}
@@ -415,12 +710,22 @@ void task::parallel(std::vector<std::pair<std::string, std::function<void ()>>>
 {
 	std::vector<std::thread> ts;
 
+	// processes started by the threads are counted in the phase that called
+	// this, the sink outlives the threads since they're joined below
+	const auto* sink = usage_sink::current();
+
+	// same for spans, the ones started by the threads are children of the
+	// current one
+	const auto spans = span::current();
+
 	for (auto&& [name, f] : v)
 	{
 		cx().trace(context::generic, "running in parallel: {}", name);
 
-		ts.push_back(start_thread([this, name, f]
+		ts.push_back(start_thread([this, name, f, sink, spans]
 		{
+			usage_sink::exchange(sink);
+			span::exchange(spans);
 			threaded_run(name, f);
 		}));
 	}
@@ -429,33 +734,102 @@ void task::parallel(std::vector<std::pair<std::string, std::function<void ()>>>
 		t.join();
 }
 
-task_conf_holder task::task_conf() const
+fs::path task::download_and_extract(downloader dl, const fs::path& where)
 {
-	return task_conf_holder(*this);
-}
+	// what was extracted, used by make_manifest(); the time or the machine
+	// must not be in there, the manifest is also the key of the artifact
+	// cache
+	auto write_stamp = [&](const fs::path& file)
+	{
+		if (conf::dry())
+			return;
 
-void task::run()
-{
-	threaded_run(name(), [&]
+		sha256 h;
+		h.update_from_file(file);
+
+		std::string s;
+		s += "url = " + (dl.urls().empty() ? "" : dl.urls().front().string());
+		s += "\nsha256 = " + h.finish();
+		s += "\nversion = " + get_version() + "\n";
+
+		op::write_text_file(
+			cx(), encodings::utf8, extractor::stamp_file(where), s);
+	};
+
+	auto extract = [&](const fs::path& file)
 	{
-		if (!enabled())
+		extractor ex;
+		ex.file(file).output(where);
+
+		instrument<times::extract>([&]
 		{
-			cx().debug(context::generic, "task is disabled");
-			return;
-		}
+			run_tool(ex);
+		});
 
-		cx().info(context::generic, "running task");
+		if (ex.extracted())
+			write_stamp(file);
+	};
 
-		fetch();
-		join();
+	if (!conf::stream_extract() || conf::dry() || extractor::tar_binary().empty())
+	{
+		const auto file = instrument<times::fetch>([&]
+		{
+			return run_tool(dl);
+		});
 
-		check_interrupted();
+		extract(file);
+		return file;
+	}
 
-		build_and_install();
-		join();
+	// the downloader only uses the stream if the file isn't already there and
+	// tar can read it sequentially
+	auto stream = std::make_shared<download_stream>([](const fs::path& f)
+	{
+		return extractor::can_stream(f);
+	});
 
-		check_interrupted();
+	dl.stream_to(stream);
+
+	extractor ex;
+	ex.stream(stream).output(where);
+
+	fs::path file;
+
+	parallel({
+		{"fetch", [&]
+		{
+			// in case the downloader never runs because the task was
+			// interrupted, the extractor waits on the stream
+			guard g([&]{ stream->finish(false); });
+
+			file = instrument<times::fetch>([&]
+			{
+				return run_tool(dl);
+			});
+		}},
+
+		{"extract", [&]
+		{
+			instrument<times::extract>([&]
+			{
+				run_tool(ex);
+			});
+		}}
 	});
+
+	check_interrupted();
+
+	if (ex.stream_failed())
+		extract(file);
+	else if (ex.extracted())
+		write_stamp(file);
+
+	return file;
+}
+
+task_conf_holder task::task_conf() const
+{
+	return task_conf_holder(*this);
 }
 
 void task::interrupt()
@@ -466,6 +840,10 @@ void task::interrupt()
 
 	for (auto* t : tools_)
 		t->interrupt();
+
+	// in case it's waiting for slots in lease_jobs() or fetch()
+	job_slots::instance().wake_all();
+	job_slots::network().wake_all();
 }
 
 void task::join()
@@ -507,19 +885,36 @@ void task::fetch()
 	{
 		threaded_run(name(), [&]
 		{
+			auto& ls = live_status::instance();
+			guard g([&]{ ls.remove(name()); });
+
+			ls.set_phase(name(), "cleaning");
 			clean_task();
 			check_interrupted();
 
 			if (conf::fetch())
 			{
-				cx().info(context::generic, "fetching");
-				do_fetch();
+				{
+					ls.set_phase(name(), "waiting for network");
+
+					// all tasks are fetched as soon as mob starts, this keeps
+					// too many downloads and clones from running at once
+					auto lease = job_slots::network().lease(
+						1, [&]{ return interrupted_.load(); });
+
+					check_interrupted();
+
+					cx().info(context::generic, "fetching");
+					ls.set_phase(name(), "fetching");
+					do_fetch();
+				}
 
 				check_interrupted();
 
 				if (!get_source_path().empty())
 				{
 					cx().debug(context::generic, "patching");
+					ls.set_phase(name(), "patching");
 
 					run_tool(patcher()
 						.task(name(), get_prebuilt())
@@ -548,16 +943,116 @@ void task::build_and_install()
 	{
 		threaded_run(name(), [&]
 		{
+			auto& ls = live_status::instance();
+			guard g([&]{ ls.remove(name()); });
+
 			check_interrupted();
 
+			// a previous round of `watch` that failed before the other task
+			// built this one
+			deferred_ = false;
+			deferred_manifest_.reset();
+
+			ls.set_phase(name(), "checking inputs");
+			const bool use_cache = can_use_artifact_cache();
+			const bool skip =
+				can_skip_unchanged() && task_conf().skip_unchanged();
+			std::optional<std::string> manifest;
+			bool restored = false;
+
+			if (skip || use_cache)
+			{
+				manifest = make_manifest();
+
+				if (skip)
+				{
+					if (inputs_unchanged(manifest) && outputs_exist())
+					{
+						cx().info(context::bypass,
+							"inputs unchanged, skipping build and install");
+
+						cache_stats::hit("skip_unchanged");
+						return;
+					}
+
+					cache_stats::miss("skip_unchanged");
+				}
+
+				// a failed build must not leave an old manifest behind
+				op::delete_file(cx(), manifest_file(), op::optional);
+
+				if (use_cache && manifest)
+				{
+					restored = restore_artifact(*manifest);
+
+					if (restored)
+						cache_stats::hit("artifact");
+					else
+						cache_stats::miss("artifact");
+				}
+			}
+
+			check_interrupted();
+
+			// when restored from the cache, this is only expected to install
+			// files, all the build tools should find their outputs up to date
 			cx().info(context::generic, "build and install");
+			ls.set_phase(name(), "building");
+
+			// the tools leasing slots with 0 share the budget with the other
+			// tasks building at the same time
+			auto& js = job_slots::instance();
+			js.add_contender();
+			guard cg([&]{ js.remove_contender(); });
+
+			// copies done by an earlier round of `watch` that failed
+			op::take_installed_files(name());
+
+			compiler_cache::measure ccm(cx(), name());
 			do_build_and_install();
+			ccm.finish();
 
 			check_interrupted();
+
+			const bool publish =
+				use_cache && !restored && conf::publish_artifacts();
+
+			if (deferred_)
+			{
+				// nothing is built yet, see defer_inputs()
+				cx().debug(context::generic,
+					"inputs will be recorded once the build is done");
+
+				deferred_manifest_ = manifest;
+				deferred_publish_ = publish;
+				return;
+			}
+
+			record_inputs(manifest, publish);
 		});
 	});
 }
 
+void task::record_inputs(
+	const std::optional<std::string>& manifest, bool publish)
+{
+	// written whether skip_unchanged is on or not, it's also used by
+	// `build --affected`
+	if (!conf::dry())
+		write_stamp();
+
+	if (manifest)
+	{
+		if (publish)
+			publish_artifact(*manifest);
+
+		op::create_directories(cx(), manifest_file().parent_path());
+
+		op::write_text_file(
+			cx(), encodings::utf8, manifest_file(), *manifest);
+	}
+}
+
 task::clean task::make_clean_flags() const
 {
 	clean c = clean::nothing;
@@ -577,129 +1072,495 @@ task::clean task::make_clean_flags() const
 	return c;
 }
 
-void task::check_interrupted()
+job_lease task::lease_jobs(std::size_t want)
 {
-	if (interrupted_)
-		throw interrupted();
+	auto& js = job_slots::instance();
+
+	auto lease = js.lease(want, [&]{ return interrupted_.load(); });
+	check_interrupted();
+
+	cx().debug(context::generic,
+		"leased {}/{} job slots", lease.count(), js.total());
+
+	return lease;
 }
 
-void task::run_tool_impl(tool* t)
+fs::path task::manifest_file() const
+{
+	return paths::build() / "_mob_manifests" / (name() + ".txt");
+}
+
+std::optional<std::string> task::make_manifest() const
 {
+	// dependencies are locked after this one, they can't depend on it
+	std::scoped_lock lock(manifest_mutex_);
+
+	if (manifest_generation_ != g_manifest_generation)
 	{
-		std::scoped_lock lock(tools_mutex_);
-		tools_.push_back(t);
+		manifest_ = compute_manifest();
+		manifest_generation_ = g_manifest_generation;
 	}
 
-	guard g([&]
+	return manifest_;
+}
+
+std::optional<std::string> task::compute_manifest() const
+{
+	std::ostringstream oss;
+
+	auto add = [&](auto&& k, auto&& v)
 	{
-		std::scoped_lock lock(tools_mutex_);
+		oss << k << " = " << v << "\n";
+	};
 
-		for (auto itor=tools_.begin(); itor!=tools_.end(); ++itor)
+	add("task", name());
+	add("version", get_version());
+	add("prebuilt", get_prebuilt());
+	add("vs", vs::version());
+	add("toolset", vs::toolset());
+	add("sdk", vs::sdk());
+
+	// versions of other tasks are sometimes used, like python for boost, so
+	// include everything
+	for (auto&& k : conf::global_keys("versions"))
+		add("versions/" + k, conf::version_by_name(k));
+
+	for (auto&& k : conf::global_keys("prebuilt"))
+		add("prebuilt/" + k, conf::get_global("prebuilt", k));
+
+	// [task] options that change what's built; the others are for fetching
+	// and git, which end up in the HEAD below, or are specific to the
+	// machine, like priority, and would make the manifest useless for the
+	// artifact cache
+	const auto tc = task_conf();
+	add("task/cmake_generator", tc.cmake_generator());
+	add("task/aggregate_build", tc.aggregate_build());
+
+	const std::string profile =
+		tc.build_profile().empty() ? "release" : tc.build_profile();
+
+	add("task/build_profile", profile);
+
+	for (auto&& k : conf::global_keys("profile_" + profile))
+	{
+		add("profile/" + k,
+			conf::get_global("profile_" + profile, k));
+	}
+
+	// only the kind of cache, the path is different for every machine
+	const auto cc = conf::compiler_cache();
+	add("compiler_cache",
+		cc.empty() ? "" : path_to_utf8(fs::path(utf8_to_utf16(cc)).stem()));
+
+
+	// patches
+	const auto patches = paths::patches() / name();
+
+	if (fs::exists(patches))
+	{
+		std::vector<fs::path> files;
+
+		for (auto&& e : fs::recursive_directory_iterator(patches))
 		{
-			if (*itor == t)
-			{
-				tools_.erase(itor);
-				break;
-			}
+			if (e.is_regular_file())
+				files.push_back(e.path());
 		}
-	});
 
-	cx().debug(context::generic, "running tool {}", t->name());
+		std::sort(files.begin(), files.end());
 
-	context cxcopy(cx());
+		for (auto&& f : files)
+		{
+			const auto bytes = op::read_text_file(cx(), encodings::dont_know, f);
 
-	check_interrupted();
-	t->run(cxcopy);
-	check_interrupted();
+			add(
+				"patch/" + path_to_utf8(fs::relative(f, patches)),
+				hash_string(bytes));
+		}
+	}
+
+
+	// source tree
+	const auto src = get_fingerprint_path();
+
+	if (!src.empty() && fs::exists(src) && git::is_git_repo(src))
+	{
+		if (git::is_dirty(src))
+		{
+			cx().debug(context::generic,
+				"{} has uncommitted changes, can't fingerprint", src);
+
+			return {};
+		}
+
+		add("head", git::head_commit(src));
+	}
+	else if (!src.empty() && fs::exists(extractor::stamp_file(src)))
+	{
+		// url, sha256 and version of the archive, see download_and_extract()
+		const auto text = op::read_text_file(
+			cx(), encodings::utf8, extractor::stamp_file(src));
+
+		for_each_line(text, [&](std::string_view line)
+		{
+			if (!line.empty())
+				oss << "archive/" << line << "\n";
+		});
+	}
+
+
+	// a dependency whose inputs changed must rebuild this task too; this is
+	// its manifest whether it has skip_unchanged or not, what it wrote after
+	// its last build could be from before it changed; it's the one cached
+	// for this run, dependencies are shared by many tasks
+	for (auto* d : dependencies())
+	{
+		const auto dm = d->make_manifest();
+		if (!dm)
+		{
+			cx().debug(context::generic,
+				"dependency {} can't be fingerprinted", d->name());
+
+			return {};
+		}
+
+		add("dependency/" + d->name(), hash_string(*dm));
+	}
+
+	return oss.str();
 }
 
+bool task::would_skip_unchanged() const
+{
+	if (!can_skip_unchanged() || !task_conf().skip_unchanged())
+		return false;
+
+	if (conf::clean() && make_clean_flags() != clean::nothing)
+		return false;
+
+	const auto m = make_manifest();
+	if (!m)
+		return false;
+
+	const auto old = op::read_text_file(
+		cx(), encodings::utf8, manifest_file(), op::optional);
 
-parallel_tasks::parallel_tasks(bool super)
-	: container_task("parallel"), super_(super)
+	return (old == *m && outputs_exist());
+}
+
+fs::path task::stamp_file() const
 {
+	return paths::build() / "_mob_manifests" / (name() + ".stamp.txt");
 }
 
-std::vector<task*> parallel_tasks::children() const
+void task::write_stamp()
 {
-	std::vector<task*> v;
+	std::string s;
 
-	for (auto&& t : children_)
-		v.push_back(t.get());
+	const auto src = get_fingerprint_path();
+	if (!src.empty() && fs::exists(src) && git::is_git_repo(src))
+		s += "head = " + git::head_commit(src) + "\n";
 
-	return v;
+	for (auto&& f : op::take_installed_files(name()))
+		s += "output = " + path_to_utf8(f) + "\n";
+
+	op::create_directories(cx(), stamp_file().parent_path());
+	op::write_text_file(cx(), encodings::utf8, stamp_file(), s);
 }
 
-bool parallel_tasks::is_super() const
+std::vector<std::string> task::stamp_values(const std::string& key) const
 {
-	return super_;
+	const auto text = op::read_text_file(
+		cx(), encodings::utf8, stamp_file(), op::optional);
+
+	const std::string prefix = key + " = ";
+	std::vector<std::string> v;
+
+	for_each_line(text, [&](std::string_view line)
+	{
+		if (line.starts_with(prefix))
+			v.emplace_back(line.substr(prefix.size()));
+	});
+
+	return v;
 }
 
-void parallel_tasks::run()
+bool task::outputs_exist() const
 {
-	for (auto& t : children_)
+	if (!fs::exists(stamp_file()))
 	{
-		threads_.push_back(start_thread([&]
+		cx().debug(context::generic, "no build stamp at {}", stamp_file());
+		return false;
+	}
+
+	if (!fs::exists(paths::install()))
+	{
+		cx().debug(context::generic, "{} doesn't exist", paths::install());
+		return false;
+	}
+
+	for (auto&& f : stamp_values("output"))
+	{
+		const fs::path p = utf8_to_utf16(f);
+
+		if (!fs::exists(p))
 		{
-			t->run();
-		}));
+			cx().debug(context::generic, "output {} is missing", p);
+			return false;
+		}
 	}
 
-	join();
+	return true;
 }
 
-
-void parallel_tasks::interrupt()
+bool task::inputs_unchanged(const std::optional<std::string>& manifest) const
 {
-	for (auto& t : children_)
-		t->interrupt();
+	if (!manifest)
+		return false;
+
+	if (conf::dry())
+		return false;
+
+	if (conf::clean() && make_clean_flags() != clean::nothing)
+	{
+		cx().trace(context::rebuild,
+			"cleaning was requested, ignoring manifest");
+
+		return false;
+	}
+
+	if (!fs::exists(manifest_file()))
+	{
+		cx().trace(context::generic, "no manifest at {}", manifest_file());
+		return false;
+	}
+
+	const auto old = op::read_text_file(
+		cx(), encodings::utf8, manifest_file(), op::optional);
+
+	if (old == *manifest)
+		return true;
+
+	// log the first line that changed
+	const auto old_lines = split(old, "\n");
+	const auto new_lines = split(*manifest, "\n");
+
+	for (std::size_t i=0; i<new_lines.size(); ++i)
+	{
+		if (i >= old_lines.size() || old_lines[i] != new_lines[i])
+		{
+			cx().debug(context::generic,
+				"inputs changed: {}", new_lines[i]);
+
+			break;
+		}
+	}
+
+	return false;
 }
 
-void parallel_tasks::join()
+bool task::can_use_artifact_cache() const
 {
-	for (auto& t : threads_)
-		t.join();
+	if (conf::artifact_cache().empty() || conf::dry())
+		return false;
+
+	if (!task_conf().use_artifact_cache())
+		return false;
+
+	// prebuilts are already downloaded, super tasks have no source path
+	if (get_prebuilt() || get_source_path().empty())
+		return false;
 
-	threads_.clear();
+	// the user wants this task to actually be built
+	if (conf::clean() && make_clean_flags() != clean::nothing)
+		return false;
+
+	return true;
+}
+
+std::string task::artifact_filename(const std::string& manifest) const
+{
+	return name() + "-" + hash_string(manifest) + ".7z";
 }
 
-void parallel_tasks::fetch()
+static bool is_url(const std::string& s)
 {
-	// no-op
+	return s.starts_with("http://") || s.starts_with("https://");
 }
 
-void parallel_tasks::build_and_install()
+bool task::restore_artifact(const std::string& manifest)
 {
-	threaded_run(name(), [&]
+	const std::string cache = conf::artifact_cache();
+	const std::string filename = artifact_filename(manifest);
+	const fs::path file = paths::cache() / "artifacts" / filename;
+
+	op::create_directories(cx(), file.parent_path());
+
+	if (fs::exists(file))
+	{
+		cx().trace(context::bypass, "artifact {} already downloaded", file);
+	}
+	else if (is_url(cache))
 	{
-		for (auto& t : children_)
+		const url u = cache + "/" + filename;
+
+		// run as a tool so it's interrupted with the task
+		const auto downloaded = run_tool(downloader(u)
+			.file(file)
+			.allow_failure(true));
+
+		check_interrupted();
+
+		if (downloaded.empty())
 		{
-			threads_.push_back(start_thread([&]
-			{
-				t->run();
-			}));
+			cx().debug(context::net, "artifact {} not in cache", u);
+			return false;
 		}
-	});
+	}
+	else
+	{
+		const fs::path src = fs::path(utf8_to_utf16(cache)) / filename;
+
+		if (!fs::exists(src))
+		{
+			cx().debug(context::generic, "artifact {} not in cache", src);
+			return false;
+		}
+
+		// source file is outside prefix
+		op::copy_file_to_file_if_better(cx(), src, file, op::unsafe);
+	}
+
+	check_interrupted();
+
+	cx().info(context::generic, "restoring {} from artifact cache", filename);
+
+	// extracted next to the source directory and swapped, in case it
+	// fails or is interrupted
+	const fs::path src = get_source_path();
+	fs::path temp = src;
+	temp += ".artifact";
+
+	op::delete_directory(cx(), temp, op::optional);
+
+	run_tool(process_runner(process()
+		.binary(extractor::binary())
+		.arg("x")
+		.arg("-aoa")
+		.arg("-bd")
+		.arg("-bb0")
+		.arg("-o", temp, process::nospace)
+		.arg(file)));
+
+	check_interrupted();
+
+	// the extraction stamp isn't in artifacts, the local one is what the
+	// manifest was made from
+	if (fs::exists(extractor::stamp_file(src)))
+	{
+		op::copy_file_to_file_if_better(
+			cx(), extractor::stamp_file(src), extractor::stamp_file(temp));
+	}
+
+	op::delete_directory(cx(), src, op::optional);
+	op::rename(cx(), temp, src);
+
+	return true;
 }
 
-void parallel_tasks::do_fetch()
+void task::publish_artifact(const std::string& manifest)
 {
+	const std::string cache = conf::artifact_cache();
+
+	if (is_url(cache))
+	{
+		cx().debug(context::generic,
+			"artifact cache {} is a url, can't publish", cache);
+
+		return;
+	}
+
+	const std::string filename = artifact_filename(manifest);
+	const fs::path dest = fs::path(utf8_to_utf16(cache)) / filename;
+
+	if (fs::exists(dest))
+	{
+		cx().trace(context::bypass, "artifact {} already published", dest);
+		return;
+	}
+
+	cx().info(context::generic, "publishing {} to artifact cache", filename);
+
+	const fs::path temp = paths::temp_dir() / filename;
+	op::delete_file(cx(), temp, op::optional);
+	guard g([&]{ op::delete_file(cx(), temp, op::optional); });
+
+	// the extraction stamp is kept by restore_artifact()
+	op::archive_from_glob(cx(), get_source_path() / "*", temp,
+		{path_to_utf8(extractor::stamp_file({}).filename())});
+
+	// the cache is outside the prefix, op:: can't be used; this is copied
+	// under a temporary name first so that other machines never pick up a
+	// partial file
+	fs::path part = dest;
+	part += ".part";
+
+	std::error_code ec;
+	fs::create_directories(dest.parent_path(), ec);
+
+	if (!ec)
+		fs::copy_file(temp, part, fs::copy_options::overwrite_existing, ec);
+
+	if (!ec)
+		fs::rename(part, dest, ec);
+
+	if (ec)
+	{
+		cx().warning(context::fs,
+			"failed to publish {}, {}", dest, ec.message());
+	}
 }
 
-void parallel_tasks::do_build_and_install()
+void task::check_interrupted()
 {
+	if (interrupted_)
+		throw interrupted();
 }
 
-void parallel_tasks::do_clean(clean)
+void task::run_tool_impl(tool* t)
 {
-	for (auto& t : children_)
 	{
-		threads_.push_back(start_thread([&]
-		{
-			t->clean_task();
-		}));
+		std::scoped_lock lock(tools_mutex_);
+		tools_.push_back(t);
 	}
 
-	join();
+	live_status::instance().set_tool(name(), t->name());
+
+	guard g([&]
+	{
+		std::scoped_lock lock(tools_mutex_);
+
+		for (auto itor=tools_.begin(); itor!=tools_.end(); ++itor)
+		{
+			if (*itor == t)
+			{
+				tools_.erase(itor);
+				break;
+			}
+		}
+
+		// back to the tool that was running before, if any
+		live_status::instance().set_tool(
+			name(), tools_.empty() ? "" : tools_.back()->name());
+	});
+
+	cx().debug(context::generic, "running tool {}", t->name());
+
+	span_scope ss("tool", t->name());
+	context cxcopy(cx());
+
+	check_interrupted();
+	t->run(cxcopy);
+	check_interrupted();
 }
 
 }	// namespace
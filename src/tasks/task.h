@@ -21,7 +21,23 @@ Task& add_task(Args&&... args)
 	return *p;
 }
 
-void run_all_tasks();
+template <class Task, class T, class... Args>
+Task& add_task(std::initializer_list<T> il, Args&&... args)
+{
+	auto sp = std::make_unique<Task>(std::move(il), std::forward<Args>(args)...);
+	auto* p = sp.get();
+	add_task(std::move(sp));
+	return *p;
+}
+
+// runs all the tasks; fetching starts right away for all of them, but a
+// task is built only once all of its dependencies have been built and
+// installed, see task::depends_on()
+//
+// `fetched` is called from the thread of each enabled task as soon as it's
+// been fetched, while other tasks are still running; it must not throw
+//
+void run_all_tasks(std::function<void (task&)> fetched={});
 bool is_super_task(const std::string& name);
 std::vector<task*> find_tasks(const std::string& pattern);
 task* find_task(const std::string& pattern);
@@ -42,6 +58,8 @@ public:
 	bool ignore_ts()const;
 	std::string git_url_prefix() const;
 	bool git_shallow() const;
+	std::string git_filter() const;
+	std::vector<std::string> git_sparse() const;
 	std::string git_user() const;
 	std::string git_email() const;
 	bool set_origin_remote() const;
@@ -49,6 +67,11 @@ public:
 	std::string remote_key() const;
 	bool remote_no_push_upstream() const;
 	bool remote_push_default_origin() const;
+	bool skip_unchanged() const;
+	bool use_artifact_cache() const;
+	std::string cmake_generator() const;
+	bool aggregate_build() const;
+	std::string build_profile() const;
 
 	git make_git(git::ops o=git::clone_or_pull) const;
 
@@ -92,6 +115,16 @@ public:
 
 	static void interrupt_all();
 
+	// whether interrupt_all() was called, by sigint or a task that bailed
+	// out
+	//
+	static bool all_interrupted();
+
+	// forgets about interrupt_all() so the tasks can run again, used by
+	// `watch` between builds
+	//
+	static void reset_interrupt();
+
 	virtual bool enabled() const;
 	const std::string& name() const;
 	const std::vector<std::string>& names() const;
@@ -100,9 +133,88 @@ public:
 	virtual std::string get_version() const = 0;
 	virtual const bool get_prebuilt() const = 0;
 
+	// directory that's checked for a git HEAD when creating the manifest of
+	// inputs for this task, see skip_unchanged; defaults to get_source_path()
+	//
+	virtual fs::path get_fingerprint_path() const;
+
 	virtual bool is_super() const;
 
-	virtual void run();
+	// for tasks that can be fetched as a prebuilt archive instead of being
+	// built from source: the filename given to make_prebuilt_url(), empty for
+	// the others
+	//
+	virtual std::string prebuilt_filename() const;
+
+	// the directory that fetching the prebuilt archive of this task must
+	// reproduce, and the files and directories in it that go into the
+	// archive; see `release prebuilts`
+	//
+	// defaults to everything in get_source_path()
+	//
+	virtual fs::path prebuilt_root() const;
+	virtual std::vector<fs::path> prebuilt_files() const;
+
+	// whether the build can be skipped by skip_unchanged; false for tasks
+	// whose inputs are the work of other tasks, like super_build
+	//
+	virtual bool can_skip_unchanged() const;
+
+	// called while this task is building when the actual build is handed
+	// to another task, see super_build; the stamp and the manifest are not
+	// written after do_build_and_install() and the artifact isn't
+	// published, finish_deferred() does it once the other task succeeded
+	//
+	void defer_inputs();
+	void finish_deferred();
+
+	// file written after a build with the manifest of its inputs, checked
+	// by skip_unchanged
+	//
+	fs::path manifest_file() const;
+
+	// the inputs of this task as `key = value` lines, or empty if there's
+	// something that can't be fingerprinted, like uncommitted changes;
+	// computed once per run_all_tasks(), after this task has been fetched
+	//
+	std::optional<std::string> make_manifest() const;
+
+	// whether build_and_install() would skip this task with skip_unchanged
+	// right now; unlike the check done while building, this works with
+	// --dry
+	//
+	bool would_skip_unchanged() const;
+
+	// file written after every successful build, with `key = value` lines:
+	// `head` for the HEAD of the repo at get_fingerprint_path(), if any, and
+	// `output` for each file this task copied into the install directory
+	//
+	fs::path stamp_file() const;
+
+	// values for the given key in the stamp, empty if there's no stamp
+	//
+	std::vector<std::string> stamp_values(const std::string& key) const;
+
+	// whether there's a stamp and the install directory and all the outputs
+	// in the stamp exist; a build isn't skipped if they don't
+	//
+	bool outputs_exist() const;
+
+	// task name patterns that must be built and installed before this task
+	// can be built; the patterns are resolved with find_tasks() when the
+	// tasks are run, so they can be globs or `super`
+	//
+	// this task is never considered as its own dependency, so `super` can be
+	// given to a super task
+	//
+	task& depends_on(std::vector<std::string> patterns);
+	const std::vector<std::string>& dependency_patterns() const;
+
+	// resolves dependency_patterns(), bails out if a pattern doesn't match
+	// any task
+	//
+	std::vector<task*> dependencies() const;
+
 	virtual void interrupt();
 	virtual void join();
 
@@ -135,28 +247,80 @@ protected:
 		return t.result();
 	}
 
+	// leases slots from the global job budget for processes that are not
+	// started by a tool that handles it already, such as b2; throws if the
+	// task is interrupted while waiting
+	//
+	job_lease lease_jobs(std::size_t want=0);
+
 	void threaded_run(std::string name, std::function<void ()> f);
 	void parallel(std::vector<std::pair<std::string, std::function<void ()>>> v);
 
+	// runs the downloader and extracts the file it returns into `where`,
+	// returns the file; if the `stream_extract` option is set and the format
+	// allows it, the archive is extracted while it's being downloaded
+	//
+	fs::path download_and_extract(downloader dl, const fs::path& where);
+
 	task_conf_holder task_conf() const;
 
 private:
 	struct thread_context;
 
 	std::vector<std::string> names_;
+	std::vector<std::string> deps_;
 	std::thread thread_;
 	std::atomic<bool> interrupted_;
 
-	std::vector<std::unique_ptr<thread_context>> contexts_;
-	mutable std::mutex contexts_mutex_;
+	// context bound to the current thread by threaded_run(), cx() walks this
+	// list, which is almost always a single node
+	static thread_local const thread_context* thread_context_;
+
+	// used by cx() when called from the thread that created this task
+	context cx_;
+	std::thread::id creator_tid_;
 
 	std::vector<tool*> tools_;
 	mutable std::mutex tools_mutex_;
 
 	static std::mutex interrupt_mutex_;
 
+	// cached by make_manifest(), valid while the generation is the same as
+	// the one bumped by run_all_tasks()
+	mutable std::mutex manifest_mutex_;
+	mutable std::uint64_t manifest_generation_;
+	mutable std::optional<std::string> manifest_;
+
 	clean make_clean_flags() const;
 	void run_tool_impl(tool* t);
+
+	// set by defer_inputs(), with what build_and_install() would have
+	// recorded
+	bool deferred_;
+	std::optional<std::string> deferred_manifest_;
+	bool deferred_publish_;
+
+	// writes stamp_file() after a build
+	//
+	void write_stamp();
+
+	// writes the stamp and the manifest, if any, and publishes the artifact
+	// if `publish` is true; done after a successful build
+	//
+	void record_inputs(
+		const std::optional<std::string>& manifest, bool publish);
+
+	std::optional<std::string> compute_manifest() const;
+	bool inputs_unchanged(const std::optional<std::string>& manifest) const;
+
+	// whether the built source directory of this task can be restored from
+	// or published to the artifact cache
+	//
+	bool can_use_artifact_cache() const;
+
+	std::string artifact_filename(const std::string& manifest) const;
+	bool restore_artifact(const std::string& manifest);
+	void publish_artifact(const std::string& manifest);
 };
 
 
@@ -185,79 +349,4 @@ public:
 	}
 };
 
-
-class container_task : public task
-{
-public:
-	using task::task;
-
-	virtual std::vector<task*> children() const = 0;
-};
-
-
-class parallel_tasks : public container_task
-{
-public:
-	parallel_tasks(bool super);
-
-	bool enabled() const override
-	{
-		return true;
-	}
-
-	template <class Task, class... Args>
-	parallel_tasks& add_task(Args&&... args)
-	{
-		children_.push_back(
-			std::make_unique<Task>(std::forward<Args>(args)...));
-
-		return *this;
-	}
-
-	template <class Task, class T, class... Args>
-	parallel_tasks& add_task(std::initializer_list<T> il, Args&&... args)
-	{
-		children_.push_back(
-			std::make_unique<Task>(std::move(il), std::forward<Args>(args)...));
-
-		return *this;
-	}
-
-	fs::path get_source_path() const override
-	{
-		return {};
-	}
-
-	std::string get_version() const override
-	{
-		return {};
-	}
-
-	const bool get_prebuilt() const override
-	{
-		return false;
-	}
-
-	bool is_super() const override;
-
-	void run() override;
-	void interrupt() override;
-	void join() override;
-
-	void fetch() override;
-	void build_and_install() override;
-
-	std::vector<task*> children() const override;
-
-protected:
-	void do_fetch() override;
-	void do_build_and_install() override;
-	void do_clean(clean c) override;
-
-private:
-	bool super_;
-	std::vector<std::unique_ptr<task>> children_;
-	std::vector<std::thread> threads_;
-};
-
 }	// namespace
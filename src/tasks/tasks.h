@@ -28,6 +28,8 @@ public:
 	static fs::path lib_path(arch a);
 	static fs::path root_lib_path(arch a);
 
+	std::string prebuilt_filename() const override;
+
 protected:
 	void do_clean(clean c) override;
 	void do_fetch() override;
@@ -49,7 +51,7 @@ private:
 
 	static std::string source_download_filename();
 	static fs::path config_jam_file();
-	static url prebuilt_url();
+	url prebuilt_url() const;
 	static url source_url();
 	static fs::path b2_exe();
 	static std::string python_dll();
@@ -261,6 +263,8 @@ public:
 	static bool prebuilt();
 	static fs::path source_path();
 
+	std::string prebuilt_filename() const override;
+
 protected:
 	void do_clean(clean c) override;
 	void do_fetch() override;
@@ -278,7 +282,7 @@ private:
 	void build_and_install_from_source();
 
 	msbuild create_msbuild_tool(msbuild::ops o=msbuild::build);
-	static url prebuilt_url();
+	url prebuilt_url() const;
 };
 
 
@@ -291,6 +295,37 @@ public:
 		gamebryo = 0x01
 	};
 
+	// a `[profile_<name>]` section of the ini, selected by the
+	// `build_profile` task option; the empty strings leave the settings of
+	// the project alone
+	//
+	struct profile
+	{
+		std::string name;
+
+		// msbuild configuration and CMAKE_BUILD_TYPE
+		std::string config;
+
+		// appended to the build directory, so switching profiles doesn't
+		// rebuild everything
+		std::string dir;
+
+		// "zi" or "z7"
+		std::string debug_info;
+
+		// "true" or "false"
+		std::string fastlink;
+		std::string incremental;
+		std::string ltcg;
+
+		static profile get(const std::string& name);
+
+		// whether any of the compiler or linker settings are set
+		//
+		bool overrides_flags() const;
+	};
+
+
 	modorganizer(std::string name, flags f=noflags);
 	modorganizer(std::vector<std::string> names, flags f=noflags);
 	modorganizer(std::vector<const char*> names, flags f=noflags);
@@ -302,12 +337,15 @@ public:
 	static fs::path super_path();
 
 	static cmake create_cmake_tool(
-		const fs::path& root, cmake::ops o=cmake::generate);
+		const fs::path& root, cmake::ops o=cmake::generate,
+		cmake::generators g=cmake::vs);
 
 	bool is_super() const override;
 	bool is_gamebryo_plugin() const;
 	url git_url() const;
 
+	fs::path get_fingerprint_path() const override;
+
 protected:
 	void do_clean(clean c) override;
 	void do_fetch() override;
@@ -317,12 +355,36 @@ private:
 	std::string repo_;
 	flags flags_;
 
-	cmake create_this_cmake_tool(cmake::ops o=cmake::generate);
+	cmake create_this_cmake_tool(cmake::ops o=cmake::generate) const;
 	msbuild create_this_msbuild_tool(msbuild::ops o=msbuild::build);
+	ninja create_this_ninja_tool(ninja::ops o=ninja::build);
+
+	// whether the solution of this task is built by super_build, see the
+	// `aggregate_build` option
+	//
+	bool aggregated() const;
+
+	// from the `cmake_generator` task option, either vs or ninja
+	//
+	cmake::generators generator() const;
 	void initialize_super(const fs::path& super_root);
 
 	fs::path this_source_path() const;
+	fs::path this_build_path() const;
 	fs::path this_solution_path() const;
+
+	profile this_profile() const;
+
+	// settings of the profile for the vs generator, imported by every
+	// project through ForceImportBeforeCppTargets; the ninja generator
+	// gets them as cmake definitions instead
+	//
+	fs::path this_props_path() const;
+	void write_profile_props();
+
+	// msbuild properties for this task's profile
+	//
+	std::vector<std::string> profile_properties() const;
 };
 
 
@@ -383,6 +445,8 @@ public:
 	static fs::path include_path();
 	static fs::path bin_path();
 
+	std::string prebuilt_filename() const override;
+
 protected:
 	void do_clean(clean c) override;
 	void do_fetch() override;
@@ -395,13 +459,22 @@ private:
 	void build_and_install_from_source();
 
 	void configure();
-	void install_engines();
+
+	// builds in stages, each one parallel, then installs
+	//
+	void build();
+
+	// runs jom on the target; if it fails, the failure is recorded in
+	// retry_stats and the rest of the target is built with a single job
+	//
+	void run_stage(const std::string& target, jom::flags_t f=jom::noflags);
+
 	void copy_files();
 	void copy_dlls_to(const fs::path& dir);
 	void copy_pdbs_to(const fs::path& dir);
 
 	static url source_url();
-	static url prebuilt_url();
+	url prebuilt_url() const;
 	static fs::path build_path();
 	static std::vector<std::string> output_names();
 	static std::string version_no_patch_underscores();
@@ -419,6 +492,10 @@ public:
 
 	static fs::path source_path();
 
+	std::string prebuilt_filename() const override;
+	fs::path prebuilt_root() const override;
+	std::vector<fs::path> prebuilt_files() const override;
+
 protected:
 	void do_clean(clean c) override;
 	void do_fetch() override;
@@ -431,11 +508,12 @@ private:
 	void build_and_install_from_source();
 
 	void sip_build();
+	void build_modules(const env& pyqt_env);
 	void install_sip_file();
 	void copy_files();
 
 	static url source_url();
-	static url prebuilt_url();
+	url prebuilt_url() const;
 	static fs::path sip_install_file();
 	static fs::path build_path();
 	static std::vector<std::string> modules();
@@ -465,6 +543,8 @@ public:
 	static fs::path scripts_path();
 	static fs::path site_packages_path();
 
+	std::string prebuilt_filename() const override;
+
 protected:
 	void do_clean(clean c) override;
 	void do_fetch() override;
@@ -483,7 +563,7 @@ private:
 	msbuild create_msbuild_tool(msbuild::ops o=msbuild::build);
 
 	static std::string version_without_v();
-	static url prebuilt_url();
+	url prebuilt_url() const;
 	static fs::path solution_file();
 	static std::string version_for_dll();
 };
@@ -500,7 +580,7 @@ public:
 
 	static fs::path source_path();
 	static fs::path sip_module_exe();
-	static fs::path sip_install_exe();
+	static fs::path sip_build_exe();
 	static fs::path module_source_path();
 
 protected:
@@ -593,6 +673,59 @@ private:
 };
 
 
+// with the `aggregate_build` option, MO tasks only generate their solution
+// and add it here; this task depends on all of them and builds everything in
+// one msbuild process, so projects from different tasks share the nodes and
+// the job budget instead of running ~40 separate msbuild instances
+//
+// the solutions are built in waves that follow the dependencies between
+// their tasks, the projects of a wave are all built in parallel
+//
+class super_build : public basic_task<super_build>
+{
+public:
+	super_build();
+
+	static std::string version();
+	static bool prebuilt();
+	static fs::path source_path();
+
+	// thread-safe, called by MO tasks instead of building
+	//
+	static void add(
+		task& t, const fs::path& project,
+		std::vector<std::string> properties={});
+
+	// only enabled when there's something to build
+	//
+	bool enabled() const override;
+
+	bool can_skip_unchanged() const override;
+
+protected:
+	void do_build_and_install() override;
+
+private:
+	struct project
+	{
+		task* t = nullptr;
+		fs::path file;
+
+		// given to the project through the Properties metadata, overrides
+		// the global properties
+		std::vector<std::string> properties;
+
+		std::size_t wave = 0;
+	};
+
+	static fs::path aggregate_file();
+
+	std::vector<project> sorted_projects() const;
+	void write_aggregate(const std::vector<project>& v) const;
+	std::string owner_of(const std::vector<project>& v, const fs::path& p) const;
+};
+
+
 class translations : public basic_task<translations>
 {
 public:
@@ -647,6 +780,21 @@ protected:
 	void do_clean(clean c) override;
 	void do_fetch() override;
 	void do_build_and_install() override;
+
+private:
+	// .qm file -> hash of its inputs, for everything compiled by the last
+	// build; languages that haven't changed are not compiled again
+	//
+	using manifest = std::map<std::string, std::string>;
+
+	static fs::path manifest_file();
+	manifest read_manifest() const;
+	void write_manifest(const manifest& m) const;
+
+	static std::string qm_filename(
+		const projects::project& p, const projects::lang& lg);
+
+	static std::string inputs_hash(const projects::lang& lg);
 };
 
 
@@ -217,7 +217,9 @@ void translations::do_fetch()
 				.root(source_path())
 				.api_key(key)
 				.minimum(conf::get_global_int("transifex", "minimum"))
-				.force(conf::get_global_bool("transifex", "force")));
+				.force(conf::get_global_bool("transifex", "force"))
+				.workers(static_cast<std::size_t>(
+					conf::get_global_int("transifex", "workers"))));
 		}
 		else
 		{
@@ -226,6 +228,60 @@ void translations::do_fetch()
 	});
 }
 
+fs::path translations::manifest_file()
+{
+	return source_path() / "mob_qm_manifest.txt";
+}
+
+translations::manifest translations::read_manifest() const
+{
+	manifest m;
+
+	if (!fs::exists(manifest_file()))
+		return m;
+
+	const auto text = op::read_text_file(
+		cx(), encodings::utf8, manifest_file(), op::optional);
+
+	for_each_line(text, [&](auto&& line)
+	{
+		// qm file, hash
+		const auto cs = split(std::string(line), "\t");
+		if (cs.size() == 2)
+			m[cs[0]] = cs[1];
+	});
+
+	return m;
+}
+
+void translations::write_manifest(const manifest& m) const
+{
+	std::string s;
+
+	for (auto&& [qm, h] : m)
+		s += qm + "\t" + h + "\n";
+
+	op::write_text_file(cx(), encodings::utf8, manifest_file(), s);
+}
+
+std::string translations::qm_filename(
+	const projects::project& p, const projects::lang& lg)
+{
+	// same as lrelease::qm_file()
+	return p.name + "_" + trim_copy(lg.name) + ".qm";
+}
+
+std::string translations::inputs_hash(const projects::lang& lg)
+{
+	// a different lrelease can give a different .qm
+	std::string s = path_to_utf8(lrelease::binary()) + "\n";
+
+	for (auto&& f : lg.ts_files)
+		s += path_to_utf8(f) + " " + hash_file(f) + "\n";
+
+	return hash_string(s);
+}
+
 void translations::do_build_and_install()
 {
 	instrument<times::build>([&]
@@ -239,12 +295,45 @@ void translations::do_build_and_install()
 		for (auto&& w : ps.warnings())
 			cx().warning(context::generic, "{}", w);
 
+		const auto old = read_manifest();
+		manifest current;
+		std::size_t stale = 0, unchanged = 0;
+
 		thread_pool tp;
 
 		for (auto& p : ps.get())
 		{
+			// languages with a single .ts file, compiled by one lrelease
+			// process for the whole project
+			std::vector<const projects::lang*> batch;
+
 			for (auto& lg : p.langs)
 			{
+				const auto qm = qm_filename(p, lg);
+				const auto h = inputs_hash(lg);
+
+				current[qm] = h;
+
+				auto itor = old.find(qm);
+				if (itor != old.end() && itor->second == h)
+				{
+					if (fs::exists(dest / qm))
+					{
+						++unchanged;
+						continue;
+					}
+				}
+
+				++stale;
+
+				if (lg.ts_files.size() == 1)
+				{
+					batch.push_back(&lg);
+					continue;
+				}
+
+				// gamebryo plugins merge their .ts with the one from
+				// game_gamebryo, lrelease can only do one of those at a time
 				tp.add([&]
 				{
 					threaded_run(lg.name + "." + p.name, [&]
@@ -256,7 +345,47 @@ void translations::do_build_and_install()
 					});
 				});
 			}
+
+			if (batch.empty())
+				continue;
+
+			tp.add([&, batch]
+			{
+				threaded_run(p.name, [&]
+				{
+					std::vector<fs::path> sources;
+					for (auto* lg : batch)
+						sources.push_back(lg->ts_files[0]);
+
+					// each .qm is created next to its .ts
+					run_tool(lrelease()
+						.sources(sources)
+						.merge(false));
+
+					for (auto* lg : batch)
+					{
+						auto src = lg->ts_files[0];
+						src.replace_extension(".qm");
+
+						const auto qm = dest / qm_filename(p, *lg);
+
+						op::delete_file(cx(), qm, op::optional);
+						op::rename(cx(), src, qm);
+					}
+				});
+			});
 		}
+
+		cx().debug(context::generic,
+			"{} languages to compile, {} unchanged", stale, unchanged);
+
+		tp.join();
+
+		// a failed lrelease interrupts everything and the manifest is not
+		// written, so the languages compiled so far are done again next time
+		check_interrupted();
+
+		write_manifest(current);
 	});
 }
 
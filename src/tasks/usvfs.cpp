@@ -87,8 +87,13 @@ void usvfs::fetch_prebuilt()
 	instrument<times::fetch>([&]
 	{
 		fetch_from_source();
-		download_from_appveyor(arch::x64);
-		download_from_appveyor(arch::x86);
+
+		parallel({
+			{"usvfs-x64", [&]{ download_from_appveyor(arch::x64); }},
+			{"usvfs-x86", [&]{ download_from_appveyor(arch::x86); }}
+		});
+
+		check_interrupted();
 	});
 }
 
@@ -122,8 +127,24 @@ void usvfs::build_and_install_from_source()
 		// usvfs/vsbuild/stage_helper.cmd, which copies everything into
 		// install/
 
-		run_tool(create_msbuild_tool(arch::x86));
-		run_tool(create_msbuild_tool(arch::x64));
+		// both architectures have their own output directories, they're
+		// built concurrently with half the job budget each
+		const std::size_t jobs = (job_slots::instance().total() + 1) / 2;
+
+		parallel({
+			{"usvfs-x86", [&]
+			{
+				run_tool(create_msbuild_tool(arch::x86).max_jobs(jobs));
+			}},
+
+			{"usvfs-x64", [&]
+			{
+				run_tool(create_msbuild_tool(arch::x64).max_jobs(jobs));
+			}}
+		});
+
+		// an architecture that failed interrupts all tasks
+		check_interrupted();
 	});
 }
 
@@ -207,8 +228,11 @@ usvfs::create_appveyor_downloaders(arch a, downloader::ops o) const
 
 		auto dl = std::make_shared<downloader>(o);
 
+		// artifacts from the latest build, they change without the url
+		// changing
 		dl->url(u);
 		dl->file(paths::build() / dir / u.filename());
+		dl->revalidate(true);
 
 		return dl;
 	};
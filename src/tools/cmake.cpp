@@ -5,7 +5,8 @@ namespace mob
 {
 
 cmake::cmake(ops o)
-	: basic_process_runner("cmake"), op_(o), gen_(jom), arch_(arch::def)
+	: basic_process_runner("cmake"), op_(o), gen_(jom), arch_(arch::def),
+		build_type_("Release")
 {
 }
 
@@ -46,6 +47,7 @@ cmake& cmake::prefix(const fs::path& s)
 
 cmake& cmake::def(const std::string& name, const std::string& value)
 {
+	defs_.push_back(name + "=" + value);
 	process_.arg("-D" + name + "=" + value + "");
 	return *this;
 }
@@ -74,6 +76,12 @@ cmake& cmake::cmd(const std::string& s)
 	return *this;
 }
 
+cmake& cmake::build_type(const std::string& s)
+{
+	build_type_ = s;
+	return *this;
+}
+
 fs::path cmake::build_path() const
 {
 	if (!output_.empty())
@@ -123,7 +131,7 @@ void cmake::do_generate()
 		.stdout_encoding(encodings::utf8)
 		.stderr_encoding(encodings::utf8)
 		.binary(binary())
-		.arg("-DCMAKE_BUILD_TYPE=Release")
+		.arg("-DCMAKE_BUILD_TYPE=" + build_type_)
 		.arg("-DCMAKE_INSTALL_MESSAGE=NEVER")
 		.arg("--log-level=ERROR")
 		.arg("--no-warn-unused-cli");
@@ -143,17 +151,116 @@ void cmake::do_generate()
 	if (!prefix_.empty())
 		process_.arg("-DCMAKE_INSTALL_PREFIX=", prefix_, process::nospace);
 
+	if (uses_launcher())
+	{
+		const auto cc = compiler_cache::binary();
+
+		process_
+			.arg("-DCMAKE_C_COMPILER_LAUNCHER=", cc, process::nospace)
+			.arg("-DCMAKE_CXX_COMPILER_LAUNCHER=", cc, process::nospace);
+	}
+
 	if (cmd_.empty())
 		process_.arg("..");
 	else
 		process_.arg(cmd_);
 
+	env e = env::vs(arch_)
+		.set("CXXFLAGS", "/wd4566");
+
+	const auto stamp = make_stamp(e);
+
+	if (!conf::reconfigure() && stamp_matches(stamp))
+	{
+		cx().debug(context::bypass,
+			"configure inputs unchanged for {}, not running cmake",
+			build_path());
+
+		return;
+	}
+
+	// a failed configure must not leave the old stamp behind
+	op::delete_file(cx(), stamp_file(), op::optional);
+
 	process_
-		.env(env::vs(arch_)
-			.set("CXXFLAGS", "/wd4566"))
+		.env(e)
 		.cwd(build_path());
 
 	execute_and_join();
+
+	if (exit_code() == 0)
+		op::write_text_file(cx(), encodings::utf8, stamp_file(), stamp);
+}
+
+bool cmake::uses_launcher() const
+{
+	// the visual studio generator ignores launchers, msbuild is given the
+	// compiler cache instead
+	return
+		compiler_cache::kind() != compiler_cache::none &&
+		gen_ != generators::vs;
+}
+
+fs::path cmake::stamp_file() const
+{
+	return build_path() / ".mob-configure";
+}
+
+std::string cmake::make_stamp(const env& e) const
+{
+	std::ostringstream oss;
+
+	auto add = [&](auto&& k, auto&& v)
+	{
+		oss << k << " = " << v << "\n";
+	};
+
+	const auto& g = get_generator(gen_);
+
+	add("binary", path_to_utf8(binary()));
+	add("root", path_to_utf8(root_));
+	add("generator", genstring_.empty() ? g.name : genstring_);
+	add("arch", g.get_arch(arch_));
+	add("build_type", build_type_);
+	add("prefix", path_to_utf8(prefix_));
+	add("cmd", cmd_);
+
+	for (auto&& d : defs_)
+		add("def", d);
+
+	if (uses_launcher())
+		add("launcher", path_to_utf8(compiler_cache::binary()));
+
+	// the whole vcvars environment, it changes with the toolset, sdk, etc.
+	std::string vars;
+
+	for (auto&& [k, v] : e.get_map())
+	{
+		vars += utf16_to_utf8(k);
+		vars += "=";
+		vars += utf16_to_utf8(v);
+		vars += "\n";
+	}
+
+	add("env", hash_string(vars));
+
+	return oss.str();
+}
+
+bool cmake::stamp_matches(const std::string& stamp) const
+{
+	// the cache is gone if the build directory was cleaned or if the last
+	// configure failed
+	if (!fs::exists(build_path() / "CMakeCache.txt"))
+		return false;
+
+	if (!fs::exists(stamp_file()))
+		return false;
+
+	const auto old = op::read_text_file(
+		cx(), encodings::utf8, stamp_file(), op::optional);
+
+	return (old == stamp);
 }
 
 void cmake::do_clean()
@@ -168,6 +275,8 @@ const std::map<cmake::generators, cmake::gen_info>& cmake::all_generators()
 	{
 		{ generators::jom, {"build", "NMake Makefiles JOM", "", "" }},
 
+		{ generators::ninja, {"ninjabuild", "Ninja", "", "" }},
+
 		{ generators::vs, {
 			"vsbuild",
 			"Visual Studio " + vs::version() + " " + vs::year(),
@@ -5,7 +5,8 @@ namespace mob
 {
 
 downloader::downloader(ops o)
-	: tool("dl"), op_(o)
+	: tool("dl"), op_(o), revalidate_(false), allow_failure_(false),
+		racers_(std::make_unique<racers>())
 {
 }
 
@@ -27,6 +28,34 @@ downloader& downloader::file(const fs::path& p)
 	return *this;
 }
 
+downloader& downloader::stream_to(std::shared_ptr<download_stream> s)
+{
+	stream_ = std::move(s);
+	return *this;
+}
+
+downloader& downloader::revalidate(bool b)
+{
+	revalidate_ = b;
+	return *this;
+}
+
+downloader& downloader::allow_failure(bool b)
+{
+	allow_failure_ = b;
+	return *this;
+}
+
+fs::path downloader::meta_file(const fs::path& file)
+{
+	return file.native() + L".meta";
+}
+
+const std::vector<mob::url>& downloader::urls() const
+{
+	return urls_;
+}
+
 fs::path downloader::result() const
 {
 	return file_;
@@ -55,16 +84,46 @@ void downloader::do_run()
 	}
 }
 
+// hosts that won a race, they're tried first for later downloads instead of
+// racing again
+//
+static std::mutex g_race_winners_mutex;
+static std::set<std::string> g_race_winners;
+
+static bool is_race_winner(const mob::url& u)
+{
+	std::scoped_lock lock(g_race_winners_mutex);
+	return g_race_winners.contains(u.host());
+}
+
+static void add_race_winner(const mob::url& u)
+{
+	std::scoped_lock lock(g_race_winners_mutex);
+	g_race_winners.insert(u.host());
+}
+
 void downloader::do_download()
 {
 	dl_.reset(new curl_downloader(&cx()));
+	dl_->quiet_http_errors(allow_failure_);
+
+	// whoever reads the stream must not wait forever if it's not used, like
+	// when the file was already downloaded or all the urls failed
+	guard finish_stream([&]
+	{
+		if (stream_)
+			stream_->finish(false);
+	});
 
 	cx().trace(context::net, "looking for already downloaded files");
 
 	if (!file_.empty())
 	{
-		if (try_picking(file_))
+		if (try_picking(urls_.front(), file_))
+		{
+			cache_stats::hit("download");
 			return;
+		}
 	}
 	else
 	{
@@ -72,39 +131,126 @@ void downloader::do_download()
 		{
 			const auto file = path_for_url(u);
 
-			if (try_picking(file))
+			if (try_picking(u, file))
 			{
 				file_ = file;
+				cache_stats::hit("download");
 				return;
 			}
 		}
 	}
 
 
+	const bool shared = !conf::shared_download_cache().empty();
+
+	if (shared)
+	{
+		for (auto&& u : urls_)
+		{
+			const auto file = (file_.empty() ? path_for_url(u) : file_);
+
+			if (try_shared_cache(u, file))
+			{
+				file_ = file;
+				cache_stats::hit("download");
+				cache_stats::hit("shared_download");
+				return;
+			}
+		}
+
+		cache_stats::miss("shared_download");
+	}
+
+	cache_stats::miss("download");
+
+
+	const auto urls = ordered_urls();
+
 	cx().trace(context::net, "no cached downloads were found, will try:");
-	for (auto&& u : urls_)
+	for (auto&& u : urls)
 		cx().trace(context::net, "  . {}", u);
 
 
+	// a url that failed when there are more to try counts as a retry for
+	// the timings
+	auto retry = [&](const mob::url& u)
+	{
+		if (&u != &urls.back())
+		{
+			resource_usage ru;
+			ru.download_retries = 1;
+			usage_sink::add(ru);
+		}
+	};
+
+	const auto race_count = std::min(urls.size(), static_cast<std::size_t>(
+		std::max(1, conf::get_global_int("global", "download_race"))));
+
+	// all the urls are downloaded to the same file, named after the first
+	// one
+	if (file_.empty())
+		file_ = path_for_url(urls_.front());
+
+	std::size_t first = 0;
+
+	// a host that already won a race is tried first, without racing
+	if (!conf::dry() && race_count > 1 && !is_race_winner(urls.front()))
+	{
+		const std::vector<mob::url> candidates(
+			urls.begin(), urls.begin() + static_cast<std::ptrdiff_t>(race_count));
+
+		if (race(candidates, shared))
+			return;
+
+		if (interrupted())
+		{
+			cx().trace(context::interruption, "");
+			return;
+		}
+
+		first = race_count;
+
+		if (first < urls.size())
+			retry(urls[first - 1]);
+	}
+
 	// try them in order
-	for (auto&& u : urls_)
+	for (std::size_t i=first; i<urls.size(); ++i)
 	{
-		if (file_.empty())
-			file_ = path_for_url(u);
+		const auto& u = urls[i];
+
+		const auto expected = conf::expected_sha256(
+			path_to_utf8(file_.filename()));
 
 		cx().trace(context::net, "trying {} into {}", u, file_);
 
+		// only the first attempt can be streamed, the stream is finished if
+		// it fails
+		if (stream_ && !stream_->finished())
+		{
+			if (stream_->accepts(file_))
+				dl_->stream_to(stream_);
+			else
+				stream_->finish(false);
+		}
+		else
+		{
+			dl_->stream_to({});
+		}
+
+		dl_->compute_hash(shared || !expected.empty());
 		dl_->start(u, file_);
 		cx().trace(context::net, "waiting for download");
 		dl_->join();
 
-		if (dl_->ok())
-		{
-			cx().trace(context::net, "file {} downloaded", file_);
+		if (check_download(u, *dl_, file_, shared))
 			return;
-		}
+
+		if (interrupted())
+			break;
 
 		cx().debug(context::net, "download failed");
+		retry(u);
 	}
 
 	if (interrupted())
@@ -113,26 +259,206 @@ void downloader::do_download()
 		return;
 	}
 
+	if (allow_failure_)
+	{
+		cx().debug(context::net, "all urls failed to download");
+		file_.clear();
+		return;
+	}
+
 	// all failed
 	cx().bail_out(context::net, "all urls failed to download");
 }
 
+bool downloader::check_download(
+	const mob::url& u, const curl_downloader& dl,
+	const fs::path& file, bool shared)
+{
+	if (!dl.ok())
+		return false;
+
+	const auto expected = conf::expected_sha256(path_to_utf8(file.filename()));
+
+	if (!expected.empty() && dl.hash() != expected)
+	{
+		cx().error(context::net,
+			"sha256 mismatch for {}, expected {}, got {}",
+			u, expected, dl.hash());
+
+		op::delete_file(cx(), file, op::optional);
+		return false;
+	}
+
+	cx().trace(context::net, "file {} downloaded", file);
+	write_meta(file, dl);
+
+	if (shared)
+		add_to_shared_cache(u, file, dl.hash());
+
+	return true;
+}
+
+std::vector<mob::url> downloader::ordered_urls() const
+{
+	auto v = urls_;
+
+	std::stable_partition(v.begin(), v.end(), [&](auto&& u)
+	{
+		return is_race_winner(u);
+	});
+
+	return v;
+}
+
+bool downloader::race(const std::vector<mob::url>& urls, bool shared)
+{
+	using namespace std::chrono;
+
+	// long enough to get past dns, tls and slow starts, short enough that a
+	// bad mirror doesn't waste much bandwidth
+	const auto window = 2s;
+
+	const auto expected = conf::expected_sha256(path_to_utf8(file_.filename()));
+
+	// each one has its own file, the winner is renamed once it's done
+	std::vector<fs::path> files;
+
+	cx().debug(context::net, "racing {} urls for {}", urls.size(), file_);
+
+	{
+		std::scoped_lock lock(racers_->mutex);
+
+		for (std::size_t i=0; i<urls.size(); ++i)
+		{
+			files.push_back(
+				file_.native() + L".race" + std::to_wstring(i));
+
+			auto dl = std::make_unique<curl_downloader>(&cx());
+			dl->quiet_http_errors(allow_failure_);
+			dl->compute_hash(shared || !expected.empty());
+			dl->start(urls[i], files.back());
+
+			racers_->v.push_back(std::move(dl));
+		}
+	}
+
+	// only this thread changes the vector
+	const auto& rs = racers_->v;
+
+	// a racer that completes during the window wins right away
+	std::optional<std::size_t> winner;
+	const auto start = steady_clock::now();
+
+	while (!interrupted() && (steady_clock::now() - start) < window)
+	{
+		bool all_done = true;
+
+		for (std::size_t i=0; i<rs.size(); ++i)
+		{
+			if (!rs[i]->finished())
+				all_done = false;
+			else if (!winner && rs[i]->ok())
+				winner = i;
+		}
+
+		if (winner || all_done)
+			break;
+
+		std::this_thread::sleep_for(100ms);
+	}
+
+	if (!winner && !interrupted())
+	{
+		// the one that received the most, in the order of the urls for ties
+		for (std::size_t i=0; i<rs.size(); ++i)
+		{
+			const auto& r = *rs[i];
+
+			if (r.finished() && !r.ok())
+				continue;
+
+			if (!winner || r.bytes_received() > rs[*winner]->bytes_received())
+				winner = i;
+		}
+	}
+
+	for (std::size_t i=0; i<rs.size(); ++i)
+	{
+		if (!winner || i != *winner)
+		{
+			rs[i]->cancel();
+			rs[i]->join();
+
+			// may have completed in the meantime
+			op::delete_file(cx(), files[i], op::optional);
+		}
+	}
+
+	bool ok = false;
+
+	if (winner)
+	{
+		const auto& u = urls[*winner];
+		auto& dl = *rs[*winner];
+
+		cx().debug(context::net,
+			"{} won the race with {} bytes", u, dl.bytes_received());
+
+		cx().trace(context::net, "waiting for download");
+		dl.join();
+
+		if (dl.ok())
+		{
+			op::rename(cx(), files[*winner], file_);
+
+			ok = check_download(u, dl, file_, shared);
+			if (ok)
+				add_race_winner(u);
+		}
+	}
+
+	{
+		std::scoped_lock lock(racers_->mutex);
+		racers_->v.clear();
+	}
+
+	return ok;
+}
+
 void downloader::do_clean()
 {
+	auto clean = [&](const fs::path& file)
+	{
+		cx().debug(context::redownload, "deleting {}", file);
+
+		op::delete_file(cx(), file, op::optional);
+		op::delete_file(cx(), curl_downloader::part_file(file), op::optional);
+		op::delete_file(cx(), meta_file(file), op::optional);
+
+		op::delete_file(
+			cx(), curl_downloader::part_info_file(file), op::optional);
+
+		// leftovers from an interrupted race
+		for (std::size_t i=0; i<urls_.size(); ++i)
+		{
+			const fs::path race = file.native() + L".race" + std::to_wstring(i);
+
+			op::delete_file(cx(), race, op::optional);
+			op::delete_file(cx(), curl_downloader::part_file(race), op::optional);
+
+			op::delete_file(
+				cx(), curl_downloader::part_info_file(race), op::optional);
+		}
+	};
+
 	if (!file_.empty())
 	{
-		cx().debug(context::redownload, "deleting {}", file_);
-		op::delete_file(cx(), file_, op::optional);
+		clean(file_);
 	}
 	else
 	{
 		for (auto&& u : urls_)
-		{
-			const auto file = path_for_url(u);
-
-			cx().debug(context::redownload, "deleting {}", file);
-			op::delete_file(cx(), file, op::optional);
-		}
+			clean(path_for_url(u));
 	}
 }
 
@@ -140,21 +466,316 @@ void downloader::do_interrupt()
 {
 	if (dl_)
 		dl_->interrupt();
+
+	std::scoped_lock lock(racers_->mutex);
+	for (auto&& r : racers_->v)
+		r->interrupt();
 }
 
-bool downloader::try_picking(const fs::path& file)
+bool downloader::try_picking(const mob::url& u, const fs::path& file)
 {
-	if (fs::exists(file))
+	if (!fs::exists(file))
 	{
-		cx().trace(context::bypass, "picking {}", file_);
+		cx().trace(context::net, "no {}", file);
+		return false;
+	}
+
+	if (!conf::dry() && (revalidate_ || conf::revalidate_downloads()))
+		return try_revalidating(u, file);
+
+	cx().trace(context::bypass, "picking {}", file);
+	return true;
+}
+
+bool downloader::try_revalidating(const mob::url& u, const fs::path& file)
+{
+	std::string etag, last_modified;
+
+	{
+		std::ifstream in(meta_file(file));
+		std::string line;
+
+		while (std::getline(in, line))
+		{
+			const auto sep = line.find('=');
+			if (sep == std::string::npos)
+				continue;
+
+			const auto k = trim_copy(line.substr(0, sep));
+			const auto v = trim_copy(line.substr(sep + 1));
+
+			if (k == "etag")
+				etag = v;
+			else if (k == "last-modified")
+				last_modified = v;
+		}
+	}
+
+	if (etag.empty() && last_modified.empty())
+	{
+		cx().debug(context::net,
+			"{} can't be revalidated, downloading it again", file);
+
+		return false;
+	}
+
+	cx().trace(context::net,
+		"revalidating {}, etag {}, last modified {}", file, etag, last_modified);
+
+	// a 304 has no body and a 200 may not be an archive anymore
+	dl_->stream_to({});
+	dl_->compute_hash(!conf::shared_download_cache().empty());
+	dl_->if_changed(etag, last_modified);
+	dl_->start(u, file);
+	dl_->join();
+
+	if (dl_->not_modified())
+	{
+		cx().trace(context::bypass, "{} not modified, picking {}", u, file);
 		return true;
 	}
+
+	if (dl_->ok())
+	{
+		cx().debug(context::net, "{} changed, downloaded again", u);
+
+		// deletes the file if the hash doesn't match
+		return check_download(
+			u, *dl_, file, !conf::shared_download_cache().empty());
+	}
+
+	if (interrupted())
+		return false;
+
+	// better than failing the build when offline
+	cx().warning(context::net,
+		"can't revalidate {}, using the cached {}", u, file);
+
+	return true;
+}
+
+void downloader::write_meta(const fs::path& file, const curl_downloader& dl)
+{
+	const auto p = meta_file(file);
+	std::error_code ec;
+
+	if (dl.etag().empty() && dl.last_modified().empty())
+	{
+		fs::remove(p, ec);
+		return;
+	}
+
+	std::ofstream out(p, std::ios::binary);
+
+	if (!dl.etag().empty())
+		out << "etag = " << dl.etag() << "\n";
+
+	if (!dl.last_modified().empty())
+		out << "last-modified = " << dl.last_modified() << "\n";
+}
+
+// the shared cache has the files in objects/, named after their sha256, and
+// one file per url in urls/ that contains the hash of what it downloaded
+//
+static fs::path shared_object_file(const std::string& hash)
+{
+	return fs::path(utf8_to_utf16(conf::shared_download_cache())) /
+		"objects" / hash;
+}
+
+// size and time of an object when its hash was last checked, it's only
+// hashed again if they changed
+//
+static fs::path shared_stat_file(const fs::path& object)
+{
+	return object.native() + L".stat";
+}
+
+static std::string object_stat(const fs::path& object)
+{
+	std::error_code ec;
+
+	const auto size = fs::file_size(object, ec);
+	if (ec)
+		return {};
+
+	const auto time = fs::last_write_time(object, ec);
+	if (ec)
+		return {};
+
+	return std::to_string(size) + " " +
+		std::to_string(time.time_since_epoch().count());
+}
+
+static bool object_verified(const fs::path& object)
+{
+	std::ifstream in(shared_stat_file(object), std::ios::binary);
+
+	std::string line;
+	std::getline(in, line);
+
+	const auto st = object_stat(object);
+	return (!st.empty() && trim_copy(line) == st);
+}
+
+static void set_object_verified(const fs::path& object)
+{
+	const auto st = object_stat(object);
+	if (st.empty())
+		return;
+
+	const fs::path f = shared_stat_file(object);
+	const fs::path tmp = f.native() + L"." +
+		utf8_to_utf16(std::to_string(GetCurrentProcessId())) + L".tmp";
+
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		out << st << "\n";
+	}
+
+	std::error_code ec;
+	fs::rename(tmp, f, ec);
+
+	if (ec)
+		fs::remove(tmp, ec);
+}
+
+static fs::path shared_url_file(const mob::url& u)
+{
+	return fs::path(utf8_to_utf16(conf::shared_download_cache())) /
+		"urls" / (hash_string(u.string()) + ".txt");
+}
+
+// copies the file under a temporary name and renames it, so an interrupted
+// copy never looks complete; objects in the shared cache are never linked,
+// anything that modifies the file in the prefix would modify the object too
+//
+static bool copy_whole_file(const fs::path& src, const fs::path& dest)
+{
+	std::error_code ec;
+	fs::create_directories(dest.parent_path(), ec);
+
+	const fs::path tmp = dest.native() + L"." +
+		utf8_to_utf16(std::to_string(GetCurrentProcessId())) + L".tmp";
+
+	fs::copy_file(src, tmp, fs::copy_options::overwrite_existing, ec);
+
+	if (!ec)
+		fs::rename(tmp, dest, ec);
+
+	if (ec)
+	{
+		fs::remove(tmp, ec);
+		return false;
+	}
+
+	return true;
+}
+
+bool downloader::try_shared_cache(const mob::url& u, const fs::path& file)
+{
+	// a known hash doesn't need the url
+	std::string hash = conf::expected_sha256(path_to_utf8(file.filename()));
+
+	if (hash.empty())
+	{
+		const auto url_file = shared_url_file(u);
+
+		std::ifstream in(url_file);
+		std::getline(in, hash);
+		hash = trim_copy(hash);
+
+		if (hash.empty())
+		{
+			cx().trace(context::net, "{} not in shared cache", u);
+			return false;
+		}
+	}
+
+	const auto object = shared_object_file(hash);
+
+	if (!fs::exists(object))
+	{
+		cx().trace(context::net, "{} not in shared cache", object);
+		return false;
+	}
+
+	if (conf::dry())
+		return true;
+
+	// the cache is shared with other machines and instances, an object that
+	// was truncated or modified must not end up in the build; it's only
+	// hashed again if its size or time changed since the last check
+	if (object_verified(object))
+	{
+		cx().trace(context::bypass, "{} already verified", object);
+	}
 	else
 	{
-		cx().trace(context::net, "no {}", file);
+		sha256 h;
+		if (!h.update_from_file(object) || h.finish() != hash)
+		{
+			cx().warning(context::net,
+				"{} in shared cache doesn't match its hash, removing it",
+				object);
+
+			std::error_code ec;
+			fs::remove(object, ec);
+			fs::remove(shared_stat_file(object), ec);
+
+			return false;
+		}
+
+		set_object_verified(object);
+	}
+
+	if (!copy_whole_file(object, file))
+	{
+		cx().debug(context::net, "failed to copy {} to {}", object, file);
+		return false;
+	}
+
+	cx().trace(context::bypass, "picking {} from shared cache {}", file, object);
+	return true;
+}
+
+void downloader::add_to_shared_cache(
+	const mob::url& u, const fs::path& file, const std::string& hash)
+{
+	if (hash.empty() || conf::dry())
+		return;
+
+	const auto object = shared_object_file(hash);
+	std::error_code ec;
+
+	if (!fs::exists(object))
+	{
+		// copied under a temporary name first so other instances of mob
+		// never see an incomplete file; if it fails, it was maybe added by
+		// another instance in the meantime
+		if (!copy_whole_file(file, object))
+		{
+			cx().debug(context::net, "failed to add {} to shared cache", file);
+			return;
+		}
+
+		// the hash is from the download itself
+		set_object_verified(object);
 	}
 
-	return false;
+	const auto url_file = shared_url_file(u);
+	const fs::path tmp = url_file.native() + L".tmp";
+
+	fs::create_directories(url_file.parent_path(), ec);
+
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		out << hash << "\n" << u.string() << "\n";
+	}
+
+	fs::rename(tmp, url_file, ec);
+
+	cx().trace(context::net, "added {} to shared cache as {}", u, object);
 }
 
 fs::path downloader::path_for_url(const mob::url& u) const
@@ -5,7 +5,8 @@ namespace mob
 {
 
 extractor::extractor()
-	: basic_process_runner("extract")
+	: basic_process_runner("extract"), stream_failed_(false),
+		extracted_(false)
 {
 }
 
@@ -14,6 +15,62 @@ fs::path extractor::binary()
 	return conf::tool_by_name("sevenz");
 }
 
+fs::path extractor::tar_binary()
+{
+	// libarchive's bsdtar, it's shipped with Windows 10 in System32
+	static const fs::path path = []
+	{
+		const auto tar = conf::tool_by_name("tar");
+		if (tar.empty())
+			return fs::path();
+
+		if (tar.has_parent_path())
+			return (fs::exists(tar) ? tar : fs::path());
+
+		return find_in_path(path_to_utf8(tar));
+	}();
+
+	return path;
+}
+
+bool extractor::can_stream(const fs::path& file)
+{
+	if (tar_binary().empty())
+		return false;
+
+	const auto s = file.u8string();
+	return s.ends_with(u8".tar.gz") || s.ends_with(u8".zip");
+}
+
+// a substitution for bsdtar's -s that strips the given directory from the
+// beginning of every entry, so an archive with a single folder named like the
+// output directory extracts straight into it; the entry for the directory
+// itself becomes empty, which tar skips
+//
+// entries that don't start with the directory are unchanged
+//
+static std::string tar_strip_pattern(const fs::path& dir)
+{
+	const std::string name = path_to_utf8(dir.filename());
+
+	// the pattern is delimited by commas
+	if (name.empty() || name.find(',') != std::string::npos)
+		return {};
+
+	std::string escaped;
+
+	for (char c : name)
+	{
+		// special characters in a basic regular expression
+		if (std::string_view(".[]*^$\\").find(c) != std::string_view::npos)
+			escaped += '\\';
+
+		escaped += c;
+	}
+
+	return ",^" + escaped + "/,,";
+}
+
 extractor& extractor::file(const fs::path& file)
 {
 	file_ = file;
@@ -26,8 +83,31 @@ extractor& extractor::output(const fs::path& dir)
 	return *this;
 }
 
+extractor& extractor::stream(std::shared_ptr<download_stream> s)
+{
+	stream_ = std::move(s);
+	return *this;
+}
+
+bool extractor::stream_failed() const
+{
+	return stream_failed_;
+}
+
+bool extractor::extracted() const
+{
+	return extracted_;
+}
+
 void extractor::do_run()
 {
+	// the downloader can't write to the pipe forever if this returns early
+	guard close_stream([&]
+	{
+		if (stream_)
+			stream_->close_read();
+	});
+
 	interruption_file ifile(cx(), where_, "extractor");
 
 	if (ifile.exists())
@@ -49,7 +129,10 @@ void extractor::do_run()
 		}
 	}
 
-	cx().debug(context::generic, "extracting {} into {}", file_, where_);
+	if (stream_)
+		cx().debug(context::generic, "extracting download into {}", where_);
+	else
+		cx().debug(context::generic, "extracting {} into {}", file_, where_);
 
 	ifile.create();
 
@@ -70,11 +153,58 @@ void extractor::do_run()
 	// that pax_global_header makes 7z fail with "unspecified error"
 	//
 	// so the handling of a duplicate directory is done manually in
-	// check_duplicate_directory() below
+	// check_duplicate_directory() below; tar can strip the directory while
+	// writing the files instead, which avoids moving everything afterwards
+
+	const auto strip = tar_strip_pattern(where_);
+
+	// with tar, pax headers are interpreted instead of extracted as files,
+	// the exclusion is in case they aren't
+	auto add_tar_args = [&]
+	{
+		process_.arg("--exclude", "pax_global_header");
+
+		if (!strip.empty())
+			process_.arg("-s", strip, process::quote);
+	};
+
+	bool stripped = false;
 
-	if (file_.u8string().ends_with(u8".tar.gz"))
+	if (stream_)
 	{
-		cx().trace(context::generic, "this is a tar.gz, piping");
+		// reads the archive from the pipe as it's downloaded, tar figures
+		// out the format; failures are handled below
+		cx().trace(context::generic, "streaming into tar");
+
+		process_ = process()
+			.binary(tar_binary())
+			.arg("-x")
+			.arg("-f", "-")
+			.arg("-C", where_)
+			.stdin_handle(stream_->read_handle())
+			.flags(process::allow_failure);
+
+		add_tar_args();
+		stripped = !strip.empty();
+	}
+	else if (file_.u8string().ends_with(u8".tar.gz") && !tar_binary().empty())
+	{
+		// decompresses and writes files in one pass, instead of piping the
+		// tar from one 7z process to another
+		cx().trace(context::generic, "this is a tar.gz, using tar");
+
+		process_ = process()
+			.binary(tar_binary())
+			.arg("-x")
+			.arg("-f", file_)
+			.arg("-C", where_);
+
+		add_tar_args();
+		stripped = !strip.empty();
+	}
+	else if (file_.u8string().ends_with(u8".tar.gz"))
+	{
+		cx().trace(context::generic, "this is a tar.gz and tar is missing, piping");
 
 		auto extract_tar = process()
 			.binary(binary())
@@ -87,6 +217,7 @@ void extractor::do_run()
 			.arg("-aoa")
 			.arg("-si")
 			.arg("-ttar")
+			.arg("-x!pax_global_header")
 			.arg("-o", where_, process::nospace);
 
 		process_ = process::pipe(extract_tar, extract_gz);
@@ -99,17 +230,59 @@ void extractor::do_run()
 			.arg("-aoa")
 			.arg("-bd")
 			.arg("-bb0")
+			.arg("-mmt=on")
 			.arg("-o", where_, process::nospace)
 			.arg(file_);
 	}
 
-	execute_and_join();
-	check_duplicate_directory(ifile.file());
+	const auto exit_code = execute_and_join();
+
+	if (stream_)
+	{
+		stream_->close_read();
+
+		// the downloader can fail, start over or not use the stream at all if
+		// the file was already downloaded
+		const bool streamed = stream_->wait();
+
+		if (exit_code != 0 || !streamed)
+		{
+			if (interrupted())
+			{
+				// the interruption file is kept, the directory is extracted
+				// again on the next run
+				delete_output.cancel();
+				return;
+			}
+
+			cx().debug(context::generic,
+				"streamed extraction failed (exit code {}, stream {}), "
+				"will extract from the file",
+				exit_code, (streamed ? "complete" : "incomplete"));
+
+			// delete_output removes what was extracted
+			stream_failed_ = true;
+			return;
+		}
+	}
+
+	// tar already stripped the directory; checking again would move up a
+	// directory that has the same name but is part of the content
+	if (!stripped)
+		check_duplicate_directory(ifile.file());
 
 	delete_output.cancel();
 
 	if (!interrupted())
+	{
 		ifile.remove();
+		extracted_ = true;
+	}
+}
+
+fs::path extractor::stamp_file(const fs::path& dir)
+{
+	return dir / "_mob_extracted.txt";
 }
 
 void extractor::check_duplicate_directory(const fs::path& ifile)
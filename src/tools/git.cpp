@@ -7,6 +7,269 @@ namespace mob
 
 constexpr git::ops no_op(git::ops(0));
 
+
+// small readers for the files in a .git directory, used by the queries that
+// run often so they don't have to spawn git; all of these return empty when
+// something isn't understood and the caller falls back to running git
+
+// first line of a small file, trimmed; empty if it can't be read
+//
+static std::string first_line(const fs::path& p)
+{
+	std::ifstream in(p, std::ios::binary);
+	if (!in)
+		return {};
+
+	std::string line;
+	std::getline(in, line);
+
+	return trim_copy(line);
+}
+
+// the git directory of a working tree; .git is normally a directory, but it
+// can be a file with "gitdir: path" for submodules and worktrees
+//
+static fs::path git_dir(const fs::path& root)
+{
+	const fs::path dot_git = root / ".git";
+
+	std::error_code ec;
+	if (fs::is_directory(dot_git, ec))
+		return dot_git;
+
+	const std::string line = first_line(dot_git);
+	if (!line.starts_with("gitdir:"))
+		return {};
+
+	fs::path p = utf8_to_utf16(trim_copy(line.substr(7)));
+	if (p.is_relative())
+		p = root / p;
+
+	return p;
+}
+
+// where refs and config are, which isn't the git directory for worktrees
+//
+static fs::path common_dir(const fs::path& gd)
+{
+	const std::string line = first_line(gd / "commondir");
+	if (line.empty())
+		return gd;
+
+	fs::path p = utf8_to_utf16(line);
+	if (p.is_relative())
+		p = gd / p;
+
+	return p;
+}
+
+static bool is_hash(std::string_view s)
+{
+	if (s.size() != 40)
+		return false;
+
+	for (char c : s)
+	{
+		if (!std::isxdigit(static_cast<unsigned char>(c)))
+			return false;
+	}
+
+	return true;
+}
+
+// hash of a ref like "refs/heads/master", from the loose file or from
+// packed-refs
+//
+static std::string resolve_ref(const fs::path& gd, const std::string& ref)
+{
+	const fs::path cd = common_dir(gd);
+
+	// symbolic refs can point to other symbolic refs, but not forever
+	std::string name = ref;
+
+	for (int depth=0; depth<5; ++depth)
+	{
+		std::string s = first_line(gd / utf8_to_utf16(name));
+		if (s.empty())
+			s = first_line(cd / utf8_to_utf16(name));
+
+		if (s.empty())
+			break;
+
+		if (!s.starts_with("ref:"))
+			return (is_hash(s) ? s : std::string());
+
+		name = trim_copy(s.substr(4));
+	}
+
+	std::ifstream in(cd / "packed-refs", std::ios::binary);
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		// comments and peeled tags
+		if (line.empty() || line[0] == '#' || line[0] == '^')
+			continue;
+
+		const auto sp = line.find(' ');
+		if (sp == std::string::npos)
+			continue;
+
+		if (trim_copy(line.substr(sp + 1)) == name)
+		{
+			const auto h = line.substr(0, sp);
+			return (is_hash(h) ? h : std::string());
+		}
+	}
+
+	return {};
+}
+
+// whether a [remote "name"] section exists in the repo's config
+//
+static bool config_has_remote(const fs::path& gd, const std::string& name)
+{
+	std::ifstream in(common_dir(gd) / "config", std::ios::binary);
+	std::string line;
+
+	const std::string section = "[remote \"" + name + "\"]";
+
+	while (std::getline(in, line))
+	{
+		if (trim_copy(line) == section)
+			return true;
+	}
+
+	return false;
+}
+
+// whether core.sparseCheckout is true in the repo's config or in the
+// worktree's, where `sparse-checkout set` puts it
+//
+static bool config_has_sparse(const fs::path& gd)
+{
+	for (auto&& f : {common_dir(gd) / "config", gd / "config.worktree"})
+	{
+		std::ifstream in(f, std::ios::binary);
+		std::string line;
+
+		while (std::getline(in, line))
+		{
+			const auto cs = split(line, "=");
+			if (cs.size() != 2)
+				continue;
+
+			auto k = trim_copy(cs[0]);
+			std::transform(k.begin(), k.end(), k.begin(), ::tolower);
+
+			if (k == "sparsecheckout" && trim_copy(cs[1]) == "true")
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static std::uint32_t read_be32(const std::string& d, std::size_t pos)
+{
+	const auto* p = reinterpret_cast<const unsigned char*>(d.data() + pos);
+
+	return
+		(std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) |
+		(std::uint32_t(p[2]) << 8)  |  std::uint32_t(p[3]);
+}
+
+// paths of all the entries in the index, utf8 with forward slashes; handles
+// versions 2 to 4, returns nothing for anything else
+//
+static std::optional<std::vector<std::string>> index_paths(const fs::path& gd)
+{
+	std::ifstream in(gd / "index", std::ios::binary);
+	if (!in)
+		return {};
+
+	const std::string d(
+		(std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	if (d.size() < 12 || d.compare(0, 4, "DIRC") != 0)
+		return {};
+
+	const auto version = read_be32(d, 4);
+	const auto count = read_be32(d, 8);
+
+	if (version < 2 || version > 4)
+		return {};
+
+	// ctime, mtime, dev, ino, mode, uid, gid, size, hash and flags
+	const std::size_t fixed = 62;
+
+	std::vector<std::string> paths;
+	paths.reserve(count);
+
+	std::size_t pos = 12;
+	std::string previous;
+
+	for (std::uint32_t i=0; i<count; ++i)
+	{
+		const std::size_t start = pos;
+		if (pos + fixed > d.size())
+			return {};
+
+		const unsigned flags =
+			(unsigned(static_cast<unsigned char>(d[pos + 60])) << 8) |
+			unsigned(static_cast<unsigned char>(d[pos + 61]));
+
+		pos += fixed;
+
+		// extended flags
+		if (version >= 3 && (flags & 0x4000))
+			pos += 2;
+
+		std::string path;
+
+		if (version == 4)
+		{
+			// number of bytes to remove from the previous path, as an offset
+			// varint, followed by the rest of the path
+			if (pos >= d.size())
+				return {};
+
+			unsigned char c = static_cast<unsigned char>(d[pos++]);
+			std::size_t strip = c & 0x7f;
+
+			while (c & 0x80)
+			{
+				if (pos >= d.size())
+					return {};
+
+				c = static_cast<unsigned char>(d[pos++]);
+				strip = ((strip + 1) << 7) | (c & 0x7f);
+			}
+
+			if (strip > previous.size())
+				return {};
+
+			path = previous.substr(0, previous.size() - strip);
+		}
+
+		const auto nul = d.find('\0', pos);
+		if (nul == std::string::npos)
+			return {};
+
+		path += d.substr(pos, nul - pos);
+		pos = nul + 1;
+
+		// entries are padded with nuls to a multiple of 8 bytes before v4
+		if (version < 4)
+			pos = start + ((pos - start + 7) & ~std::size_t(7));
+
+		previous = path;
+		paths.push_back(std::move(path));
+	}
+
+	return paths;
+}
+
 git::git(ops o)
 	: basic_process_runner("git"), op_(o)
 {
@@ -95,12 +358,136 @@ bool git::is_git_repo(const fs::path& p)
 	return g.is_repo();
 }
 
-bool git::branch_exists(const mob::url& u, const std::string& name)
+std::string git::head_commit(const fs::path& repo)
+{
+	git g(no_op);
+	g.root(repo);
+	return g.rev_parse_head();
+}
+
+bool git::is_dirty(const fs::path& repo)
+{
+	git g(no_op);
+	g.root(repo);
+	return g.has_uncommitted_changes();
+}
+
+bool git::changed_since(const fs::path& repo, const std::string& rev)
 {
 	git g(no_op);
-	g.url(u);
-	g.branch(name);
-	return g.branch_exists();
+	g.root(repo);
+
+	// `diff` ignores untracked files
+	return g.has_uncommitted_changes() || g.differs_from(rev);
+}
+
+std::vector<fs::path> git::tracked_files(const fs::path& repo)
+{
+	git g(no_op);
+	g.root(repo);
+	return g.tracked_files();
+}
+
+bool git::branch_exists(const mob::url& u, const std::string& name)
+{
+	return !remote_commit(u, name).empty();
+}
+
+std::vector<mob::url> git::remotes_without_branch(
+	const std::vector<mob::url>& urls, const std::string& name)
+{
+	// git can only talk to one repository per connection, but the probes
+	// don't depend on each other
+	std::vector<char> found(urls.size(), 0);
+
+	parallel_for(urls.size(), job_slots::network().total(), [&](std::size_t i)
+	{
+		found[i] = (branch_exists(urls[i], name) ? 1 : 0);
+	});
+
+	std::vector<mob::url> missing;
+
+	for (std::size_t i=0; i<urls.size(); ++i)
+	{
+		if (!found[i])
+			missing.push_back(urls[i]);
+	}
+
+	return missing;
+}
+
+// remote commits for url and branch, filled by remote_commit(); each one has
+// its own mutex so different remotes are probed in parallel
+//
+struct remote_state
+{
+	std::mutex mutex;
+	bool done = false;
+	std::string commit;
+};
+
+static std::mutex g_remotes_mutex;
+static std::map<std::string, std::shared_ptr<remote_state>> g_remotes;
+
+std::string git::remote_commit(const mob::url& u, const std::string& branch)
+{
+	std::shared_ptr<remote_state> state;
+
+	{
+		std::scoped_lock lock(g_remotes_mutex);
+
+		auto& sp = g_remotes[u.string() + " " + branch];
+		if (!sp)
+			sp = std::make_shared<remote_state>();
+
+		state = sp;
+	}
+
+	std::scoped_lock lock(state->mutex);
+
+	if (!state->done)
+	{
+		git g(no_op);
+		g.url(u);
+		g.branch(branch);
+
+		state->commit = g.ls_remote();
+		state->done = true;
+	}
+
+	return state->commit;
+}
+
+void git::add_submodules(context& cx, std::vector<git> v)
+{
+	// all the submodules are normally in the same super repo
+	std::map<fs::path, std::vector<git>> roots;
+
+	for (auto&& g : v)
+	{
+		if (!fs::exists(g.root_ / g.submodule_ / ".git"))
+		{
+			// `git submodule add` clones it, run it on its own
+			cx.trace(context::generic,
+				"{} is not a repo, adding it separately",
+				g.root_ / g.submodule_);
+
+			g.run(cx);
+			continue;
+		}
+
+		roots[g.root_].push_back(std::move(g));
+	}
+
+	for (auto&& [root, gits] : roots)
+	{
+		git g(ops::add_submodule);
+		g.url(gits.front().url_);
+		g.root(root);
+		g.submodules_ = std::move(gits);
+
+		g.run(cx);
+	}
 }
 
 void git::init_repo(const fs::path& p)
@@ -186,6 +573,18 @@ git& git::shallow(bool b)
 	return *this;
 }
 
+git& git::filter(const std::string& spec)
+{
+	filter_ = spec;
+	return *this;
+}
+
+git& git::sparse(std::vector<std::string> dirs)
+{
+	sparse_ = std::move(dirs);
+	return *this;
+}
+
 void git::do_run()
 {
 	if (url_.empty() || root_.empty())
@@ -238,6 +637,12 @@ process git::make_process()
 
 void git::do_add_submodule()
 {
+	if (!submodules_.empty())
+	{
+		do_add_submodules();
+		return;
+	}
+
 	process_ = make_process()
 		.stderr_level(context::level::trace)
 		.arg("-c", "core.autocrlf=false")
@@ -254,6 +659,231 @@ void git::do_add_submodule()
 	execute_and_join();
 }
 
+void git::do_add_submodules()
+{
+	struct entry
+	{
+		std::string name;
+		std::string url;
+		std::string section;
+		std::string commit;
+	};
+
+	// add_submodules() only batches the ones that are already cloned
+	std::vector<entry> entries;
+
+	for (auto&& s : submodules_)
+	{
+		const fs::path path = root_ / s.submodule_;
+
+		entries.push_back({
+			s.submodule_,
+			s.url_.string(),
+			"[submodule \"" + s.submodule_ + "\"]\n"
+			"\tpath = " + s.submodule_ + "\n"
+			"\turl = " + s.url_.string() + "\n"
+			"\tbranch = " + s.branch_ + "\n",
+			head_commit(path)});
+	}
+
+	if (entries.empty())
+		return;
+
+	cx().debug(context::generic,
+		"registering {} submodules in {}", entries.size(), root_);
+
+	if (conf::dry())
+		return;
+
+
+	// existing sections are kept in order, the ones for the new submodules
+	// are replaced, like `--force` does
+	const fs::path gitmodules = root_ / ".gitmodules";
+	std::vector<std::pair<std::string, std::string>> sections;
+
+	if (fs::exists(gitmodules))
+	{
+		const std::string text = op::read_text_file(
+			cx(), encodings::utf8, gitmodules);
+
+		static const std::regex header(R"(^\[submodule "(.*)"\]\s*$)");
+
+		for (auto&& line : split(text, "\n"))
+		{
+			std::smatch m;
+
+			if (std::regex_match(line, m, header))
+				sections.push_back({m[1].str(), ""});
+			else if (sections.empty())
+				sections.push_back({"", ""});
+
+			sections.back().second += line + "\n";
+		}
+	}
+
+	for (auto&& e : entries)
+	{
+		auto itor = std::find_if(sections.begin(), sections.end(),
+			[&](auto&& sec){ return sec.first == e.name; });
+
+		if (itor == sections.end())
+			sections.push_back({e.name, e.section});
+		else
+			itor->second = e.section;
+	}
+
+	std::string text;
+	for (auto&& sec : sections)
+		text += sec.second;
+
+	op::write_text_file(cx(), encodings::utf8, gitmodules, text);
+
+
+	// gitlinks for all the submodules and .gitmodules in one index update
+	process_ = make_process()
+		.stderr_level(context::level::trace)
+		.arg("-c", "core.autocrlf=false")
+		.arg("update-index")
+		.arg("--add");
+
+	for (auto&& e : entries)
+		process_.arg("--cacheinfo", "160000," + e.commit + "," + e.name);
+
+	process_
+		.arg("--")
+		.arg(".gitmodules")
+		.cwd(root_);
+
+	execute_and_join();
+
+
+	// `git submodule add` also registers the submodules in .git/config,
+	// without this they're ignored by `git submodule update` and friends
+	for (auto&& e : entries)
+	{
+		set_config("submodule." + e.name + ".url", e.url);
+		set_config("submodule." + e.name + ".active", "true");
+	}
+}
+
+// a mirror is only created or fetched once per run, even if several tasks
+// clone the same url; each one has its own mutex so different mirrors are
+// updated in parallel
+//
+struct mirror_state
+{
+	std::mutex mutex;
+	bool done = false;
+	bool ok = false;
+};
+
+static std::mutex g_mirrors_mutex;
+static std::map<fs::path, std::shared_ptr<mirror_state>> g_mirrors;
+
+fs::path git::reference_repo()
+{
+	const auto store = conf::git_reference_store();
+	if (store.empty())
+		return {};
+
+	// named after the repo so it's easy to find, with a hash of the url
+	// for forks with the same name
+	std::string name = url_.filename();
+	if (name.ends_with(".git"))
+		name = name.substr(0, name.size() - 4);
+
+	const fs::path mirror = fs::path(utf8_to_utf16(store)) /
+		(name + "-" + hash_string(url_.string()) + ".git");
+
+	std::shared_ptr<mirror_state> state;
+
+	{
+		std::scoped_lock lock(g_mirrors_mutex);
+
+		auto& sp = g_mirrors[mirror];
+		if (!sp)
+			sp = std::make_shared<mirror_state>();
+
+		state = sp;
+	}
+
+	std::scoped_lock lock(state->mutex);
+
+	if (state->done)
+		return (state->ok ? mirror : fs::path());
+
+	state->done = true;
+
+	if (conf::dry())
+	{
+		state->ok = true;
+		return mirror;
+	}
+
+	if (fs::exists(mirror / "HEAD"))
+	{
+		cx().trace(context::generic, "updating mirror {}", mirror);
+
+		process_ = make_process()
+			.flags(process::allow_failure)
+			.stderr_level(context::level::trace)
+			.arg("fetch")
+			.arg("--prune")
+			.arg("--quiet", process::log_quiet)
+			.cwd(mirror);
+
+		// a stale mirror still has most of the objects, the clone gets the
+		// rest from the remote
+		if (execute_and_join() != 0)
+			cx().warning(context::generic, "failed to update mirror {}", mirror);
+
+		state->ok = true;
+		return mirror;
+	}
+
+	cx().debug(context::generic, "creating mirror {} for {}", mirror, url_);
+
+	// cloned under another name first so an interrupted clone is never used
+	const fs::path temp = mirror.native() + L".tmp" +
+		std::to_wstring(GetCurrentProcessId());
+
+	std::error_code ec;
+	fs::remove_all(temp, ec);
+	fs::create_directories(mirror.parent_path(), ec);
+
+	process_ = make_process()
+		.flags(process::allow_failure)
+		.stderr_level(context::level::trace)
+		.arg("clone")
+		.arg("--mirror")
+		.arg("--quiet", process::log_quiet)
+		.arg(url_)
+		.arg(temp);
+
+	if (execute_and_join() != 0)
+	{
+		cx().warning(context::generic,
+			"failed to create mirror {}, cloning without it", mirror);
+
+		fs::remove_all(temp, ec);
+		return {};
+	}
+
+	fs::rename(temp, mirror, ec);
+
+	if (ec)
+	{
+		// maybe created by another instance in the meantime
+		fs::remove_all(temp, ec);
+
+		if (!fs::exists(mirror / "HEAD"))
+			return {};
+	}
+
+	state->ok = true;
+	return mirror;
+}
+
 void git::do_clone_or_pull()
 {
 	if (!do_clone())
@@ -269,6 +899,8 @@ bool git::do_clone()
 		return false;
 	}
 
+	const auto reference = reference_repo();
+
 	process_ = make_process()
 		.stderr_level(context::level::trace)
 		.arg("clone")
@@ -277,6 +909,24 @@ bool git::do_clone()
 	if (shallow_)
 		process_.arg("--depth", "1");
 
+	// the filter is remembered in the repo's config, later pulls only fetch
+	// what's missing for the checkout
+	if (!filter_.empty())
+		process_.arg("--filter=" + filter_);
+
+	// only checks out files at the root, the directories are added below
+	if (!sparse_.empty())
+		process_.arg("--sparse");
+
+	if (!reference.empty())
+	{
+		// objects are copied from the mirror instead of downloaded, the clone
+		// doesn't depend on the mirror afterwards
+		process_
+			.arg("--reference-if-able", reference)
+			.arg("--dissociate");
+	}
+
 	process_
 		.arg("--branch", branch_)
 		.arg("--quiet", process::log_quiet)
@@ -286,6 +936,8 @@ bool git::do_clone()
 
 	execute_and_join();
 
+	if (!sparse_.empty())
+		do_set_sparse();
 
 	if (!creds_username_.empty() || !creds_email_.empty())
 		do_set_credentials();
@@ -301,6 +953,25 @@ bool git::do_clone()
 
 void git::do_pull()
 {
+	// the directories might have changed in the ini since the clone
+	do_set_sparse();
+
+	if (conf::probe_remotes())
+	{
+		// the pull would contact the remote anyway, but ls-remote doesn't
+		// negotiate anything and there's nothing to merge
+		const auto remote = remote_commit(url_, branch_);
+
+		if (!remote.empty() && remote == rev_parse_head())
+		{
+			cx().debug(context::generic,
+				"{} is already at {} on the remote, not pulling",
+				branch_, remote);
+
+			return;
+		}
+	}
+
 	if (revert_ts_)
 		do_revert_ts();
 
@@ -316,6 +987,44 @@ void git::do_pull()
 	execute_and_join();
 }
 
+void git::do_set_sparse()
+{
+	if (sparse_.empty())
+	{
+		// the option was cleared after the repo was made sparse
+		const auto gd = git_dir(root_);
+		if (gd.empty() || !config_has_sparse(gd))
+			return;
+
+		cx().debug(context::generic, "disabling sparse checkout");
+
+		process_ = make_process()
+			.stderr_level(context::level::trace)
+			.arg("sparse-checkout")
+			.arg("disable")
+			.cwd(root_);
+
+		execute_and_join();
+		return;
+	}
+
+	cx().debug(context::generic,
+		"sparse checkout of {}", join(sparse_, " "));
+
+	process_ = make_process()
+		.stderr_level(context::level::trace)
+		.arg("sparse-checkout")
+		.arg("set")
+		.arg("--cone");
+
+	for (auto&& d : sparse_)
+		process_.arg(d);
+
+	process_.cwd(root_);
+
+	execute_and_join();
+}
+
 void git::do_set_credentials()
 {
 	cx().debug(context::generic, "setting up credentials");
@@ -352,58 +1061,49 @@ void git::do_set_remote()
 }
 
 template <class F>
-void for_each_ts(const fs::path& root, F&& f)
+void git::run_with_path_list(const std::vector<fs::path>& files, F&& f)
 {
-	for (auto&& e : fs::recursive_directory_iterator(root))
-	{
-		if (!e.is_regular_file())
-			continue;
+	std::string list;
 
-		const auto p = e.path();
+	for (auto&& rp : files)
+		list += utf16_to_utf8(rp.generic_wstring()) + "\n";
 
-		if (!path_to_utf8(p.extension()).ends_with(".ts"))
-			continue;
+	const auto list_file = make_temp_file();
+	guard g([&]
+	{
+		op::delete_file(cx(), list_file, op::optional);
+	});
 
-		f(p);
-	}
+	op::write_text_file(cx(), encodings::utf8, list_file, list);
+	f(list_file);
 }
 
 void git::do_ignore_ts()
 {
-	for_each_ts(root_, [&](auto&& p)
-	{
-		const auto rp = fs::relative(p, root_);
+	const auto files = tracked_ts_files();
 
-		if (is_tracked(rp))
-		{
-			cx().trace(context::generic, "  . {}", rp);
-			set_assume_unchanged(rp, true);
-		}
-		else
-		{
-			cx().trace(context::generic, "  . {} (skipping, not tracked)", rp);
-		}
-	});
+	for (auto&& f : files)
+		cx().trace(context::generic, "  . {}", f);
+
+	set_assume_unchanged(files, true);
 }
 
 void git::do_revert_ts()
 {
-	for_each_ts(root_, [&](auto&& p)
-	{
-		const auto rp = fs::relative(p, root_);
-
-		if (!is_tracked(rp))
-		{
-			cx().debug(context::generic,
-				"won't try to revert ts file '{}', not tracked", rp);
+	const auto files = tracked_ts_files();
+	if (files.empty())
+		return;
 
-			return;
-		}
+	for (auto&& f : files)
+		cx().trace(context::generic, "  . reverting {}", f);
 
+	run_with_path_list(files, [&](auto&& list_file)
+	{
 		process_ = make_process()
 			.stderr_level(context::level::trace)
 			.arg("checkout")
-			.arg(p)
+			.arg("--pathspec-from-file=-")
+			.stdin_file(list_file)
 			.cwd(root_);
 
 		execute_and_join();
@@ -424,6 +1124,10 @@ void git::set_config(const std::string& key, const std::string& value)
 
 bool git::has_remote(const std::string& name)
 {
+	const auto gd = git_dir(root_);
+	if (!gd.empty() && fs::exists(common_dir(gd) / "config"))
+		return config_has_remote(gd, name);
+
 	process_ = make_process()
 		.flags(process::allow_failure)
 		.stderr_level(context::level::debug)
@@ -472,19 +1176,47 @@ void git::set_remote_push(const std::string& remote, const std::string& url)
 	execute_and_join();
 }
 
-void git::set_assume_unchanged(const fs::path& relative_file, bool on)
+void git::set_assume_unchanged(
+	const std::vector<fs::path>& relative_files, bool on)
 {
-	process_ = make_process()
-		.arg("update-index")
-		.arg(on ? "--assume-unchanged" : "--no-assume-unchanged")
-		.arg(relative_file, process::forward_slashes)
-		.cwd(root_);
+	if (relative_files.empty())
+		return;
 
-	execute_and_join();
+	run_with_path_list(relative_files, [&](auto&& list_file)
+	{
+		process_ = make_process()
+			.arg("update-index")
+			.arg(on ? "--assume-unchanged" : "--no-assume-unchanged")
+			.arg("--stdin")
+			.stdin_file(list_file)
+			.cwd(root_);
+
+		execute_and_join();
+	});
 }
 
 bool git::is_tracked(const fs::path& relative_file)
 {
+	const auto gd = git_dir(root_);
+
+	if (!gd.empty())
+	{
+		if (auto paths=index_paths(gd))
+		{
+			const std::string rp =
+				replace_all(path_to_utf8(relative_file), "\\", "/");
+
+			// ls-files also matches directories with tracked files in them
+			for (auto&& p : *paths)
+			{
+				if (p == rp || (p.starts_with(rp) && p[rp.size()] == '/'))
+					return true;
+			}
+
+			return false;
+		}
+	}
+
 	process_ = make_process()
 		.stdout_level(context::level::debug)
 		.stderr_level(context::level::debug)
@@ -497,33 +1229,240 @@ bool git::is_tracked(const fs::path& relative_file)
 	return (execute_and_join() == 0);
 }
 
-bool git::is_repo()
+// .ts files found in the index of a repo, along with the HEAD and the index
+// time they were found for
+//
+struct ts_cache_entry
 {
-	process_ = make_process()
-		.arg("rev-parse")
-		.arg("--is-inside-work-tree")
-		.stderr_filter([](process::filter& f)
+	std::string key;
+	std::vector<fs::path> files;
+};
+
+static std::mutex g_ts_cache_mutex;
+static std::map<fs::path, ts_cache_entry> g_ts_cache;
+
+// the entry is also kept in the git directory so later runs don't have to
+// read the index again; the first line is the key, then one file per line
+//
+static fs::path ts_cache_file(const fs::path& gd)
+{
+	return gd / "mob_ts_files.txt";
+}
+
+static std::optional<ts_cache_entry> read_ts_cache(const fs::path& gd)
+{
+	std::ifstream in(ts_cache_file(gd), std::ios::binary);
+	if (!in)
+		return {};
+
+	ts_cache_entry e;
+	if (!std::getline(in, e.key))
+		return {};
+
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (!line.empty())
+			e.files.push_back(utf8_to_utf16(line));
+	}
+
+	return e;
+}
+
+static void write_ts_cache(const fs::path& gd, const ts_cache_entry& e)
+{
+	if (conf::dry())
+		return;
+
+	const fs::path f = ts_cache_file(gd);
+	const fs::path tmp = f.native() + L".tmp";
+
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		out << e.key << "\n";
+
+		for (auto&& p : e.files)
+			out << path_to_utf8(p) << "\n";
+	}
+
+	std::error_code ec;
+	fs::rename(tmp, f, ec);
+
+	if (ec)
+		fs::remove(tmp, ec);
+}
+
+std::vector<fs::path> git::tracked_ts_files()
+{
+	std::vector<fs::path> files;
+
+	const auto gd = git_dir(root_);
+
+	if (!gd.empty())
+	{
+		// a pull changes HEAD, adding files changes the index
+		std::error_code ec;
+		const auto t = fs::last_write_time(gd / "index", ec);
+
+		const std::string key =
+			rev_parse_head() + " " +
+			std::to_string(t.time_since_epoch().count());
+
+		bool found = false;
+
 		{
-			if (f.line.find("not a git repo") != std::string::npos)
-				f.lv = context::level::trace;
-		})
-		.flags(process::allow_failure)
+			std::scoped_lock lock(g_ts_cache_mutex);
+
+			auto itor = g_ts_cache.find(root_);
+			if (itor != g_ts_cache.end() && itor->second.key == key)
+			{
+				files = itor->second.files;
+				found = true;
+			}
+		}
+
+		if (!found)
+		{
+			// from a previous run
+			auto e = read_ts_cache(gd);
+
+			if (e && e->key == key)
+			{
+				files = e->files;
+				found = true;
+
+				std::scoped_lock lock(g_ts_cache_mutex);
+				g_ts_cache[root_] = std::move(*e);
+			}
+		}
+
+		if (!found)
+		{
+			if (auto paths=index_paths(gd))
+			{
+				for (auto&& p : *paths)
+				{
+					if (p.ends_with(".ts"))
+						files.push_back(utf8_to_utf16(p));
+				}
+
+				write_ts_cache(gd, {key, files});
+
+				std::scoped_lock lock(g_ts_cache_mutex);
+				g_ts_cache[root_] = {key, files};
+
+				found = true;
+			}
+		}
+
+		if (found)
+		{
+			// the index can have files that were deleted from the working
+			// tree
+			std::erase_if(files, [&](auto&& rp)
+			{
+				return !fs::is_regular_file(root_ / rp);
+			});
+
+			return files;
+		}
+	}
+
+	// a single ls-files for the whole repo instead of one per file
+	process_ = make_process()
+		.stdout_flags(process::keep_in_string)
+		.stdout_encoding(encodings::utf8)
+		.arg("-c", "core.quotepath=off")
+		.arg("ls-files")
+		.arg("--")
+		.arg("*.ts")
 		.cwd(root_);
 
-	return (execute_and_join() == 0);
+	execute_and_join();
+
+	for (auto&& line : split(process_.stdout_string(), "\r\n"))
+	{
+		const fs::path rp = utf8_to_utf16(line);
+
+		// the index can have files that were deleted from the working tree
+		if (fs::is_regular_file(root_ / rp))
+			files.push_back(rp);
+	}
+
+	return files;
+}
+
+std::vector<fs::path> git::tracked_files()
+{
+	std::vector<fs::path> files;
+
+	const auto gd = git_dir(root_);
+	std::optional<std::vector<std::string>> paths;
+
+	if (!gd.empty())
+		paths = index_paths(gd);
+
+	if (!paths)
+	{
+		process_ = make_process()
+			.stdout_flags(process::keep_in_string)
+			.stdout_encoding(encodings::utf8)
+			.arg("-c", "core.quotepath=off")
+			.arg("ls-files")
+			.cwd(root_);
+
+		execute_and_join();
+
+		paths = split(process_.stdout_string(), "\r\n");
+	}
+
+	files.reserve(paths->size());
+
+	for (auto&& p : *paths)
+	{
+		const fs::path rp = utf8_to_utf16(p);
+
+		// the index can have files that were deleted from the working tree
+		if (fs::is_regular_file(root_ / rp))
+			files.push_back(rp);
+	}
+
+	return files;
 }
 
-bool git::branch_exists()
+bool git::is_repo()
+{
+	const auto gd = git_dir(root_);
+	return (!gd.empty() && fs::exists(gd / "HEAD"));
+}
+
+std::string git::ls_remote()
 {
+	const std::string ref = "refs/heads/" + branch_;
+
 	process_ = make_process()
 		.flags(process::allow_failure)
+		.stdout_flags(process::keep_in_string)
 		.arg("ls-remote")
 		.arg("--exit-code")
 		.arg("--heads")
 		.arg(url_)
-		.arg(branch_);
+		.arg(ref);
 
-	return (execute_and_join() == 0);
+	if (execute_and_join() != 0)
+		return {};
+
+	// patterns match the end of refs, so this could also give
+	// refs/heads/something/branch
+	for (auto&& line : split(process_.stdout_string(), "\r\n"))
+	{
+		const auto cs = split(line, " \t");
+
+		if (cs.size() == 2 && cs[1] == ref)
+			return cs[0];
+	}
+
+	return {};
 }
 
 bool git::has_uncommitted_changes()
@@ -541,8 +1480,62 @@ bool git::has_uncommitted_changes()
 	return (process_.stdout_string() != "");
 }
 
+bool git::differs_from(const std::string& rev)
+{
+	// exits with 1 when there are differences and 128 when the revision
+	// doesn't exist, which is also a change as far as the callers are
+	// concerned
+	process_ = make_process()
+		.stderr_level(context::level::trace)
+		.flags(process::allow_failure)
+		.arg("diff")
+		.arg("--quiet")
+		.arg(rev)
+		.arg("--")
+		.cwd(root_);
+
+	execute_and_join();
+
+	return (exit_code() != 0);
+}
+
+std::string git::rev_parse_head()
+{
+	const auto gd = git_dir(root_);
+
+	if (!gd.empty())
+	{
+		// HEAD is either a hash when detached or a ref to a branch
+		const std::string head = first_line(gd / "HEAD");
+
+		if (is_hash(head))
+			return head;
+
+		if (head.starts_with("ref:"))
+		{
+			const auto h = resolve_ref(gd, trim_copy(head.substr(4)));
+			if (!h.empty())
+				return h;
+		}
+	}
+
+	process_ = make_process()
+		.stdout_flags(process::keep_in_string)
+		.arg("rev-parse")
+		.arg("HEAD")
+		.cwd(root_);
+
+	execute_and_join();
+
+	return trim_copy(process_.stdout_string());
+}
+
 bool git::has_stashed_changes()
 {
+	const auto gd = git_dir(root_);
+	if (!gd.empty())
+		return !resolve_ref(gd, "refs/stash").empty();
+
 	process_ = make_process()
 		.flags(process::allow_failure)
 		.stderr_level(context::level::trace)
@@ -686,19 +1679,13 @@ void git_submodule_adder::process()
 	cx_.trace(context::generic,
 		"git_submodule_adder: woke up, {} to process", v.size());
 
-	for (auto&& g : v)
-	{
-		instrument<times::add_submodule>([&]
-		{
-			cx_.trace(context::generic,
-				"git_submodule_adder: running {}", g.submodule_name());
-
-			g.run(cx_);
-		});
+	if (v.empty() || quit_)
+		return;
 
-		if (quit_)
-			break;
-	}
+	instrument<times::add_submodule>([&]
+	{
+		git::add_submodules(cx_, std::move(v));
+	});
 }
 
 }	// namespace
@@ -6,7 +6,8 @@ namespace mob
 {
 
 jom::jom()
-	: basic_process_runner("jom"), arch_(arch::def)
+	: basic_process_runner("jom"),
+		flags_(noflags), arch_(arch::def), max_jobs_(0)
 {
 }
 
@@ -45,6 +46,18 @@ jom& jom::architecture(arch a)
 	return *this;
 }
 
+jom& jom::max_jobs(std::size_t n)
+{
+	max_jobs_ = n;
+	return *this;
+}
+
+jom& jom::env(const mob::env& e)
+{
+	env_ = e;
+	return *this;
+}
+
 int jom::result() const
 {
 	return exit_code();
@@ -74,13 +87,15 @@ void jom::do_run()
 		.arg("/W", process::log_dump)
 		.arg("/K");
 
-	if (flags_ & single_job)
-		process_.arg("/J", "1");
+	// held until jom exits
+	const auto jobs = lease_jobs((flags_ & single_job) ? 1 : max_jobs_);
+
+	process_.arg("/J", std::to_string(jobs.count()));
 
 	process_
 		.arg(target_)
 		.flags(pflags)
-		.env(env::vs(arch_));
+		.env(env_ ? *env_ : mob::env::vs(arch_));
 
 	execute_and_join();
 }
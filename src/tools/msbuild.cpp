@@ -5,9 +5,14 @@
 namespace mob
 {
 
+static std::mutex g_perf_mutex;
+static std::vector<msbuild::perf_entry> g_perf;
+
+
 msbuild::msbuild(ops o) :
 	basic_process_runner("msbuild"),
-	op_(o), config_("Release"), arch_(arch::def), flags_(noflags)
+	op_(o), config_("Release"), arch_(arch::def), flags_(noflags),
+	max_jobs_(0)
 {
 }
 
@@ -58,12 +63,24 @@ msbuild& msbuild::flags(flags_t f)
 	return *this;
 }
 
+msbuild& msbuild::max_jobs(std::size_t n)
+{
+	max_jobs_ = n;
+	return *this;
+}
+
 msbuild& msbuild::prepend_path(const fs::path& p)
 {
 	prepend_path_.push_back(p);
 	return *this;
 }
 
+msbuild& msbuild::project_owners(owner_fun f)
+{
+	owners_ = std::move(f);
+	return *this;
+}
+
 int msbuild::result() const
 {
 	return exit_code();
@@ -126,7 +143,9 @@ void msbuild::do_run(const std::vector<std::string>& targets)
 		plat = platform_;
 	}
 
-	process::flags_t pflags = process::noflags;
+	// the nodes stay around for the next msbuild, they're killed after the
+	// build, see build_command::terminate_msbuild()
+	process::flags_t pflags = process::keep_leftovers;
 
 	if (is_set(flags_, allow_failure))
 	{
@@ -145,12 +164,18 @@ void msbuild::do_run(const std::vector<std::string>& targets)
 		.stderr_encoding(encodings::utf8)
 		.arg("-nologo");
 
+	// held until msbuild exits
+	const auto jobs = lease_jobs(is_set(flags_, single_job) ? 1 : max_jobs_);
+
 	if (!is_set(flags_, single_job))
 	{
+		// UseMultiToolTask schedules cl.exe across projects, CL_MPCount is
+		// the number of processes it's allowed to spawn
 		process_
-			.arg("-maxCpuCount")
+			.arg("-maxCpuCount:" + std::to_string(jobs.count()))
 			.arg("-property:UseMultiToolTask=true")
-			.arg("-property:EnforceProcessCountAcrossBuilds=true");
+			.arg("-property:EnforceProcessCountAcrossBuilds=true")
+			.arg("-property:CL_MPCount=" + std::to_string(jobs.count()));
 	}
 
 	process_
@@ -164,6 +189,62 @@ void msbuild::do_run(const std::vector<std::string>& targets)
 	if (!targets.empty())
 		process_.arg("-target:" + mob::join(targets, ";"));
 
+	// the clean op doesn't need it
+	const bool logs = (conf::msbuild_logs() && op_ == build);
+	const bool summary = (logs || (owners_ && op_ == build));
+	fs::path perf_file;
+
+	if (summary)
+	{
+		op::create_directories(cx(), log_file(targets, "").parent_path());
+
+		perf_file = log_file(targets, ".perf.log");
+
+		// the file logger only gets the summary, the binlog has everything
+		if (logs)
+		{
+			process_.arg(
+				"-binaryLogger:", log_file(targets, ".binlog"), process::quote);
+		}
+
+		process_
+			.arg("-fileLogger")
+			.arg(
+				"-fileLoggerParameters:PerformanceSummary;Verbosity=quiet;"
+				"LogFile=", perf_file, process::quote);
+	}
+
+	switch (compiler_cache::kind())
+	{
+		case compiler_cache::buildcache:
+		{
+			// file tracking would record buildcache instead of the files
+			// opened by cl.exe and rebuild everything every time
+			const auto cc = compiler_cache::binary();
+
+			process_
+				.arg("-property:CLToolExe=", cc.filename(), process::quote)
+				.arg("-property:CLToolPath=", cc.parent_path(), process::quote)
+				.arg("-property:TrackFileAccess=false");
+
+			break;
+		}
+
+		case compiler_cache::sccache:
+		{
+			// sccache wants the compiler as its first argument, which the CL
+			// task can't do
+			cx().trace(context::generic,
+				"sccache can't replace cl.exe in msbuild, not using it");
+
+			break;
+		}
+
+		case compiler_cache::none:
+		default:
+			break;
+	}
+
 	for (auto&& p : params_)
 		process_.arg("-property:" + p);
 
@@ -179,6 +260,9 @@ void msbuild::do_run(const std::vector<std::string>& targets)
 		.env(e);
 
 	execute_and_join();
+
+	if (summary && !conf::dry())
+		read_perf_summary(perf_file);
 }
 
 void msbuild::do_clean()
@@ -187,6 +271,119 @@ void msbuild::do_clean()
 	do_run(map(targets_, [&](auto&& t){ return t + ":Clean"; }));
 }
 
+std::vector<msbuild::perf_entry> msbuild::perf()
+{
+	std::scoped_lock lock(g_perf_mutex);
+	return g_perf;
+}
+
+fs::path msbuild::log_file(
+	const std::vector<std::string>& targets, const std::string& ext) const
+{
+	std::string name = path_to_utf8(sln_.stem());
+
+	if (!targets.empty())
+		name += "-" + mob::join(targets, "-");
+
+	for (auto& c : name)
+	{
+		if (c == ':' || c == '\\' || c == '/' || c == ';' || c == ' ')
+			c = '_';
+	}
+
+	name += ext;
+
+	return sln_.parent_path() / ".mob-msbuild" / utf8_to_utf16(name);
+}
+
+void msbuild::read_perf_summary(const fs::path& file)
+{
+	if (!fs::exists(file))
+	{
+		cx().debug(context::generic, "no performance summary in {}", file);
+		return;
+	}
+
+	const auto text = op::read_text_file(cx(), encodings::dont_know, file);
+
+	// "    1234 ms  C:\path\project.vcxproj    2 calls"
+	static std::regex re(R"(^(\s*)(\d+) ms\s+(.+?)\s+(\d+) calls\s*$)");
+
+	std::vector<perf_entry> v;
+	std::string kind;
+
+	// project lines are followed by one more indented line per call, only
+	// the first level is kept
+	std::size_t indent = std::string::npos;
+
+	for_each_line(text, [&](std::string_view line)
+	{
+		if (line.find("Project Performance Summary:") != std::string::npos)
+		{
+			kind = "project";
+			indent = std::string::npos;
+			return;
+		}
+
+		if (line.find("Target Performance Summary:") != std::string::npos)
+		{
+			kind = "target";
+			indent = std::string::npos;
+			return;
+		}
+
+		if (line.find("Performance Summary:") != std::string::npos)
+		{
+			// tasks, etc.
+			kind.clear();
+			return;
+		}
+
+		if (kind.empty())
+			return;
+
+		std::match_results<std::string_view::const_iterator> m;
+		if (!std::regex_match(line.begin(), line.end(), m, re))
+			return;
+
+		const std::size_t this_indent = static_cast<std::size_t>(m[1].length());
+
+		if (indent == std::string::npos)
+			indent = this_indent;
+		else if (this_indent > indent)
+			return;
+
+		try
+		{
+			perf_entry e;
+			e.task = cx().task_name();
+			e.kind = kind;
+			e.name = m[3].str();
+
+			if (owners_ && kind == "project")
+			{
+				const auto owner = owners_(fs::path(utf8_to_utf16(e.name)));
+				if (!owner.empty())
+					e.task = owner;
+			}
+			e.time = std::chrono::milliseconds(std::stoull(m[2].str()));
+			e.calls = std::stoul(m[4].str());
+
+			v.push_back(std::move(e));
+		}
+		catch(std::exception&)
+		{
+			// not a number, ignore
+		}
+	});
+
+	cx().debug(context::generic,
+		"{} projects and targets in performance summary {}", v.size(), file);
+
+	std::scoped_lock lock(g_perf_mutex);
+	g_perf.insert(g_perf.end(), v.begin(), v.end());
+}
+
 void msbuild::error_filter(process::filter& f) const
 {
 	// ": error C2065"
@@ -0,0 +1,122 @@
+#include "pch.h"
+#include "tools.h"
+#include "../conf.h"
+
+namespace mob
+{
+
+ninja::ninja(ops o) :
+	basic_process_runner("ninja"),
+	op_(o), flags_(noflags), arch_(arch::def)
+{
+}
+
+fs::path ninja::binary()
+{
+	return conf::tool_by_name("ninja");
+}
+
+ninja& ninja::path(const fs::path& p)
+{
+	path_ = p;
+	return *this;
+}
+
+ninja& ninja::target(const std::string& s)
+{
+	target_ = s;
+	return *this;
+}
+
+ninja& ninja::flag(flags_t f)
+{
+	flags_ = f;
+	return *this;
+}
+
+ninja& ninja::architecture(arch a)
+{
+	arch_ = a;
+	return *this;
+}
+
+int ninja::result() const
+{
+	return exit_code();
+}
+
+void ninja::do_run()
+{
+	process::flags_t pflags = process::terminate_on_interrupt;
+
+	if (is_set(flags_, allow_failure) || op_ == clean)
+	{
+		process_.stderr_level(context::level::trace);
+		pflags |= process::allow_failure;
+	}
+
+	process_
+		.binary(binary())
+		.stdout_encoding(encodings::utf8)
+		.stderr_encoding(encodings::utf8)
+		.stdout_filter([](process::filter& f)
+		{
+			// "FAILED: foo.obj" and compiler errors, everything else is the
+			// progress of each edge
+			if (f.line.find("FAILED:") == 0)
+				f.lv = context::level::error;
+			else if (f.line.find(": error ") != std::string::npos)
+				f.lv = context::level::error;
+		})
+		.arg("-C", path_)
+		.flags(pflags)
+		.env(env::vs(arch_));
+
+	switch (op_)
+	{
+		case clean:
+		{
+			do_clean();
+			break;
+		}
+
+		case build:
+		{
+			do_build();
+			break;
+		}
+
+		default:
+		{
+			cx().bail_out(context::generic, "bad ninja op {}", op_);
+		}
+	}
+}
+
+void ninja::do_build()
+{
+	// held until ninja exits
+	const auto jobs = lease_jobs(is_set(flags_, single_job) ? 1 : 0);
+
+	process_.arg("-j", std::to_string(jobs.count()));
+
+	if (!target_.empty())
+		process_.arg(target_);
+
+	execute_and_join();
+}
+
+void ninja::do_clean()
+{
+	if (!fs::exists(path_ / "build.ninja"))
+	{
+		cx().trace(context::rebuild,
+			"no build.ninja in {}, nothing to clean", path_);
+		return;
+	}
+
+	process_.arg("-t", "clean");
+	execute_and_join();
+}
+
+}	// namespace
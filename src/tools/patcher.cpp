@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "tools.h"
+#include "../utility.h"
 #include "../conf.h"
 
 namespace mob
@@ -100,6 +101,125 @@ void patcher::do_run()
 	}
 }
 
+// files changed by a unified diff, from the `+++` lines, relative to the
+// directory the patch is applied in
+//
+static std::vector<fs::path> patch_targets(const fs::path& patch_file)
+{
+	std::vector<fs::path> v;
+
+	std::ifstream in(patch_file, std::ios::binary);
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		if (!line.starts_with("+++ "))
+			continue;
+
+		// the filename is followed by a tab and a date
+		auto name = trim_copy(line.substr(4, line.find('\t') - 4));
+		if (name.empty() || name == "/dev/null")
+			continue;
+
+		v.push_back(utf8_to_utf16(name));
+	}
+
+	return v;
+}
+
+static std::uint64_t stamp_time(const fs::path& p)
+{
+	std::error_code ec;
+	const auto t = fs::last_write_time(p, ec);
+
+	if (ec)
+		return 0;
+
+	return static_cast<std::uint64_t>(t.time_since_epoch().count());
+}
+
+// one line with the hash of the patch file, followed by a line per target
+// file with its size, time and hash after the patch was applied
+//
+static std::string make_patch_stamp(
+	const fs::path& patch_file, const fs::path& root)
+{
+	std::string s = hash_file(patch_file) + "\n";
+
+	for (auto&& t : patch_targets(patch_file))
+	{
+		const auto p = root / t;
+
+		std::error_code ec;
+		const auto size = fs::file_size(p, ec);
+
+		s +=
+			path_to_utf8(t) + "\t" +
+			std::to_string(ec ? 0 : size) + "\t" +
+			std::to_string(stamp_time(p)) + "\t" +
+			hash_file(p) + "\n";
+	}
+
+	return s;
+}
+
+fs::path patcher::stamp_file(const fs::path& patch_file) const
+{
+	return output_ / ".mob-patches" /
+		(path_to_utf8(patch_file.filename()) + ".txt");
+}
+
+bool patcher::stamp_matches(const fs::path& patch_file) const
+{
+	std::ifstream in(stamp_file(patch_file), std::ios::binary);
+	if (!in)
+		return false;
+
+	std::string line;
+	if (!std::getline(in, line) || line != hash_file(patch_file))
+		return false;
+
+	std::size_t count = 0;
+
+	while (std::getline(in, line))
+	{
+		const auto cs = split(line, "\t");
+		if (cs.size() != 4)
+			return false;
+
+		const auto p = output_ / utf8_to_utf16(cs[0]);
+
+		std::error_code ec;
+		const auto size = fs::file_size(p, ec);
+
+		if (ec || std::to_string(size) != cs[1])
+			return false;
+
+		// a touched file still matches if it has the same contents
+		if (std::to_string(stamp_time(p)) != cs[2] && hash_file(p) != cs[3])
+			return false;
+
+		++count;
+	}
+
+	// a stamp without targets would always match
+	return (count > 0);
+}
+
+void patcher::write_stamp(const fs::path& patch_file)
+{
+	if (conf::dry())
+		return;
+
+	const auto f = stamp_file(patch_file);
+
+	std::error_code ec;
+	fs::create_directories(f.parent_path(), ec);
+
+	std::ofstream out(f, std::ios::binary);
+	out << make_patch_stamp(patch_file, output_);
+}
+
 void patcher::do_patch(const fs::path& patch_file)
 {
 	const auto base = process()
@@ -123,6 +243,14 @@ void patcher::do_patch(const fs::path& patch_file)
 
 	cx().trace(context::generic, "trying to patch using {}", patch_file);
 
+	if (stamp_matches(patch_file))
+	{
+		cx().trace(context::bypass,
+			"patch {} already applied, stamp matches", patch_file);
+
+		return;
+	}
+
 	{
 		// check
 
@@ -137,6 +265,7 @@ void patcher::do_patch(const fs::path& patch_file)
 			cx().trace(context::generic,
 				"patch {} already applied", patch_file);
 
+			write_stamp(patch_file);
 			return;
 		}
 		else if (ret == 1)
@@ -156,6 +285,8 @@ void patcher::do_patch(const fs::path& patch_file)
 		cx().trace(context::generic, "applying patch {}", patch_file);
 		process_ = apply;
 		execute_and_join();
+
+		write_stamp(patch_file);
 	}
 }
 
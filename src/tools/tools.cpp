@@ -53,6 +53,9 @@ void tool::interrupt()
 		cx().debug(context::interruption, "interrupting {}", name_);
 		interrupted_ = true;
 		do_interrupt();
+
+		// in case it's waiting in lease_jobs()
+		job_slots::instance().wake_all();
 	}
 }
 
@@ -61,6 +64,28 @@ bool tool::interrupted() const
 	return interrupted_;
 }
 
+job_lease tool::lease_jobs(std::size_t want) const
+{
+	auto& js = job_slots::instance();
+
+	auto lease = js.lease(want, [&]{ return interrupted(); });
+
+	// the tool can't run without slots, and returning would look like it
+	// succeeded; tool::interrupted() hides the class
+	if (lease.count() == 0)
+	{
+		cx().debug(context::interruption,
+			"{} interrupted while waiting for job slots", name_);
+
+		throw mob::interrupted();
+	}
+
+	cx().debug(context::generic,
+		"leased {}/{} job slots", lease.count(), js.total());
+
+	return lease;
+}
+
 const context& tool::cx() const
 {
 	if (cx_)
@@ -101,6 +126,222 @@ std::string qt::vs_version()
 }
 
 
+static std::mutex g_compiler_cache_mutex;
+static std::vector<compiler_cache::task_entry> g_compiler_cache_tasks;
+
+// number of tasks currently in a measure and how many have started one, see
+// measure::shared_
+static std::atomic<std::size_t> g_compiler_cache_building = 0;
+static std::atomic<std::uint64_t> g_compiler_cache_epoch = 0;
+
+compiler_cache::measure::measure(const context& cx, std::string task)
+	: cx_(cx), task_(std::move(task))
+{
+	if (kind() == none)
+	{
+		done_ = true;
+		return;
+	}
+
+	shared_ = (g_compiler_cache_building++ > 0);
+	epoch_ = ++g_compiler_cache_epoch;
+	before_ = stats(cx_);
+}
+
+compiler_cache::measure::~measure()
+{
+	if (!done_)
+		--g_compiler_cache_building;
+}
+
+void compiler_cache::measure::finish()
+{
+	if (done_)
+		return;
+
+	done_ = true;
+	--g_compiler_cache_building;
+
+	// another task started while this one was building
+	if (g_compiler_cache_epoch != epoch_)
+		shared_ = true;
+
+	const auto after = stats(cx_);
+	if (!before_ || !after)
+		return;
+
+	task_entry e;
+	e.task = task_;
+	e.shared = shared_;
+
+	// the counters go back to 0 if the server is restarted
+	if (after->hits >= before_->hits && after->misses >= before_->misses)
+	{
+		e.counts.hits = after->hits - before_->hits;
+		e.counts.misses = after->misses - before_->misses;
+	}
+
+	cx_.debug(context::generic,
+		"compiler cache: {} hits, {} misses{}",
+		e.counts.hits, e.counts.misses,
+		(e.shared ? " (shared with other tasks)" : ""));
+
+	std::scoped_lock lock(g_compiler_cache_mutex);
+	g_compiler_cache_tasks.push_back(std::move(e));
+}
+
+compiler_cache::kinds compiler_cache::kind()
+{
+	const auto s = conf::compiler_cache();
+	if (s.empty())
+		return none;
+
+	const auto name = path_to_utf8(fs::path(s).stem());
+
+	if (_stricmp(name.c_str(), "sccache") == 0)
+		return sccache;
+	else if (_stricmp(name.c_str(), "buildcache") == 0)
+		return buildcache;
+
+	gcx().bail_out(context::conf,
+		"compiler_cache must be sccache or buildcache, not '{}'", s);
+}
+
+fs::path compiler_cache::binary()
+{
+	static const fs::path p = []
+	{
+		const fs::path s = conf::compiler_cache();
+
+		if (s.is_absolute())
+		{
+			if (!fs::exists(s))
+				gcx().bail_out(context::conf, "compiler cache {} not found", s);
+
+			return s;
+		}
+
+		auto exe = s;
+		if (!exe.has_extension())
+			exe += ".exe";
+
+		const auto found = find_in_path(path_to_utf8(exe));
+		if (found.empty())
+			gcx().bail_out(context::conf, "compiler cache {} not found", exe);
+
+		return found;
+	}();
+
+	return p;
+}
+
+void compiler_cache::set_env(env& e)
+{
+	const auto dir = conf::compiler_cache_dir();
+
+	switch (kind())
+	{
+		case sccache:
+		{
+			if (!dir.empty())
+				e.set("SCCACHE_DIR", dir);
+
+			break;
+		}
+
+		case buildcache:
+		{
+			if (!dir.empty())
+				e.set("BUILDCACHE_DIR", dir);
+
+			// msbuild runs buildcache.exe instead of cl.exe, it has no way of
+			// knowing which compiler it's replacing
+			e.set("BUILDCACHE_IMPERSONATE", "cl.exe");
+			break;
+		}
+
+		case none:
+		default:
+			break;
+	}
+}
+
+std::optional<cache_stats::counts> compiler_cache::stats(const context& cx)
+{
+	const auto k = kind();
+	if (k == none)
+		return {};
+
+	env e = env::vs(arch::def);
+
+	auto p = process()
+		.set_context(&cx)
+		.binary(binary())
+		.arg(k == sccache ? "--show-stats" : "-s")
+		.stdout_flags(process::keep_in_string)
+		.stdout_encoding(encodings::utf8)
+		.stderr_level(context::level::trace)
+		.flags(process::allow_failure)
+		.env(e);
+
+	p.run();
+	p.join();
+
+	if (p.exit_code() != 0)
+	{
+		cx.warning(context::generic,
+			"can't get compiler cache stats, {} exited with {}",
+			binary(), p.exit_code());
+
+		return {};
+	}
+
+	// sccache has "Cache hits" and "Cache misses", buildcache has hits for
+	// the local and remote caches and a total for misses; the longer lines
+	// like "Cache hits (C/C++)" in newer versions of sccache are ignored
+	static const std::regex re(
+		R"(^\s*(Cache hits|Cache misses|Local hits|Remote hits|Misses):?\s+(\d+))");
+
+	cache_stats::counts c;
+	bool found = false;
+
+	for_each_line(p.stdout_string(), [&](auto&& line)
+	{
+		const std::string s(line);
+		std::smatch m;
+
+		if (!std::regex_search(s, m, re))
+			return;
+
+		const std::string what = m[1];
+		const auto n = std::stoull(m[2]);
+
+		if (what == "Cache misses" || what == "Misses")
+			c.misses += n;
+		else
+			c.hits += n;
+
+		found = true;
+	});
+
+	if (!found)
+	{
+		cx.warning(context::generic,
+			"no hits or misses in the output of {}", binary());
+
+		return {};
+	}
+
+	return c;
+}
+
+std::vector<compiler_cache::task_entry> compiler_cache::tasks()
+{
+	std::scoped_lock lock(g_compiler_cache_mutex);
+	return g_compiler_cache_tasks;
+}
+
+
 vs::vs(ops o)
 	: basic_process_runner("vs"), op_(o)
 {
@@ -169,6 +410,14 @@ void vs::do_run()
 	}
 }
 
+// lists the files in a directory of cache/vs_upgrade/, relative to the
+// directory of the solution; written last
+//
+static fs::path upgrade_manifest(const fs::path& dir)
+{
+	return dir / "mob_upgrade.txt";
+}
+
 void vs::do_upgrade()
 {
 	if (fs::exists(sln_.parent_path() / "UpgradeLog.htm"))
@@ -177,6 +426,18 @@ void vs::do_upgrade()
 		return;
 	}
 
+	fs::path cache_dir;
+	std::vector<fs::path> files;
+
+	if (conf::upgrade_cache() && !conf::dry())
+	{
+		files = upgraded_files();
+		cache_dir = upgrade_cache_dir(files);
+
+		if (restore_upgrade(cache_dir))
+			return;
+	}
+
 	process_
 		.binary(devenv_binary())
 		.env(env::vs(arch::x64))
@@ -184,8 +445,156 @@ void vs::do_upgrade()
 		.arg(sln_);
 
 	execute_and_join();
+
+	if (!cache_dir.empty())
+		save_upgrade(cache_dir, files);
 }
 
+std::vector<fs::path> vs::upgraded_files() const
+{
+	// Project("{8BC9CEB8-...}") = "name", "dir\name.vcxproj", "{...}"
+	static const std::regex re(
+		R"(^Project\("[^"]*"\)\s*=\s*"[^"]*"\s*,\s*"([^"]+)")");
+
+	std::vector<fs::path> v = {sln_};
+
+	const auto text = op::read_text_file(cx(), encodings::utf8, sln_);
+
+	for_each_line(text, [&](auto&& line)
+	{
+		const std::string s(line);
+		std::smatch m;
+
+		if (!std::regex_search(s, m, re))
+			return;
+
+		// solution folders have the same syntax, they're not files
+		const fs::path p = sln_.parent_path() / utf8_to_utf16(m[1].str());
+		if (!fs::is_regular_file(p))
+			return;
+
+		v.push_back(p);
+
+		fs::path filters = p;
+		filters += ".filters";
+
+		if (fs::exists(filters))
+			v.push_back(filters);
+	});
+
+	return v;
+}
+
+fs::path vs::upgrade_cache_dir(const std::vector<fs::path>& files) const
+{
+	std::string key =
+		path_to_utf8(devenv_binary()) + "\n" +
+		vs::version() + "\n" +
+		vs::toolset() + "\n" +
+		vs::sdk() + "\n";
+
+	for (auto&& f : files)
+	{
+		key +=
+			path_to_utf8(f.lexically_relative(sln_.parent_path())) + " " +
+			hash_file(f) + "\n";
+	}
+
+	const auto name = path_to_utf8(sln_.stem()) + "-" + hash_string(key);
+	return paths::cache() / "vs_upgrade" / name;
+}
+
+bool vs::restore_upgrade(const fs::path& dir)
+{
+	const auto manifest = upgrade_manifest(dir);
+
+	if (!fs::exists(manifest))
+	{
+		cx().trace(context::generic, "no cached upgrade in {}", dir);
+		return false;
+	}
+
+	const auto text = op::read_text_file(
+		cx(), encodings::utf8, manifest, op::optional);
+
+	std::vector<fs::path> rels;
+
+	for_each_line(text, [&](auto&& line)
+	{
+		rels.push_back(utf8_to_utf16(std::string(line)));
+	});
+
+	for (auto&& r : rels)
+	{
+		if (!fs::exists(dir / r))
+		{
+			cx().debug(context::generic,
+				"cached upgrade in {} is missing {}, ignoring", dir, r);
+
+			return false;
+		}
+	}
+
+	cx().debug(context::generic,
+		"restoring {} upgraded files for {} from {}", rels.size(), sln_, dir);
+
+	for (auto&& r : rels)
+	{
+		const auto dest = sln_.parent_path() / r;
+
+		// the cached file can be older than the one that was extracted
+		op::delete_file(cx(), dest, op::optional);
+		op::copy_file_to_file_if_better(cx(), dir / r, dest);
+	}
+
+	return true;
+}
+
+void vs::save_upgrade(
+	const fs::path& dir, const std::vector<fs::path>& files)
+{
+	// the log is what's checked by do_upgrade() next time
+	auto v = files;
+	v.push_back(sln_.parent_path() / "UpgradeLog.htm");
+
+	std::string manifest;
+
+	for (auto&& f : v)
+	{
+		const auto rel = f.lexically_relative(sln_.parent_path());
+
+		if (rel.empty() || *rel.begin() == "..")
+		{
+			cx().debug(context::generic,
+				"{} is outside the solution directory, not caching the "
+				"upgrade", f);
+
+			return;
+		}
+
+		if (!fs::exists(f))
+			continue;
+
+		manifest += path_to_utf8(rel) + "\n";
+	}
+
+	cx().debug(context::generic, "caching upgraded {} in {}", sln_, dir);
+
+	op::delete_directory(cx(), dir, op::optional);
+
+	for (auto&& line : split(manifest, "\n"))
+	{
+		const fs::path rel = utf8_to_utf16(line);
+
+		op::create_directories(cx(), (dir / rel).parent_path());
+		op::copy_file_to_file_if_better(
+			cx(), sln_.parent_path() / rel, dir / rel);
+	}
+
+	// written last, a directory without a manifest is ignored
+	op::write_text_file(
+		cx(), encodings::utf8, upgrade_manifest(dir), manifest);
+}
 
 nuget::nuget(fs::path sln)
 	: basic_process_runner("nuget"), sln_(std::move(sln))
@@ -231,35 +640,192 @@ pip_install& pip_install::file(const fs::path& p)
 	return *this;
 }
 
+fs::path pip_install::wheelhouse()
+{
+	return paths::cache() / "wheels";
+}
+
+// lines of "filename sha256" for every file downloaded for a package
+//
+static fs::path wheels_manifest(const fs::path& dir)
+{
+	return dir / "mob_wheels.txt";
+}
+
+static std::string file_sha256(const fs::path& p)
+{
+	sha256 h;
+	if (!h.update_from_file(p))
+		return {};
+
+	return h.finish();
+}
+
 void pip_install::do_run()
 {
+	if (package_.empty() || !conf::wheel_cache())
+	{
+		process_ = make_pip_process("install");
+		process_.arg("--no-warn-script-location");
+
+		if (!package_.empty())
+			process_.arg(package_ + "==" + version_);
+		else if (!file_.empty())
+			process_.arg(file_);
+
+		execute_and_join();
+		return;
+	}
+
+	const auto dir = wheelhouse() / (package_ + "-" + version_);
+
+	if (!check_wheels(dir))
+		download_wheels(dir);
+
+	// only the wheels for this version are looked at, so it doesn't matter
+	// what else is in the wheelhouse or on PyPI
+	process_ = make_pip_process("install");
+
 	process_
+		.arg("--no-warn-script-location")
+		.arg("--no-index")
+		.arg("--find-links", dir)
+		.arg(package_ + "==" + version_);
+
+	execute_and_join();
+}
+
+process pip_install::make_pip_process(const std::string& command) const
+{
+	return process()
 		.binary(python::python_exe())
 		.chcp(65001)
 		.stdout_encoding(encodings::utf8)
 		.stderr_encoding(encodings::utf8)
 		.arg("-X", "utf8")
 		.arg("-m", "pip")
-		.arg("install")
-		.arg("--no-warn-script-location")
-		.arg("--disable-pip-version-check");
+		.arg(command)
+		.arg("--disable-pip-version-check")
+		.env(this_env::get()
+			.set("PYTHONUTF8", "1"));
+}
+
+bool pip_install::check_wheels(const fs::path& dir) const
+{
+	const auto manifest = wheels_manifest(dir);
+
+	if (!fs::exists(manifest))
+	{
+		cx().debug(context::generic,
+			"no wheels for {}=={} in {}", package_, version_, dir);
+
+		return false;
+	}
 
-	if (!package_.empty())
-		process_.arg(package_ + "==" + version_);
-	else if (!file_.empty())
-		process_.arg(file_);
+	const auto text = op::read_text_file(
+		cx(), encodings::utf8, manifest, op::optional);
+
+	bool ok = true;
+	std::size_t count = 0;
+
+	for_each_line(text, [&](auto&& line)
+	{
+		if (!ok)
+			return;
+
+		const auto cs = split(std::string(line), " ");
+		if (cs.size() != 2)
+			return;
+
+		++count;
+
+		const auto file = dir / utf8_to_utf16(cs[0]);
+		const auto hash = file_sha256(file);
+
+		if (hash != cs[1])
+		{
+			cx().warning(context::generic,
+				"wheel {} is missing or its hash has changed, "
+				"downloading again", file);
+
+			ok = false;
+		}
+	});
+
+	if (ok && count == 0)
+	{
+		cx().debug(context::generic, "wheel manifest {} is empty", manifest);
+		ok = false;
+	}
+
+	if (ok)
+	{
+		cx().debug(context::generic,
+			"using {} cached wheels for {}=={}", count, package_, version_);
+	}
+
+	return ok;
+}
+
+void pip_install::download_wheels(const fs::path& dir)
+{
+	// anything left over from an interrupted download or a bad hash
+	op::delete_directory(cx(), dir, op::optional);
+	op::create_directories(cx(), dir);
+
+	cx().info(context::generic,
+		"downloading wheels for {}=={} into {}", package_, version_, dir);
+
+	process_ = make_pip_process("download");
 
 	process_
-		.env(this_env::get()
-			.set("PYTHONUTF8", "1"));
+		.arg("--dest", dir)
+		.arg(package_ + "==" + version_);
 
 	execute_and_join();
-}
 
+	if (conf::dry())
+		return;
+
+	std::string out;
+
+	for (auto&& e : fs::directory_iterator(dir))
+	{
+		if (!e.is_regular_file())
+			continue;
+
+		const auto name = path_to_utf8(e.path().filename());
+		const auto hash = file_sha256(e.path());
+
+		if (hash.empty())
+			cx().bail_out(context::generic, "can't read {}", e.path());
+
+		const auto expected = conf::expected_sha256(name);
+
+		if (!expected.empty() && hash != expected)
+		{
+			// not kept, or it would be installed by a later run that
+			// trusts the manifest
+			op::delete_directory(cx(), dir, op::optional);
+
+			cx().bail_out(context::generic,
+				"sha256 mismatch for {}, expected {}, got {}",
+				name, expected, hash);
+		}
+
+		cx().trace(context::generic, "wheel {} {}", name, hash);
+		out += name + " " + hash + "\n";
+	}
+
+	// written last, a directory without a manifest is downloaded again
+	op::write_text_file(
+		cx(), encodings::utf8, wheels_manifest(dir), out);
+}
 
 transifex::transifex(ops o) :
 	basic_process_runner("transifex"), op_(o),
-	stdout_(context::level::trace), min_(100), force_(false)
+	stdout_(context::level::trace), min_(100), force_(false), workers_(1),
+	pulls_(new pulls)
 {
 }
 
@@ -304,6 +870,50 @@ transifex& transifex::force(bool b)
 	return *this;
 }
 
+transifex& transifex::workers(std::size_t n)
+{
+	workers_ = std::max<std::size_t>(n, 1);
+	return *this;
+}
+
+std::vector<std::string> transifex::resources(const fs::path& root)
+{
+	const auto file = root / ".tx" / "config";
+	if (!fs::exists(file))
+		return {};
+
+	const auto text = op::read_text_file(gcx(), encodings::utf8, file);
+
+	// every section but [main] is a resource, like
+	// [mod-organizer-2.uibase] or [o:org:p:project:r:resource]
+	std::vector<std::string> v;
+
+	for_each_line(text, [&](auto&& line)
+	{
+		const auto s = trim_copy(line);
+
+		if (s.size() < 3 || s.front() != '[' || s.back() != ']')
+			return;
+
+		const auto name = s.substr(1, s.size() - 2);
+		if (name != "main")
+			v.push_back(name);
+	});
+
+	return v;
+}
+
+void transifex::do_interrupt()
+{
+	basic_process_runner::do_interrupt();
+
+	std::scoped_lock lock(pulls_->mutex);
+
+	pulls_->interrupted = true;
+	for (auto* p : pulls_->v)
+		p->interrupt();
+}
+
 void transifex::do_run()
 {
 	switch (op_)
@@ -362,11 +972,11 @@ void transifex::do_config()
 	execute_and_join();
 }
 
-void transifex::do_pull()
+process transifex::make_pull_process() const
 {
-	op::create_directories(cx(), root_, op::unsafe);
-
-	process_ = process()
+	// without --force, tx only downloads the languages that are newer on the
+	// server than the local file
+	auto p = process()
 		.binary(binary())
 		.stdout_level(stdout_)
 		.arg("pull")
@@ -379,11 +989,94 @@ void transifex::do_pull()
 		.cwd(root_);
 
 	if (force_)
-		process_.arg("--force");
+		p.arg("--force");
+
+	return p;
+}
+
+void transifex::do_pull()
+{
+	op::create_directories(cx(), root_, op::unsafe);
+
+	const auto rs = resources(root_);
+
+	if (workers_ > 1 && rs.size() > 1)
+	{
+		do_parallel_pull(rs);
+		return;
+	}
 
+	process_ = make_pull_process();
 	execute_and_join();
 }
 
+void transifex::do_parallel_pull(const std::vector<std::string>& rs)
+{
+	const std::size_t count = std::min(workers_, rs.size());
+
+	cx().debug(context::generic,
+		"pulling {} resources with {} workers", rs.size(), count);
+
+	std::atomic<std::size_t> next = 0;
+	std::exception_ptr error;
+	std::mutex error_mutex;
+
+	auto worker = [&]
+	{
+		for (;;)
+		{
+			const std::size_t i = next++;
+			if (i >= rs.size())
+				break;
+
+			auto p = make_pull_process();
+			p.arg("-r", rs[i]);
+			p.set_context(&cx());
+
+			{
+				std::scoped_lock lock(pulls_->mutex);
+				if (pulls_->interrupted)
+					break;
+
+				pulls_->v.push_back(&p);
+			}
+
+			guard g([&]
+			{
+				std::scoped_lock lock(pulls_->mutex);
+				std::erase(pulls_->v, &p);
+			});
+
+			try
+			{
+				p.run();
+				p.join();
+			}
+			catch(...)
+			{
+				// the other workers stop after their current resource
+				next = rs.size();
+
+				std::scoped_lock lock(error_mutex);
+				if (!error)
+					error = std::current_exception();
+
+				break;
+			}
+		}
+	};
+
+	std::vector<std::thread> ts;
+	for (std::size_t i=0; i<count; ++i)
+		ts.push_back(start_thread(worker));
+
+	for (auto& t : ts)
+		t.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
 
 lrelease::lrelease()
 	: basic_process_runner("lrelease")
@@ -419,6 +1112,12 @@ lrelease& lrelease::out(const fs::path& dir)
 	return *this;
 }
 
+lrelease& lrelease::merge(bool b)
+{
+	merge_ = b;
+	return *this;
+}
+
 fs::path lrelease::qm_file() const
 {
 	if (sources_.empty())
@@ -436,8 +1135,6 @@ fs::path lrelease::qm_file() const
 
 void lrelease::do_run()
 {
-	const auto qm = qm_file();
-
 	process_ = process()
 		.binary(binary())
 		.arg("-silent")
@@ -453,8 +1150,8 @@ void lrelease::do_run()
 	for (auto&& s : sources_)
 		process_.arg(s);
 
-	process_
-		.arg("-qm", (out_ / qm));
+	if (merge_)
+		process_.arg("-qm", (out_ / qm_file()));
 
 	execute_and_join();
 }
@@ -31,6 +31,12 @@ protected:
 
 	bool interrupted() const;
 
+	// leases up to `want` slots from the global job budget, or a fair share
+	// if 0; throws `interrupted` if the tool was interrupted while waiting,
+	// the lease always has at least one slot
+	//
+	job_lease lease_jobs(std::size_t want=0) const;
+
 	virtual void do_run() = 0;
 	virtual void do_interrupt() = 0;
 
@@ -61,6 +67,77 @@ struct qt
 	static std::string vs_version();
 };
 
+// sccache or buildcache, see the `compiler_cache` option; cmake passes it as
+// the compiler launcher for ninja and jom, msbuild runs it instead of cl.exe
+// and env::vs() has its environment variables
+//
+struct compiler_cache
+{
+	enum kinds
+	{
+		none = 0,
+		sccache,
+		buildcache
+	};
+
+	// hits and misses during a task's build, see measure
+	//
+	struct task_entry
+	{
+		std::string task;
+		cache_stats::counts counts;
+
+		// whether another task was building at the same time; the cache
+		// keeps one set of counters for everybody, so the numbers include
+		// the other task's compilations
+		bool shared = false;
+	};
+
+	// records the counters of the cache around the build of a task, the
+	// entry is only added by finish(), not if the build failed
+	//
+	class measure
+	{
+	public:
+		measure(const context& cx, std::string task);
+		~measure();
+
+		measure(const measure&) = delete;
+		measure& operator=(const measure&) = delete;
+
+		void finish();
+
+	private:
+		const context& cx_;
+		std::string task_;
+		std::optional<cache_stats::counts> before_;
+		std::uint64_t epoch_ = 0;
+		bool shared_ = false;
+		bool done_ = false;
+	};
+
+
+	static kinds kind();
+
+	// path to the binary, bails if it can't be found
+	//
+	static fs::path binary();
+
+	// sets the cache directory, if any; for buildcache, also tells it that
+	// it's running as cl.exe for msbuild
+	//
+	static void set_env(env& e);
+
+	// current counters of the cache, empty if it's disabled or if they
+	// can't be read
+	//
+	static std::optional<cache_stats::counts> stats(const context& cx);
+
+	// all the entries added by measure::finish()
+	//
+	static std::vector<task_entry> tasks();
+};
+
 
 class downloader : public tool
 {
@@ -77,6 +154,31 @@ public:
 	downloader& url(const mob::url& u);
 	downloader& file(const fs::path& p);
 
+	// the file is written to the stream while it's being downloaded, if the
+	// stream accepts it; the stream is finished without being used if the
+	// file was already downloaded, see task::download_and_extract()
+	//
+	downloader& stream_to(std::shared_ptr<download_stream> s);
+
+	// a file that's already downloaded is downloaded again if it changed on
+	// the server, which costs a 304 round trip if it hasn't; this is always
+	// on if the `revalidate_downloads` option is set
+	//
+	// the ETag and Last-Modified headers are kept next to the file for this
+	//
+	downloader& revalidate(bool b);
+
+	// a download that fails is not an error, result() is empty instead and
+	// http errors are only logged as debug, like for optional files in a
+	// cache
+	//
+	downloader& allow_failure(bool b);
+
+	// ETag and Last-Modified of the file, see revalidate()
+	//
+	static fs::path meta_file(const fs::path& file);
+
+	const std::vector<mob::url>& urls() const;
 	fs::path result() const;
 
 protected:
@@ -88,12 +190,57 @@ private:
 	std::unique_ptr<curl_downloader> dl_;
 	fs::path file_;
 	std::vector<mob::url> urls_;
+	std::shared_ptr<download_stream> stream_;
+	bool revalidate_;
+	bool allow_failure_;
+
+	// downloads started by race(), also interrupted by do_interrupt(); on
+	// the heap so downloaders stay movable
+	struct racers
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<curl_downloader>> v;
+	};
+
+	std::unique_ptr<racers> racers_;
 
 	void do_clean();
 	void do_download();
 
+	// starts downloading the given urls at the same time, keeps the one that
+	// received the most after a short window and cancels the others; returns
+	// false if the winner failed or if they all failed
+	//
+	bool race(const std::vector<mob::url>& urls, bool shared);
+
+	// checks the hash of a completed download and adds it to the shared
+	// cache, returns false if the download failed or the hash didn't match
+	//
+	bool check_download(
+		const mob::url& u, const curl_downloader& dl,
+		const fs::path& file, bool shared);
+
+	// urls that won a previous race first, see race()
+	//
+	std::vector<mob::url> ordered_urls() const;
+
 	fs::path path_for_url(const mob::url& u) const;
-	bool try_picking(const fs::path& file);
+	bool try_picking(const mob::url& u, const fs::path& file);
+
+	// sends a conditional request for a file that's already downloaded,
+	// returns false if the file has to be downloaded normally
+	//
+	bool try_revalidating(const mob::url& u, const fs::path& file);
+
+	void write_meta(const fs::path& file, const curl_downloader& dl);
+
+	// links the file from the shared download cache, if any, see
+	// conf::shared_download_cache()
+	//
+	bool try_shared_cache(const mob::url& u, const fs::path& file);
+
+	void add_to_shared_cache(
+		const mob::url& u, const fs::path& file, const std::string& hash);
 };
 
 
@@ -180,7 +327,46 @@ public:
 		bool push_default);
 
 	static bool is_git_repo(const fs::path& p);
+
+	// registers all the given add_submodule operations with one .gitmodules
+	// write and one index update per super repo instead of one
+	// `git submodule add` each; submodules that aren't cloned yet are run
+	// on their own since `git submodule add` has to clone them
+	//
+	static void add_submodules(context& cx, std::vector<git> v);
+
+	// hash of HEAD in the given repo
+	//
+	static std::string head_commit(const fs::path& repo);
+
+	// whether the working tree has uncommitted changes
+	//
+	static bool is_dirty(const fs::path& repo);
+
+	// whether the working tree differs from the given commit, including
+	// untracked files; also true if the commit doesn't exist in the repo
+	//
+	static bool changed_since(const fs::path& repo, const std::string& rev);
+
+	// files in the index of the given repo that exist in the working tree,
+	// relative to the repo
+	//
+	static std::vector<fs::path> tracked_files(const fs::path& repo);
 	static bool branch_exists(const mob::url& u, const std::string& name);
+
+	// probes all the remotes for the branch at once, as many in parallel as
+	// the network job slots allow; returns the ones that don't have it, the
+	// results are cached for remote_commit()
+	//
+	static std::vector<mob::url> remotes_without_branch(
+		const std::vector<mob::url>& urls, const std::string& name);
+
+	// hash of the branch on the remote, empty if it doesn't exist or the
+	// remote can't be reached; this is cached for the whole run
+	//
+	static std::string remote_commit(
+		const mob::url& u, const std::string& branch);
+
 	static void init_repo(const fs::path& p);
 
 
@@ -194,6 +380,15 @@ public:
 	git& ignore_ts_on_clone(bool b);
 	git& revert_ts_on_pull(bool b);
 	git& shallow(bool b);
+
+	// partial clone with the given spec, such as "blob:none" or "tree:0"
+	//
+	git& filter(const std::string& spec);
+
+	// cone-mode sparse checkout of the given directories, relative to the
+	// root; files at the root are always checked out
+	//
+	git& sparse(std::vector<std::string> dirs);
 	bool is_tracked(const fs::path& relative_file);
 
 	git& remote(
@@ -218,29 +413,55 @@ private:
 	bool ignore_ts_ = false;
 	bool revert_ts_ = false;
 	bool shallow_ = false;
+	std::string filter_;
+	std::vector<std::string> sparse_;
+
+	// add_submodule operations registered together by add_submodules()
+	std::vector<git> submodules_;
 
 	process make_process();
 
+	// bare mirror of the url in the `git_reference_store`, created or fetched
+	// once per run; empty if there's no store or the mirror can't be created
+	//
+	fs::path reference_repo();
+
 	void do_clone_or_pull();
 	bool do_clone();
 	void do_pull();
 	void do_add_submodule();
+	void do_add_submodules();
 
 	void do_set_credentials();
 	void do_set_remote();
 	void do_ignore_ts();
 	void do_revert_ts();
+	void do_set_sparse();
 
 	void set_config(const std::string& key, const std::string& value);
 	bool has_remote(const std::string& name);
 	void rename_remote(const std::string& from, const std::string& to);
 	void add_remote(const std::string& name, const std::string& url);
 	void set_remote_push(const std::string& remote, const std::string& url);
-	void set_assume_unchanged(const fs::path& relative_file, bool on);
+	void set_assume_unchanged(
+		const std::vector<fs::path>& relative_files, bool on);
+
+	// tracked .ts files in the repo, relative to the root
+	//
+	std::vector<fs::path> tracked_ts_files();
+	std::vector<fs::path> tracked_files();
+
+	// writes the paths to a temporary file, one per line, and calls f() with
+	// it; used to give a list of files to git on stdin
+	//
+	template <class F>
+	void run_with_path_list(const std::vector<fs::path>& files, F&& f);
 	bool is_repo();
-	bool branch_exists();
+	std::string ls_remote();
 	bool has_uncommitted_changes();
+	bool differs_from(const std::string& rev);
 	bool has_stashed_changes();
+	std::string rev_parse_head();
 	void init();
 
 	std::string git_file();
@@ -297,15 +518,52 @@ public:
 
 	static fs::path binary();
 
+	// path to tar from the [tools] section, or empty if it can't be found;
+	// used for .tar.gz instead of piping between two 7z processes
+	//
+	static fs::path tar_binary();
+
+	// whether the archive can be extracted from a stream by tar, which
+	// reads zip files from their local headers instead of the central
+	// directory at the end
+	//
+	static bool can_stream(const fs::path& file);
+
+	// written in the output directory by task::download_and_extract() after
+	// a successful extraction, with the url, sha256 and version of the
+	// archive; used as the fingerprint of tasks that aren't git repos, see
+	// task::make_manifest()
+	//
+	static fs::path stamp_file(const fs::path& dir);
+
 	extractor& file(const fs::path& file);
 	extractor& output(const fs::path& dir);
 
+	// extracts the archive from the stream while it's being downloaded
+	// instead of from file(), see task::download_and_extract()
+	//
+	extractor& stream(std::shared_ptr<download_stream> s);
+
+	// true if stream() was used and the extraction failed, in which case the
+	// output directory was deleted and the archive has to be extracted again
+	// from the file
+	//
+	bool stream_failed() const;
+
+	// true if the archive was extracted, false if the output directory
+	// already existed or the extraction failed
+	//
+	bool extracted() const;
+
 protected:
 	void do_run() override;
 
 private:
 	fs::path file_;
 	fs::path where_;
+	std::shared_ptr<download_stream> stream_;
+	bool stream_failed_;
+	bool extracted_;
 
 	void check_duplicate_directory(const fs::path& ifile);
 };
@@ -332,6 +590,14 @@ private:
 	fs::path file_;
 
 	void do_patch(const fs::path& patch_file);
+
+	// a stamp is written in the root after a patch is applied, with the
+	// hashes of the patch and target files; a patch is not checked again as
+	// long as the stamp matches
+	//
+	fs::path stamp_file(const fs::path& patch_file) const;
+	bool stamp_matches(const fs::path& patch_file) const;
+	void write_stamp(const fs::path& patch_file);
 };
 
 
@@ -341,7 +607,8 @@ public:
 	enum generators
 	{
 		vs    = 0x01,
-		jom   = 0x02
+		jom   = 0x02,
+		ninja = 0x04
 	};
 
 	enum ops
@@ -365,6 +632,11 @@ public:
 	cmake& architecture(arch a);
 	cmake& cmd(const std::string& s);
 
+	// CMAKE_BUILD_TYPE, Release by default; only used by single-config
+	// generators like jom and ninja
+	//
+	cmake& build_type(const std::string& s);
+
 	// returns the path given in output(), if it was set
 	//
 	// if not, returns the build path based on the parameters (for example,
@@ -399,10 +671,22 @@ private:
 	fs::path output_;
 	arch arch_;
 	std::string cmd_;
+	std::string build_type_;
+	std::vector<std::string> defs_;
 
 	void do_clean();
 	void do_generate();
 
+	bool uses_launcher() const;
+
+	// the inputs of the last successful configure are written in the build
+	// directory, cmake isn't run again as long as they're the same; changes
+	// to CMakeLists.txt files are picked up by the generated build system
+	//
+	fs::path stamp_file() const;
+	std::string make_stamp(const env& e) const;
+	bool stamp_matches(const std::string& stamp) const;
+
 	static const std::map<generators, gen_info>& all_generators();
 	static const gen_info& get_generator(generators g);
 };
@@ -428,17 +712,78 @@ public:
 	jom& flag(flags_t f);
 	jom& architecture(arch a);
 
+	// maximum number of job slots to lease, 0 for as many as possible; useful
+	// when multiple jom processes run concurrently for the same task
+	//
+	jom& max_jobs(std::size_t n);
+
+	// replaces the visual studio environment for the architecture, must
+	// already contain it
+	//
+	jom& env(const mob::env& e);
+
+	int result() const;
+
+protected:
+	void do_run() override;
+
+private:
+	std::string target_;
+	flags_t flags_;
+	arch arch_;
+	std::size_t max_jobs_;
+	std::optional<mob::env> env_;
+};
+
+MOB_ENUM_OPERATORS(jom::flags_t);
+
+
+// runs ninja in a build directory generated by cmake::ninja, with as many
+// jobs as can be leased
+//
+class ninja : public basic_process_runner
+{
+public:
+	enum flags_t
+	{
+		noflags        = 0x00,
+		single_job     = 0x01,
+		allow_failure  = 0x02
+	};
+
+	enum ops
+	{
+		build = 1,
+		clean
+	};
+
+	ninja(ops o=build);
+
+	static fs::path binary();
+
+	ninja& path(const fs::path& p);
+	ninja& target(const std::string& s);
+	ninja& flag(flags_t f);
+	ninja& architecture(arch a);
+
 	int result() const;
 
 protected:
 	void do_run() override;
 
 private:
+	ops op_;
+	fs::path path_;
 	std::string target_;
 	flags_t flags_;
 	arch arch_;
+
+	void do_build();
+	void do_clean();
 };
 
+MOB_ENUM_OPERATORS(ninja::flags_t);
+
 
 class msbuild : public basic_process_runner
 {
@@ -469,8 +814,41 @@ public:
 	msbuild& flags(flags_t f);
 	msbuild& prepend_path(const fs::path& p);
 
+	// maximum number of job slots to lease, 0 for as many as possible; useful
+	// when multiple msbuild processes run concurrently for the same task
+	//
+	msbuild& max_jobs(std::size_t n);
+
+	// when building something that contains the projects of several tasks,
+	// returns the task that owns the given project file, or an empty string;
+	// the projects in the performance summary are attributed to that task,
+	// and the summary is written even if `msbuild_logs` is not set
+	//
+	using owner_fun = std::function<std::string (const fs::path&)>;
+	msbuild& project_owners(owner_fun f);
+
 	int result() const;
 
+	// one line from the performance summary of a build, kept for all the
+	// builds done so far when the `msbuild_logs` option is set or when
+	// project_owners() was given
+	//
+	struct perf_entry
+	{
+		std::string task;
+
+		// "project" or "target"
+		std::string kind;
+		std::string name;
+
+		std::chrono::milliseconds time{};
+		std::size_t calls = 0;
+	};
+
+	// thread-safe
+	//
+	static std::vector<perf_entry> perf();
+
 protected:
 	void do_run() override;
 
@@ -483,13 +861,25 @@ private:
 	std::string platform_;
 	arch arch_;
 	flags_t flags_;
+	std::size_t max_jobs_;
 	std::vector<fs::path> prepend_path_;
+	owner_fun owners_;
 
 	void do_clean();
 	void do_build();
 	void do_run(const std::vector<std::string>& targets);
 
 	void error_filter(process::filter& f) const;
+
+	// path of the binlog or performance summary for this build in the
+	// solution's directory, named after the solution and the targets
+	//
+	fs::path log_file(
+		const std::vector<std::string>& targets, const std::string& ext) const;
+
+	// parses the project and target sections of a performance summary
+	//
+	void read_perf_summary(const fs::path& file);
 };
 
 MOB_ENUM_OPERATORS(msbuild::flags_t);
@@ -524,6 +914,26 @@ private:
 	fs::path sln_;
 
 	void do_upgrade();
+
+	// the solution and the projects it references, along with their
+	// filters; these are the files changed by devenv /upgrade
+	//
+	std::vector<fs::path> upgraded_files() const;
+
+	// directory in cache/vs_upgrade/ keyed on the contents of
+	// upgraded_files() before the upgrade and the vs version, toolset and
+	// sdk
+	//
+	fs::path upgrade_cache_dir(const std::vector<fs::path>& files) const;
+
+	// copies the files from the cache over the ones in the tree, returns
+	// false if the cache doesn't have them
+	//
+	bool restore_upgrade(const fs::path& dir);
+
+	// copies the upgraded files into the cache
+	//
+	void save_upgrade(const fs::path& dir, const std::vector<fs::path>& files);
 };
 
 
@@ -551,6 +961,11 @@ public:
 	pip_install& version(const std::string& s);
 	pip_install& file(const fs::path& p);
 
+	// wheels downloaded by `pip download`, one directory per package and
+	// version, along with their dependencies
+	//
+	static fs::path wheelhouse();
+
 protected:
 	void do_run() override;
 
@@ -558,6 +973,18 @@ private:
 	std::string package_;
 	std::string version_;
 	fs::path file_;
+
+	process make_pip_process(const std::string& command) const;
+
+	// whether all the wheels listed in the manifest of the given directory
+	// are there and have the same hash
+	//
+	bool check_wheels(const fs::path& dir) const;
+
+	// downloads the package and its dependencies in the given directory,
+	// checks them against [sha256] and writes the manifest
+	//
+	void download_wheels(const fs::path& dir);
 };
 
 
@@ -583,8 +1010,19 @@ public:
 	transifex& stdout_level(context::level lv);
 	transifex& force(bool b);
 
+	// number of `tx pull` processes running at the same time, each one
+	// pulling a single resource; 1 pulls everything with one process
+	//
+	transifex& workers(std::size_t n);
+
+	// resources in the .tx/config file of the given directory, empty if it
+	// doesn't exist
+	//
+	static std::vector<std::string> resources(const fs::path& root);
+
 protected:
 	void do_run() override;
+	void do_interrupt() override;
 
 private:
 	ops op_;
@@ -594,10 +1032,25 @@ private:
 	mob::url url_;
 	int min_;
 	bool force_;
+	std::size_t workers_;
+
+	// processes started by do_parallel_pull(), also interrupted by
+	// do_interrupt(); on the heap so the tool stays movable
+	struct pulls
+	{
+		std::mutex mutex;
+		std::vector<process*> v;
+		bool interrupted = false;
+	};
+
+	std::unique_ptr<pulls> pulls_;
 
 	void do_init();
 	void do_config();
 	void do_pull();
+	void do_parallel_pull(const std::vector<std::string>& resources);
+
+	process make_pull_process() const;
 };
 
 
@@ -613,6 +1066,13 @@ public:
 	lrelease& sources(const std::vector<fs::path>& v);
 	lrelease& out(const fs::path& dir);
 
+	// by default, all the sources are merged into qm_file() in the output
+	// directory; when false, each source is compiled to a .qm file next to
+	// it instead, which allows for building several languages with one
+	// process
+	//
+	lrelease& merge(bool b);
+
 	fs::path qm_file() const;
 
 protected:
@@ -622,6 +1082,7 @@ private:
 	std::string project_;
 	std::vector<fs::path> sources_;
 	fs::path out_;
+	bool merge_ = true;
 };
 
 
@@ -11,6 +11,9 @@ namespace mob
 
 static std::mutex g_output_mutex;
 
+// number of lines drawn by set_console_footer(), g_output_mutex must be locked
+static std::size_t g_footer_lines = 0;
+
 extern u8stream u8cout(false);
 extern u8stream u8cerr(true);
 
@@ -224,9 +227,82 @@ void set_std_streams()
 		_setmode(_fileno(stderr), _O_U16TEXT);
 }
 
+// moves the cursor back to the first line of the footer and erases it, the
+// footer is redrawn on the next set_console_footer(); g_output_mutex must be
+// locked
+//
+static void erase_console_footer()
+{
+	if (g_footer_lines == 0)
+		return;
+
+	std::wcout << L"\x1b[" << g_footer_lines << L"F\x1b[J";
+	std::wcout.flush();
+
+	g_footer_lines = 0;
+}
+
+bool enable_console_footer()
+{
+	if (!stdout_console)
+		return false;
+
+	HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
+
+	DWORD mode = 0;
+	if (!GetConsoleMode(h, &mode))
+		return false;
+
+	if (mode & ENABLE_VIRTUAL_TERMINAL_PROCESSING)
+		return true;
+
+	return SetConsoleMode(h, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+}
+
+void set_console_footer(const std::vector<std::string>& lines)
+{
+	if (!stdout_console)
+		return;
+
+	std::size_t width = 80;
+
+	CONSOLE_SCREEN_BUFFER_INFO info = {};
+	if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
+	{
+		// one less so the cursor doesn't wrap to the next line
+		const auto w = info.srWindow.Right - info.srWindow.Left;
+		if (w > 0)
+			width = static_cast<std::size_t>(w);
+	}
+
+	std::wstring s;
+	for (auto&& line : lines)
+	{
+		std::wstring ws = utf8_to_utf16(line);
+		if (ws.size() > width)
+			ws.resize(width);
+
+		s += ws;
+		s += L"\n";
+	}
+
+	std::scoped_lock lock(g_output_mutex);
+
+	erase_console_footer();
+
+	std::wcout << s;
+	std::wcout.flush();
+
+	g_footer_lines = lines.size();
+}
+
 void u8stream::do_output(const std::string& s)
 {
+	// logs that were pushed before this output go first
+	flush_logs();
+
 	std::scoped_lock lock(g_output_mutex);
+	erase_console_footer();
 
 	if (err_)
 	{
@@ -247,6 +323,7 @@ void u8stream::do_output(const std::string& s)
 void u8stream::write_ln(std::string_view utf8)
 {
 	std::scoped_lock lock(g_output_mutex);
+	erase_console_footer();
 
 	if (err_)
 	{
@@ -318,32 +395,296 @@ url make_appveyor_artifact_url(
 		project + "/artifacts/" + filename + "?job=Platform:%20" + arch_s;
 }
 
+std::string json_string(std::string_view utf8)
+{
+	std::string r;
+	r.reserve(utf8.size() + 2);
+	r += '"';
+
+	for (char c : utf8)
+	{
+		switch (c)
+		{
+			case '"':  r += "\\\""; break;
+			case '\\': r += "\\\\"; break;
+			case '\n': r += "\\n"; break;
+			case '\r': r += "\\r"; break;
+			case '\t': r += "\\t"; break;
+
+			default:
+			{
+				if (static_cast<unsigned char>(c) < 0x20)
+					r += ::fmt::format("\\u{:04x}", static_cast<int>(c));
+				else
+					r += c;
+
+				break;
+			}
+		}
+	}
+
+	r += '"';
+	return r;
+}
+
+std::string file_time_string(const fs::path& p)
+{
+	std::error_code ec;
+	const auto t = fs::last_write_time(p, ec);
+
+	if (ec)
+		return "";
+
+	return std::to_string(t.time_since_epoch().count());
+}
+
+// lowercase, underscores become dashes
+//
+static char glob_char(char c)
+{
+	if (c == '_')
+		return '-';
+
+	return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+glob::glob(std::string_view pattern)
+{
+	pattern_.reserve(pattern.size());
+
+	for (char c : pattern)
+		pattern_ += glob_char(c);
+}
+
+const glob& glob::get(const std::string& pattern)
+{
+	static std::mutex m;
+	static std::map<std::string, std::unique_ptr<glob>> map;
+
+	std::scoped_lock lock(m);
+
+	auto& g = map[pattern];
+	if (!g)
+		g = std::make_unique<glob>(pattern);
+
+	return *g;
+}
+
+bool glob::matches(std::string_view s) const
+{
+	// iterative wildcard matching, backtracks to the last * on mismatch
+	std::size_t p = 0, i = 0;
+	std::size_t star = std::string::npos, star_i = 0;
+
+	while (i < s.size())
+	{
+		if (p < pattern_.size() &&
+			(pattern_[p] == '?' || pattern_[p] == glob_char(s[i])))
+		{
+			++p;
+			++i;
+		}
+		else if (p < pattern_.size() && pattern_[p] == '*')
+		{
+			star = p++;
+			star_i = i;
+		}
+		else if (star != std::string::npos)
+		{
+			p = star + 1;
+			i = ++star_i;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while (p < pattern_.size() && pattern_[p] == '*')
+		++p;
+
+	return (p == pattern_.size());
+}
+
 bool glob_match(const std::string& pattern, const std::string& s)
 {
-	try
+	return glob::get(pattern).matches(s);
+}
+
+std::string hash_string(std::string_view bytes)
+{
+	std::uint64_t h = 0xcbf29ce484222325ull;
+
+	for (const char c : bytes)
 	{
-		std::string fixed_pattern = pattern;
-		fixed_pattern = replace_all(fixed_pattern, "*", ".*");
-		fixed_pattern = replace_all(fixed_pattern, "_", "-");
+		h ^= static_cast<unsigned char>(c);
+		h *= 0x100000001b3ull;
+	}
+
+	return ::fmt::format("{:016x}", h);
+}
+
+std::string hash_file(const fs::path& p)
+{
+	mapped_file m(p);
+	if (!m.ok())
+		return {};
+
+	// BCryptHashData() takes a ULONG
+	const std::size_t chunk = 1024 * 1024 * 1024;
+	const std::string_view bytes = m.bytes();
 
-		std::string fixed_string = s;
-		fixed_string = replace_all(fixed_string, "_", "-");
+	sha256 h;
 
-		std::regex re(fixed_pattern, std::regex::icase);
+	for (std::size_t i=0; i<bytes.size(); i+=chunk)
+		h.update(bytes.substr(i, chunk));
+
+	return h.finish();
+}
+
+
+mapped_file::mapped_file(const fs::path& p)
+	: file_(INVALID_HANDLE_VALUE), mapping_(nullptr), view_(nullptr),
+		size_(0), ok_(false)
+{
+	// logs can still be open by the process that writes them
+	file_ = CreateFileW(
+		p.native().c_str(), GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE,
+		nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+	if (file_ == INVALID_HANDLE_VALUE)
+		return;
 
-		return std::regex_match(fixed_string, re);
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(file_, &size))
+		return;
+
+	// files of size 0 can't be mapped
+	if (size.QuadPart == 0)
+	{
+		ok_ = true;
+		return;
 	}
-	catch(std::exception&)
+
+	mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping_)
+		return;
+
+	view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+	if (!view_)
+		return;
+
+	size_ = static_cast<std::size_t>(size.QuadPart);
+	ok_ = true;
+}
+
+mapped_file::~mapped_file()
+{
+	if (view_)
+		UnmapViewOfFile(view_);
+
+	if (mapping_)
+		CloseHandle(mapping_);
+
+	if (file_ != INVALID_HANDLE_VALUE)
+		CloseHandle(file_);
+}
+
+bool mapped_file::ok() const
+{
+	return ok_;
+}
+
+std::string_view mapped_file::bytes() const
+{
+	if (!view_)
+		return {};
+
+	return {static_cast<const char*>(view_), size_};
+}
+
+
+sha256::sha256()
+	: h_(nullptr)
+{
+	static BCRYPT_ALG_HANDLE alg = []
+	{
+		BCRYPT_ALG_HANDLE a = nullptr;
+
+		const auto r = ::BCryptOpenAlgorithmProvider(
+			&a, BCRYPT_SHA256_ALGORITHM, nullptr, 0);
+
+		if (!BCRYPT_SUCCESS(r))
+			gcx().bail_out(context::generic, "can't open sha256 provider, {}", r);
+
+		return a;
+	}();
+
+	const auto r = ::BCryptCreateHash(alg, &h_, nullptr, 0, nullptr, 0, 0);
+
+	if (!BCRYPT_SUCCESS(r))
+		gcx().bail_out(context::generic, "can't create sha256 hash, {}", r);
+}
+
+sha256::~sha256()
+{
+	if (h_)
+		::BCryptDestroyHash(h_);
+}
+
+void sha256::update(std::string_view bytes)
+{
+	MOB_ASSERT(h_);
+
+	::BCryptHashData(
+		h_, reinterpret_cast<PUCHAR>(const_cast<char*>(bytes.data())),
+		static_cast<ULONG>(bytes.size()), 0);
+}
+
+bool sha256::update_from_file(const fs::path& p, std::uint64_t size)
+{
+	std::ifstream in(p, std::ios::binary);
+	if (!in)
+		return false;
+
+	auto buffer = std::make_unique<char[]>(1024 * 1024);
+
+	while (size > 0 && in)
 	{
-		u8cerr
-			<< "bad glob '" << pattern << "'\n"
-			<< "globs are actually bastardized regexes where '*' is "
-			<< "replaced by '.*', so don't push it\n";
+		const auto want = static_cast<std::streamsize>(
+			std::min<std::uint64_t>(size, 1024 * 1024));
 
-		throw bailed();
+		in.read(buffer.get(), want);
+		const auto n = in.gcount();
+
+		if (n <= 0)
+			break;
+
+		update({buffer.get(), static_cast<std::size_t>(n)});
+		size -= static_cast<std::uint64_t>(n);
 	}
+
+	return (in || in.eof());
 }
 
+std::string sha256::finish()
+{
+	MOB_ASSERT(h_);
+
+	unsigned char out[32] = {};
+	::BCryptFinishHash(h_, out, sizeof(out), 0);
+	::BCryptDestroyHash(h_);
+	h_ = nullptr;
+
+	std::string s;
+
+	for (auto c : out)
+		s += ::fmt::format("{:02x}", c);
+
+	return s;
+}
+
+
 std::string replace_all(
 	std::string s, const std::string& from, const std::string& to)
 {
@@ -593,6 +934,123 @@ void bypass_file::create()
 }
 
 
+// room for a few hundred changes, the buffer also can't be larger than 64KB
+// for network shares
+static constexpr std::size_t watcher_buffer_size = 64 * 1024;
+
+directory_watcher::directory_watcher(fs::path dir) :
+	dir_(std::move(dir)), ov_{},
+	buffer_(new DWORD[watcher_buffer_size / sizeof(DWORD)]),
+	pending_(false)
+{
+	HANDLE h = ::CreateFileW(
+		dir_.native().c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS|FILE_FLAG_OVERLAPPED, nullptr);
+
+	if (h == INVALID_HANDLE_VALUE)
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::fs,
+			"can't watch {}, {}", dir_, error_message(e));
+	}
+
+	handle_.reset(h);
+	event_.reset(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+	ov_.hEvent = event_.get();
+}
+
+directory_watcher::~directory_watcher()
+{
+	if (pending_)
+	{
+		// the buffer must stay alive until the request is gone
+		::CancelIoEx(handle_.get(), &ov_);
+
+		DWORD bytes = 0;
+		::GetOverlappedResult(handle_.get(), &ov_, &bytes, TRUE);
+	}
+}
+
+void directory_watcher::start()
+{
+	::ResetEvent(event_.get());
+
+	const DWORD filter =
+		FILE_NOTIFY_CHANGE_FILE_NAME |
+		FILE_NOTIFY_CHANGE_DIR_NAME |
+		FILE_NOTIFY_CHANGE_LAST_WRITE |
+		FILE_NOTIFY_CHANGE_SIZE;
+
+	const BOOL r = ::ReadDirectoryChangesW(
+		handle_.get(), buffer_.get(),
+		static_cast<DWORD>(watcher_buffer_size), TRUE, filter,
+		nullptr, &ov_, nullptr);
+
+	if (!r)
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::fs,
+			"can't watch {}, {}", dir_, error_message(e));
+	}
+
+	pending_ = true;
+}
+
+std::vector<fs::path> directory_watcher::wait(
+	std::chrono::milliseconds timeout)
+{
+	if (!pending_)
+		start();
+
+	const auto ms = static_cast<DWORD>(timeout.count());
+	if (::WaitForSingleObject(event_.get(), ms) != WAIT_OBJECT_0)
+		return {};
+
+	pending_ = false;
+
+	DWORD bytes = 0;
+	if (!::GetOverlappedResult(handle_.get(), &ov_, &bytes, FALSE))
+	{
+		const auto e = GetLastError();
+		gcx().bail_out(context::fs,
+			"watching {} failed, {}", dir_, error_message(e));
+	}
+
+	std::vector<fs::path> v;
+
+	// the buffer overflowed, the changes are lost
+	if (bytes == 0)
+	{
+		v.push_back(dir_);
+		return v;
+	}
+
+	const auto* p = reinterpret_cast<const std::byte*>(buffer_.get());
+
+	for (;;)
+	{
+		const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+
+		const std::wstring_view name(
+			info->FileName, info->FileNameLength / sizeof(wchar_t));
+
+		v.push_back(dir_ / name);
+
+		if (info->NextEntryOffset == 0)
+			break;
+
+		p += info->NextEntryOffset;
+	}
+
+	// watch again right away so changes during a build are not missed
+	start();
+
+	return v;
+}
+
+
 enum class color_methods
 {
 	none = 0,
@@ -695,13 +1153,15 @@ console_color::~console_color()
 }
 
 
-std::optional<std::wstring> to_widechar(UINT from, std::string_view s)
+bool to_widechar(UINT from, std::string_view s, std::wstring& ws)
 {
-	std::wstring ws;
-
 	if (s.empty())
-		return ws;
+	{
+		ws.clear();
+		return true;
+	}
 
+	// resizing doesn't allocate as long as `ws` has enough capacity
 	ws.resize(s.size() + 1);
 
 	for (int t=0; t<3; ++t)
@@ -721,7 +1181,7 @@ std::optional<std::wstring> to_widechar(UINT from, std::string_view s)
 			}
 			else
 			{
-				return {};
+				return false;
 			}
 		}
 		else
@@ -732,17 +1192,18 @@ std::optional<std::wstring> to_widechar(UINT from, std::string_view s)
 		}
 	}
 
-	return ws;
+	return true;
 }
 
-std::optional<std::string> to_multibyte(UINT to, std::wstring_view ws)
+bool to_multibyte(UINT to, std::wstring_view ws, std::string& s)
 {
-	std::string s;
-
 	if (ws.empty())
-		return s;
-
+	{
+		s.clear();
+		return true;
+	}
 
+	// resizing doesn't allocate as long as `s` has enough capacity
 	s.resize(static_cast<std::size_t>(
 		static_cast<double>(ws.size()) * 1.5));
 
@@ -758,12 +1219,12 @@ std::optional<std::string> to_multibyte(UINT to, std::wstring_view ws)
 
 			if (e == ERROR_INSUFFICIENT_BUFFER)
 			{
-				s.resize(ws.size() * 2);
+				s.resize(s.size() * 2);
 				continue;
 			}
 			else
 			{
-				return {};
+				return false;
 			}
 		}
 		else
@@ -774,6 +1235,26 @@ std::optional<std::string> to_multibyte(UINT to, std::wstring_view ws)
 		}
 	}
 
+	return true;
+}
+
+std::optional<std::wstring> to_widechar(UINT from, std::string_view s)
+{
+	std::wstring ws;
+
+	if (!to_widechar(from, s, ws))
+		return {};
+
+	return ws;
+}
+
+std::optional<std::string> to_multibyte(UINT to, std::wstring_view ws)
+{
+	std::string s;
+
+	if (!to_multibyte(to, ws, s))
+		return {};
+
 	return s;
 }
 
@@ -860,6 +1341,54 @@ std::string bytes_to_utf8(encodings e, std::string_view s)
 	}
 }
 
+void utf16_to_utf8(std::wstring_view ws, std::string& out)
+{
+	if (!to_multibyte(CP_UTF8, ws, out))
+	{
+		std::wcerr << L"can't convert from utf16 to utf8\n";
+		out = "???";
+	}
+}
+
+void bytes_to_utf8(
+	encodings e, std::string_view s, std::string& out, std::wstring& scratch)
+{
+	switch (e)
+	{
+		case encodings::utf16:
+		{
+			const auto* ws = reinterpret_cast<const wchar_t*>(s.data());
+			const auto chars = s.size() / sizeof(wchar_t);
+			utf16_to_utf8({ws, chars}, out);
+			break;
+		}
+
+		case encodings::acp:
+		case encodings::oem:
+		{
+			const UINT cp = (e == encodings::acp ? CP_ACP : CP_OEMCP);
+
+			if (!to_widechar(cp, s, scratch))
+			{
+				std::wcerr << L"can't convert from cp " << cp << L" to utf16\n";
+				out = "???";
+				break;
+			}
+
+			utf16_to_utf8(scratch, out);
+			break;
+		}
+
+		case encodings::utf8:
+		case encodings::dont_know:
+		default:
+		{
+			out.assign(s.begin(), s.end());
+			break;
+		}
+	}
+}
+
 std::string utf16_to_bytes(encodings e, std::wstring_view ws)
 {
 	switch (e)
@@ -891,6 +1420,57 @@ std::string utf16_to_bytes(encodings e, std::wstring_view ws)
 
 }
 
+void utf8_to_bytes(
+	encodings e, std::string_view utf8, std::string& out, std::wstring& scratch)
+{
+	switch (e)
+	{
+		case encodings::utf16:
+		{
+			if (!to_widechar(CP_UTF8, utf8, scratch))
+			{
+				std::wcerr << L"can't convert from utf8 to utf16\n";
+				scratch = L"???";
+			}
+
+			out.assign(
+				reinterpret_cast<const char*>(scratch.data()),
+				scratch.size() * sizeof(wchar_t));
+
+			break;
+		}
+
+		case encodings::acp:
+		case encodings::oem:
+		{
+			const UINT cp = (e == encodings::acp ? CP_ACP : CP_OEMCP);
+
+			if (!to_widechar(CP_UTF8, utf8, scratch))
+			{
+				std::wcerr << L"can't convert from utf8 to utf16\n";
+				out = "???";
+				break;
+			}
+
+			if (!to_multibyte(cp, scratch, out))
+			{
+				std::wcerr << L"can't convert from utf16 to cp " << cp << L"\n";
+				out = "???";
+			}
+
+			break;
+		}
+
+		case encodings::utf8:
+		case encodings::dont_know:
+		default:
+		{
+			out.assign(utf8.begin(), utf8.end());
+			break;
+		}
+	}
+}
+
 std::string utf8_to_bytes(encodings e, std::string_view utf8)
 {
 	switch (e)
@@ -921,60 +1501,404 @@ std::string path_to_utf8(fs::path p)
 
 
 thread_pool::thread_pool(std::size_t count)
-	: count_(std::max<std::size_t>(1, count))
+	: queued_(0), pending_(0), next_(0), quit_(false)
 {
-	for (std::size_t i=0; i<count_; ++i)
-		threads_.emplace_back(std::make_unique<thread_info>());
+	count = std::max<std::size_t>(1, count);
+
+	for (std::size_t i=0; i<count; ++i)
+		workers_.emplace_back(std::make_unique<worker>());
+
+	for (std::size_t i=0; i<count; ++i)
+		workers_[i]->thread = start_thread([this, i]{ thread_fun(i); });
 }
 
 thread_pool::~thread_pool()
 {
 	join();
+
+	{
+		std::scoped_lock lock(m_);
+		quit_ = true;
+	}
+
+	wakeup_.notify_all();
+
+	for (auto&& w : workers_)
+	{
+		if (w->thread.joinable())
+			w->thread.join();
+	}
+}
+
+thread_pool& thread_pool::shared()
+{
+	static thread_pool tp;
+	return tp;
+}
+
+std::future<void> thread_pool::add(fun f)
+{
+	return submit(std::move(f));
 }
 
 void thread_pool::join()
 {
-	for (auto&& t : threads_)
+	std::unique_lock lock(m_);
+	idle_.wait(lock, [&]{ return pending_ == 0; });
+}
+
+void thread_pool::push(fun f)
+{
+	// counted before the job is visible, or a worker could pop it and
+	// decrement queued_ before it's incremented; a worker woken up in between
+	// only retries until the job is there
+	{
+		std::scoped_lock lock(m_);
+		++pending_;
+		++queued_;
+	}
+
+	auto& w = *workers_[next_++ % workers_.size()];
+
 	{
-		if (t->thread.joinable())
-			t->thread.join();
+		std::scoped_lock lock(w.m);
+		w.jobs.push_back(std::move(f));
 	}
+
+	wakeup_.notify_one();
 }
 
-void thread_pool::add(fun thread_fun)
+bool thread_pool::pop(std::size_t i, fun& f)
+{
+	// own queue first, oldest job first
+	{
+		auto& w = *workers_[i];
+		std::scoped_lock lock(w.m);
+
+		if (!w.jobs.empty())
+		{
+			f = std::move(w.jobs.front());
+			w.jobs.pop_front();
+			--queued_;
+			return true;
+		}
+	}
+
+	// steal the newest job from another worker
+	for (std::size_t j=1; j<workers_.size(); ++j)
+	{
+		auto& w = *workers_[(i + j) % workers_.size()];
+		std::scoped_lock lock(w.m);
+
+		if (!w.jobs.empty())
+		{
+			f = std::move(w.jobs.back());
+			w.jobs.pop_back();
+			--queued_;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void thread_pool::thread_fun(std::size_t i)
 {
 	for (;;)
 	{
-		if (try_add(thread_fun))
+		fun f;
+
+		if (pop(i, f))
+		{
+			f();
+
+			bool idle = false;
+
+			{
+				std::scoped_lock lock(m_);
+				--pending_;
+				idle = (pending_ == 0);
+			}
+
+			if (idle)
+				idle_.notify_all();
+
+			continue;
+		}
+
+		std::unique_lock lock(m_);
+		wakeup_.wait(lock, [&]{ return quit_ || queued_ > 0; });
+
+		if (quit_ && queued_ == 0)
 			break;
+	}
+}
+
+
+void parallel_for(
+	std::size_t count, std::size_t jobs, std::function<void (std::size_t)> f)
+{
+	jobs = std::clamp<std::size_t>(jobs, 1, std::max<std::size_t>(count, 1));
+
+	// the helpers are queued in the shared pool, but parallel_for() can be
+	// called from one of its workers; if all the workers are waiting in a
+	// parallel_for(), the helpers would never start
+	//
+	// so the caller doesn't wait for helpers that haven't started: once it
+	// runs out of indices, it closes the state and only waits for the ones
+	// that are running; helpers that start afterwards return right away, the
+	// state is shared with them for that
+	struct state
+	{
+		std::function<void (std::size_t)> f;
+		std::size_t count = 0;
+		std::atomic<std::size_t> next = 0;
+		std::atomic<bool> failed = false;
+
+		std::mutex m;
+		std::condition_variable cv;
+		bool closed = false;
+		std::size_t active = 0;
+		std::exception_ptr e;
+	};
+
+	auto st = std::make_shared<state>();
+	st->f = std::move(f);
+	st->count = count;
+
+	// each thread takes the next index until there are none left
+	auto run = [](state& st)
+	{
+		while (!st.failed)
+		{
+			const std::size_t i = st.next++;
+			if (i >= st.count)
+				break;
+
+			try
+			{
+				st.f(i);
+			}
+			catch(...)
+			{
+				st.failed = true;
+
+				std::scoped_lock lock(st.m);
+				if (!st.e)
+					st.e = std::current_exception();
+			}
+		}
+	};
+
+	for (std::size_t i=1; i<jobs; ++i)
+	{
+		thread_pool::shared().add([st, run]
+		{
+			{
+				std::scoped_lock lock(st->m);
+				if (st->closed)
+					return;
+
+				++st->active;
+			}
+
+			run(*st);
+
+			{
+				std::scoped_lock lock(st->m);
+				--st->active;
+			}
+
+			st->cv.notify_all();
+		});
+	}
+
+	run(*st);
+
+	std::unique_lock lock(st->m);
+	st->closed = true;
+	st->cv.wait(lock, [&]{ return st->active == 0; });
+
+	if (st->e)
+		std::rethrow_exception(st->e);
+}
+
+
+job_lease::job_lease()
+	: js_(nullptr), count_(0)
+{
+}
+
+job_lease::job_lease(job_slots& js, std::size_t count)
+	: js_(&js), count_(count)
+{
+}
+
+job_lease::job_lease(job_lease&& other)
+	: js_(other.js_), count_(std::exchange(other.count_, 0))
+{
+}
+
+job_lease& job_lease::operator=(job_lease&& other)
+{
+	if (this != &other)
+	{
+		release();
+		js_ = other.js_;
+		count_ = std::exchange(other.count_, 0);
+	}
+
+	return *this;
+}
+
+job_lease::~job_lease()
+{
+	release();
+}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+std::size_t job_lease::count() const
+{
+	return count_;
+}
+
+void job_lease::release()
+{
+	if (count_ > 0)
+	{
+		js_->release(count_);
+		count_ = 0;
 	}
 }
 
-bool thread_pool::try_add(fun thread_fun)
+
+job_slots::job_slots(std::size_t total)
+	: total_(std::max<std::size_t>(1, total)), used_(0), holders_(0),
+		contenders_(0)
 {
-	for (auto& t : threads_)
+}
+
+job_slots& job_slots::instance()
+{
+	static job_slots js([]
 	{
-		if (!t->running)
+		std::size_t n = static_cast<std::size_t>(
+			std::max(0, conf::get_global_int("global", "jobs")));
+
+		if (n == 0)
+			n = std::max(1u, std::thread::hardware_concurrency());
+
+		const auto mb_per_job = static_cast<std::size_t>(
+			std::max(0, conf::get_global_int("global", "job_memory")));
+
+		if (mb_per_job > 0)
 		{
-			if (t->thread.joinable())
-				t->thread.join();
+			MEMORYSTATUSEX ms = {};
+			ms.dwLength = sizeof(ms);
+
+			if (::GlobalMemoryStatusEx(&ms))
+			{
+				const auto total_mb = static_cast<std::size_t>(
+					ms.ullTotalPhys / (1024 * 1024));
+
+				n = std::min(n, std::max<std::size_t>(1, total_mb / mb_per_job));
+			}
+		}
+
+		gcx().debug(context::generic, "job budget is {} slots", n);
+
+		return n;
+	}());
 
-			t->running = true;
-			t->thread_fun = thread_fun;
+	return js;
+}
+
+job_slots& job_slots::network()
+{
+	static job_slots js([]
+	{
+		const auto n = static_cast<std::size_t>(
+			std::max(0, conf::get_global_int("global", "fetch_jobs")));
+
+		if (n == 0)
+			return std::numeric_limits<std::size_t>::max();
+
+		return n;
+	}());
+
+	return js;
+}
+
+std::size_t job_slots::total() const
+{
+	return total_;
+}
 
-			t->thread = std::thread([&]
+job_lease job_slots::lease(
+	std::size_t want, std::function<bool ()> interrupted)
+{
+	std::unique_lock lock(m_);
+
+	for (;;)
+	{
+		if (used_ < total_)
+		{
+			std::size_t n = want;
+
+			if (n == 0)
 			{
-				t->thread_fun();
-				t->running = false;
-			});
+				const auto sharing = std::max(contenders_, holders_ + 1);
+				n = std::max<std::size_t>(1, total_ / sharing);
+			}
 
-			return true;
+			n = std::min(n, total_ - used_);
+			used_ += n;
+			++holders_;
+
+			return job_lease(*this, n);
 		}
+
+		if (interrupted && interrupted())
+			return {};
+
+		// woken up by release() and wake_all()
+		cv_.wait(lock);
 	}
+}
 
-	return false;
+void job_slots::wake_all()
+{
+	{
+		// lease() checks `interrupted` with the lock held
+		std::scoped_lock lock(m_);
+	}
+
+	cv_.notify_all();
+}
+
+void job_slots::add_contender()
+{
+	std::scoped_lock lock(m_);
+	++contenders_;
+}
+
+void job_slots::remove_contender()
+{
+	std::scoped_lock lock(m_);
+	MOB_ASSERT(contenders_ > 0);
+	--contenders_;
+}
+
+void job_slots::release(std::size_t n)
+{
+	{
+		std::scoped_lock lock(m_);
+		MOB_ASSERT(used_ >= n);
+		MOB_ASSERT(holders_ > 0);
+		used_ -= n;
+		--holders_;
+	}
+
+	cv_.notify_all();
 }
 
 }	// namespace
@@ -77,6 +77,11 @@ enum class encodings
 class context;
 class url;
 
+// thrown when a task or a tool is interrupted, such as by Ctrl-C or because
+// another task failed; unlike bailed, nothing is logged
+//
+class interrupted {};
+
 class bailed
 {
 public:
@@ -124,6 +129,214 @@ using file_ptr = std::unique_ptr<FILE, file_closer>;
 //
 std::chrono::nanoseconds timestamp();
 
+// a small number unique to the calling thread, given in the order in which
+// threads first call this
+//
+std::size_t thread_index();
+
+
+// resources used by processes, from their job objects
+//
+struct resource_usage
+{
+	std::chrono::nanoseconds user{}, kernel{};
+	std::uint64_t peak_memory = 0;
+	std::uint64_t read_bytes = 0;
+	std::uint64_t write_bytes = 0;
+	std::uint64_t processes = 0;
+
+	// downloads done on the thread, see curl_downloader::join()
+	std::uint64_t downloads = 0;
+	std::uint64_t download_bytes = 0;
+	std::chrono::nanoseconds download_time{};
+	std::uint64_t download_retries = 0;
+
+	// copies, deletions, renames and archives done through op:: on the
+	// thread, see op::fs_stats
+	std::uint64_t fs_ops = 0;
+	std::uint64_t fs_files = 0;
+	std::uint64_t fs_bytes = 0;
+	std::chrono::nanoseconds fs_time{};
+
+	// sums everything, except for peak_memory, which is the max
+	//
+	resource_usage& operator+=(const resource_usage& u);
+};
+
+
+// while alive, the resources used by every process that completes on this
+// thread are added to the given usage; sinks nest, so a process is counted
+// in all the sinks that are active on its thread
+//
+// threads started on behalf of another one can bind its current sink with
+// exchange(), the sink must outlive them, see task::parallel()
+//
+class usage_sink
+{
+public:
+	usage_sink(resource_usage& u);
+	~usage_sink();
+
+	// non-copyable
+	usage_sink(const usage_sink&) = delete;
+	usage_sink& operator=(const usage_sink&) = delete;
+
+	static const usage_sink* current();
+
+	// makes the given sink current on this thread and returns the previous
+	// one
+	//
+	static const usage_sink* exchange(const usage_sink* s);
+
+	// adds to all the sinks active on this thread
+	//
+	static void add(const resource_usage& u);
+
+private:
+	resource_usage* u_;
+	const usage_sink* previous_;
+
+	static thread_local const usage_sink* current_;
+};
+
+
+// hits and misses of the various caches, such as downloads or the artifact
+// cache, for the metrics written at the end of a build; thread-safe
+//
+class cache_stats
+{
+public:
+	struct counts
+	{
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+	};
+
+	static void hit(const std::string& cache);
+	static void miss(const std::string& cache);
+
+	// for caches that keep their own counters, like the compiler cache
+	//
+	static void add(const std::string& cache, const counts& c);
+
+	// by cache name
+	//
+	static std::map<std::string, counts> all();
+};
+
+
+// steps of a task that failed and had to be run again, with the time lost
+// on the failed attempts
+//
+class retry_stats
+{
+public:
+	struct counts
+	{
+		std::uint64_t retries = 0;
+		std::chrono::nanoseconds wasted{};
+	};
+
+	// thread-safe
+	//
+	static void add(
+		const std::string& task, const std::string& step,
+		std::chrono::nanoseconds wasted);
+
+	// by task and step
+	//
+	static std::map<std::pair<std::string, std::string>, counts> all();
+};
+
+
+// a named interval in a tree: task -> phase -> tool -> process, etc.; the
+// parent of a span is the innermost span_scope alive on the thread that
+// created it
+//
+// finished spans are appended to a buffer owned by the thread that ends them
+// and collected by all() once the build is done, see build_command
+//
+class span
+{
+public:
+	struct record
+	{
+		// ids start at 1, the parent is 0 for roots
+		std::uint64_t id = 0;
+		std::uint64_t parent = 0;
+
+		// task of the innermost span that had one, can be empty
+		std::string task;
+
+		// "task", "phase", "tool", "process", "download", etc.
+		std::string kind;
+		std::string name;
+
+		std::chrono::nanoseconds start{}, end{};
+
+		// thread_index() of the thread that created this
+		std::size_t thread = 0;
+	};
+
+	// state of the current thread, can be given to another thread with
+	// exchange(), see task::parallel()
+	//
+	struct thread_state
+	{
+		std::uint64_t current = 0;
+		std::string task;
+	};
+
+	// starts a span as a child of the current one on this thread; it doesn't
+	// become current, see span_scope
+	//
+	span(std::string kind, std::string name, std::string task={});
+
+	// calls end()
+	//
+	~span();
+
+	// non-copyable
+	span(const span&) = delete;
+	span& operator=(const span&) = delete;
+
+	std::uint64_t id() const;
+	const std::string& task() const;
+
+	// records this span, does nothing if it was already ended
+	//
+	void end();
+
+	static const thread_state& current();
+	static thread_state exchange(thread_state s);
+
+	// every span that was ended so far, in no particular order
+	//
+	static std::vector<record> all();
+
+private:
+	record r_;
+	bool ended_;
+};
+
+
+// a span that's the parent of everything started on this thread while it's
+// alive; a non-empty task becomes the task of the spans under it
+//
+class span_scope
+{
+public:
+	span_scope(std::string kind, std::string name, std::string task={});
+	~span_scope();
+
+	span_scope(const span_scope&) = delete;
+	span_scope& operator=(const span_scope&) = delete;
+
+private:
+	span span_;
+	span::thread_state previous_;
+};
+
 
 template <std::size_t N>
 class instrumentable
@@ -132,12 +345,21 @@ public:
 	struct time_pair
 	{
 		std::chrono::nanoseconds start{}, end{};
+
+		// thread_index() of the thread that ran this
+		std::size_t thread = 0;
+
+		// resources used by processes while this was running
+		resource_usage usage;
 	};
 
 	struct task
 	{
 		std::string name;
-		std::vector<time_pair> tps;
+
+		// a deque because instrument() keeps references to the elements while
+		// nested calls add more
+		std::deque<time_pair> tps;
 	};
 
 	struct timing_ender
@@ -173,7 +395,10 @@ public:
 		auto& t = std::get<static_cast<std::size_t>(E)>(tasks_);
 		t.tps.push_back({});
 		t.tps.back().start = timestamp();
+		t.tps.back().thread = thread_index();
 		timing_ender te(t.tps.back());
+		usage_sink us(t.tps.back().usage);
+		span_scope ss("phase", t.name);
 		return f();
 	}
 
@@ -275,6 +500,41 @@ private:
 };
 
 
+// watches a directory and everything under it for changes with
+// ReadDirectoryChangesW(); the first call to wait() starts watching
+//
+class directory_watcher
+{
+public:
+	// bails out if the directory can't be opened
+	//
+	directory_watcher(fs::path dir);
+	~directory_watcher();
+
+	directory_watcher(const directory_watcher&) = delete;
+	directory_watcher& operator=(const directory_watcher&) = delete;
+
+	// waits up to `timeout` for changes and returns the files that were
+	// changed, added, removed or renamed, which can have duplicates; empty on
+	// timeout
+	//
+	// if too many changes happened at once, the returned vector only
+	// contains the watched directory
+	//
+	std::vector<fs::path> wait(std::chrono::milliseconds timeout);
+
+private:
+	fs::path dir_;
+	handle_ptr handle_;
+	handle_ptr event_;
+	OVERLAPPED ov_;
+	std::unique_ptr<DWORD[]> buffer_;
+	bool pending_;
+
+	void start();
+};
+
+
 class console_color
 {
 public:
@@ -310,14 +570,107 @@ url make_prebuilt_url(const std::string& filename);
 url make_appveyor_artifact_url(
 	arch a, const std::string& project, const std::string& filename);
 
-// case insensitive, underscores and dashes are equivalent; gets converted to
-// a regex where * becomes .*
+// the utf8 string as a quoted json string
+//
+std::string json_string(std::string_view utf8);
+
+// modification time of the file as a string, empty if it doesn't exist
+//
+std::string file_time_string(const fs::path& p);
+
+// a wildcard pattern where * matches any number of characters and ? matches
+// one character; case insensitive, underscores and dashes are equivalent
+//
+class glob
+{
+public:
+	glob(std::string_view pattern);
+
+	// compiled once and kept for the whole run
+	//
+	static const glob& get(const std::string& pattern);
+
+	bool matches(std::string_view s) const;
+
+private:
+	// lowercase, with dashes instead of underscores
+	std::string pattern_;
+};
+
+// glob::get(pattern).matches(s)
 //
 bool glob_match(const std::string& pattern, const std::string& s);
 
 std::string replace_all(
 	std::string s, const std::string& from, const std::string& to);
 
+// 64-bit FNV-1a of the given bytes as a hex string; this is not cryptographic,
+// it's only used to detect changes
+//
+std::string hash_string(std::string_view bytes);
+
+// sha256 of the contents of a file as a hex string, read through a memory
+// mapping; empty if the file can't be read
+//
+std::string hash_file(const fs::path& p);
+
+
+// read-only memory mapping of a whole file, pages are only read from disk
+// when they're touched; files of size 0 are valid but can't be mapped, they
+// have an empty view
+//
+class mapped_file
+{
+public:
+	explicit mapped_file(const fs::path& p);
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// false if the file can't be opened or mapped
+	//
+	bool ok() const;
+
+	std::string_view bytes() const;
+
+private:
+	HANDLE file_;
+	HANDLE mapping_;
+	const void* view_;
+	std::size_t size_;
+	bool ok_;
+};
+
+
+// incremental sha-256, used to verify downloads while they're written
+//
+class sha256
+{
+public:
+	sha256();
+	~sha256();
+
+	sha256(const sha256&) = delete;
+	sha256& operator=(const sha256&) = delete;
+
+	void update(std::string_view bytes);
+
+	// reads `size` bytes from the beginning of the file, or all of it by
+	// default; returns false if the file can't be read
+	//
+	bool update_from_file(
+		const fs::path& p,
+		std::uint64_t size=std::numeric_limits<std::uint64_t>::max());
+
+	// lowercase hex string of the hash; update() can't be called after this
+	//
+	std::string finish();
+
+private:
+	BCRYPT_HASH_HANDLE h_;
+};
+
 template <class T, class Sep>
 T join(const std::vector<T>& v, const Sep& sep)
 {
@@ -354,8 +707,23 @@ std::wstring trim_copy(std::wstring_view s, std::wstring_view what=L" \t\r\n");
 std::wstring utf8_to_utf16(std::string_view s);
 std::string utf16_to_utf8(std::wstring_view ws);
 std::string bytes_to_utf8(encodings e, std::string_view bytes);
+
+// same as above, but converts into `out`, reusing its capacity; `scratch` is
+// used for the intermediate utf16 string when converting from a codepage
+//
+void utf16_to_utf8(std::wstring_view ws, std::string& out);
+void bytes_to_utf8(
+	encodings e, std::string_view bytes,
+	std::string& out, std::wstring& scratch);
+
 std::string utf8_to_bytes(encodings e, std::string_view utf8);
 
+// same as above, but converts into `out`, reusing its capacity
+//
+void utf8_to_bytes(
+	encodings e, std::string_view utf8,
+	std::string& out, std::wstring& scratch);
+
 template <class T>
 std::string path_to_utf8(T&&) = delete;
 
@@ -395,6 +763,17 @@ extern u8stream u8cerr;
 
 void set_std_streams();
 
+// enables virtual terminal sequences on stdout, returns false if stdout is not
+// a console or if it doesn't support them; required by set_console_footer()
+//
+bool enable_console_footer();
+
+// replaces the lines kept at the bottom of the console, used by live_status;
+// the lines are truncated to the width of the console and erased before
+// anything else is written to it, they stay erased until the next call
+//
+void set_console_footer(const std::vector<std::string>& lines);
+
 
 template <class F>
 void for_each_line(std::string_view s, F&& f)
@@ -589,34 +968,185 @@ auto map(const std::vector<T>& v, F&& f)
 }
 
 
+// a persistent pool of worker threads, each with its own queue; idle workers
+// steal jobs from the others
+//
+// jobs are given to workers in round-robin; add() and submit() return a
+// future that can be used to wait for a result or to get an exception that
+// escaped the job
+//
 class thread_pool
 {
 public:
 	typedef std::function<void ()> fun;
 
 	thread_pool(std::size_t count=std::thread::hardware_concurrency());
+
+	// waits for all the jobs to finish
 	~thread_pool();
 
 	// non-copyable
 	thread_pool(const thread_pool&) = delete;
 	thread_pool& operator=(const thread_pool&) = delete;
 
-	void add(fun f);
+	// pool shared by anything that has short jobs to run and doesn't need
+	// its own
+	//
+	static thread_pool& shared();
+
+	std::future<void> add(fun f);
+
+	template <class F>
+	auto submit(F&& f)
+	{
+		using R = decltype(f());
+
+		auto pt = std::make_shared<std::packaged_task<R ()>>(
+			std::forward<F>(f));
+
+		auto fu = pt->get_future();
+		push([pt]{ (*pt)(); });
+
+		return fu;
+	}
+
+	// waits until all the jobs added so far are finished; the workers are
+	// kept alive and more jobs can be added afterwards
+	//
 	void join();
 
 private:
-	struct thread_info
+	struct worker
 	{
-		std::atomic<bool> running = false;
-		fun thread_fun;
+		std::mutex m;
+		std::deque<fun> jobs;
 		std::thread thread;
 	};
 
+	std::vector<std::unique_ptr<worker>> workers_;
+
+	// for sleeping workers and join()
+	std::mutex m_;
+	std::condition_variable wakeup_;
+	std::condition_variable idle_;
+
+	// jobs sitting in a queue
+	std::atomic<std::size_t> queued_;
+
+	// jobs queued or running, protected by m_
+	std::size_t pending_;
+
+	std::atomic<std::size_t> next_;
+	bool quit_;
+
+	void push(fun f);
+	bool pop(std::size_t i, fun& f);
+	void thread_fun(std::size_t i);
+};
+
+
+// calls f(i) for every i in [0, count) on up to `jobs` threads, the calling
+// thread and workers from the shared pool; after an exception, no more
+// indices are given out and the exception is rethrown once all the threads
+// are done
+//
+// the calling thread never waits for workers that haven't started, so this
+// can be called from a job running in the shared pool
+//
+void parallel_for(
+	std::size_t count, std::size_t jobs, std::function<void (std::size_t)> f);
+
+
+class job_slots;
+
+// a lease on slots from job_slots, given back on destruction
+//
+class job_lease
+{
+public:
+	job_lease();
+	job_lease(job_slots& js, std::size_t count);
+	job_lease(job_lease&& other);
+	job_lease& operator=(job_lease&& other);
+	~job_lease();
+
+	// non-copyable
+	job_lease(const job_lease&) = delete;
+	job_lease& operator=(const job_lease&) = delete;
+
+	// number of slots held, 0 if the wait was interrupted
+	//
+	std::size_t count() const;
+
+	void release();
+
+private:
+	job_slots* js_;
+	std::size_t count_;
+};
+
+
+// a jobserver-like budget shared by all the tools running concurrently
+//
+// instance() is for build tools, such as msbuild, jom or b2; each tool leases
+// a number of slots before running and translates that into its own
+// parallelism flags, so the total number of compiler processes stays around
+// the budget; the budget is the `jobs` option, or the number of cores if 0,
+// capped by `job_memory` (in MB per job) against the total physical memory
+//
+// network() limits how many tasks can be fetching at the same time, from the
+// `fetch_jobs` option, or unlimited if 0
+//
+class job_slots
+{
+public:
+	static job_slots& instance();
+	static job_slots& network();
+
+	// total number of slots in the budget
+	//
+	std::size_t total() const;
+
+	// waits until at least one slot is free and takes as many as possible up
+	// to `want`; if `want` is 0, this is a fair share of the budget between
+	// the contenders, or the tools currently holding a lease if there are
+	// more of them
+	//
+	// `interrupted` is polled while waiting; if it returns true, this gives
+	// up and returns an empty lease
+	//
+	job_lease lease(
+		std::size_t want, std::function<bool ()> interrupted={});
+
+	// wakes up the threads waiting in lease() so they check `interrupted`
+	// right away
+	//
+	void wake_all();
+
+	// a task that's about to build and might lease slots, see lease(); tools
+	// started by the tasks can't change their parallelism once they run, so
+	// the first one must not take everything
+	//
+	void add_contender();
+	void remove_contender();
+
+private:
+	friend class job_lease;
+
+	std::size_t total_;
+	std::size_t used_;
+
+	// leases currently held
+	std::size_t holders_;
+
+	// from add_contender()
+	std::size_t contenders_;
 
-	const std::size_t count_;
-	std::vector<std::unique_ptr<thread_info>> threads_;
+	mutable std::mutex m_;
+	std::condition_variable cv_;
 
-	bool try_add(fun thread_fun);
+	job_slots(std::size_t total);
+	void release(std::size_t n);
 };
 
 }	// namespace